@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 
 using namespace std;
 
@@ -6,6 +7,7 @@ using namespace std;
 class Burger {
 public:
     virtual void prepare() = 0;  // Pure virtual function
+    virtual ~Burger() {}  // Products are deleted through Burger*, so the destructor must be virtual
 };
 
 class BasicBurger : public Burger {
@@ -54,6 +56,7 @@ public:
 class GarlicBread {
 public:
     virtual void prepare() = 0;
+    virtual ~GarlicBread() {}
 };
 
 class BasicGarlicBread : public GarlicBread {
@@ -88,30 +91,31 @@ public:
 class MealFactory {
 public:
 //This abstract factory class will handle both the items
-    virtual Burger* createBurger(string& type) = 0;
-    virtual GarlicBread* createGarlicBread(string& type) = 0;
+    virtual unique_ptr<Burger> createBurger(string& type) = 0;
+    virtual unique_ptr<GarlicBread> createGarlicBread(string& type) = 0;
+    virtual ~MealFactory() {}
 };
 
 class SinghBurger : public MealFactory {
 public:
-    Burger* createBurger(string& type) override {
+    unique_ptr<Burger> createBurger(string& type) override {
         if (type == "basic") {
-            return new BasicBurger();
+            return unique_ptr<Burger>(new BasicBurger());
         } else if (type == "standard") {
-            return new StandardBurger();
+            return unique_ptr<Burger>(new StandardBurger());
         } else if (type == "premium") {
-            return new PremiumBurger();
+            return unique_ptr<Burger>(new PremiumBurger());
         } else {
             cout << "Invalid burger type! " << endl;
             return nullptr;
         }
     }
 
-    GarlicBread* createGarlicBread(string& type) override {
+    unique_ptr<GarlicBread> createGarlicBread(string& type) override {
         if (type == "basic") {
-            return new BasicGarlicBread();
+            return unique_ptr<GarlicBread>(new BasicGarlicBread());
         } else if (type == "cheese") {
-            return new CheeseGarlicBread();
+            return unique_ptr<GarlicBread>(new CheeseGarlicBread());
         } 
         else {
             cout << "Invalid Garlic bread type! " << endl;
@@ -122,24 +126,24 @@ public:
 
 class KingBurger : public MealFactory {
 public:
-    Burger* createBurger(string& type) override {
+    unique_ptr<Burger> createBurger(string& type) override {
         if (type == "basic") {
-            return new BasicWheatBurger();
+            return unique_ptr<Burger>(new BasicWheatBurger());
         } else if (type == "standard") {
-            return new StandardWheatBurger();
+            return unique_ptr<Burger>(new StandardWheatBurger());
         } else if (type == "premium") {
-            return new PremiumWheatBurger();
+            return unique_ptr<Burger>(new PremiumWheatBurger());
         } else {
             cout << "Invalid burger type! " << endl;
             return nullptr;
         }
     }
 
-    GarlicBread* createGarlicBread(string& type) override {
+    unique_ptr<GarlicBread> createGarlicBread(string& type) override {
         if (type == "basic") {
-            return new BasicWheatGarlicBread();
+            return unique_ptr<GarlicBread>(new BasicWheatGarlicBread());
         } else if (type == "cheese") {
-            return new CheeseWheatGarlicBread();
+            return unique_ptr<GarlicBread>(new CheeseWheatGarlicBread());
         } 
         else {
             cout << "Invalid Garlic bread type! " << endl;
@@ -152,13 +156,13 @@ int main() {
     string burgerType = "basic";
     string garlicBreadType = "cheese";
 
-    MealFactory* mealFactory = new KingBurger();
+    unique_ptr<MealFactory> mealFactory(new KingBurger());
 
-    Burger* burger = mealFactory->createBurger(burgerType);
-    GarlicBread* garlicBread = mealFactory->createGarlicBread(garlicBreadType);
+    unique_ptr<Burger> burger = mealFactory->createBurger(burgerType);
+    unique_ptr<GarlicBread> garlicBread = mealFactory->createGarlicBread(garlicBreadType);
 
     burger->prepare();
     garlicBread->prepare();
-
+    // No delete: the products and the factory are freed when their unique_ptrs go out of scope
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <array>
+#include <span>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// Build with -std=c++20 (std::span).
+//
+// The Abstract Factory makes one product per virtual call, and every product is its own heap object.
+// For bulk orders (the lunch rush) that means thousands of virtual calls, small allocations scattered over the
+// heap, and prepare() jumping between product types on every item.
+// createMeals() takes a whole batch of order lines instead:
+// - the franchise is resolved once: one virtual call for the whole batch
+// - products are built into one contiguous array per concrete type (counted first, so each array is allocated once)
+// - prepareAll() walks the arrays type by type, so every prepare() call is a direct (non virtual) call
+//
+// prepare() writes to a kitchen ticket instead of cout, so the benchmark measures the factory, not the terminal.
+
+// Product 1 --> Burger
+class Burger {
+public:
+    virtual void prepare(string& ticket) = 0;  // Pure virtual function
+    virtual ~Burger() {}
+};
+
+class BasicBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Burger with bun, patty, and ketchup\n";
+    }
+};
+
+class StandardBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Standard Burger with bun, patty, cheese, and lettuce\n";
+    }
+};
+
+class PremiumBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Premium Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce\n";
+    }
+};
+
+class BasicWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Wheat Burger with bun, patty, and ketchup\n";
+    }
+};
+
+class StandardWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Standard Wheat Burger with bun, patty, cheese, and lettuce\n";
+    }
+};
+
+class PremiumWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Premium Wheat Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce\n";
+    }
+};
+
+// Product 2 --> GarlicBread
+class GarlicBread {
+public:
+    virtual void prepare(string& ticket) = 0;
+    virtual ~GarlicBread() {}
+};
+
+class BasicGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Garlic Bread with butter and garlic\n";
+    }
+};
+
+class CheeseGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Cheese Garlic Bread with extra cheese and butter\n";
+    }
+};
+
+class BasicWheatGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Wheat Garlic Bread with butter and garlic\n";
+    }
+};
+
+class CheeseWheatGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Cheese Wheat Garlic Bread with extra cheese and butter\n";
+    }
+};
+
+// One line of a bulk order: `quantity` times this burger and this garlic bread (an empty name means none)
+struct OrderLine {
+    string_view burger;
+    string_view garlicBread;
+    uint32_t quantity;
+};
+
+// All products of one createMeals() call
+class MealBatch {
+public:
+    virtual ~MealBatch() {}
+    virtual void prepareAll(string& ticket) = 0;
+    virtual size_t size() = 0;
+    size_t rejectedLines = 0;  // lines with an unknown product name
+};
+
+// One array per concrete product type
+template <typename... Products>
+class TypedBatch : public MealBatch {
+public:
+    template <size_t I>
+    auto& items() {
+        return get<I>(arrays);
+    }
+
+    void prepareAll(string& ticket) override {
+        apply([&](auto&... arrays) { (prepareEach(arrays, ticket), ...); }, arrays);
+    }
+
+    size_t size() override {
+        return apply([](auto&... arrays) { return (arrays.size() + ...); }, arrays);
+    }
+
+private:
+    // The exact type is known here, so T::prepare is called directly and can be inlined
+    template <typename T>
+    static void prepareEach(vector<T>& items, string& ticket) {
+        for (T& item : items) {
+            item.T::prepare(ticket);
+        }
+    }
+
+    tuple<vector<Products>...> arrays;
+};
+
+// Menu positions shared by all franchises; -1 for an unknown name
+int burgerIndex(string_view type) {
+    if (type == "basic") {
+        return 0;
+    } else if (type == "standard") {
+        return 1;
+    } else if (type == "premium") {
+        return 2;
+    }
+    return -1;
+}
+
+int garlicBreadIndex(string_view type) {
+    if (type == "basic") {
+        return 0;
+    } else if (type == "cheese") {
+        return 1;
+    }
+    return -1;
+}
+
+// Factory and its concretions
+class MealFactory {
+public:
+    virtual ~MealFactory() {}
+//One product per call, as in Abstract-Factory.cpp
+    virtual unique_ptr<Burger> createBurger(string_view type) = 0;
+    virtual unique_ptr<GarlicBread> createGarlicBread(string_view type) = 0;
+//A whole batch per call
+    virtual unique_ptr<MealBatch> createMeals(span<const OrderLine> lines) = 0;
+};
+
+// Both franchises sell the same menu with different products, so the code is written once for any five types
+template <typename Basic, typename Standard, typename Premium, typename BasicBread, typename CheeseBread>
+class Franchise : public MealFactory {
+    typedef TypedBatch<Basic, Standard, Premium, BasicBread, CheeseBread> Batch;
+
+    template <size_t I>
+    static void add(Batch& batch, uint32_t quantity) {
+        auto& items = batch.template items<I>();
+        for (uint32_t q = 0; q < quantity; q++) {
+            items.emplace_back();
+        }
+    }
+
+public:
+    unique_ptr<Burger> createBurger(string_view type) override {
+        switch (burgerIndex(type)) {
+            case 0: return unique_ptr<Burger>(new Basic());
+            case 1: return unique_ptr<Burger>(new Standard());
+            case 2: return unique_ptr<Burger>(new Premium());
+        }
+        cout << "Invalid burger type! " << endl;
+        return nullptr;
+    }
+
+    unique_ptr<GarlicBread> createGarlicBread(string_view type) override {
+        switch (garlicBreadIndex(type)) {
+            case 0: return unique_ptr<GarlicBread>(new BasicBread());
+            case 1: return unique_ptr<GarlicBread>(new CheeseBread());
+        }
+        cout << "Invalid Garlic bread type! " << endl;
+        return nullptr;
+    }
+
+    unique_ptr<MealBatch> createMeals(span<const OrderLine> lines) override {
+        unique_ptr<Batch> batch(new Batch());
+        // Pass 1: resolve every name once and count, so each array is allocated exactly once
+        vector<array<int8_t, 2>> resolved(lines.size());
+        array<size_t, 5> counts = {};
+        for (size_t i = 0; i < lines.size(); i++) {
+            int burger = lines[i].burger.empty() ? -2 : burgerIndex(lines[i].burger);
+            int bread = lines[i].garlicBread.empty() ? -2 : garlicBreadIndex(lines[i].garlicBread);
+            if (burger == -1 || bread == -1) {
+                resolved[i] = {-1, -1};
+                batch->rejectedLines++;
+                continue;
+            }
+            resolved[i] = {(int8_t)burger, (int8_t)bread};
+            if (burger >= 0) {
+                counts[burger] += lines[i].quantity;
+            }
+            if (bread >= 0) {
+                counts[3 + bread] += lines[i].quantity;
+            }
+        }
+        batch->template items<0>().reserve(counts[0]);
+        batch->template items<1>().reserve(counts[1]);
+        batch->template items<2>().reserve(counts[2]);
+        batch->template items<3>().reserve(counts[3]);
+        batch->template items<4>().reserve(counts[4]);
+        // Pass 2: build the products in place
+        for (size_t i = 0; i < lines.size(); i++) {
+            uint32_t quantity = lines[i].quantity;
+            switch (resolved[i][0]) {
+                case 0: add<0>(*batch, quantity); break;
+                case 1: add<1>(*batch, quantity); break;
+                case 2: add<2>(*batch, quantity); break;
+            }
+            switch (resolved[i][1]) {
+                case 0: add<3>(*batch, quantity); break;
+                case 1: add<4>(*batch, quantity); break;
+            }
+        }
+        return batch;
+    }
+};
+
+class SinghBurger : public Franchise<BasicBurger, StandardBurger, PremiumBurger, BasicGarlicBread, CheeseGarlicBread> {};
+
+class KingBurger : public Franchise<BasicWheatBurger, StandardWheatBurger, PremiumWheatBurger, BasicWheatGarlicBread, CheeseWheatGarlicBread> {};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+// The per item way: one virtual call, one allocation and one virtual prepare per product
+size_t preparePerItem(MealFactory& factory, span<const OrderLine> lines, string& ticket) {
+    size_t made = 0;
+    for (const OrderLine& line : lines) {
+        for (uint32_t q = 0; q < line.quantity; q++) {
+            if (!line.burger.empty()) {
+                unique_ptr<Burger> burger = factory.createBurger(line.burger);
+                burger->prepare(ticket);
+                made++;
+            }
+            if (!line.garlicBread.empty()) {
+                unique_ptr<GarlicBread> garlicBread = factory.createGarlicBread(line.garlicBread);
+                garlicBread->prepare(ticket);
+                made++;
+            }
+        }
+    }
+    return made;
+}
+
+int main(int argc, char** argv) {
+    unique_ptr<MealFactory> mealFactory(new KingBurger());
+
+    vector<OrderLine> lunch = {{"basic", "cheese", 2}, {"premium", "", 1}, {"standard", "basic", 3}};
+    unique_ptr<MealBatch> batch = mealFactory->createMeals(lunch);
+    string ticket;
+    batch->prepareAll(ticket);
+    cout << ticket;
+
+    cout << "===Checks===" << endl;
+    string perItemTicket;
+    size_t perItem = preparePerItem(*mealFactory, lunch, perItemTicket);
+    check(batch->size() == perItem && batch->size() == 11, "batch makes the same number of products as the per item API");
+    check(ticket.size() == perItemTicket.size(), "batch prepares the same products, grouped by type");
+    vector<OrderLine> bad = {{"deluxe", "cheese", 1}, {"basic", "", 1}};
+    unique_ptr<MealBatch> badBatch = mealFactory->createMeals(bad);
+    check(badBatch->rejectedLines == 1 && badBatch->size() == 1, "lines with unknown products are rejected, the rest is made");
+    check(mealFactory->createMeals(span<const OrderLine>())->size() == 0, "an empty batch is fine");
+
+    // Benchmark: orders per second by batch size, every order is a line of 1 to 3 burgers with or without bread
+    size_t orders = argc > 1 ? atol(argv[1]) : 1000000;
+    static const string_view burgers[] = {"basic", "standard", "premium"};
+    static const string_view breads[] = {"basic", "cheese", ""};
+    mt19937 random(1);
+    vector<OrderLine> stream(orders);
+    for (auto& line : stream) {
+        line = {burgers[random() % 3], breads[random() % 3], 1 + (uint32_t)(random() % 3)};
+    }
+    cout << "===Orders per second (M), " << orders << " orders===" << endl;
+    for (size_t batchSize : {1, 100, 10000}) {
+        string kitchen;
+        kitchen.reserve(1 << 20);
+        auto start = chrono::steady_clock::now();
+        size_t made = 0;
+        for (size_t at = 0; at < orders; at += batchSize) {
+            span<const OrderLine> lines(stream.data() + at, min(batchSize, orders - at));
+            made += preparePerItem(*mealFactory, lines, kitchen);
+            kitchen.clear();
+        }
+        double perItemSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        size_t batched = 0;
+        for (size_t at = 0; at < orders; at += batchSize) {
+            span<const OrderLine> lines(stream.data() + at, min(batchSize, orders - at));
+            unique_ptr<MealBatch> meals = mealFactory->createMeals(lines);
+            meals->prepareAll(kitchen);
+            batched += meals->size();
+            kitchen.clear();
+        }
+        double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "batch of " << batchSize << ": per item " << orders / perItemSeconds / 1e6 << ", createMeals "
+             << orders / batchSeconds / 1e6 << (made == batched ? "" : " (product counts differ!)") << endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
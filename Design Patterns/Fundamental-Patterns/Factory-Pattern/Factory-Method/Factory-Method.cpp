@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 using namespace std;
 
 //This is our base abstract base class
@@ -54,21 +55,22 @@ class PremiumWheatBurger: public Burger {
 //This is our Abstract Factory class which will create the different types of burger objects according to the type passed as argument
 class BurgerFactory{
   public:
-    virtual Burger* createBurger(string &type) = 0;
+    virtual unique_ptr<Burger> createBurger(string &type) = 0;
+    virtual ~BurgerFactory() {}
 };
 
 //Here we will simply inherit the BurgerFactory class and implement the createBurger method in the franchise of SinghBurger
 class SinghBurger: public BurgerFactory {
   public:
-    Burger* createBurger(string &type) override {
+    unique_ptr<Burger> createBurger(string &type) override {
       if(type == "Basic"){
-        return new BasicBurger();
+        return unique_ptr<Burger>(new BasicBurger());
       }
       else if(type == "Standard"){
-        return new StandardBurger();
+        return unique_ptr<Burger>(new StandardBurger());
       }
       else if(type == "Premium"){
-        return new PremiumBurger();
+        return unique_ptr<Burger>(new PremiumBurger());
       }
       else{
         cout << "THe type is not valid" << endl;
@@ -79,15 +81,15 @@ class SinghBurger: public BurgerFactory {
 
 class KingBurger: public BurgerFactory {
   public:
-    Burger* createBurger(string &type) override {
+    unique_ptr<Burger> createBurger(string &type) override {
       if(type == "Basic"){
-        return new BasicWheatBurger();
+        return unique_ptr<Burger>(new BasicWheatBurger());
       }
       else if(type == "Standard"){
-        return new StandardWheatBurger();
+        return unique_ptr<Burger>(new StandardWheatBurger());
       }
       else if(type == "Premium"){
-        return new PremiumWheatBurger();
+        return unique_ptr<Burger>(new PremiumWheatBurger());
       }
       else{
         cout << "THe type is not valid" << endl;
@@ -99,11 +101,12 @@ class KingBurger: public BurgerFactory {
 int main(){
   string type = "Standard";
   //Now we will create a object of BurgerFactory according to the franchise
-  BurgerFactory * myBurgerFactory = new KingBurger();
+  unique_ptr<BurgerFactory> myBurgerFactory(new KingBurger());
   //In the following line, burger object will be returned by createBurger method of KingBurger class according to the type that is BasicWheatBurger
-  Burger * burger = myBurgerFactory->createBurger(type);
+  unique_ptr<Burger> burger = myBurgerFactory->createBurger(type);
   //Now we can easily call the prepare method of that method
   burger->prepare();
-  
+
+  //No delete: the unique_ptrs free the burger and the factory
   return 0;
 }
\ No newline at end of file
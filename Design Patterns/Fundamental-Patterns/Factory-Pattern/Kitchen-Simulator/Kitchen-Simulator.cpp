@@ -0,0 +1,609 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+using namespace std;
+
+// How many cooks does a franchise location need? This simulator answers it instead of guessing.
+// A day of orders arrives at every location of SinghBurger and KingBurger. Each location is a kitchen with a number
+// of cooks; an order waits until a cook is free, then takes as long as its items take to prepare.
+//
+// The simulation runs in simulated time (seconds of the day), so a day takes seconds, not a day:
+// - one generator thread per franchise draws the orders of every location and pushes them into that location's
+//   lock-free queue
+// - a pool of worker threads runs the kitchens: it pops the orders, makes every item through the franchise's
+//   factory, and advances the kitchen's simulated clock
+// Every location gets its own random stream (seed + location) and is always simulated by one worker at a time,
+// in arrival order. So the results only depend on the seed and the configuration, never on the thread count
+// or on timing.
+
+// Product 1 --> Burger
+class Burger {
+public:
+    virtual void prepare(string& ticket) = 0;  // Pure virtual function
+    virtual ~Burger() {}
+};
+
+class BasicBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Burger with bun, patty, and ketchup\n";
+    }
+};
+
+class StandardBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Standard Burger with bun, patty, cheese, and lettuce\n";
+    }
+};
+
+class PremiumBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Premium Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce\n";
+    }
+};
+
+class BasicWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Wheat Burger with bun, patty, and ketchup\n";
+    }
+};
+
+class StandardWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Standard Wheat Burger with bun, patty, cheese, and lettuce\n";
+    }
+};
+
+class PremiumWheatBurger : public Burger {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Premium Wheat Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce\n";
+    }
+};
+
+// Product 2 --> GarlicBread
+class GarlicBread {
+public:
+    virtual void prepare(string& ticket) = 0;
+    virtual ~GarlicBread() {}
+};
+
+class BasicGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Garlic Bread with butter and garlic\n";
+    }
+};
+
+class CheeseGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Cheese Garlic Bread with extra cheese and butter\n";
+    }
+};
+
+class BasicWheatGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Basic Wheat Garlic Bread with butter and garlic\n";
+    }
+};
+
+class CheeseWheatGarlicBread : public GarlicBread {
+public:
+    void prepare(string& ticket) override {
+        ticket += "Cheese Wheat Garlic Bread with extra cheese and butter\n";
+    }
+};
+
+// Factory and its concretions
+class MealFactory {
+public:
+    virtual ~MealFactory() {}
+//This abstract factory class will handle both the items
+    virtual Burger* createBurger(const string& type) = 0;
+    virtual GarlicBread* createGarlicBread(const string& type) = 0;
+};
+
+class SinghBurger : public MealFactory {
+public:
+    Burger* createBurger(const string& type) override {
+        if (type == "basic") {
+            return new BasicBurger();
+        } else if (type == "standard") {
+            return new StandardBurger();
+        } else if (type == "premium") {
+            return new PremiumBurger();
+        } else {
+            cout << "Invalid burger type! " << endl;
+            return nullptr;
+        }
+    }
+
+    GarlicBread* createGarlicBread(const string& type) override {
+        if (type == "basic") {
+            return new BasicGarlicBread();
+        } else if (type == "cheese") {
+            return new CheeseGarlicBread();
+        }
+        else {
+            cout << "Invalid Garlic bread type! " << endl;
+            return nullptr;
+        }
+    }
+};
+
+class KingBurger : public MealFactory {
+public:
+    Burger* createBurger(const string& type) override {
+        if (type == "basic") {
+            return new BasicWheatBurger();
+        } else if (type == "standard") {
+            return new StandardWheatBurger();
+        } else if (type == "premium") {
+            return new PremiumWheatBurger();
+        } else {
+            cout << "Invalid burger type! " << endl;
+            return nullptr;
+        }
+    }
+
+    GarlicBread* createGarlicBread(const string& type) override {
+        if (type == "basic") {
+            return new BasicWheatGarlicBread();
+        } else if (type == "cheese") {
+            return new CheeseWheatGarlicBread();
+        }
+        else {
+            cout << "Invalid Garlic bread type! " << endl;
+            return nullptr;
+        }
+    }
+};
+
+// Bounded single producer / single consumer queue without locks: the producer only writes `tail`, the consumer
+// only writes `head`, and each sits on its own cache line so they do not slow each other down
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size = size * 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    bool push(const T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) > mask) {
+            return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire)) {
+            return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    // Set by the producer after its last push
+    atomic<bool> closed{false};
+
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+};
+
+// HDR style histogram of latencies, in the unit the caller records: values are grouped by their highest bit, and each
+// power of two is split into 16 linear sub buckets (values below 32 get a bucket each). A percentile is reported as the
+// upper edge of its bucket, so it is at most 1/16 (6.25%) above the real value. The table is 60 x 32 x 8 B, about 15 KB.
+// Every example is a standalone program, so Kitchen-Simulator.cpp, Trainer-Instrumentation.cpp and Replay-Harness.cpp
+// each carry this class; the three copies are identical on purpose, change them together.
+class LatencyHistogram {
+    static const int subBits = 5;
+    static const int subCount = 1 << subBits;
+    uint64_t buckets[64 - subBits + 1][subCount] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static void locate(uint64_t value, int& range, int& sub) {
+        int highest = value == 0 ? 0 : 63 - __builtin_clzll(value);
+        range = highest < subBits ? 0 : highest - subBits + 1;
+        sub = (int)((value >> range) & (subCount - 1));
+    }
+public:
+    void record(uint64_t value) {
+        int range, sub;
+        locate(value, range, sub);
+        buckets[range][sub]++;
+        total++;
+        maxValue = max(maxValue, value);
+    }
+    void add(const LatencyHistogram& other) {
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                buckets[range][sub] += other.buckets[range][sub];
+            }
+        }
+        total += other.total;
+        maxValue = max(maxValue, other.maxValue);
+    }
+    uint64_t count() const {
+        return total;
+    }
+    uint64_t maximum() const {
+        return maxValue;
+    }
+    // Smallest value v such that at least `percent` of the recorded values are <= v (upper edge of the bucket)
+    uint64_t percentile(double percent) const {
+        uint64_t wanted = max<uint64_t>(1, (uint64_t)(total * percent / 100.0 + 0.5));
+        uint64_t seen = 0;
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                seen += buckets[range][sub];
+                if (seen >= wanted) {
+                    return min(((((uint64_t)sub + 1) << range) - 1), maxValue);
+                }
+            }
+        }
+        return maxValue;
+    }
+};
+
+// How orders arrive over the day
+enum class Arrivals {
+    Steady,   // Poisson process with a constant rate
+    Rush,     // Poisson with a lunch peak around 12:30 and a dinner peak around 19:00
+    Even      // exactly evenly spaced
+};
+
+// How long one item takes a cook, in seconds
+struct ServiceTime {
+    enum Kind { Fixed, Exponential, LogNormal } kind;
+    double mean;
+    double sample(mt19937_64& random) const {
+        if (kind == Fixed) {
+            return mean;
+        } else if (kind == Exponential) {
+            return exponential_distribution<double>(1.0 / mean)(random);
+        }
+        // sigma 0.5, mu chosen so that the mean is `mean`
+        return lognormal_distribution<double>(log(mean) - 0.125, 0.5)(random);
+    }
+};
+
+struct Config {
+    uint64_t seed = 42;
+    int locations = 8;               // per franchise
+    int cooks = 3;                   // per location
+    double ordersPerHour = 20;       // average over the day, per location
+    Arrivals arrivals = Arrivals::Rush;
+    ServiceTime burgerTime = {ServiceTime::LogNormal, 90};
+    ServiceTime garlicBreadTime = {ServiceTime::Exponential, 45};
+    double daySeconds = 24 * 3600;
+    int workers = 4;
+    size_t queueCapacity = 1024;
+};
+
+struct Order {
+    double arrival;        // seconds since the start of the day
+    uint8_t burger;        // 0 basic, 1 standard, 2 premium
+    uint8_t garlicBread;   // 0 none, 1 basic, 2 cheese
+    uint8_t quantity;
+    double service;        // total cook time of the order, drawn with the order
+};
+
+// Result of one location, merged per franchise at the end
+struct KitchenStats {
+    uint64_t orders = 0;
+    uint64_t items = 0;
+    double busySeconds = 0;
+    double lastFinish = 0;
+    uint64_t depthSum = 0;
+    uint64_t maxDepth = 0;
+    LatencyHistogram latency;  // arrival to ready, in milliseconds
+};
+
+// One franchise location: the order queue from the generator and the simulated kitchen behind it
+struct Location {
+    Location(size_t capacity) : queue(capacity) {}
+    SpscQueue<Order> queue;
+    MealFactory* factory = nullptr;
+    // Simulated kitchen: when each cook is free again, and when each waiting order will start
+    priority_queue<double, vector<double>, greater<double>> cookFree;
+    deque<double> waitingStarts;
+    KitchenStats stats;
+    string ticket;
+
+    // Runs one order through the kitchen: waits for the first free cook (orders are taken first come, first served)
+    void serve(const Order& order) {
+        static const string burgerTypes[] = {"basic", "standard", "premium"};
+        static const string breadTypes[] = {"", "basic", "cheese"};
+        // Queue depth seen by this order: orders that arrived earlier and have not started yet
+        while (!waitingStarts.empty() && waitingStarts.front() <= order.arrival) {
+            waitingStarts.pop_front();
+        }
+        stats.depthSum += waitingStarts.size();
+        stats.maxDepth = max<uint64_t>(stats.maxDepth, waitingStarts.size());
+
+        double start = max(order.arrival, cookFree.top());
+        cookFree.pop();
+        double finish = start + order.service;
+        cookFree.push(finish);
+        if (start > order.arrival) {
+            waitingStarts.push_back(start);
+        }
+
+        // The real factory work: every item is created and prepared
+        ticket.clear();
+        for (int q = 0; q < order.quantity; q++) {
+            Burger* burger = factory->createBurger(burgerTypes[order.burger]);
+            burger->prepare(ticket);
+            delete burger;
+            stats.items++;
+            if (order.garlicBread != 0) {
+                GarlicBread* garlicBread = factory->createGarlicBread(breadTypes[order.garlicBread]);
+                garlicBread->prepare(ticket);
+                delete garlicBread;
+                stats.items++;
+            }
+        }
+        stats.orders++;
+        stats.busySeconds += order.service;
+        stats.lastFinish = max(stats.lastFinish, finish);
+        stats.latency.record((uint64_t)((finish - order.arrival) * 1000));
+    }
+};
+
+class KitchenSimulator {
+public:
+    struct FranchiseReport {
+        string name;
+        KitchenStats total;
+    };
+
+    KitchenSimulator(const Config& c) : config(c) {
+        franchises.push_back(unique_ptr<MealFactory>(new SinghBurger()));
+        franchises.push_back(unique_ptr<MealFactory>(new KingBurger()));
+        for (size_t f = 0; f < franchises.size(); f++) {
+            for (int l = 0; l < config.locations; l++) {
+                Location* location = new Location(config.queueCapacity);
+                location->factory = franchises[f].get();
+                for (int k = 0; k < config.cooks; k++) {
+                    location->cookFree.push(0);
+                }
+                locations.push_back(unique_ptr<Location>(location));
+            }
+        }
+    }
+
+    vector<FranchiseReport> run() {
+        vector<thread> threads;
+        for (size_t f = 0; f < franchises.size(); f++) {
+            threads.emplace_back(&KitchenSimulator::generate, this, f);
+        }
+        for (int w = 0; w < config.workers; w++) {
+            threads.emplace_back(&KitchenSimulator::work, this, w);
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        static const char* names[] = {"SinghBurger", "KingBurger"};
+        vector<FranchiseReport> reports;
+        for (size_t f = 0; f < franchises.size(); f++) {
+            FranchiseReport report;
+            report.name = names[f];
+            for (int l = 0; l < config.locations; l++) {
+                KitchenStats& s = locations[f * config.locations + l]->stats;
+                report.total.orders += s.orders;
+                report.total.items += s.items;
+                report.total.busySeconds += s.busySeconds;
+                report.total.lastFinish = max(report.total.lastFinish, s.lastFinish);
+                report.total.depthSum += s.depthSum;
+                report.total.maxDepth = max(report.total.maxDepth, s.maxDepth);
+                report.total.latency.add(s.latency);
+            }
+            reports.push_back(move(report));
+        }
+        return reports;
+    }
+
+private:
+    // Orders per hour at a time of the day, relative to the average (the Rush curve averages about 1)
+    double rushShape(double seconds) {
+        double hour = seconds / 3600;
+        return 0.35 + 2.2 * exp(-pow((hour - 12.5) / 1.2, 2)) + 1.8 * exp(-pow((hour - 19) / 1.5, 2));
+    }
+
+    // Draws the day of every location of one franchise, in arrival order, into their queues
+    void generate(size_t franchise) {
+        double rate = config.ordersPerHour / 3600;
+        double peak = rate * (config.arrivals == Arrivals::Rush ? 2.6 / rushAverage() : 1);
+        for (int l = 0; l < config.locations; l++) {
+            Location& location = *locations[franchise * config.locations + l];
+            mt19937_64 random(config.seed * 1000003 + franchise * 1009 + l);
+            exponential_distribution<double> gap(peak);
+            uniform_real_distribution<double> uniform(0, 1);
+            double t = 0;
+            while (true) {
+                if (config.arrivals == Arrivals::Even) {
+                    t += 1 / rate;
+                } else {
+                    t += gap(random);
+                    // Thinning: keep an arrival with probability rate(t) / peak
+                    if (config.arrivals == Arrivals::Rush && uniform(random) * 2.6 > rushShape(t)) {
+                        continue;
+                    }
+                }
+                if (t >= config.daySeconds) {
+                    break;
+                }
+                Order order;
+                order.arrival = t;
+                order.burger = (uint8_t)(random() % 3);
+                order.garlicBread = (uint8_t)(random() % 3);
+                order.quantity = (uint8_t)(1 + random() % 3);
+                order.service = 0;
+                for (int q = 0; q < order.quantity; q++) {
+                    order.service += config.burgerTime.sample(random);
+                    if (order.garlicBread != 0) {
+                        order.service += config.garlicBreadTime.sample(random);
+                    }
+                }
+                while (!location.queue.push(order)) {
+                    this_thread::yield();
+                }
+            }
+            location.queue.closed.store(true, memory_order_release);
+        }
+    }
+
+    double rushAverage() {
+        double sum = 0;
+        for (int minute = 0; minute < 24 * 60; minute++) {
+            sum += rushShape(minute * 60.0);
+        }
+        return sum / (24 * 60);
+    }
+
+    // Worker w owns locations w, w + workers, ...: one location is only ever simulated by one thread
+    void work(int w) {
+        vector<Location*> mine;
+        for (size_t l = w; l < locations.size(); l += config.workers) {
+            mine.push_back(locations[l].get());
+        }
+        while (!mine.empty()) {
+            bool progress = false;
+            for (size_t i = 0; i < mine.size();) {
+                Location& location = *mine[i];
+                bool closed = location.queue.closed.load(memory_order_acquire);
+                Order order;
+                int taken = 0;
+                while (taken < 256 && location.queue.pop(order)) {
+                    location.serve(order);
+                    taken++;
+                }
+                progress = progress || taken > 0;
+                // Closed is read before popping, so an empty queue after that really is the end
+                if (closed && taken == 0) {
+                    mine.erase(mine.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+            if (!progress) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    Config config;
+    vector<unique_ptr<MealFactory>> franchises;
+    vector<unique_ptr<Location>> locations;
+};
+
+void printReport(const Config& config, const vector<KitchenSimulator::FranchiseReport>& reports) {
+    for (auto& r : reports) {
+        const KitchenStats& s = r.total;
+        double hours = config.daySeconds / 3600;
+        // An overloaded kitchen keeps cooking after midnight, so utilization is over the time it was open
+        double open = max(config.daySeconds, s.lastFinish);
+        cout << r.name << ": " << s.orders << " orders (" << s.orders / hours << "/h), " << s.items << " items, cook utilization "
+             << 100 * s.busySeconds / (open * config.cooks * config.locations) << "%, queue depth mean "
+             << (s.orders ? (double)s.depthSum / s.orders : 0) << " max " << s.maxDepth << ", latency p50 "
+             << s.latency.percentile(50) / 1000.0 << " s p99 " << s.latency.percentile(99) / 1000.0 << " s" << endl;
+    }
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+bool sameReports(const vector<KitchenSimulator::FranchiseReport>& a, const vector<KitchenSimulator::FranchiseReport>& b) {
+    for (size_t f = 0; f < a.size(); f++) {
+        const KitchenStats& x = a[f].total;
+        const KitchenStats& y = b[f].total;
+        if (x.orders != y.orders || x.items != y.items || x.depthSum != y.depthSum || x.maxDepth != y.maxDepth
+            || x.busySeconds != y.busySeconds || x.latency.percentile(99) != y.latency.percentile(99)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Usage: ./kitchen [locations per franchise] [cooks per location] [orders per hour per location] [workers]
+int main(int argc, char** argv) {
+    Config config;
+    if (argc > 1) config.locations = max(1, atoi(argv[1]));
+    if (argc > 2) config.cooks = max(1, atoi(argv[2]));
+    if (argc > 3) config.ordersPerHour = atof(argv[3]);
+    if (argc > 4) config.workers = max(1, atoi(argv[4]));
+
+    cout << "===One day, " << config.locations << " locations per franchise, " << config.cooks << " cooks, "
+         << config.ordersPerHour << " orders/h, lunch and dinner rush===" << endl;
+    auto start = chrono::steady_clock::now();
+    KitchenSimulator simulator(config);
+    vector<KitchenSimulator::FranchiseReport> reports = simulator.run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printReport(config, reports);
+    uint64_t orders = reports[0].total.orders + reports[1].total.orders;
+    cout << "Simulated " << orders << " orders in " << seconds << " s (" << orders / seconds / 1e6 << " M orders/s, "
+         << config.workers << " workers)" << endl;
+
+    cout << "===Checks===" << endl;
+    Config single = config;
+    single.workers = 1;
+    single.queueCapacity = 4;
+    check(sameReports(reports, KitchenSimulator(single).run()), "same seed gives the same day with 1 worker and tiny queues");
+    Config other = config;
+    other.seed = config.seed + 1;
+    check(!sameReports(reports, KitchenSimulator(other).run()), "another seed gives another day");
+    Config even = config;
+    even.arrivals = Arrivals::Even;
+    even.ordersPerHour = 10;
+    even.cooks = 1;
+    even.burgerTime = {ServiceTime::Fixed, 60};
+    even.garlicBreadTime = {ServiceTime::Fixed, 0};
+    vector<KitchenSimulator::FranchiseReport> calm = KitchenSimulator(even).run();
+    check(calm[0].total.maxDepth == 0 && calm[0].total.latency.percentile(100) <= 180 * 1000,
+          "a kitchen that is never busy has no queue and latency = cook time");
+
+    // Kitchen sizing: p99 latency by number of cooks for the configured load
+    cout << "===p99 latency by cooks per location===" << endl;
+    for (int cooks = 1; cooks <= 6; cooks++) {
+        Config sizing = config;
+        sizing.cooks = cooks;
+        vector<KitchenSimulator::FranchiseReport> r = KitchenSimulator(sizing).run();
+        cout << cooks << " cooks: p99 " << r[0].total.latency.percentile(99) / 1000.0 << " s, max queue " << r[0].total.maxDepth << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
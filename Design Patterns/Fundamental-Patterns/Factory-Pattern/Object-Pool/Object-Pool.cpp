@@ -0,0 +1,485 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+using namespace std;
+
+// The factories in Abstract-Factory.cpp make every product with `new`, so every order is a few small malloc / free calls.
+// Here the products come from object pools instead:
+// - one pool per concrete product type, so every block has exactly the right size
+// - every thread has its own free list per type, so creating and destroying needs no lock at all
+// - the factories return unique_ptr whose deleter destroys the product and hands the block back to the pool
+
+// A free block stores the pointer to the next free block in itself
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Memory of all blocks of one product type, shared by all threads.
+// Threads only come here (and take the lock) to fetch or return a batch of blocks.
+template <typename T>
+class PoolStorage {
+public:
+    static const size_t blockSize = sizeof(T) > sizeof(FreeBlock) ? sizeof(T) : sizeof(FreeBlock);
+    static const size_t blockAlign = alignof(T) > alignof(FreeBlock) ? alignof(T) : alignof(FreeBlock);
+    static const size_t stride = (blockSize + blockAlign - 1) / blockAlign * blockAlign;
+    static const size_t batchSize = 64;
+
+    static PoolStorage& instance() {
+        static PoolStorage storage;
+        return storage;
+    }
+
+    // A list of free blocks: up to `batchSize` returned ones if there are, else `batchSize` from a new slab.
+    // `taken` is set to the length of the list.
+    FreeBlock* takeBatch(size_t& taken) {
+        lock_guard<mutex> lock(m);
+        if (shared != nullptr) {
+            FreeBlock* head = shared;
+            FreeBlock* last = head;
+            taken = 1;
+            while (taken < batchSize && last->next != nullptr) {
+                last = last->next;
+                taken++;
+            }
+            shared = last->next;
+            last->next = nullptr;
+            return head;
+        }
+        char* slab = (char*)::operator new(stride * batchSize, align_val_t(blockAlign));
+        slabs.push_back(slab);
+        for (size_t i = 0; i < batchSize; i++) {
+            ((FreeBlock*)(slab + i * stride))->next = i + 1 < batchSize ? (FreeBlock*)(slab + (i + 1) * stride) : nullptr;
+        }
+        taken = batchSize;
+        return (FreeBlock*)slab;
+    }
+
+    void giveBack(FreeBlock* head, FreeBlock* last) {
+        lock_guard<mutex> lock(m);
+        last->next = shared;
+        shared = head;
+    }
+
+    size_t slabCount() {
+        lock_guard<mutex> lock(m);
+        return slabs.size();
+    }
+
+    // Slabs live until the end of the program, because a product may be destroyed by any thread at any time
+    ~PoolStorage() {
+        for (char* slab : slabs) {
+            ::operator delete(slab, align_val_t(blockAlign));
+        }
+    }
+
+private:
+    PoolStorage() {}
+    mutex m;
+    vector<char*> slabs;
+    FreeBlock* shared = nullptr;
+};
+
+// The calling thread's free list for one product type. No locks: only its own thread ever touches it.
+template <typename T>
+class ThreadCache {
+public:
+    static ThreadCache& local() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    void* allocate() {
+        if (head == nullptr) {
+            head = storage.takeBatch(count);
+        }
+        FreeBlock* block = head;
+        head = head->next;
+        count--;
+        return block;
+    }
+
+    // Keeps at most two batches; a thread that only destroys products (e.g. a consumer) gives the rest back
+    void release(void* p) {
+        FreeBlock* block = (FreeBlock*)p;
+        block->next = head;
+        head = block;
+        count++;
+        if (count > 2 * PoolStorage<T>::batchSize) {
+            giveBack(PoolStorage<T>::batchSize);
+        }
+    }
+
+    ~ThreadCache() {
+        giveBack(count);
+    }
+
+    // Free blocks in this thread's list, for the checks
+    size_t cached() const {
+        return count;
+    }
+
+private:
+    ThreadCache() : storage(PoolStorage<T>::instance()) {}
+
+    void giveBack(size_t n) {
+        if (n == 0 || head == nullptr) {
+            return;
+        }
+        FreeBlock* first = head;
+        FreeBlock* last = head;
+        for (size_t i = 1; i < n && last->next != nullptr; i++) {
+            last = last->next;
+        }
+        head = last->next;
+        count = count - n;
+        storage.giveBack(first, last);
+    }
+
+    PoolStorage<T>& storage;
+    FreeBlock* head = nullptr;
+    size_t count = 0;
+};
+
+// Deleter for unique_ptr<Base>: remembers how the concrete product has to be destroyed
+template <typename Base>
+struct ProductDeleter {
+    void (*destroy)(Base*) = nullptr;
+    void operator()(Base* p) const {
+        if (p != nullptr) {
+            destroy(p);
+        }
+    }
+};
+
+template <typename Base>
+using ProductPtr = unique_ptr<Base, ProductDeleter<Base>>;
+
+template <typename T, typename Base>
+void destroyPooled(Base* p) {
+    T* product = static_cast<T*>(p);
+    product->~T();
+    ThreadCache<T>::local().release(product);
+}
+
+template <typename T, typename Base>
+void destroyHeap(Base* p) {
+    delete static_cast<T*>(p);
+}
+
+// Creates a T either in its pool or with plain new; both come with the matching deleter
+template <typename T, typename Base>
+ProductPtr<Base> makeProduct(bool pooled) {
+    if (!pooled) {
+        return ProductPtr<Base>(new T(), ProductDeleter<Base>{destroyHeap<T, Base>});
+    }
+    void* block = ThreadCache<T>::local().allocate();
+    try {
+        return ProductPtr<Base>(new (block) T(), ProductDeleter<Base>{destroyPooled<T, Base>});
+    } catch (...) {
+        ThreadCache<T>::local().release(block);
+        throw;
+    }
+}
+
+// Product 1 --> Burger
+class Burger {
+public:
+    static atomic<long> alive;  // products constructed and not yet destroyed, for the checks
+    Burger() {
+        alive++;
+    }
+    virtual void prepare() = 0;  // Pure virtual function
+    virtual ~Burger() {
+        alive--;
+    }
+};
+atomic<long> Burger::alive{0};
+
+class BasicBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Burger with bun, patty, and ketchup!" << endl;
+    }
+};
+
+class StandardBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Standard Burger with bun, patty, cheese, and lettuce!" << endl;
+    }
+};
+
+class PremiumBurger : public Burger {
+    string sauce = "secret sauce with a name too long for the small string buffer";
+public:
+    void prepare() override {
+        cout << "Preparing Premium Burger with gourmet bun, premium patty, cheese, lettuce, and " << sauce << "!" << endl;
+    }
+};
+
+class BasicWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Wheat Burger with bun, patty, and ketchup!" << endl;
+    }
+};
+
+class StandardWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Standard Wheat Burger with bun, patty, cheese, and lettuce!" << endl;
+    }
+};
+
+class PremiumWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Premium Wheat Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce!" << endl;
+    }
+};
+
+// Product 2 --> GarlicBread
+class GarlicBread {
+public:
+    static atomic<long> alive;
+    GarlicBread() {
+        alive++;
+    }
+    virtual void prepare() = 0;
+    virtual ~GarlicBread() {
+        alive--;
+    }
+};
+atomic<long> GarlicBread::alive{0};
+
+class BasicGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Garlic Bread with butter and garlic!" << endl;
+    }
+};
+
+class CheeseGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Cheese Garlic Bread with extra cheese and butter!" << endl;
+    }
+};
+
+class BasicWheatGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Wheat Garlic Bread with butter and garlic!" << endl;
+    }
+};
+
+class CheeseWheatGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Cheese Wheat Garlic Bread with extra cheese and butter!" << endl;
+    }
+};
+
+// Factory and its concretions
+class MealFactory {
+public:
+    MealFactory(bool usePools = true) {
+        pooled = usePools;
+    }
+    virtual ~MealFactory() {}
+//This abstract factory class will handle both the items; the returned products free themselves
+    virtual ProductPtr<Burger> createBurger(const string& type) = 0;
+    virtual ProductPtr<GarlicBread> createGarlicBread(const string& type) = 0;
+protected:
+    bool pooled;
+};
+
+class SinghBurger : public MealFactory {
+public:
+    SinghBurger(bool usePools = true) : MealFactory(usePools) {}
+
+    ProductPtr<Burger> createBurger(const string& type) override {
+        if (type == "basic") {
+            return makeProduct<BasicBurger, Burger>(pooled);
+        } else if (type == "standard") {
+            return makeProduct<StandardBurger, Burger>(pooled);
+        } else if (type == "premium") {
+            return makeProduct<PremiumBurger, Burger>(pooled);
+        } else {
+            cout << "Invalid burger type! " << endl;
+            return nullptr;
+        }
+    }
+
+    ProductPtr<GarlicBread> createGarlicBread(const string& type) override {
+        if (type == "basic") {
+            return makeProduct<BasicGarlicBread, GarlicBread>(pooled);
+        } else if (type == "cheese") {
+            return makeProduct<CheeseGarlicBread, GarlicBread>(pooled);
+        }
+        else {
+            cout << "Invalid Garlic bread type! " << endl;
+            return nullptr;
+        }
+    }
+};
+
+class KingBurger : public MealFactory {
+public:
+    KingBurger(bool usePools = true) : MealFactory(usePools) {}
+
+    ProductPtr<Burger> createBurger(const string& type) override {
+        if (type == "basic") {
+            return makeProduct<BasicWheatBurger, Burger>(pooled);
+        } else if (type == "standard") {
+            return makeProduct<StandardWheatBurger, Burger>(pooled);
+        } else if (type == "premium") {
+            return makeProduct<PremiumWheatBurger, Burger>(pooled);
+        } else {
+            cout << "Invalid burger type! " << endl;
+            return nullptr;
+        }
+    }
+
+    ProductPtr<GarlicBread> createGarlicBread(const string& type) override {
+        if (type == "basic") {
+            return makeProduct<BasicWheatGarlicBread, GarlicBread>(pooled);
+        } else if (type == "cheese") {
+            return makeProduct<CheeseWheatGarlicBread, GarlicBread>(pooled);
+        }
+        else {
+            cout << "Invalid Garlic bread type! " << endl;
+            return nullptr;
+        }
+    }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Every thread takes `orders` orders of a burger and a garlic bread. The last 64 orders stay alive (an open
+// order window), so the allocator sees frees out of order like in a real kitchen.
+double ordersPerSecond(bool pooled, int threads, size_t orders) {
+    static const string burgerTypes[] = {"basic", "standard", "premium"};
+    static const string breadTypes[] = {"basic", "cheese"};
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([=] {
+            SinghBurger singh(pooled);
+            KingBurger king(pooled);
+            vector<ProductPtr<Burger>> burgers(64);
+            vector<ProductPtr<GarlicBread>> breads(64);
+            for (size_t i = 0; i < orders; i++) {
+                MealFactory& factory = (i + t) % 2 ? (MealFactory&)singh : (MealFactory&)king;
+                burgers[i % 64] = factory.createBurger(burgerTypes[i % 3]);
+                breads[i % 64] = factory.createGarlicBread(breadTypes[i % 2]);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return threads * orders / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    string burgerType = "basic";
+    string garlicBreadType = "cheese";
+
+    {
+        unique_ptr<MealFactory> mealFactory(new KingBurger());
+
+        ProductPtr<Burger> burger = mealFactory->createBurger(burgerType);
+        ProductPtr<GarlicBread> garlicBread = mealFactory->createGarlicBread(garlicBreadType);
+
+        burger->prepare();
+        garlicBread->prepare();
+        // No delete: both products go back to their pools here
+    }
+
+    cout << "===Checks===" << endl;
+    check(Burger::alive == 0 && GarlicBread::alive == 0, "products are destroyed when their handles go away");
+    SinghBurger singh;
+    void* first = singh.createBurger("premium").get();
+    ProductPtr<Burger> again = singh.createBurger("premium");
+    check(again.get() == first, "a freed block is reused by the next product of the same type");
+    check(again.get_deleter().destroy == destroyPooled<PremiumBurger, Burger>, "the deleter matches the concrete type");
+    again.reset();
+    check(singh.createBurger("deluxe") == nullptr, "an invalid type gives an empty handle");
+
+    // Produced on one thread, destroyed on another: the block goes to the destroying thread's free list
+    vector<ProductPtr<Burger>> handOver;
+    thread producer([&] {
+        for (int i = 0; i < 10000; i++) {
+            handOver.push_back(singh.createBurger("standard"));
+        }
+    });
+    producer.join();
+    check(Burger::alive == 10000, "products outlive the thread that created them");
+    thread consumer([&] { handOver.clear(); });
+    consumer.join();
+    check(Burger::alive == 0, "products can be destroyed on another thread");
+    size_t slabs = PoolStorage<StandardBurger>::instance().slabCount();
+    for (int i = 0; i < 10000; i++) {
+        handOver.push_back(singh.createBurger("standard"));
+    }
+    handOver.clear();
+    check(PoolStorage<StandardBurger>::instance().slabCount() == slabs, "blocks of finished threads are reused, not leaked");
+
+    // Only 3 returned blocks are shared: a thread that takes them must count 3, not a full batch
+    PoolStorage<BasicWheatGarlicBread>& breadStorage = PoolStorage<BasicWheatGarlicBread>::instance();
+    size_t taken = 0;
+    FreeBlock* batch = breadStorage.takeBatch(taken);
+    FreeBlock* third = batch->next->next;
+    FreeBlock* rest = third->next;
+    breadStorage.giveBack(batch, third);
+    size_t cachedAfterOne = 0;
+    size_t slabsAfterThree = 0;
+    thread shortBatch([&] {
+        ThreadCache<BasicWheatGarlicBread>& cache = ThreadCache<BasicWheatGarlicBread>::local();
+        void* blocks[3];
+        for (int i = 0; i < 3; i++) {
+            blocks[i] = cache.allocate();
+        }
+        slabsAfterThree = breadStorage.slabCount();
+        for (int i = 0; i < 3; i++) {
+            cache.release(blocks[i]);
+        }
+        cache.release(cache.allocate());
+        cachedAfterOne = cache.cached();
+    });
+    shortBatch.join();
+    FreeBlock* restLast = rest;
+    while (restLast->next != nullptr) {
+        restLast = restLast->next;
+    }
+    breadStorage.giveBack(rest, restLast);
+    check(taken == PoolStorage<BasicWheatGarlicBread>::batchSize && slabsAfterThree == 1 && cachedAfterOne == 3,
+          "a short batch from the shared list is counted by its real length");
+
+    // Benchmark: million orders (burger + garlic bread) per second, malloc vs pools
+    size_t orders = argc > 1 ? atol(argv[1]) : 2000000;
+    int maxThreads = max(1u, thread::hardware_concurrency());
+    cout << "===Orders per second (M), " << orders << " orders per thread===" << endl;
+    for (int threads = 1; threads <= maxThreads * 2; threads = threads * 2) {
+        double heap = ordersPerSecond(false, threads, orders);
+        double pool = ordersPerSecond(true, threads, orders);
+        cout << threads << " thread(s): malloc " << heap << ", pools " << pool << endl;
+    }
+    check(Burger::alive == 0 && GarlicBread::alive == 0, "no product is left after the benchmark");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,613 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <array>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <random>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// The factories in Abstract-Factory.cpp find the product with an if / else chain of string compares.
+// That is one compare per product type for every order, and every new product means editing the factory.
+// Here every franchise keeps a registry: product name -> constructor function, looked up through a perfect hash
+// (every registered name gets its own slot, so a lookup is one hash, two array reads and one compare).
+// The built-in menu is served from a table the compiler builds; products added at startup are inserted one by one
+// into a second table. A caller that knows the product in advance can
+// resolve the name once and then create by integer ID without hashing at all.
+
+typedef int32_t ProductId;
+static const ProductId invalidProduct = -1;
+
+// Finalizer of MurmurHash3: spreads every input bit over all output bits
+constexpr uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash of the name, 8 bytes per step. The bytes are put together with shifts instead of memcpy so that it
+// also runs at compile time; at runtime the compiler turns them into one load.
+constexpr uint64_t nameHash(string_view name) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ name.size();
+    size_t i = 0;
+    for (; i + 8 <= name.size(); i += 8) {
+        uint64_t word = 0;
+        for (size_t b = 0; b < 8; b++) {
+            word |= (uint64_t)(unsigned char)name[i + b] << (8 * b);
+        }
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    for (size_t b = 0; i + b < name.size(); b++) {
+        tail |= (uint64_t)(unsigned char)name[i + b] << (8 * b);
+    }
+    return mix(h ^ tail);
+}
+
+// Maps a hash to [0, n) with a multiply instead of a (much slower) division
+constexpr uint32_t reduce(uint64_t h, uint64_t n) {
+    return (uint32_t)(((unsigned __int128)h * n) >> 64);
+}
+
+// Perfect hash built with "hash and displace" (CHD):
+//  1. names are grouped into n/2 buckets by one hash
+//  2. biggest bucket first, each bucket tries displacement d = 0, 1, 2 ... until all its names land on free slots
+//  3. a lookup hashes the name once, reads its bucket's displacement and goes straight to the slot
+// Everything is constexpr, so the compiler can build the table for a fixed menu and prove there are no collisions.
+// Products registered at runtime go into a table sized for MaxKeys from the start (withCapacity()), one insert()
+// at a time: only the names in the new name's bucket are placed again, nothing else moves.
+template <size_t MaxKeys>
+class PerfectHash {
+    static constexpr size_t maxBuckets = MaxKeys / 2 + 1;
+    static constexpr size_t maxSlots = MaxKeys + MaxKeys / 4 + 1;
+    static constexpr uint32_t maxDisplacement = 1 << 16;
+
+    // Everything a lookup needs about a slot, so it reads one cache line
+    struct Slot {
+        uint64_t hash = 0;
+        string_view name;
+        ProductId id = invalidProduct;
+    };
+
+    size_t buckets = 1;
+    size_t slots = 1;
+    uint64_t seed = 0;
+    bool valid = false;
+    array<uint32_t, maxBuckets> displacement = {};
+    array<Slot, maxSlots> slot = {};
+
+    constexpr uint32_t bucketOf(uint64_t h) const {
+        return reduce(h, buckets);
+    }
+    constexpr uint32_t slotOf(uint64_t h, uint32_t d) const {
+        return reduce(mix((h ^ seed) + (d + 1) * 0x9e3779b97f4a7c15ULL), slots);
+    }
+
+    // One attempt with the current seed, false when some bucket finds no displacement
+    constexpr bool place(const string_view* names, size_t n) {
+        for (size_t s = 0; s < slots; s++) {
+            slot[s] = Slot();
+        }
+        array<uint32_t, maxBuckets> bucketSize = {};
+        for (size_t i = 0; i < n; i++) {
+            bucketSize[bucketOf(nameHash(names[i]))]++;
+        }
+        array<uint32_t, MaxKeys> members = {};
+        for (size_t size = n; size >= 1; size--) {
+            for (size_t b = 0; b < buckets; b++) {
+                if (bucketSize[b] != size) {
+                    continue;
+                }
+                size_t count = 0;
+                for (size_t i = 0; i < n; i++) {
+                    if (bucketOf(nameHash(names[i])) == b) {
+                        members[count++] = (uint32_t)i;
+                    }
+                }
+                bool placed = false;
+                for (uint32_t d = 0; d < maxDisplacement && !placed; d++) {
+                    size_t taken = 0;
+                    while (taken < count) {
+                        uint32_t s = slotOf(nameHash(names[members[taken]]), d);
+                        if (slot[s].id != invalidProduct) {
+                            break;
+                        }
+                        slot[s].id = (ProductId)members[taken];
+                        taken++;
+                    }
+                    placed = taken == count;
+                    if (placed) {
+                        displacement[b] = d;
+                    } else {
+                        // Undo this attempt
+                        for (size_t k = 0; k < taken; k++) {
+                            slot[slotOf(nameHash(names[members[k]]), d)].id = invalidProduct;
+                        }
+                    }
+                }
+                if (!placed) {
+                    return false;
+                }
+            }
+        }
+        for (size_t s = 0; s < slots; s++) {
+            if (slot[s].id != invalidProduct) {
+                slot[s].hash = nameHash(names[slot[s].id]);
+                slot[s].name = names[slot[s].id];
+            }
+        }
+        return true;
+    }
+
+public:
+    // Name i gets ID i. Fails (isValid() == false) for too many names or duplicate names.
+    static constexpr PerfectHash build(const string_view* names, size_t n) {
+        PerfectHash table;
+        if (n > MaxKeys) {
+            return table;
+        }
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (names[i] == names[j]) {
+                    return table;
+                }
+            }
+        }
+        table.buckets = n / 2 + 1;
+        table.slots = n + n / 4 + 1;
+        for (uint64_t seed = 0; seed < 16 && !table.valid; seed++) {
+            table.seed = seed * 0x2545f4914f6cdd1dULL;
+            table.valid = table.place(names, n);
+        }
+        return table;
+    }
+
+    template <size_t N>
+    static constexpr PerfectHash build(const array<string_view, N>& names) {
+        return build(names.data(), N);
+    }
+
+    // An empty table with room for MaxKeys names, for insert()
+    static constexpr PerfectHash withCapacity() {
+        PerfectHash table;
+        table.buckets = maxBuckets;
+        table.slots = maxSlots;
+        table.valid = true;
+        return table;
+    }
+
+    // Adds a name with its ID: the bucket of the name is given a displacement that fits all of its names,
+    // which is O(slots) work. False (and nothing changes) when no displacement fits, as in a full table.
+    bool insert(string_view name, ProductId id) {
+        uint64_t h = nameHash(name);
+        uint32_t b = bucketOf(h);
+        vector<Slot> members;
+        for (size_t s = 0; s < slots; s++) {
+            if (slot[s].id != invalidProduct && bucketOf(slot[s].hash) == b) {
+                members.push_back(slot[s]);
+                slot[s] = Slot();
+            }
+        }
+        members.push_back({h, name, id});
+        for (uint32_t d = 0; d < maxDisplacement; d++) {
+            size_t taken = 0;
+            while (taken < members.size() && slot[slotOf(members[taken].hash, d)].id == invalidProduct) {
+                slot[slotOf(members[taken].hash, d)] = members[taken];
+                taken++;
+            }
+            if (taken == members.size()) {
+                displacement[b] = d;
+                return true;
+            }
+            for (size_t k = 0; k < taken; k++) {
+                slot[slotOf(members[k].hash, d)] = Slot();
+            }
+        }
+        // Put the bucket back as it was
+        for (size_t k = 0; k + 1 < members.size(); k++) {
+            slot[slotOf(members[k].hash, displacement[b])] = members[k];
+        }
+        return false;
+    }
+
+    constexpr bool isValid() const {
+        return valid;
+    }
+
+    // ID of the name, or invalidProduct for a name that was never added
+    constexpr ProductId find(string_view name) const {
+        uint64_t h = nameHash(name);
+        const Slot& s = slot[slotOf(h, displacement[bucketOf(h)])];
+        return s.id != invalidProduct && s.hash == h && s.name == name ? s.id : invalidProduct;
+    }
+};
+
+// Product 1 --> Burger
+class Burger {
+public:
+    virtual void prepare() = 0;  // Pure virtual function
+    virtual ~Burger() {}
+};
+
+class BasicBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Burger with bun, patty, and ketchup!" << endl;
+    }
+};
+
+class StandardBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Standard Burger with bun, patty, cheese, and lettuce!" << endl;
+    }
+};
+
+class PremiumBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Premium Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce!" << endl;
+    }
+};
+
+class BasicWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Wheat Burger with bun, patty, and ketchup!" << endl;
+    }
+};
+
+class StandardWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Standard Wheat Burger with bun, patty, cheese, and lettuce!" << endl;
+    }
+};
+
+class PremiumWheatBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Premium Wheat Burger with gourmet bun, premium patty, cheese, lettuce, and secret sauce!" << endl;
+    }
+};
+
+// A product added later without touching any factory code
+class VeggieBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Veggie Burger with bun, veggie patty, and mint sauce!" << endl;
+    }
+};
+
+// Product 2 --> GarlicBread
+class GarlicBread {
+public:
+    virtual void prepare() = 0;
+    virtual ~GarlicBread() {}
+};
+
+class BasicGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Garlic Bread with butter and garlic!" << endl;
+    }
+};
+
+class CheeseGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Cheese Garlic Bread with extra cheese and butter!" << endl;
+    }
+};
+
+class BasicWheatGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Basic Wheat Garlic Bread with butter and garlic!" << endl;
+    }
+};
+
+class CheeseWheatGarlicBread : public GarlicBread {
+public:
+    void prepare() override {
+        cout << "Preparing Cheese Wheat Garlic Bread with extra cheese and butter!" << endl;
+    }
+};
+
+// Constructor function of one concrete product, stored in the registry
+template <typename Concrete, typename Product>
+Product* make() {
+    return new Concrete();
+}
+
+// Name -> constructor for one product family of one franchise.
+// The built-in menu (MenuSize names) is found in the table the compiler built for it and keeps IDs 0 .. MenuSize-1.
+// Products added at startup go into a second table, one insert each, and get the next IDs.
+// After startup lookups only read, so one registry can serve any number of threads.
+template <typename Product, size_t MenuSize = 0, size_t MaxProducts = 1024>
+class ProductRegistry {
+public:
+    typedef Product* (*Creator)();
+
+    ProductRegistry() {}
+    // `creators[i]` makes the product named by ID i of `menu`
+    ProductRegistry(const PerfectHash<MenuSize>& menu, const array<Creator, MenuSize>& creators)
+        : menu(&menu), creators(creators.begin(), creators.end()) {}
+    // Not copyable: a copy's table would still point at the original's names
+    ProductRegistry(const ProductRegistry&) = delete;
+    ProductRegistry& operator=(const ProductRegistry&) = delete;
+
+    // Returns the new product's ID (IDs are given out in order after the menu), or invalidProduct for a
+    // duplicate name or a full registry.
+    ProductId add(string_view name, Creator creator) {
+        if (resolve(name) != invalidProduct || names.size() >= MaxProducts) {
+            return invalidProduct;
+        }
+        names.emplace_back(name);
+        ProductId id = (ProductId)creators.size();
+        if (!added.insert(names.back(), id)) {
+            names.pop_back();
+            return invalidProduct;
+        }
+        creators.push_back(creator);
+        return id;
+    }
+
+    ProductId resolve(string_view name) const {
+        ProductId id = menu != nullptr ? menu->find(name) : invalidProduct;
+        return id != invalidProduct || names.empty() ? id : added.find(name);
+    }
+
+    // No hashing at all: the ID is an index into the constructors
+    Product* create(ProductId id) const {
+        return id >= 0 && (size_t)id < creators.size() ? creators[id]() : nullptr;
+    }
+
+    Product* create(string_view name) const {
+        return create(resolve(name));
+    }
+
+    size_t size() const {
+        return creators.size();
+    }
+
+private:
+    const PerfectHash<MenuSize>* menu = nullptr;
+    deque<string> names;  // of the added products; a deque never moves its strings, so `added` stays valid
+    vector<Creator> creators;
+    PerfectHash<MaxProducts> added = PerfectHash<MaxProducts>::withCapacity();
+};
+
+// The built-in menu is known at compile time, so the compiler builds its perfect hash and checks it
+constexpr array<string_view, 3> burgerMenu = {"basic", "standard", "premium"};
+constexpr array<string_view, 2> garlicBreadMenu = {"basic", "cheese"};
+constexpr auto burgerMenuHash = PerfectHash<burgerMenu.size()>::build(burgerMenu);
+constexpr auto garlicBreadMenuHash = PerfectHash<garlicBreadMenu.size()>::build(garlicBreadMenu);
+static_assert(burgerMenuHash.isValid() && garlicBreadMenuHash.isValid(), "menu names must be unique");
+
+// Pre-resolved IDs: computed by the compiler, usable with createBurger(ProductId) in every franchise,
+// because every franchise serves its built-in menu from these tables
+constexpr ProductId basicBurger = burgerMenuHash.find("basic");
+constexpr ProductId standardBurger = burgerMenuHash.find("standard");
+constexpr ProductId premiumBurger = burgerMenuHash.find("premium");
+constexpr ProductId basicGarlicBread = garlicBreadMenuHash.find("basic");
+constexpr ProductId cheeseGarlicBread = garlicBreadMenuHash.find("cheese");
+
+typedef ProductRegistry<Burger, burgerMenu.size()> BurgerRegistry;
+typedef ProductRegistry<GarlicBread, garlicBreadMenu.size()> GarlicBreadRegistry;
+static_assert(premiumBurger == 2 && burgerMenuHash.find("deluxe") == invalidProduct, "menu IDs are menu positions");
+
+// Factory and its concretions
+class MealFactory {
+public:
+    // What the franchise makes for each built-in menu item, in menu order
+    MealFactory(const array<BurgerRegistry::Creator, burgerMenu.size()>& burgerCreators,
+                const array<GarlicBreadRegistry::Creator, garlicBreadMenu.size()>& garlicBreadCreators)
+        : burgers(burgerMenuHash, burgerCreators), garlicBreads(garlicBreadMenuHash, garlicBreadCreators) {}
+    virtual ~MealFactory() {}
+    // Owns registries, which cannot be copied
+    MealFactory(const MealFactory&) = delete;
+    MealFactory& operator=(const MealFactory&) = delete;
+
+//Same interface as in Abstract-Factory.cpp, but the franchise only decides what is registered, not how to look it up
+    Burger* createBurger(string& type) {
+        Burger* burger = burgers.create(type);
+        if (burger == nullptr) {
+            cout << "Invalid burger type! " << endl;
+        }
+        return burger;
+    }
+
+    GarlicBread* createGarlicBread(string& type) {
+        GarlicBread* garlicBread = garlicBreads.create(type);
+        if (garlicBread == nullptr) {
+            cout << "Invalid Garlic bread type! " << endl;
+        }
+        return garlicBread;
+    }
+
+    Burger* createBurger(ProductId id) {
+        return burgers.create(id);
+    }
+
+    GarlicBread* createGarlicBread(ProductId id) {
+        return garlicBreads.create(id);
+    }
+
+    ProductId burgerId(string_view type) {
+        return burgers.resolve(type);
+    }
+
+    ProductId garlicBreadId(string_view type) {
+        return garlicBreads.resolve(type);
+    }
+
+    ProductId registerBurger(string_view type, BurgerRegistry::Creator creator) {
+        return burgers.add(type, creator);
+    }
+
+    ProductId registerGarlicBread(string_view type, GarlicBreadRegistry::Creator creator) {
+        return garlicBreads.add(type, creator);
+    }
+
+protected:
+    BurgerRegistry burgers;
+    GarlicBreadRegistry garlicBreads;
+};
+
+class SinghBurger : public MealFactory {
+public:
+    SinghBurger()
+        : MealFactory({make<BasicBurger, Burger>, make<StandardBurger, Burger>, make<PremiumBurger, Burger>},
+                      {make<BasicGarlicBread, GarlicBread>, make<CheeseGarlicBread, GarlicBread>}) {}
+};
+
+class KingBurger : public MealFactory {
+public:
+    KingBurger()
+        : MealFactory({make<BasicWheatBurger, Burger>, make<StandardWheatBurger, Burger>, make<PremiumWheatBurger, Burger>},
+                      {make<BasicWheatGarlicBread, GarlicBread>, make<CheeseWheatGarlicBread, GarlicBread>}) {}
+};
+
+// For the benchmark: product type number N, so there can be hundreds of distinct product classes
+template <size_t N>
+class NumberedBurger : public Burger {
+public:
+    void prepare() override {
+        cout << "Preparing Burger number " << N << endl;
+    }
+};
+
+template <size_t... I>
+array<ProductRegistry<Burger>::Creator, sizeof...(I)> numberedCreators(index_sequence<I...>) {
+    return {make<NumberedBurger<I>, Burger>...};
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Creations per second with `types` product types, for the three ways to find the product
+void benchmark(size_t types, size_t orders) {
+    static const auto creators = numberedCreators(make_index_sequence<500>());
+    vector<string> names;
+    ProductRegistry<Burger> registry;
+    for (size_t i = 0; i < types; i++) {
+        names.push_back("burger-" + to_string(i * 7919));
+        registry.add(names.back(), creators[i]);
+    }
+    mt19937 random(1);
+    vector<string> orderNames(orders);
+    vector<ProductId> orderIds(orders);
+    for (size_t i = 0; i < orders; i++) {
+        orderNames[i] = names[random() % types];
+        orderIds[i] = registry.resolve(orderNames[i]);
+    }
+
+    auto rate = [&](auto createOne) {
+        auto start = chrono::steady_clock::now();
+        size_t created = 0;
+        for (size_t i = 0; i < orders; i++) {
+            Burger* burger = createOne(i);
+            created = created + (burger != nullptr);
+            delete burger;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return created == orders ? orders / seconds / 1e6 : -1.0;
+    };
+    // What an if / else chain does: compare the name with every type until one matches
+    double chain = rate([&](size_t i) -> Burger* {
+        for (size_t t = 0; t < types; t++) {
+            if (orderNames[i] == names[t]) {
+                return creators[t]();
+            }
+        }
+        return nullptr;
+    });
+    double byName = rate([&](size_t i) { return registry.create(orderNames[i]); });
+    double byId = rate([&](size_t i) { return registry.create(orderIds[i]); });
+    cout << types << " types: if/else chain " << chain << ", registry by name " << byName << ", by ID " << byId
+         << " M creations/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    string burgerType = "basic";
+    string garlicBreadType = "cheese";
+
+    MealFactory* mealFactory = new KingBurger();
+
+    Burger* burger = mealFactory->createBurger(burgerType);
+    GarlicBread* garlicBread = mealFactory->createGarlicBread(garlicBreadType);
+
+    burger->prepare();
+    garlicBread->prepare();
+
+    // A new product registered at startup, and an order by pre-resolved ID
+    mealFactory->registerBurger("veggie", make<VeggieBurger, Burger>);
+    string veggieType = "veggie";
+    Burger* veggie = mealFactory->createBurger(veggieType);
+    veggie->prepare();
+    Burger* premium = mealFactory->createBurger(premiumBurger);
+    premium->prepare();
+
+    cout << "===Checks===" << endl;
+    SinghBurger singh;
+    bool allFound = true;
+    for (size_t i = 0; i < burgerMenu.size(); i++) {
+        allFound = allFound && singh.burgerId(burgerMenu[i]) == (ProductId)i;
+    }
+    for (size_t i = 0; i < garlicBreadMenu.size(); i++) {
+        allFound = allFound && singh.garlicBreadId(garlicBreadMenu[i]) == (ProductId)i;
+    }
+    check(allFound && singh.garlicBreadId("cheese") == cheeseGarlicBread && basicGarlicBread == 0,
+          "built-in menu IDs match the compile time IDs");
+    check(singh.burgerId("Basic") == invalidProduct && singh.burgerId("") == invalidProduct
+          && singh.burgerId("premiumm") == invalidProduct, "unknown names are not found");
+    check(singh.registerBurger("basic", make<VeggieBurger, Burger>) == invalidProduct, "a name can not be registered twice");
+    check(mealFactory->burgerId("veggie") == 3 && mealFactory->burgerId("premium") == premiumBurger,
+          "registering keeps the IDs of earlier products");
+    ProductRegistry<Burger> big;
+    static const auto creators = numberedCreators(make_index_sequence<500>());
+    bool bigOk = true;
+    for (size_t i = 0; i < 500; i++) {
+        bigOk = bigOk && big.add("burger-" + to_string(i), creators[i]) == (ProductId)i;
+    }
+    for (size_t i = 0; i < 500; i++) {
+        bigOk = bigOk && big.resolve("burger-" + to_string(i)) == (ProductId)i;
+    }
+    check(bigOk && big.resolve("burger-500") == invalidProduct, "500 registered names each find their own ID");
+    ProductRegistry<Burger, 0, 64> full;
+    size_t fitted = 0;
+    while (fitted < 100 && full.add("burger-" + to_string(fitted), creators[fitted % 500]) != invalidProduct) {
+        fitted++;
+    }
+    bool fullOk = fitted == 64;
+    for (size_t i = 0; i < fitted; i++) {
+        fullOk = fullOk && full.resolve("burger-" + to_string(i)) == (ProductId)i;
+    }
+    check(fullOk, "a registry takes exactly MaxProducts names, one insert each");
+
+    size_t orders = argc > 1 ? atol(argv[1]) : 2000000;
+    cout << "===Creation throughput, " << orders << " orders===" << endl;
+    for (size_t types : {3, 50, 500}) {
+        benchmark(types, orders);
+    }
+
+    delete burger;
+    delete garlicBread;
+    delete veggie;
+    delete premium;
+    delete mealFactory;
+    return failures == 0 ? 0 : 1;
+}
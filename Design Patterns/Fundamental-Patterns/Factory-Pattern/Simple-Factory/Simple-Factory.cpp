@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 using namespace std;
 
 //This is our base abstract base class
@@ -34,15 +35,15 @@ class PremiumBurger: public Burger {
 class BurgerFactory {
   public:
   //So here we are creating a method which will return object of Burger type and according to the type passed as argument it will create the object of that type
-    Burger* createBurger(string &type) {
+    unique_ptr<Burger> createBurger(string &type) {
       if(type == "Basic"){
-        return new BasicBurger();
+        return unique_ptr<Burger>(new BasicBurger());
       }
       else if(type == "Standard"){
-        return new StandardBurger();
+        return unique_ptr<Burger>(new StandardBurger());
       }
       else if(type == "Premium"){
-        return new PremiumBurger();
+        return unique_ptr<Burger>(new PremiumBurger());
       }
       else{
         cout << "THe type is not valid" << endl;
@@ -54,11 +55,12 @@ class BurgerFactory {
 int main(){
   string type = "Standard";
   //Now we will create a object of BurgerFactory class which will handle all burger object creation 
-  BurgerFactory * myBurgerFactory = new BurgerFactory();
+  unique_ptr<BurgerFactory> myBurgerFactory(new BurgerFactory());
   //In the following line, burger object will be returned by createBurger method of BurgerFactory class according to the type
-  Burger * burger = myBurgerFactory->createBurger(type);
+  unique_ptr<Burger> burger = myBurgerFactory->createBurger(type);
   //Now we can easily call the prepare method of that method
   burger->prepare();
-  
+
+  //No delete: the unique_ptrs free the burger and the factory
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,613 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+using namespace std;
+
+//This file builds the same File/Folder composite tree as Composite-Pattern.cpp,
+//but from a real directory on disk, and saves it into a binary snapshot which can be mmaped back.
+//It is Linux only as it talks to the kernel directly with getdents64 and statx.
+
+//Same base Interface for the files and folders
+class FilSystemItem {
+  public:
+    virtual void ls(int indent = 0) = 0;
+    virtual string getName() = 0;
+    virtual uint64_t getSize() = 0;
+    virtual bool isFolder() = 0;
+    virtual ~FilSystemItem() {}
+};
+
+//Leaf of the tree
+class File: public FilSystemItem {
+  string name;
+  uint64_t size;  //files over 2 GiB are common, so never an int
+  public:
+    File(const string& n, uint64_t s){
+      name = n;
+      size = s;
+    }
+    void ls(int indent = 0) override {
+      cout << string(indent, ' ') << name << "\n";
+    }
+    string getName() override {
+      return name;
+    }
+    uint64_t getSize() override {
+      return size;
+    }
+    bool isFolder() override {
+      return false;
+    }
+};
+
+//Composite node of the tree
+class Folder: public FilSystemItem {
+  string name;
+  vector<FilSystemItem*> children;
+  public:
+    Folder(const string& n){
+      name = n;
+    }
+    //The folder owns its children so it frees them as well
+    ~Folder(){
+      for(auto child: children){
+        delete child;
+      }
+    }
+    void add(FilSystemItem* item){
+      children.push_back(item);
+    }
+    //The snapshot writer needs to walk the children directly
+    const vector<FilSystemItem*>& getChildren(){
+      return children;
+    }
+    void ls(int indent = 0) override {
+      for(auto child: children){
+        cout << string(indent, child->isFolder() ? '+' : ' ') << child->getName() << "\n";
+      }
+    }
+    string getName() override {
+      return name;
+    }
+    uint64_t getSize() override {
+      uint64_t size = 0;
+      for(auto child: children){
+        size = size + child->getSize();
+      }
+      return size;
+    }
+    bool isFolder() override {
+      return true;
+    }
+};
+
+//Layout of one record returned by the getdents64 syscall (glibc does not export it)
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+//The importer walks the directory with a pool of threads.
+//Every folder is read by exactly one thread, so a Folder object is only ever written by one thread and needs no lock.
+//Only the shared queue of "folders still to be read" is protected by a mutex.
+class FileSystemImporter {
+  struct Job {
+    Folder* folder;
+    string path;
+  };
+  deque<Job> jobs;
+  mutex m;
+  condition_variable cv;
+  int pending = 0;
+  int threadCount;
+
+  //However readFolder ends (an early return or an exception), its job is finished: the sub folders found so far are
+  //queued and pending goes down by one. Without this the other workers would wait for the job forever.
+  struct JobDone {
+    FileSystemImporter* importer;
+    vector<Job> found;
+    ~JobDone(){
+      lock_guard<mutex> lock(importer->m);
+      for(auto& sub: found){
+        importer->jobs.push_back(move(sub));
+      }
+      importer->pending = importer->pending + (int)found.size() - 1;
+      importer->cv.notify_all();
+    }
+  };
+
+  //Reads one directory: a single getdents64 call returns a whole buffer of entries at once
+  //and the d_type field tells us file or folder without a stat call.
+  //Only regular files need statx, and we ask for the size only, relative to the open directory fd.
+  //A folder that can not be opened (no permission, deleted meanwhile) is imported as empty.
+  void readFolder(Job job){
+    JobDone done{this, {}};
+    vector<Job>& found = done.found;
+    int fd = open(job.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+      return;
+    }
+    alignas(8) char buffer[64 * 1024];
+    while(true){
+      long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+      if(n <= 0){
+        break;
+      }
+      for(long offset = 0; offset < n;){
+        LinuxDirent64* entry = (LinuxDirent64*)(buffer + offset);
+        offset = offset + entry->d_reclen;
+        const char* name = entry->d_name;
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0){
+          continue;
+        }
+        unsigned char type = entry->d_type;
+        struct statx stx;
+        bool haveStat = false;
+        if(type == DT_UNKNOWN || type == DT_REG){
+          unsigned int mask = type == DT_UNKNOWN ? (STATX_TYPE | STATX_SIZE) : STATX_SIZE;
+          if(statx(fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &stx) == 0){
+            haveStat = true;
+            if(type == DT_UNKNOWN){
+              type = S_ISDIR(stx.stx_mode) ? DT_DIR : S_ISREG(stx.stx_mode) ? DT_REG : DT_UNKNOWN;
+            }
+          }
+        }
+        if(type == DT_DIR){
+          Folder* sub = new Folder(name);
+          job.folder->add(sub);
+          found.push_back({sub, job.path + "/" + name});
+        }else if(type == DT_REG && haveStat){
+          job.folder->add(new File(name, stx.stx_size));
+        }
+        //Symlinks, sockets etc. are not part of our file system model so we skip them
+      }
+    }
+    close(fd);
+  }
+
+  void worker(){
+    while(true){
+      Job job;
+      {
+        unique_lock<mutex> lock(m);
+        cv.wait(lock, [this]{ return !jobs.empty() || pending == 0; });
+        if(jobs.empty()){
+          return;
+        }
+        //Taking from the back keeps the walk close to depth first, so the queue stays small
+        job = move(jobs.back());
+        jobs.pop_back();
+      }
+      readFolder(move(job));
+    }
+  }
+
+  public:
+    FileSystemImporter(int threads = 0){
+      threadCount = threads > 0 ? threads : max(1u, thread::hardware_concurrency());
+    }
+
+    Folder* import(const string& path){
+      Folder* root = new Folder(filesystem::path(path).filename().string());
+      jobs.push_back({root, path});
+      pending = 1;
+      vector<thread> workers;
+      for(int i = 0; i < threadCount; i++){
+        workers.emplace_back(&FileSystemImporter::worker, this);
+      }
+      for(auto& t: workers){
+        t.join();
+      }
+      return root;
+    }
+};
+
+//Snapshot file format (all little endian, native layout):
+//  SnapshotHeader
+//  SnapshotNode[nodeCount]   -- breadth first, so the children of a node are contiguous
+//  names blob                -- every name back to back, not null terminated
+//Folder sizes are stored already summed up, so getSize on the snapshot is O(1).
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeCount;
+  uint64_t namesOffset;
+  uint64_t namesSize;
+};
+
+struct SnapshotNode {
+  uint64_t size;
+  uint32_t nameOffset;
+  uint32_t nameLength;
+  uint32_t firstChild;
+  uint32_t childCount;
+  uint32_t isFolder;
+  uint32_t reserved;
+};
+
+static const char snapshotMagic[8] = {'L', 'L', 'D', 'S', 'N', 'A', 'P', '1'};
+static const uint32_t snapshotVersion = 1;
+
+class SnapshotWriter {
+  public:
+    static bool write(Folder* root, const string& path){
+      vector<SnapshotNode> nodes;
+      string names;
+      vector<FilSystemItem*> order;
+      order.push_back(root);
+      nodes.push_back(makeNode(root, names));
+      //Breadth first walk: children of order[i] are appended together, so their indexes are contiguous
+      for(size_t i = 0; i < order.size(); i++){
+        if(!order[i]->isFolder()){
+          continue;
+        }
+        auto& children = ((Folder*)order[i])->getChildren();
+        nodes[i].firstChild = (uint32_t)order.size();
+        nodes[i].childCount = (uint32_t)children.size();
+        for(auto child: children){
+          order.push_back(child);
+          nodes.push_back(makeNode(child, names));
+        }
+      }
+      //Children always come after their parent, so one backwards pass sums the folder sizes
+      for(size_t i = nodes.size(); i-- > 0;){
+        if(nodes[i].isFolder){
+          uint64_t total = 0;
+          for(uint32_t c = 0; c < nodes[i].childCount; c++){
+            total = total + nodes[nodes[i].firstChild + c].size;
+          }
+          nodes[i].size = total;
+        }
+      }
+
+      SnapshotHeader header;
+      memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+      header.version = snapshotVersion;
+      header.nodeCount = (uint32_t)nodes.size();
+      header.namesOffset = sizeof(SnapshotHeader) + nodes.size() * sizeof(SnapshotNode);
+      header.namesSize = names.size();
+
+      ofstream out(path, ios::binary | ios::trunc);
+      out.write((const char*)&header, sizeof(header));
+      out.write((const char*)nodes.data(), nodes.size() * sizeof(SnapshotNode));
+      out.write(names.data(), names.size());
+      return out.good();
+    }
+
+  private:
+    static SnapshotNode makeNode(FilSystemItem* item, string& names){
+      SnapshotNode node = {};
+      string name = item->getName();
+      node.nameOffset = (uint32_t)names.size();
+      node.nameLength = (uint32_t)name.size();
+      node.isFolder = item->isFolder();
+      node.size = item->isFolder() ? 0 : item->getSize();
+      names += name;
+      return node;
+    }
+};
+
+//Read only view over a mmaped snapshot.
+//Nothing is copied on open: every query reads the node array straight from the mapping. open() does check every
+//node once (a linear pass, no allocation), so a damaged file is refused there and later queries can trust it.
+class SnapshotView {
+  void* base = MAP_FAILED;
+  size_t length = 0;
+  const SnapshotHeader* header = nullptr;
+  const SnapshotNode* nodes = nullptr;
+  const char* names = nullptr;
+
+  //The name is inside the names blob, and the children are inside the node array and come after their parent
+  //(the writer is breadth first), so walking down the tree always ends
+  bool validNode(uint32_t i){
+    const SnapshotNode& n = nodes[i];
+    if((uint64_t)n.nameOffset + n.nameLength > header->namesSize || n.isFolder > 1){
+      return false;
+    }
+    if(!n.isFolder){
+      return n.childCount == 0;
+    }
+    return n.childCount == 0 || (n.firstChild > i && (uint64_t)n.firstChild + n.childCount <= header->nodeCount);
+  }
+
+  public:
+    bool open(const string& path){
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0){
+        return false;
+      }
+      struct stat st;
+      if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)){
+        ::close(fd);
+        return false;
+      }
+      length = st.st_size;
+      base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if(base == MAP_FAILED){
+        return false;
+      }
+      header = (const SnapshotHeader*)base;
+      //Validate the header and every node before trusting any offset in the file, so the queries below can index
+      //the mapping without checks
+      if(memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic)) != 0 || header->version != snapshotVersion
+         || header->nodeCount == 0
+         || header->namesOffset != sizeof(SnapshotHeader) + (uint64_t)header->nodeCount * sizeof(SnapshotNode)
+         || header->namesOffset > length || header->namesSize > length - header->namesOffset){
+        close();
+        return false;
+      }
+      nodes = (const SnapshotNode*)((const char*)base + sizeof(SnapshotHeader));
+      names = (const char*)base + header->namesOffset;
+      if(!nodes[0].isFolder){
+        close();
+        return false;
+      }
+      for(uint32_t i = 0; i < header->nodeCount; i++){
+        if(!validNode(i)){
+          close();
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void close(){
+      if(base != MAP_FAILED){
+        munmap(base, length);
+      }
+      base = MAP_FAILED;
+      header = nullptr;
+    }
+
+    ~SnapshotView(){
+      close();
+    }
+
+    //Node 0 is always the root folder
+    uint32_t root(){
+      return 0;
+    }
+    uint32_t nodeCount(){
+      return header->nodeCount;
+    }
+    string getName(uint32_t node){
+      return string(names + nodes[node].nameOffset, nodes[node].nameLength);
+    }
+    uint64_t getSize(uint32_t node){
+      return nodes[node].size;
+    }
+    bool isFolder(uint32_t node){
+      return nodes[node].isFolder != 0;
+    }
+    //Same meaning as Folder::cd: returns the child folder with that name, or -1 if there is none
+    int64_t cd(uint32_t node, const string& target){
+      const SnapshotNode& n = nodes[node];
+      for(uint32_t c = n.firstChild; c < n.firstChild + n.childCount; c++){
+        if(nodes[c].isFolder && nodes[c].nameLength == target.size()
+           && memcmp(names + nodes[c].nameOffset, target.data(), target.size()) == 0){
+          return c;
+        }
+      }
+      return -1;
+    }
+    void ls(uint32_t node, int indent = 0){
+      const SnapshotNode& n = nodes[node];
+      for(uint32_t c = n.firstChild; c < n.firstChild + n.childCount; c++){
+        cout << string(indent, nodes[c].isFolder ? '+' : ' ') << getName(c) << "\n";
+      }
+    }
+};
+
+//Creates `fileCount` small files under `root`, 100 files per folder, 100 folders per parent
+static void generateTree(const string& root, int fileCount){
+  const int perFolder = 100;
+  int folders = (fileCount + perFolder - 1) / perFolder;
+  string payload(16, 'x');
+  for(int f = 0; f < folders; f++){
+    string dir = root + "/d" + to_string(f / 100) + "/d" + to_string(f % 100);
+    filesystem::create_directories(dir);
+    for(int i = 0; i < perFolder && f * perFolder + i < fileCount; i++){
+      int fd = open((dir + "/file" + to_string(i) + ".txt").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if(fd >= 0){
+        ssize_t written = ::write(fd, payload.data(), payload.size());
+        (void)written;
+        ::close(fd);
+      }
+    }
+  }
+}
+
+static int failures = 0;
+static void check(bool ok, const string& what){
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if(!ok){
+    failures++;
+  }
+}
+
+//A chain of folders under `root` whose full path is longer than PATH_MAX, so open() on the deepest ones fails
+//(even for root, unlike a chmod 000 folder). Made with mkdirat/openat, one level at a time.
+static const int deepLevels = 24;
+static const string deepName(200, 'n');
+
+static void makeDeepChain(const string& root){
+  int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  for(int level = 0; level < deepLevels && fd >= 0; level++){
+    mkdirat(fd, deepName.c_str(), 0755);
+    int next = openat(fd, deepName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ::close(fd);
+    fd = next;
+  }
+  if(fd >= 0){
+    ::close(fd);
+  }
+}
+
+//filesystem::remove_all works with full paths, so the chain is removed from the inside out with the fds instead
+static void removeDeepChain(const string& root){
+  vector<int> fds = {open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+  while((int)fds.size() <= deepLevels && fds.back() >= 0){
+    fds.push_back(openat(fds.back(), deepName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  }
+  for(size_t i = fds.size() - 1; i-- > 0;){
+    if(fds[i] >= 0){
+      unlinkat(fds[i], deepName.c_str(), AT_REMOVEDIR);
+    }
+  }
+  for(int fd: fds){
+    if(fd >= 0){
+      ::close(fd);
+    }
+  }
+}
+
+static bool writeBytes(const string& path, const string& bytes){
+  ofstream out(path, ios::binary | ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  return out.good();
+}
+
+static void runChecks(){
+  cout << "===Checks===" << endl;
+  char tmpl[] = "/tmp/composite-checkXXXXXX";
+  string root = mkdtemp(tmpl);
+  filesystem::create_directories(root + "/ok");
+  writeBytes(root + "/ok/file.txt", "12345");
+  filesystem::create_directories(root + "/locked");
+  filesystem::permissions(root + "/locked", filesystem::perms::none);
+  makeDeepChain(root);
+
+  //A hang here is the bug being checked for, so the import runs on its own thread with a deadline
+  auto importing = async(launch::async, [&]{ return FileSystemImporter(4).import(root); });
+  if(importing.wait_for(chrono::seconds(20)) != future_status::ready){
+    check(false, "import of a tree with folders that can not be opened finishes");
+    _exit(1);
+  }
+  Folder* tree = importing.get();
+  check(tree->getSize() == 5, "import of a tree with folders that can not be opened finishes, and they are empty");
+  delete tree;
+
+  //A sparse 3 GiB file: its size must come through whole, in the tree and in the snapshot
+  writeBytes(root + "/ok/big.bin", "");
+  filesystem::resize_file(root + "/ok/big.bin", 3ull << 30);
+  tree = FileSystemImporter(4).import(root);
+  check(tree->getSize() == (3ull << 30) + 5, "files over 2 GiB keep their size");
+
+  string snapshotPath = root + ".snap";
+  SnapshotWriter::write(tree, snapshotPath);
+  delete tree;
+  ifstream in(snapshotPath, ios::binary);
+  string good((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  SnapshotView view;
+  bool opens = view.open(snapshotPath) && view.getSize(view.root()) == (3ull << 30) + 5;
+  view.close();
+
+  //Damaged copies: every one of them must be refused by open(), none may be read out of bounds
+  auto nodeField = [&](string bytes, uint32_t node, size_t offset, uint32_t value){
+    memcpy(&bytes[sizeof(SnapshotHeader) + node * sizeof(SnapshotNode) + offset], &value, 4);
+    return bytes;
+  };
+  vector<string> damaged = {
+    good.substr(0, good.size() / 2),
+    good.substr(0, sizeof(SnapshotHeader) + 3),
+    nodeField(good, 0, offsetof(SnapshotNode, firstChild), 1000000000),
+    nodeField(good, 0, offsetof(SnapshotNode, childCount), 1000000000),
+    nodeField(good, 1, offsetof(SnapshotNode, nameOffset), 1000000000),
+    nodeField(good, 1, offsetof(SnapshotNode, nameLength), 0xFFFFFFFF),
+    nodeField(good, 0, offsetof(SnapshotNode, firstChild), 0),
+  };
+  bool refused = true;
+  for(auto& bytes: damaged){
+    writeBytes(snapshotPath, bytes);
+    refused = refused && !view.open(snapshotPath);
+    view.close();
+  }
+  check(opens && refused, "a truncated or corrupt snapshot is refused by open()");
+
+  filesystem::remove(snapshotPath);
+  filesystem::permissions(root + "/locked", filesystem::perms::owner_all);
+  removeDeepChain(root);
+  filesystem::remove_all(root);
+}
+
+static double secondsSince(chrono::steady_clock::time_point start){
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+  //Usage: ./importer [fileCount]   (use 1000000 for the full sized benchmark)
+  int fileCount = argc > 1 ? atoi(argv[1]) : 20000;
+  runChecks();
+
+  char tmpl[] = "/tmp/composite-importXXXXXX";
+  string root = mkdtemp(tmpl);
+  cout << "Generating " << fileCount << " files in " << root << endl;
+  generateTree(root, fileCount);
+
+  //Import with one thread and with all the cores so the speedup is visible
+  auto start = chrono::steady_clock::now();
+  Folder* single = FileSystemImporter(1).import(root);
+  double singleTime = secondsSince(start);
+  delete single;
+
+  start = chrono::steady_clock::now();
+  FileSystemImporter importer;
+  Folder* tree = importer.import(root);
+  double parallelTime = secondsSince(start);
+  cout << "Import (1 thread):   " << singleTime << " s, " << fileCount / singleTime << " files/s" << endl;
+  cout << "Import (all cores):  " << parallelTime << " s, " << fileCount / parallelTime << " files/s" << endl;
+
+  string snapshotPath = root + ".snap";
+  start = chrono::steady_clock::now();
+  SnapshotWriter::write(tree, snapshotPath);
+  cout << "Snapshot write:      " << secondsSince(start) << " s" << endl;
+
+  //Cold start means open + mmap + the check of every node + first real query, compared to walking the disk again
+  start = chrono::steady_clock::now();
+  SnapshotView view;
+  if(!view.open(snapshotPath)){
+    cout << "Could not open the snapshot" << endl;
+    return 1;
+  }
+  uint64_t total = view.getSize(view.root());
+  int64_t d0 = view.cd(view.root(), "d0");
+  double coldStart = secondsSince(start);
+  cout << "Snapshot cold start: " << coldStart * 1e6 << " us for " << view.nodeCount() << " nodes" << endl;
+
+  //Both trees must agree on the total size
+  cout << "Total size: tree=" << tree->getSize() << " snapshot=" << total << endl;
+  if(d0 >= 0){
+    int64_t d00 = view.cd((uint32_t)d0, "d0");
+    if(d00 >= 0){
+      cout << "ls d0/d0 (first entries):" << endl;
+      view.ls((uint32_t)d00, 2);
+    }
+  }
+
+  delete tree;
+  view.close();
+  filesystem::remove(snapshotPath);
+  filesystem::remove_all(root);
+  return failures == 0 ? 0 : 1;
+}
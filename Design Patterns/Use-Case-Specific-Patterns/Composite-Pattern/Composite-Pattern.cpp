@@ -1,7 +1,61 @@
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
 using namespace std;
 
+//ls and openAll used to write every line straight to cout and build a new string(indent, ' ') for it.
+//Now they write through this buffered sink: lines are copied into one buffer and written out in large chunks.
+//The buffer starts small and only grows (up to `limit`) as much as the output needs, so a short listing stays cheap.
+class OutputBuffer {
+  FILE* target;
+  vector<char> buffer;
+  size_t limit;
+  public:
+    OutputBuffer(FILE* t = stdout, size_t l = 1 << 20){
+      target = t;
+      limit = l;
+      buffer.reserve(min(limit, (size_t)4096));
+    }
+    ~OutputBuffer(){
+      flush();
+    }
+    void flush(){
+      if(!buffer.empty()){
+        fwrite(buffer.data(), 1, buffer.size(), target);
+        buffer.clear();
+      }
+    }
+    void append(const char* data, size_t length){
+      if(buffer.size() + length > limit){
+        flush();
+        //Very long lines skip the buffer and go out directly
+        if(length > limit){
+          fwrite(data, 1, length, target);
+          return;
+        }
+      }
+      buffer.insert(buffer.end(), data, data + length);
+    }
+    void append(const string& s){
+      append(s.data(), s.size());
+    }
+    //Writes `count` copies of `c` without building a temporary string
+    void repeat(char c, size_t count){
+      while(count > 0){
+        if(buffer.size() == limit){
+          flush();
+        }
+        size_t chunk = min(count, limit - buffer.size());
+        buffer.insert(buffer.end(), chunk, c);
+        count = count - chunk;
+      }
+    }
+};
+
 //First of all we are creating the base Interface for the files and folders
 class FilSystemItem {
   public:
@@ -12,9 +66,69 @@ class FilSystemItem {
     virtual int getSize() = 0;
     virtual FilSystemItem* cd(const string& name) = 0;
     virtual bool isFolder ()= 0;
+    //Children are exposed through the common interface so the iterator can walk files and folders uniformly
+    virtual const vector<FilSystemItem*>& getChildren() = 0;
     virtual ~FilSystemItem() {}
 };
 
+//Lazy depth first walk over the tree which yields (depth, node) pairs one at a time.
+//It keeps its own stack of folders instead of recursing, so it only holds one frame per level of depth.
+//The caller can stop whenever it wants and nothing else of the tree is visited.
+class DepthFirstIterator {
+  struct Frame {
+    FilSystemItem* folder;
+    size_t nextChild;
+    int depth;
+  };
+  vector<Frame> stack;
+  FilSystemItem* pendingRoot;
+  FilSystemItem* current = nullptr;
+  int currentDepth = 0;
+  public:
+    DepthFirstIterator(FilSystemItem* root){
+      pendingRoot = root;
+    }
+    //Moves to the next node, returns false when the whole tree is visited
+    bool next(){
+      if(pendingRoot != nullptr){
+        current = pendingRoot;
+        currentDepth = 0;
+        pendingRoot = nullptr;
+        if(current->isFolder()){
+          stack.push_back({current, 0, 0});
+        }
+        return true;
+      }
+      while(!stack.empty()){
+        Frame& top = stack.back();
+        const vector<FilSystemItem*>& children = top.folder->getChildren();
+        if(top.nextChild == children.size()){
+          stack.pop_back();
+          continue;
+        }
+        current = children[top.nextChild];
+        currentDepth = top.depth + 1;
+        top.nextChild++;
+        if(current->isFolder()){
+          stack.push_back({current, 0, currentDepth});
+        }
+        return true;
+      }
+      current = nullptr;
+      return false;
+    }
+    FilSystemItem* node(){
+      return current;
+    }
+    int depth(){
+      return currentDepth;
+    }
+    //Number of frames held right now, this only grows with the depth of the tree
+    size_t stackSize(){
+      return stack.size();
+    }
+};
+
 //Now we will be creating the File class which will be a leaf
 class File: public FilSystemItem {
   string name;
@@ -27,11 +141,14 @@ class File: public FilSystemItem {
   //Now start implementing the pure virtual methods
   //File ls just prints the name of the file
   void ls(int indent = 0) override {
-    cout << string(indent, ' ') << name << endl;
+    OutputBuffer out;
+    out.repeat(' ', indent);
+    out.append(name);
+    out.append("\n", 1);
   }
   //File openAll just prints the name of the file
   void openAll(int indent = 0) override {
-    cout << string(indent, ' ') << name << endl;
+    ls(indent);
   }
   int getSize() override {
     return size;
@@ -46,6 +163,11 @@ class File: public FilSystemItem {
   bool isFolder () override {
     return false;
   }
+  //A file has no children so it always gives back the same empty list
+  const vector<FilSystemItem*>& getChildren() override {
+    static const vector<FilSystemItem*> none;
+    return none;
+  }
 };
 
 //Noe lets create the Folder class
@@ -65,21 +187,34 @@ class Folder: public FilSystemItem {
     void ls(int indent = 0) override {
       //Loop thorugh all the children and print their names
       //All the children will of type FilSystemItem so we can call their methods
+      OutputBuffer out;
       for(auto child: children){
         if(child->isFolder()){
-          cout << string(indent, '+') << child->getName() << "\n";
+          out.repeat('+', indent);
         }else{
-          cout << string(indent, ' ') << child->getName() << "\n";
+          out.repeat(' ', indent);
         }
+        out.append(child->getName());
+        out.append("\n", 1);
       }
     }
     void openAll(int indent = 0) override{
-      //Here we will loop through all the children and call their openAll method
-      //At first we will print the name of the folder
-      cout << string(indent, ' ') << "+ " << name << "\n";
-      //Now we will loop through all the children and call their openAll method recursively
-      for(auto child: children){
-        child->openAll(indent+4);
+      OutputBuffer out;
+      openAll(out, indent);
+    }
+    //Same as openAll but writes into a sink given by the caller, e.g. a file instead of the terminal
+    void openAll(OutputBuffer& out, int indent = 0){
+      //The iterator gives every node with its depth in the same order as the old recursive version:
+      //the folder first, then its children, each level indented 4 more spaces
+      DepthFirstIterator it(this);
+      while(it.next()){
+        FilSystemItem* item = it.node();
+        out.repeat(' ', indent + 4 * it.depth());
+        if(item->isFolder()){
+          out.append("+ ", 2);
+        }
+        out.append(item->getName());
+        out.append("\n", 1);
       }
     }
     int getSize() override{
@@ -109,14 +244,86 @@ class Folder: public FilSystemItem {
     bool isFolder () override {
       return true;
     }
+    const vector<FilSystemItem*>& getChildren() override {
+      return children;
+    }
 };
 
-int main () {
+//The old recursive openAll, kept only to compare against in the benchmark
+void recursiveOpenAll(ostream& out, FilSystemItem* item, int indent){
+  if(item->isFolder()){
+    out << string(indent, ' ') << "+ " << item->getName() << "\n";
+    for(auto child: item->getChildren()){
+      recursiveOpenAll(out, child, indent + 4);
+    }
+  }else{
+    out << string(indent, ' ') << item->getName() << endl;
+  }
+}
+
+//Builds a tree with `nodeCount` nodes: every folder has 10 children and the last level is files
+Folder* buildTree(long nodeCount){
+  Folder* root = new Folder("root");
+  vector<Folder*> level = {root};
+  long made = 1;
+  while(made < nodeCount){
+    vector<Folder*> nextLevel;
+    for(auto folder: level){
+      for(int i = 0; i < 10 && made < nodeCount; i++){
+        if(made * 10 < nodeCount){
+          Folder* sub = new Folder("dir" + to_string(i));
+          folder->add(sub);
+          nextLevel.push_back(sub);
+        }else{
+          folder->add(new File("file" + to_string(i) + ".txt", 1));
+        }
+        made++;
+      }
+    }
+    level = nextLevel;
+    if(level.empty()){
+      break;
+    }
+  }
+  return root;
+}
+
+int main (int argc, char** argv) {
   //Build the File System
   Folder * root = new Folder("root");
   root->add(new File("file1.txt", 100));
   root->add(new File("file2.txt", 200));
   // root->openAll();
   root->ls();
+
+  //Pass a node count to run the benchmark, e.g. ./composite 10000000
+  if(argc > 1){
+    long nodeCount = atol(argv[1]);
+    Folder* big = buildTree(nodeCount);
+
+    ofstream devNull("/dev/null");
+    auto start = chrono::steady_clock::now();
+    recursiveOpenAll(devNull, big, 0);
+    double oldTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    FILE* sink = fopen("/dev/null", "w");
+    start = chrono::steady_clock::now();
+    {
+      OutputBuffer out(sink);
+      big->openAll(out);
+    }
+    double newTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    fclose(sink);
+    cout << "recursive cout openAll: " << nodeCount / oldTime << " lines/s" << endl;
+    cout << "iterator + buffer:      " << nodeCount / newTime << " lines/s" << endl;
+
+    //Early termination: only the first 1000 nodes are visited and the stack never holds more than the depth
+    DepthFirstIterator it(big);
+    size_t maxStack = 0;
+    for(int i = 0; i < 1000 && it.next(); i++){
+      maxStack = max(maxStack, it.stackSize());
+    }
+    cout << "first 1000 nodes visited with at most " << maxStack << " stack frames" << endl;
+  }
   return 0;
-}
\ No newline at end of file
+}
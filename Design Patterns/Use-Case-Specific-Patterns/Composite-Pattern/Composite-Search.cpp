@@ -0,0 +1,335 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+using namespace std;
+
+//Searching the composite tree for names like "*.txt" or "report*2024*" used to need a full recursive walk.
+//Here every Folder reports the items added to it to a NameIndex, which keeps a trigram inverted index of all the names.
+//A query only looks at the names which contain every trigram of the pattern, and then checks those few for real.
+
+class FilSystemItem {
+  public:
+    virtual string getName() = 0;
+    virtual int getSize() = 0;
+    virtual bool isFolder() = 0;
+    virtual ~FilSystemItem() {}
+};
+
+class File: public FilSystemItem {
+  string name;
+  int size;
+  public:
+    File(const string& n, int s){
+      name = n;
+      size = s;
+    }
+    string getName() override {
+      return name;
+    }
+    int getSize() override {
+      return size;
+    }
+    bool isFolder() override {
+      return false;
+    }
+};
+
+class Folder;
+
+//The index gives every node an id in the order it was added, so all posting lists stay sorted for free.
+//For every node we only keep the item and the id of its parent, that is enough to build the full path back.
+class NameIndex {
+  struct Entry {
+    FilSystemItem* item;
+    uint32_t parent;
+  };
+  vector<Entry> entries;
+  unordered_map<uint32_t, vector<uint32_t>> postings;
+
+  static uint32_t trigramKey(const string& s, size_t i){
+    return ((uint32_t)(unsigned char)s[i] << 16) | ((uint32_t)(unsigned char)s[i + 1] << 8) | (unsigned char)s[i + 2];
+  }
+
+  //Distinct trigrams of a string, e.g. "a.txt" -> "a.t", ".tx", "txt"
+  static vector<uint32_t> trigramsOf(const string& s){
+    vector<uint32_t> keys;
+    for(size_t i = 0; i + 3 <= s.size(); i++){
+      keys.push_back(trigramKey(s, i));
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+  }
+
+  //Ids of the names which contain all the given trigrams.
+  //We start from the shortest posting list so the intermediate result is as small as possible.
+  vector<uint32_t> candidates(vector<uint32_t> keys){
+    vector<const vector<uint32_t>*> lists;
+    for(auto key: keys){
+      auto found = postings.find(key);
+      if(found == postings.end()){
+        return {};
+      }
+      lists.push_back(&found->second);
+    }
+    sort(lists.begin(), lists.end(), [](auto a, auto b){ return a->size() < b->size(); });
+    vector<uint32_t> result = *lists[0];
+    vector<uint32_t> merged;
+    for(size_t i = 1; i < lists.size() && !result.empty(); i++){
+      merged.clear();
+      set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(), back_inserter(merged));
+      result.swap(merged);
+    }
+    return result;
+  }
+
+  //Every id when the pattern is too short to have a trigram
+  vector<uint32_t> allIds(){
+    vector<uint32_t> ids(entries.size());
+    for(uint32_t i = 0; i < ids.size(); i++){
+      ids[i] = i;
+    }
+    return ids;
+  }
+
+  //Classic glob matching: '*' is any run of characters and '?' is exactly one character
+  static bool globMatch(const string& name, const string& pattern){
+    size_t n = 0, p = 0, starP = string::npos, starN = 0;
+    while(n < name.size()){
+      if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])){
+        n++;
+        p++;
+      }else if(p < pattern.size() && pattern[p] == '*'){
+        starP = p++;
+        starN = n;
+      }else if(starP != string::npos){
+        //Let the last '*' eat one more character and try again
+        p = starP + 1;
+        n = ++starN;
+      }else{
+        return false;
+      }
+    }
+    while(p < pattern.size() && pattern[p] == '*'){
+      p++;
+    }
+    return p == pattern.size();
+  }
+
+  public:
+    static const uint32_t noParent = UINT32_MAX;
+
+    //Adds one node, and if it is a folder which already has children, the whole subtree below it
+    uint32_t insert(FilSystemItem* item, uint32_t parent);
+
+    string pathOf(uint32_t id){
+      vector<uint32_t> chain;
+      for(uint32_t at = id; at != noParent; at = entries[at].parent){
+        chain.push_back(at);
+      }
+      string path;
+      for(size_t i = chain.size(); i-- > 0;){
+        path += "/" + entries[chain[i]].item->getName();
+      }
+      return path;
+    }
+
+    //Full paths of every node whose name contains `text`
+    vector<string> findSubstring(const string& text){
+      vector<uint32_t> ids = text.size() < 3 ? allIds() : candidates(trigramsOf(text));
+      vector<string> paths;
+      for(auto id: ids){
+        if(entries[id].item->getName().find(text) != string::npos){
+          paths.push_back(pathOf(id));
+        }
+      }
+      return paths;
+    }
+
+    //Full paths of every node whose name matches the glob `pattern`.
+    //Only the literal pieces between the wildcards can give trigrams, e.g. "report*2024*" -> "report" and "2024".
+    vector<string> findGlob(const string& pattern){
+      vector<uint32_t> keys;
+      string piece;
+      for(size_t i = 0; i <= pattern.size(); i++){
+        if(i == pattern.size() || pattern[i] == '*' || pattern[i] == '?'){
+          for(auto key: trigramsOf(piece)){
+            keys.push_back(key);
+          }
+          piece.clear();
+        }else{
+          piece += pattern[i];
+        }
+      }
+      sort(keys.begin(), keys.end());
+      keys.erase(unique(keys.begin(), keys.end()), keys.end());
+      vector<uint32_t> ids = keys.empty() ? allIds() : candidates(keys);
+      vector<string> paths;
+      for(auto id: ids){
+        if(globMatch(entries[id].item->getName(), pattern)){
+          paths.push_back(pathOf(id));
+        }
+      }
+      return paths;
+    }
+
+    size_t size(){
+      return entries.size();
+    }
+
+    //Rough heap usage of the index itself, the names are owned by the tree
+    size_t memoryBytes(){
+      size_t bytes = entries.capacity() * sizeof(Entry);
+      for(auto& list: postings){
+        bytes = bytes + list.second.capacity() * sizeof(uint32_t) + sizeof(list) + sizeof(void*);
+      }
+      return bytes + postings.bucket_count() * sizeof(void*);
+    }
+
+  private:
+    void post(uint32_t id, const string& name){
+      for(auto key: trigramsOf(name)){
+        postings[key].push_back(id);
+      }
+    }
+};
+
+class Folder: public FilSystemItem {
+  string name;
+  vector<FilSystemItem*> children;
+  //Set once this folder is part of an indexed tree
+  NameIndex* index = nullptr;
+  uint32_t indexId = NameIndex::noParent;
+  public:
+    Folder(const string& n){
+      name = n;
+    }
+    //A root folder created with an index registers itself, and everything added below it is indexed too
+    Folder(const string& n, NameIndex* idx){
+      name = n;
+      idx->insert(this, NameIndex::noParent);
+    }
+    ~Folder(){
+      for(auto child: children){
+        delete child;
+      }
+    }
+    //The index is kept up to date right here, as every new node is added to the tree
+    void add(FilSystemItem* item){
+      children.push_back(item);
+      if(index != nullptr){
+        index->insert(item, indexId);
+      }
+    }
+    void attach(NameIndex* idx, uint32_t id){
+      index = idx;
+      indexId = id;
+    }
+    const vector<FilSystemItem*>& getChildren(){
+      return children;
+    }
+    string getName() override {
+      return name;
+    }
+    int getSize() override {
+      int size = 0;
+      for(auto child: children){
+        size = size + child->getSize();
+      }
+      return size;
+    }
+    bool isFolder() override {
+      return true;
+    }
+};
+
+uint32_t NameIndex::insert(FilSystemItem* item, uint32_t parent){
+  uint32_t id = (uint32_t)entries.size();
+  entries.push_back({item, parent});
+  post(id, item->getName());
+  if(item->isFolder()){
+    Folder* folder = (Folder*)item;
+    folder->attach(this, id);
+    for(auto child: folder->getChildren()){
+      insert(child, id);
+    }
+  }
+  return id;
+}
+
+//The old way to search: walk everything and compare every name
+void walkSearch(FilSystemItem* item, const string& path, const string& text, vector<string>& out){
+  string here = path + "/" + item->getName();
+  if(item->getName().find(text) != string::npos){
+    out.push_back(here);
+  }
+  if(item->isFolder()){
+    for(auto child: ((Folder*)item)->getChildren()){
+      walkSearch(child, here, text, out);
+    }
+  }
+}
+
+static double microsSince(chrono::steady_clock::time_point start){
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+  NameIndex index;
+  Folder* root = new Folder("root", &index);
+  Folder* docs = new Folder("docs");
+  root->add(docs);
+  docs->add(new File("report_jan_2024.txt", 100));
+  docs->add(new File("report_feb_2023.txt", 200));
+  docs->add(new File("notes.md", 50));
+  root->add(new File("todo.txt", 10));
+
+  cout << "*.txt:" << endl;
+  for(auto& path: index.findGlob("*.txt")){
+    cout << "  " << path << endl;
+  }
+  cout << "report*2024*:" << endl;
+  for(auto& path: index.findGlob("report*2024*")){
+    cout << "  " << path << endl;
+  }
+
+  //Pass a name count to run the benchmark, e.g. ./search 10000000
+  if(argc > 1){
+    long count = atol(argv[1]);
+    NameIndex bigIndex;
+    Folder* big = new Folder("big", &bigIndex);
+    const char* kinds[] = {"report", "invoice", "photo", "backup", "notes"};
+    const char* exts[] = {".txt", ".pdf", ".jpg", ".tar", ".md"};
+    Folder* current = nullptr;
+    auto start = chrono::steady_clock::now();
+    for(long i = 0; i < count; i++){
+      if(i % 1000 == 0){
+        current = new Folder("dir" + to_string(i / 1000));
+        big->add(current);
+      }
+      current->add(new File(string(kinds[i % 5]) + "_" + to_string(2000 + i % 25) + "_" + to_string(i) + exts[(i / 5) % 5], 1));
+    }
+    cout << "Built and indexed " << bigIndex.size() << " names in " << microsSince(start) / 1e6 << " s" << endl;
+    cout << "Index memory: " << bigIndex.memoryBytes() / (1024 * 1024) << " MB" << endl;
+
+    start = chrono::steady_clock::now();
+    size_t hits = bigIndex.findSubstring("_123456").size();
+    cout << "substring \"_123456\": " << hits << " hits in " << microsSince(start) << " us" << endl;
+
+    start = chrono::steady_clock::now();
+    hits = bigIndex.findGlob("notes*2024_1234*").size();
+    cout << "glob \"notes*2024_1234*\": " << hits << " hits in " << microsSince(start) << " us" << endl;
+
+    vector<string> walked;
+    start = chrono::steady_clock::now();
+    walkSearch(big, "", "_123456", walked);
+    cout << "full walk \"_123456\": " << walked.size() << " hits in " << microsSince(start) << " us" << endl;
+    delete big;
+  }
+  delete root;
+  return 0;
+}
@@ -0,0 +1,556 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+//In Template-Pattern.cpp loadData(path) only prints a message.
+//Here it really loads the CSV: the file is mmaped, delimiters and newlines are found 16 bytes at a time with SSE2,
+//and every numeric column ends up in its own contiguous array which preprocessData receives directly.
+
+//Column wise result of a load, T is float or double
+template <typename T>
+struct ColumnarData {
+  vector<string> names;
+  vector<vector<T>> columns;
+  size_t rows = 0;
+  //Byte offset of every row which was skipped because it was malformed
+  vector<size_t> badRows;
+};
+
+//Read only memory mapping of a whole file
+class MappedFile {
+  void* base = MAP_FAILED;
+  size_t length = 0;
+  public:
+    bool open(const string& path){
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0){
+        return false;
+      }
+      struct stat st;
+      if(fstat(fd, &st) != 0){
+        ::close(fd);
+        return false;
+      }
+      length = st.st_size;
+      if(length > 0){
+        base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      ::close(fd);
+      if(length > 0 && base == MAP_FAILED){
+        return false;
+      }
+      if(length > 0){
+        //We read the file once from start to end
+        madvise(base, length, MADV_SEQUENTIAL);
+      }
+      return true;
+    }
+    ~MappedFile(){
+      if(base != MAP_FAILED){
+        munmap(base, length);
+      }
+    }
+    const char* data(){
+      return base == MAP_FAILED ? "" : (const char*)base;
+    }
+    size_t size(){
+      return length;
+    }
+};
+
+//Returns the first position in [p, end) holding `a` or `b`, or end
+static const char* findEither(const char* p, const char* end, char a, char b){
+#if defined(__SSE2__)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  while(end - p >= 16){
+    __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+    if(mask != 0){
+      return p + __builtin_ctz(mask);
+    }
+    p = p + 16;
+  }
+#endif
+  while(p < end && *p != a && *p != b){
+    p++;
+  }
+  return p;
+}
+
+//Number of '"' bytes in [p, end)
+static size_t countQuotes(const char* p, const char* end){
+  size_t count = 0;
+#if defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  while(end - p >= 16){
+    __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+    count = count + __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)));
+    p = p + 16;
+  }
+#endif
+  while(p < end){
+    count = count + (*p == '"');
+    p++;
+  }
+  return count;
+}
+
+//Quoting rule used everywhere below: every '"' flips "inside quotes", so a newline or comma only counts
+//when an even number of quotes came before it. That is RFC 4180 for well formed files ("" is an escaped quote),
+//and it gives a fixed, predictable split for broken ones.
+static const char* findOutsideQuotes(const char* p, const char* end, char target, bool inQuotes){
+  while(true){
+    p = findEither(p, end, target, '"');
+    if(p == end){
+      return end;
+    }
+    if(*p == '"'){
+      inQuotes = !inQuotes;
+    }else if(!inQuotes){
+      return p;
+    }
+    p++;
+  }
+}
+
+//Fast path for the plain decimals which make up most CSV files, like "-12.375".
+//If the digits fit in 2^53 and there are at most 22 decimals, mantissa / 10^k is one correctly rounded division,
+//so the result is exactly what from_chars would give. Anything else (exponents, long numbers) returns false.
+static bool parseSimpleDecimal(const char* p, const char* end, double& value){
+  static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = p < end && *p == '-';
+  if(negative){
+    p++;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0, decimals = 0;
+  bool dot = false;
+  for(; p < end; p++){
+    if(*p >= '0' && *p <= '9'){
+      mantissa = mantissa * 10 + (*p - '0');
+      digits++;
+      decimals = decimals + dot;
+    }else if(*p == '.' && !dot){
+      dot = true;
+    }else{
+      return false;
+    }
+  }
+  if(digits == 0 || digits > 15 || decimals > 22){
+    return false;
+  }
+  value = (double)mantissa / powers[decimals];
+  if(negative){
+    value = -value;
+  }
+  return true;
+}
+
+template <typename T>
+class CsvLoader {
+  //The piece of the file one thread works on
+  struct Chunk {
+    const char* from;
+    const char* to;
+    size_t rowCount = 0;
+    size_t firstRow = 0;
+    size_t goodRows = 0;
+    vector<size_t> badRows;
+  };
+
+  //Removes the surrounding quotes of a field and turns "" into ", returns false for a broken field
+  static bool unquote(const char* begin, const char* end, string& out){
+    out.clear();
+    if(begin == end || *begin != '"'){
+      if(find(begin, end, '"') != end){
+        return false;
+      }
+      out.assign(begin, end);
+      return true;
+    }
+    if(end - begin < 2 || end[-1] != '"'){
+      return false;
+    }
+    for(const char* p = begin + 1; p < end - 1; p++){
+      if(*p == '"'){
+        if(p + 1 < end - 1 && p[1] == '"'){
+          p++;
+        }else{
+          return false;
+        }
+      }
+      out += *p;
+    }
+    return true;
+  }
+
+  //Splits one row (without its line ending) into fields, calling onField(begin, end) for each
+  template <typename F>
+  static size_t forEachField(const char* p, const char* end, F onField){
+    size_t count = 0;
+    while(true){
+      const char* comma = findOutsideQuotes(p, end, ',', false);
+      onField(count, p, comma);
+      count++;
+      if(comma == end){
+        return count;
+      }
+      p = comma + 1;
+    }
+  }
+
+  //Row [begin, end) without the '\n'; a trailing '\r' (CRLF file) is dropped here
+  static bool parseRow(const char* begin, const char* end, size_t columnCount, vector<T>& values){
+    if(end > begin && end[-1] == '\r'){
+      end--;
+    }
+    values.clear();
+    bool ok = true;
+    string text;
+    forEachField(begin, end, [&](size_t, const char* b, const char* e){
+      if(!ok){
+        return;
+      }
+      if(b != e && *b == '"'){
+        //Quoted numbers are allowed, the quotes are just taken off
+        if(!unquote(b, e, text)){
+          ok = false;
+          return;
+        }
+        b = text.data();
+        e = text.data() + text.size();
+      }
+      if(b == e){
+        //Empty field is a missing value
+        values.push_back(numeric_limits<T>::quiet_NaN());
+        return;
+      }
+      T value;
+      if constexpr (is_same<T, double>::value){
+        if(parseSimpleDecimal(b, e, value)){
+          values.push_back(value);
+          return;
+        }
+      }
+      auto result = from_chars(b, e, value);
+      if(result.ec != errc() || result.ptr != e){
+        ok = false;
+        return;
+      }
+      values.push_back(value);
+    });
+    return ok && values.size() == columnCount;
+  }
+
+  //Calls onRow(begin, end) for every non blank row starting inside [from, to); the last one may run past `to`
+  template <typename F>
+  static void forEachRow(const char* from, const char* to, const char* end, F onRow){
+    for(const char* row = from; row < to;){
+      const char* newline = findOutsideQuotes(row, end, '\n', false);
+      //Blank lines (also a lone "\r" in a CRLF file) are not rows
+      bool blank = newline == row || (newline - row == 1 && *row == '\r');
+      if(!blank){
+        onRow(row, newline);
+      }
+      row = newline == end ? end : newline + 1;
+    }
+  }
+
+  public:
+    static ColumnarData<T> load(const string& path, int threads = 0){
+      MappedFile file;
+      if(!file.open(path)){
+        throw runtime_error("Cannot open " + path);
+      }
+      return parse(file.data(), file.data() + file.size(), threads);
+    }
+
+    //The first row is the header with the column names, every other row must have exactly that many numbers
+    static ColumnarData<T> parse(const char* begin, const char* end, int threads = 0){
+      ColumnarData<T> result;
+      const char* headerEnd = findOutsideQuotes(begin, end, '\n', false);
+      const char* nameEnd = headerEnd > begin && headerEnd[-1] == '\r' ? headerEnd - 1 : headerEnd;
+      if(nameEnd == begin){
+        return result;
+      }
+      string name;
+      forEachField(begin, nameEnd, [&](size_t, const char* b, const char* e){
+        if(!unquote(b, e, name)){
+          name.assign(b, e);
+        }
+        result.names.push_back(name);
+      });
+      size_t columnCount = result.names.size();
+      result.columns.resize(columnCount);
+      const char* dataStart = headerEnd == end ? end : headerEnd + 1;
+
+      //Split the data into one piece per thread. Small inputs are not worth the threads
+      size_t length = end - dataStart;
+      int count = threads > 0 ? threads : max(1u, thread::hardware_concurrency());
+      count = (int)max<size_t>(1, min<size_t>(count, length / (1 << 20) + 1));
+      vector<const char*> bounds(count + 1);
+      for(int i = 0; i <= count; i++){
+        bounds[i] = dataStart + length * i / count;
+      }
+
+      //Pass 1: count the quotes of every piece in parallel, so each piece knows if it starts inside quotes
+      vector<size_t> quotes(count);
+      runParallel(count, [&](int i){ quotes[i] = countQuotes(bounds[i], bounds[i + 1]); });
+      vector<bool> startsQuoted(count, false);
+      size_t seen = 0;
+      for(int i = 0; i < count; i++){
+        startsQuoted[i] = seen % 2 == 1;
+        seen = seen + quotes[i];
+      }
+
+      //Pass 2: each piece finds its first row start and counts its rows,
+      //so the final columns can be allocated once and every piece writes straight into its own slice
+      vector<Chunk> chunks(count);
+      runParallel(count, [&](int i){
+        const char* from = bounds[i];
+        if(i > 0 && !(from[-1] == '\n' && !startsQuoted[i])){
+          const char* newline = findOutsideQuotes(from, end, '\n', startsQuoted[i]);
+          from = newline == end ? end : newline + 1;
+        }
+        chunks[i].from = from;
+        chunks[i].to = bounds[i + 1];
+        forEachRow(from, bounds[i + 1], end, [&](const char*, const char*){ chunks[i].rowCount++; });
+      });
+      size_t totalRows = 0;
+      for(auto& chunk: chunks){
+        chunk.firstRow = totalRows;
+        totalRows = totalRows + chunk.rowCount;
+      }
+      for(auto& column: result.columns){
+        column.resize(totalRows);
+      }
+
+      //Pass 3: parse. Malformed rows are not written, so a piece may fill less than its slice
+      runParallel(count, [&](int i){
+        Chunk& chunk = chunks[i];
+        vector<T> values;
+        forEachRow(chunk.from, chunk.to, end, [&](const char* row, const char* rowEnd){
+          if(parseRow(row, rowEnd, columnCount, values)){
+            for(size_t c = 0; c < columnCount; c++){
+              result.columns[c][chunk.firstRow + chunk.goodRows] = values[c];
+            }
+            chunk.goodRows++;
+          }else{
+            chunk.badRows.push_back(row - begin);
+          }
+        });
+      });
+
+      //Close the gaps left by malformed rows
+      for(auto& chunk: chunks){
+        if(chunk.firstRow != result.rows){
+          for(auto& column: result.columns){
+            copy(column.begin() + chunk.firstRow, column.begin() + chunk.firstRow + chunk.goodRows, column.begin() + result.rows);
+          }
+        }
+        result.rows = result.rows + chunk.goodRows;
+        result.badRows.insert(result.badRows.end(), chunk.badRows.begin(), chunk.badRows.end());
+      }
+      for(auto& column: result.columns){
+        column.resize(result.rows);
+      }
+      return result;
+    }
+
+  private:
+    template <typename F>
+    static void runParallel(int count, F work){
+      if(count <= 1){
+        for(int i = 0; i < count; i++){
+          work(i);
+        }
+        return;
+      }
+      vector<thread> workers;
+      for(int i = 0; i < count; i++){
+        workers.emplace_back(work, i);
+      }
+      for(auto& t: workers){
+        t.join();
+      }
+    }
+};
+
+class ModelTrainer {
+  public:
+    void trainPipeline(const string& path){
+      loadData(path);
+      preprocessData(data);
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+    virtual ~ModelTrainer() {}
+  protected:
+  //Loaded columns, the model specific steps read them from here
+    ColumnarData<double> data;
+
+    void loadData(const string& path){
+      cout << "[Common] Loading data from " << path << endl;
+      try {
+        data = CsvLoader<double>::load(path);
+      } catch (const runtime_error& e) {
+        cout << "[Common] " << e.what() << endl;
+        data = ColumnarData<double>();
+      }
+      cout << "[Common] Loaded " << data.rows << " rows, " << data.names.size() << " columns, "
+           << data.badRows.size() << " malformed rows skipped" << endl;
+    }
+
+  //Gets the columns straight from loadData, one contiguous array per column
+    void preprocessData(ColumnarData<double>& columns){
+      cout << "[Common] Preprocessing data" << endl;
+      for(size_t c = 0; c < columns.columns.size(); c++){
+        double sum = 0;
+        size_t present = 0;
+        for(double v: columns.columns[c]){
+          if(!isnan(v)){
+            sum = sum + v;
+            present++;
+          }
+        }
+        cout << "  " << columns.names[c] << " mean " << (present ? sum / present : 0) << endl;
+      }
+    }
+
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+
+    virtual void saveModel(){
+      cout << "[Common] Saving model" << endl;
+    }
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  protected:
+    void trainModel() override {
+      cout << "[NeuralNetworkModel] Training neural network model on " << data.rows << " rows" << endl;
+    }
+    void evaluateModel() override {
+      cout << "[NeuralNetworkModel] Evaluating neural network model" << endl;
+    }
+    void saveModel() override {
+      cout << "[NeuralNetworkModel] Saving neural network model" << endl;
+    }
+};
+
+//Small correctness checks for the parser: quoting, CRLF and malformed rows
+static int failures = 0;
+static void check(bool condition, const string& what){
+  cout << (condition ? "  ok   " : "  FAIL ") << what << endl;
+  failures = failures + !condition;
+}
+static ColumnarData<double> parseText(const string& text, int threads = 1){
+  return CsvLoader<double>::parse(text.data(), text.data() + text.size(), threads);
+}
+
+//Column by column comparison where NaN equals NaN
+static bool sameColumns(const ColumnarData<double>& a, const ColumnarData<double>& b){
+  if(a.rows != b.rows || a.columns.size() != b.columns.size()){
+    return false;
+  }
+  for(size_t c = 0; c < a.columns.size(); c++){
+    for(size_t r = 0; r < a.rows; r++){
+      double x = a.columns[c][r], y = b.columns[c][r];
+      if(x != y && !(isnan(x) && isnan(y))){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void runChecks(){
+  cout << "===CSV loader checks===" << endl;
+  auto plain = parseText("a,b\n1,2\n3.5,-4\n");
+  check(plain.rows == 2 && plain.columns[0][1] == 3.5 && plain.columns[1][1] == -4, "plain rows");
+
+  auto crlf = parseText("a,b\r\n1,2\r\n3,4\r\n");
+  check(crlf.rows == 2 && crlf.names[1] == "b" && crlf.columns[1][0] == 2, "CRLF line endings");
+
+  auto quoted = parseText("\"x, y\",\"say \"\"hi\"\"\"\n\"1\",2\n");
+  check(quoted.names[0] == "x, y" && quoted.names[1] == "say \"hi\"", "quoted header with comma and escaped quote");
+  check(quoted.rows == 1 && quoted.columns[0][0] == 1, "quoted number");
+
+  auto newlineInQuotes = parseText("a,b\n\"1\n\",2\n3,4\n");
+  check(newlineInQuotes.rows == 1 && newlineInQuotes.badRows.size() == 1, "newline inside quotes stays in one row");
+
+  auto numbers = parseText("a,b,c\n1e3,-0.1,12345678901234567890\n");
+  check(numbers.rows == 1 && numbers.columns[0][0] == 1000 && numbers.columns[1][0] == -0.1
+        && numbers.columns[2][0] == 12345678901234567890.0, "exponent, fraction and long numbers");
+
+  auto missing = parseText("a,b\n,2\n");
+  check(missing.rows == 1 && isnan(missing.columns[0][0]), "empty field becomes NaN");
+
+  auto malformed = parseText("a,b\n1,2\n1,2,3\nabc,4\n1\n5,6");
+  check(malformed.rows == 2 && malformed.badRows.size() == 3 && malformed.columns[0][1] == 5, "malformed rows skipped, last row without newline");
+
+  auto broken = parseText("a,b\n\"1\"x,2\n7,8\n");
+  check(broken.rows == 1 && broken.columns[0][0] == 7, "text after closing quote is malformed");
+
+  //The same input split across many threads must give the same columns
+  string many = "a,b,c\n";
+  for(int i = 0; i < 200000; i++){
+    many += (i % 7 == 0 ? "\"" + to_string(i) + "\"" : to_string(i)) + "," + to_string(i * 0.5) + (i % 3 ? ",\r\n" : ",1\n");
+  }
+  auto one = parseText(many, 1);
+  auto eight = parseText(many, 8);
+  check(one.rows == 200000 && sameColumns(one, eight), "1 thread and 8 threads agree");
+}
+
+int main(int argc, char** argv){
+  runChecks();
+
+  //Benchmark: ./csv-loader 1024 writes and loads a 1 GB file
+  size_t megabytes = argc > 1 ? atol(argv[1]) : 64;
+  string path = "/tmp/neural_network_data.csv";
+  {
+    FILE* out = fopen(path.c_str(), "w");
+    fputs("feature1,feature2,feature3,label\n", out);
+    size_t written = 0;
+    char line[128];
+    for(long i = 0; written < megabytes << 20; i++){
+      int n = snprintf(line, sizeof(line), "%ld.%03ld,%ld,-%ld.25,%ld\n", i % 1000, i % 997, i % 50, i % 31, i % 2);
+      fwrite(line, 1, n, out);
+      written = written + n;
+    }
+    fclose(out);
+  }
+  auto start = chrono::steady_clock::now();
+  auto loaded = CsvLoader<double>::load(path);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "===Loaded " << megabytes << " MB, " << loaded.rows << " rows in " << seconds << " s, "
+       << (megabytes / 1024.0) / seconds << " GB/s===" << endl;
+
+  ModelTrainer* nTrainer = new NeuralNetworkModel();
+  nTrainer->trainPipeline(path);
+  delete nTrainer;
+  remove(path.c_str());
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,447 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+//DecisionTreeModel::trainModel() in Template-Pattern.cpp is only a print statement.
+//Here it trains a real regression tree the way fast gradient boosting libraries do:
+//  1. every feature is quantized once into at most 256 bins, so a row is a few bytes instead of floats
+//  2. to split a node we build, per feature, a histogram of (sum of targets, row count) per bin, in parallel
+//  3. the best split is found by scanning the bins of each histogram, not the rows
+//  4. only the smaller child gets a new histogram; the bigger one is parent - smaller (histogram subtraction)
+
+//Small pool of threads which run parallelFor jobs; the calling thread helps as well.
+//Every job gets its own Batch, so a worker that wakes up late can never run a task of a finished job.
+class ThreadPool {
+  struct Batch {
+    const function<void(int)>* task;
+    int count;
+    atomic<int> next{0};
+    atomic<int> remaining;
+  };
+  vector<thread> workers;
+  mutex m;
+  condition_variable wake;
+  condition_variable finished;
+  shared_ptr<Batch> current;
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  void run(Batch& batch){
+    while(true){
+      int i = batch.next.fetch_add(1);
+      if(i >= batch.count){
+        return;
+      }
+      (*batch.task)(i);
+      if(batch.remaining.fetch_sub(1) == 1){
+        lock_guard<mutex> lock(m);
+        finished.notify_all();
+      }
+    }
+  }
+
+  void workerLoop(){
+    uint64_t seen = 0;
+    while(true){
+      shared_ptr<Batch> batch;
+      {
+        unique_lock<mutex> lock(m);
+        wake.wait(lock, [&]{ return stopping || generation != seen; });
+        if(stopping){
+          return;
+        }
+        seen = generation;
+        batch = current;
+      }
+      run(*batch);
+    }
+  }
+
+  public:
+    ThreadPool(int threads){
+      for(int i = 1; i < threads; i++){
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+      }
+    }
+    ~ThreadPool(){
+      {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+      }
+      wake.notify_all();
+      for(auto& t: workers){
+        t.join();
+      }
+    }
+    int size(){
+      return (int)workers.size() + 1;
+    }
+    //Calls task(0) ... task(count - 1) across the pool and returns when all of them are done
+    void parallelFor(int count, const function<void(int)>& task){
+      if(workers.empty() || count <= 1){
+        for(int i = 0; i < count; i++){
+          task(i);
+        }
+        return;
+      }
+      auto batch = make_shared<Batch>();
+      batch->task = &task;
+      batch->count = count;
+      batch->remaining = count;
+      {
+        lock_guard<mutex> lock(m);
+        current = batch;
+        generation++;
+      }
+      wake.notify_all();
+      run(*batch);
+      unique_lock<mutex> lock(m);
+      finished.wait(lock, [&]{ return batch->remaining == 0; });
+    }
+};
+
+//Features stored column by column, plus the target value of every row
+struct Dataset {
+  vector<vector<float>> features;
+  vector<float> target;
+  size_t rows(){
+    return target.size();
+  }
+};
+
+class HistogramTree {
+  public:
+    struct Node {
+      int feature = -1;       //-1 for a leaf
+      int bin = 0;            //rows with bin <= this go left
+      float threshold = 0;    //same split on raw values: x <= threshold goes left
+      int left = -1;
+      int right = -1;
+      float value = 0;        //mean target of the rows in this node
+    };
+
+    struct Options {
+      int maxDepth = 8;
+      int maxBins = 256;
+      size_t minRowsInLeaf = 20;
+    };
+
+  private:
+    struct Bin {
+      double sum = 0;
+      uint32_t count = 0;
+    };
+    //One histogram per feature, all in one flat array: bins[feature * maxBins + bin]
+    typedef vector<Bin> Histogram;
+
+    struct Split {
+      double gain = 0;
+      int feature = -1;
+      int bin = 0;
+    };
+
+    //A node which still may be split: its rows are rowIndex[begin, end)
+    struct OpenNode {
+      int node;
+      size_t begin;
+      size_t end;
+      int depth;
+      Histogram histogram;
+    };
+
+    Options options;
+    vector<vector<float>> edges;     //edges[f][b]: largest value that falls in bin b
+    vector<vector<uint8_t>> binned;  //binned[f][row]
+    vector<uint32_t> rowIndex;
+    vector<Node> nodes;
+    ThreadPool& pool;
+
+    //Quantile bin edges from a sample of the column
+    void buildEdges(const vector<float>& column, vector<float>& out){
+      vector<float> sample;
+      size_t step = max<size_t>(1, column.size() / 100000);
+      for(size_t i = 0; i < column.size(); i = i + step){
+        sample.push_back(column[i]);
+      }
+      sort(sample.begin(), sample.end());
+      out.clear();
+      for(int b = 1; b <= options.maxBins; b++){
+        float edge = sample[min(sample.size() - 1, sample.size() * b / options.maxBins)];
+        if(out.empty() || edge > out.back()){
+          out.push_back(edge);
+        }
+      }
+      //The last bin takes everything above, including values not in the sample
+      out.back() = INFINITY;
+    }
+
+    //Same result as lower_bound, but without branches: random values make lower_bound mispredict
+    //on almost every step, and quantizing was most of the training time because of that
+    int binOf(int feature, float value){
+      const float* base = edges[feature].data();
+      const float* at = base;
+      size_t n = edges[feature].size();
+      while(n > 1){
+        size_t half = n / 2;
+        at = at[half] < value ? at + half : at;
+        n = n - half;
+      }
+      return (int)(at - base) + (*at < value);
+    }
+
+    //Histograms of all features for rowIndex[begin, end), one feature per task
+    Histogram buildHistogram(Dataset& data, size_t begin, size_t end){
+      int featureCount = (int)binned.size();
+      Histogram h(featureCount * options.maxBins);
+      pool.parallelFor(featureCount, [&](int f){
+        Bin* bins = h.data() + f * options.maxBins;
+        const uint8_t* column = binned[f].data();
+        const float* target = data.target.data();
+        for(size_t i = begin; i < end; i++){
+          uint32_t row = rowIndex[i];
+          Bin& bin = bins[column[row]];
+          bin.sum = bin.sum + target[row];
+          bin.count++;
+        }
+      });
+      return h;
+    }
+
+    //Best split of every feature in parallel, then the best of those.
+    //Gain of a split for squared error: sumL^2/countL + sumR^2/countR - sum^2/count
+    Split findSplit(const Histogram& h, double sum, size_t count){
+      int featureCount = (int)binned.size();
+      vector<Split> best(featureCount);
+      double parentScore = sum * sum / count;
+      pool.parallelFor(featureCount, [&](int f){
+        const Bin* bins = h.data() + f * options.maxBins;
+        double leftSum = 0;
+        size_t leftCount = 0;
+        for(int b = 0; b + 1 < (int)edges[f].size(); b++){
+          leftSum = leftSum + bins[b].sum;
+          leftCount = leftCount + bins[b].count;
+          size_t rightCount = count - leftCount;
+          if(leftCount < options.minRowsInLeaf || rightCount < options.minRowsInLeaf){
+            continue;
+          }
+          double rightSum = sum - leftSum;
+          double gain = leftSum * leftSum / leftCount + rightSum * rightSum / rightCount - parentScore;
+          if(gain > best[f].gain){
+            best[f] = {gain, f, b};
+          }
+        }
+      });
+      Split result;
+      for(auto& s: best){
+        if(s.gain > result.gain){
+          result = s;
+        }
+      }
+      return result;
+    }
+
+  public:
+    HistogramTree(ThreadPool& p) : pool(p) {}
+    HistogramTree(ThreadPool& p, Options o) : pool(p) {
+      options = o;
+      options.maxBins = min(options.maxBins, 256);
+    }
+
+    void train(Dataset& data){
+      int featureCount = (int)data.features.size();
+      size_t rows = data.rows();
+      edges.assign(featureCount, {});
+      binned.assign(featureCount, vector<uint8_t>(rows));
+      nodes.clear();
+      if(rows == 0){
+        nodes.push_back(Node());
+        return;
+      }
+      //Step 1: quantize every feature once
+      pool.parallelFor(featureCount, [&](int f){
+        buildEdges(data.features[f], edges[f]);
+        for(size_t r = 0; r < rows; r++){
+          binned[f][r] = (uint8_t)binOf(f, data.features[f][r]);
+        }
+      });
+      rowIndex.resize(rows);
+      for(size_t r = 0; r < rows; r++){
+        rowIndex[r] = (uint32_t)r;
+      }
+
+      nodes.push_back(Node());
+      vector<OpenNode> open;
+      open.push_back({0, 0, rows, 0, buildHistogram(data, 0, rows)});
+      while(!open.empty()){
+        OpenNode current = move(open.back());
+        open.pop_back();
+        //Sum and count of the node come straight from any one feature's histogram
+        double sum = 0;
+        size_t count = current.end - current.begin;
+        for(int b = 0; b < options.maxBins; b++){
+          sum = sum + current.histogram[b].sum;
+        }
+        nodes[current.node].value = (float)(sum / count);
+        if(current.depth >= options.maxDepth || count < 2 * options.minRowsInLeaf){
+          continue;
+        }
+        Split split = findSplit(current.histogram, sum, count);
+        if(split.feature < 0){
+          continue;
+        }
+
+        //Move the rows going left to the front of the node's range
+        const uint8_t* column = binned[split.feature].data();
+        auto middle = stable_partition(rowIndex.begin() + current.begin, rowIndex.begin() + current.end,
+                                       [&](uint32_t row){ return column[row] <= split.bin; });
+        size_t mid = middle - rowIndex.begin();
+
+        int left = (int)nodes.size();
+        int right = left + 1;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        Node& parent = nodes[current.node];
+        parent.feature = split.feature;
+        parent.bin = split.bin;
+        parent.threshold = edges[split.feature][split.bin];
+        parent.left = left;
+        parent.right = right;
+
+        //Histogram subtraction: build only the smaller child, the other one is parent - smaller
+        bool leftSmaller = mid - current.begin <= current.end - mid;
+        Histogram small = leftSmaller ? buildHistogram(data, current.begin, mid) : buildHistogram(data, mid, current.end);
+        Histogram& large = current.histogram;
+        for(size_t i = 0; i < large.size(); i++){
+          large[i].sum = large[i].sum - small[i].sum;
+          large[i].count = large[i].count - small[i].count;
+        }
+        if(leftSmaller){
+          open.push_back({left, current.begin, mid, current.depth + 1, move(small)});
+          open.push_back({right, mid, current.end, current.depth + 1, move(large)});
+        }else{
+          open.push_back({left, current.begin, mid, current.depth + 1, move(large)});
+          open.push_back({right, mid, current.end, current.depth + 1, move(small)});
+        }
+      }
+      binned.clear();
+    }
+
+    float predict(const vector<vector<float>>& features, size_t row){
+      int at = 0;
+      while(nodes[at].feature >= 0){
+        at = features[nodes[at].feature][row] <= nodes[at].threshold ? nodes[at].left : nodes[at].right;
+      }
+      return nodes[at].value;
+    }
+
+    size_t nodeCount(){
+      return nodes.size();
+    }
+};
+
+//y = a non linear mix of the first features plus noise; features after the 4th are pure noise
+Dataset makeDataset(size_t rows, int featureCount, uint64_t seed){
+  Dataset data;
+  mt19937_64 random(seed);
+  uniform_real_distribution<float> uniform(-1, 1);
+  normal_distribution<float> noise(0, 0.1f);
+  data.features.assign(featureCount, vector<float>(rows));
+  data.target.resize(rows);
+  for(size_t r = 0; r < rows; r++){
+    for(int f = 0; f < featureCount; f++){
+      data.features[f][r] = uniform(random);
+    }
+    float x0 = data.features[0][r], x1 = data.features[1 % featureCount][r];
+    data.target[r] = (x0 > 0.2f ? 2.0f : -1.0f) + x1 * x1 + noise(random);
+  }
+  return data;
+}
+
+class ModelTrainer {
+  public:
+    void trainPipeline(const string& path){
+      loadData(path);
+      preprocessData();
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+    virtual ~ModelTrainer() {}
+  protected:
+    Dataset train;
+    Dataset test;
+
+    void loadData(const string& path){
+      cout << "[Common] Loading data from " << path << " (synthetic 200k rows)" << endl;
+      train = makeDataset(200000, 8, 1);
+      test = makeDataset(20000, 8, 2);
+    }
+    void preprocessData(){
+      cout << "[Common] Preprocessing data" << endl;
+    }
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+    virtual void saveModel(){
+      cout << "[Common] Saving model" << endl;
+    }
+};
+
+class DecisionTreeModel : public ModelTrainer {
+  ThreadPool pool{(int)max(1u, thread::hardware_concurrency())};
+  HistogramTree tree{pool};
+  protected:
+    void trainModel() override {
+      tree.train(train);
+      cout << "[DecisionTreeModel] Trained a tree with " << tree.nodeCount() << " nodes" << endl;
+    }
+    //Mean squared error on held out rows, next to just predicting the mean (R^2 = 1 - mse / variance)
+    void evaluateModel() override {
+      double mean = 0, error = 0, variance = 0;
+      for(float y: test.target){
+        mean = mean + y;
+      }
+      mean = mean / test.rows();
+      for(size_t r = 0; r < test.rows(); r++){
+        double d = tree.predict(test.features, r) - test.target[r];
+        error = error + d * d;
+        variance = variance + (test.target[r] - mean) * (test.target[r] - mean);
+      }
+      cout << "[DecisionTreeModel] Test MSE " << error / test.rows() << ", R^2 " << 1 - error / variance << endl;
+    }
+   //Uses default save method
+};
+
+int main(int argc, char** argv){
+  ModelTrainer* dTrainer = new DecisionTreeModel();
+  dTrainer->trainPipeline("decision_tree_data.csv");
+  delete dTrainer;
+
+  //Benchmark: training throughput by rows and threads, e.g. ./tree 20000000
+  size_t maxRows = argc > 1 ? atol(argv[1]) : 2000000;
+  int maxThreads = (int)max(1u, thread::hardware_concurrency());
+  cout << "===Training throughput (16 features, depth 8)===" << endl;
+  for(size_t rows = maxRows / 16; rows <= maxRows; rows = rows * 4){
+    Dataset data = makeDataset(rows, 16, 3);
+    for(int threads = 1; threads <= maxThreads; threads = threads * 2){
+      ThreadPool pool(threads);
+      HistogramTree tree(pool);
+      auto start = chrono::steady_clock::now();
+      tree.train(data);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      cout << rows << " rows, " << threads << " thread(s): " << seconds << " s, " << rows / seconds / 1e6 << " M rows/s" << endl;
+    }
+  }
+  return 0;
+}
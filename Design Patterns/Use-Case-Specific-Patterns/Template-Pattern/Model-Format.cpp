@@ -0,0 +1,618 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+//saveModel() in Template-Pattern.cpp is only a print statement. Here it writes a binary model file which an
+//inference process can use without deserializing it: the file is mmaped and weight tensors and tree node arrays
+//are read straight from the mapping. Opening checks the header, the tensor table and every tree node, but never
+//touches weight data, so a 10 GB network opens as fast as a 1 MB one (a tree model pays one pass over its nodes);
+//pages are read from disk only when inference first touches them.
+
+//Read only memory mapping of a whole file
+class MappedFile {
+  void* base = MAP_FAILED;
+  size_t length = 0;
+  public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool open(const string& path){
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0){
+        return false;
+      }
+      struct stat st;
+      if(fstat(fd, &st) != 0){
+        ::close(fd);
+        return false;
+      }
+      length = st.st_size;
+      if(length > 0){
+        base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      ::close(fd);
+      return length == 0 || base != MAP_FAILED;
+    }
+    void close(){
+      if(base != MAP_FAILED){
+        munmap(base, length);
+      }
+      base = MAP_FAILED;
+      length = 0;
+    }
+    ~MappedFile(){
+      close();
+    }
+    const char* data(){
+      return base == MAP_FAILED ? "" : (const char*)base;
+    }
+    size_t size(){
+      return length;
+    }
+};
+
+//Model file layout, every offset from the start of the file:
+//  ModelHeader
+//  TensorEntry[tensorCount]
+//  tensor data, each tensor starting on a 64 byte boundary (so SIMD loads and cache lines line up)
+//All fields are little endian, the same as the machines that write and read them.
+struct ModelHeader {
+  char magic[8];
+  uint32_t formatVersion;
+  uint32_t tensorCount;
+  char modelKind[32];
+  uint64_t tableOffset;
+  uint64_t fileSize;
+};
+
+enum TensorType : uint32_t { Float32 = 1, TreeNodes = 2 };
+
+struct TensorEntry {
+  char name[48];
+  uint32_t type;
+  uint32_t rank;
+  uint64_t dims[4];
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+//One decision tree node as stored in the file; a tree is an array of them, node 0 is the root
+struct TreeNodeRecord {
+  int32_t feature;     //-1 for a leaf
+  float threshold;     //x <= threshold goes left
+  int32_t left;
+  int32_t right;
+  float value;
+  uint32_t reserved;
+};
+
+static const char modelMagic[8] = {'L', 'L', 'D', 'M', 'O', 'D', 'L', '1'};
+//Bump whenever the layout above changes; readers refuse files of other versions
+static const uint32_t modelFormatVersion = 1;
+
+static uint64_t alignUp(uint64_t value){
+  return (value + 63) & ~(uint64_t)63;
+}
+
+static uint64_t elementSize(uint32_t type){
+  return type == Float32 ? sizeof(float) : type == TreeNodes ? sizeof(TreeNodeRecord) : 0;
+}
+
+//Every inner node must point at two nodes after itself, so a walk from the root stays inside the array and ends
+static bool validTree(const TreeNodeRecord* nodes, uint64_t count){
+  if(count == 0){
+    return false;
+  }
+  for(uint64_t i = 0; i < count; i++){
+    if(nodes[i].feature >= 0 && ((uint64_t)nodes[i].left <= i || (uint64_t)nodes[i].left >= count
+                                 || (uint64_t)nodes[i].right <= i || (uint64_t)nodes[i].right >= count)){
+      return false;
+    }
+  }
+  return true;
+}
+
+//Collects tensors (only pointers, nothing is copied) and writes them as one model file
+class ModelWriter {
+  struct Pending {
+    TensorEntry entry;
+    const void* data;
+  };
+  string kind;
+  vector<Pending> tensors;
+  public:
+    ModelWriter(const string& modelKind){
+      kind = modelKind;
+    }
+    void add(const string& name, TensorType type, const vector<uint64_t>& dims, const void* data){
+      Pending p = {};
+      strncpy(p.entry.name, name.c_str(), sizeof(p.entry.name) - 1);
+      p.entry.type = type;
+      p.entry.rank = (uint32_t)dims.size();
+      uint64_t count = 1;
+      for(size_t d = 0; d < dims.size() && d < 4; d++){
+        p.entry.dims[d] = dims[d];
+        count = count * dims[d];
+      }
+      p.entry.bytes = count * elementSize(type);
+      p.data = data;
+      tensors.push_back(p);
+    }
+
+    //Writes to a temporary file and renames it, so a reader never maps a half written model
+    bool write(const string& path){
+      ModelHeader h = {};
+      memcpy(h.magic, modelMagic, sizeof(modelMagic));
+      h.formatVersion = modelFormatVersion;
+      h.tensorCount = (uint32_t)tensors.size();
+      strncpy(h.modelKind, kind.c_str(), sizeof(h.modelKind) - 1);
+      h.tableOffset = sizeof(ModelHeader);
+      uint64_t offset = alignUp(h.tableOffset + tensors.size() * sizeof(TensorEntry));
+      for(auto& t: tensors){
+        t.entry.offset = offset;
+        offset = alignUp(offset + t.entry.bytes);
+      }
+      h.fileSize = offset;
+
+      string tempPath = path + ".tmp" + to_string(getpid());
+      ofstream out(tempPath, ios::binary | ios::trunc);
+      out.write((const char*)&h, sizeof(h));
+      for(auto& t: tensors){
+        out.write((const char*)&t.entry, sizeof(TensorEntry));
+      }
+      static const char zeros[64] = {};
+      uint64_t at = h.tableOffset + tensors.size() * sizeof(TensorEntry);
+      for(auto& t: tensors){
+        out.write(zeros, t.entry.offset - at);
+        out.write((const char*)t.data, t.entry.bytes);
+        at = t.entry.offset + t.entry.bytes;
+      }
+      out.write(zeros, h.fileSize - at);
+      out.close();
+      if(!out){
+        remove(tempPath.c_str());
+        return false;
+      }
+      return rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+};
+
+//A model file mapped into memory. Nothing is parsed or copied: tensor() returns pointers into the mapping,
+//valid as long as the MappedModel is open.
+class MappedModel {
+  MappedFile file;
+  const ModelHeader* header = nullptr;
+  const TensorEntry* table = nullptr;
+  public:
+    //False for a missing, truncated, foreign or other version file. Every offset and tree child index is checked
+    //here once, so tensor() can trust the table and predictTree() the nodes.
+    bool open(const string& path){
+      header = nullptr;
+      if(!file.open(path) || file.size() < sizeof(ModelHeader)){
+        file.close();
+        return false;
+      }
+      const ModelHeader* h = (const ModelHeader*)file.data();
+      if(memcmp(h->magic, modelMagic, sizeof(modelMagic)) != 0 || h->formatVersion != modelFormatVersion
+         || h->fileSize != file.size() || h->tableOffset % 8 != 0 || h->tableOffset > file.size()
+         || (uint64_t)h->tensorCount * sizeof(TensorEntry) > file.size() - h->tableOffset){
+        file.close();
+        return false;
+      }
+      const TensorEntry* t = (const TensorEntry*)(file.data() + h->tableOffset);
+      for(uint32_t i = 0; i < h->tensorCount; i++){
+        //dims that multiply past 2^64 would wrap to a small byte count and pass the size checks below
+        uint64_t count = 1, bytes = 0;
+        bool overflow = false;
+        for(uint32_t d = 0; d < t[i].rank && d < 4; d++){
+          overflow = overflow || __builtin_mul_overflow(count, t[i].dims[d], &count);
+        }
+        overflow = overflow || __builtin_mul_overflow(count, elementSize(t[i].type), &bytes);
+        if(overflow || t[i].rank > 4 || elementSize(t[i].type) == 0 || t[i].bytes != bytes
+           || t[i].offset % 64 != 0 || t[i].offset > file.size() || t[i].bytes > file.size() - t[i].offset
+           || memchr(t[i].name, '\0', sizeof(t[i].name)) == nullptr){
+          file.close();
+          return false;
+        }
+        if(t[i].type == TreeNodes
+           && !validTree((const TreeNodeRecord*)(file.data() + t[i].offset), t[i].bytes / sizeof(TreeNodeRecord))){
+          file.close();
+          return false;
+        }
+      }
+      header = h;
+      table = t;
+      return true;
+    }
+
+    string kind(){
+      return header ? string(header->modelKind, strnlen(header->modelKind, sizeof(header->modelKind))) : "";
+    }
+
+    const TensorEntry* entry(const string& name){
+      for(uint32_t i = 0; header && i < header->tensorCount; i++){
+        if(name == table[i].name){
+          return &table[i];
+        }
+      }
+      return nullptr;
+    }
+
+    //Pointer to the elements of a tensor of the given type, or nullptr
+    template <typename T>
+    const T* tensor(const string& name, TensorType type, uint64_t* count = nullptr){
+      const TensorEntry* e = entry(name);
+      if(e == nullptr || e->type != type || elementSize(type) != sizeof(T)){
+        return nullptr;
+      }
+      if(count){
+        *count = e->bytes / sizeof(T);
+      }
+      return (const T*)(file.data() + e->offset);
+    }
+
+    const char* begin(){
+      return file.data();
+    }
+    size_t size(){
+      return file.size();
+    }
+};
+
+//Baseline: the usual stream format, a length prefixed record per tensor read back into freshly allocated vectors
+namespace streamFormat {
+  struct Tensor {
+    string name;
+    vector<float> values;
+  };
+
+  bool write(const string& path, const vector<pair<string, const vector<float>*>>& tensors){
+    ofstream out(path, ios::binary | ios::trunc);
+    uint64_t count = tensors.size();
+    out.write((const char*)&count, sizeof(count));
+    for(auto& t: tensors){
+      uint64_t nameLength = t.first.size(), size = t.second->size();
+      out.write((const char*)&nameLength, sizeof(nameLength));
+      out.write(t.first.data(), nameLength);
+      out.write((const char*)&size, sizeof(size));
+      out.write((const char*)t.second->data(), size * sizeof(float));
+    }
+    return out.good();
+  }
+
+  bool read(const string& path, vector<Tensor>& tensors){
+    ifstream in(path, ios::binary);
+    uint64_t count = 0;
+    in.read((char*)&count, sizeof(count));
+    tensors.clear();
+    for(uint64_t i = 0; i < count && in; i++){
+      Tensor t;
+      uint64_t nameLength = 0, size = 0;
+      in.read((char*)&nameLength, sizeof(nameLength));
+      t.name.resize(nameLength);
+      in.read(&t.name[0], nameLength);
+      in.read((char*)&size, sizeof(size));
+      t.values.resize(size);
+      in.read((char*)t.values.data(), size * sizeof(float));
+      tensors.push_back(move(t));
+    }
+    return (bool)in;
+  }
+}
+
+class ModelTrainer {
+  public:
+    ModelTrainer(const string& directory){
+      modelDirectory = directory;
+    }
+    void trainPipeline(const string& path){
+      loadData(path);
+      preprocessData();
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+    virtual ~ModelTrainer() {}
+  protected:
+    string modelDirectory;
+
+    void loadData(const string& path){
+      cout << "[Common] Loading data from " << path << endl;
+    }
+    void preprocessData(){
+      cout << "[Common] Preprocessing data" << endl;
+    }
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+    //Hook for saveModel(): every model adds its own tensors
+    virtual void addTensors(ModelWriter& writer) = 0;
+    virtual string modelName() = 0;
+    virtual void saveModel(){
+      ModelWriter writer(modelName());
+      addTensors(writer);
+      string path = modelDirectory + "/" + modelName() + ".model";
+      cout << "[Common] Saving model to " << path << (writer.write(path) ? "" : " failed") << endl;
+    }
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  public:
+    vector<vector<float>> weights;     //layer l: sizes[l] x sizes[l + 1]
+    vector<int> sizes;
+
+    NeuralNetworkModel(const string& directory, vector<int> layerSizes) : ModelTrainer(directory) {
+      sizes = layerSizes;
+    }
+  protected:
+    void trainModel() override {
+      cout << "[NeuralNetworkModel] Training neural network" << endl;
+      mt19937 random(1);
+      normal_distribution<float> normal(0, 0.1f);
+      weights.clear();
+      for(size_t l = 0; l + 1 < sizes.size(); l++){
+        weights.emplace_back((size_t)sizes[l] * sizes[l + 1]);
+        for(auto& w: weights.back()){
+          w = normal(random);
+        }
+      }
+    }
+    void evaluateModel() override {
+      cout << "[NeuralNetworkModel] Evaluating neural network" << endl;
+    }
+    string modelName() override {
+      return "NeuralNetworkModel";
+    }
+    void addTensors(ModelWriter& writer) override {
+      for(size_t l = 0; l < weights.size(); l++){
+        writer.add("layer" + to_string(l) + ".weights", Float32, {(uint64_t)sizes[l], (uint64_t)sizes[l + 1]}, weights[l].data());
+      }
+    }
+    void saveModel() override {
+      cout << "[NeuralNetworkModel] Saving neural network model" << endl;
+      ModelTrainer::saveModel();
+    }
+};
+
+class DecisionTreeModel : public ModelTrainer {
+  public:
+    vector<TreeNodeRecord> nodes;
+
+    DecisionTreeModel(const string& directory) : ModelTrainer(directory) {}
+  protected:
+    //A complete tree of depth 10 splitting feature (depth % 4) at 0
+    void trainModel() override {
+      cout << "[DecisionTreeModel] Training decision tree" << endl;
+      int inner = (1 << 10) - 1;
+      nodes.assign(2 * inner + 1, TreeNodeRecord());
+      for(int i = 0; i < (int)nodes.size(); i++){
+        int depth = 31 - __builtin_clz(i + 1);
+        bool leaf = i >= inner;
+        nodes[i] = {leaf ? -1 : depth % 4, 0.0f, leaf ? -1 : 2 * i + 1, leaf ? -1 : 2 * i + 2, (float)(i - inner), 0};
+      }
+    }
+    void evaluateModel() override {
+      cout << "[DecisionTreeModel] Evaluating decision tree" << endl;
+    }
+    string modelName() override {
+      return "DecisionTreeModel";
+    }
+    void addTensors(ModelWriter& writer) override {
+      writer.add("tree.nodes", TreeNodes, {nodes.size()}, nodes.data());
+    }
+};
+
+//Inference straight from the mapping
+float predictTree(const TreeNodeRecord* nodes, const float* x){
+  int at = 0;
+  while(nodes[at].feature >= 0){
+    at = x[nodes[at].feature] <= nodes[at].threshold ? nodes[at].left : nodes[at].right;
+  }
+  return nodes[at].value;
+}
+
+//First output of a linear chain x * W0 * W1 ... (enough to show the weights are used in place)
+float predictNetwork(MappedModel& model, vector<float> x){
+  for(int l = 0; ; l++){
+    const TensorEntry* e = model.entry("layer" + to_string(l) + ".weights");
+    if(e == nullptr){
+      return x[0];
+    }
+    const float* w = model.tensor<float>(e->name, Float32);
+    vector<float> next(e->dims[1], 0.0f);
+    for(uint64_t i = 0; i < e->dims[0]; i++){
+      for(uint64_t j = 0; j < e->dims[1]; j++){
+        next[j] = next[j] + x[i] * w[i * e->dims[1] + j];
+      }
+    }
+    x = next;
+  }
+}
+
+static int failures = 0;
+void check(bool ok, const string& what){
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if(!ok){
+    failures++;
+  }
+}
+
+//Pushes a file out of the page cache, so the next load reads it from disk like a cold start
+void dropFromPageCache(const string& path){
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd >= 0){
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+double millisecondsSince(chrono::steady_clock::time_point start){
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+  string directory = (filesystem::temp_directory_path() / "model-format").string();
+  filesystem::create_directories(directory);
+
+  NeuralNetworkModel* network = new NeuralNetworkModel(directory, {64, 256, 256, 10});
+  DecisionTreeModel* tree = new DecisionTreeModel(directory);
+  ModelTrainer* nTrainer = network;
+  ModelTrainer* dTrainer = tree;
+  nTrainer->trainPipeline("neural_network_data.csv");
+  dTrainer->trainPipeline("decision_tree_data.csv");
+
+  cout << "===Checks===" << endl;
+  MappedModel model;
+  check(model.open(directory + "/NeuralNetworkModel.model") && model.kind() == "NeuralNetworkModel", "network model opens");
+  uint64_t count = 0;
+  const float* w = model.tensor<float>("layer1.weights", Float32, &count);
+  check(w && count == network->weights[1].size() && memcmp(w, network->weights[1].data(), count * sizeof(float)) == 0,
+        "weights read back unchanged");
+  check(w && (const char*)w > model.begin() && (const char*)w < model.begin() + model.size() && (uintptr_t)w % 64 == 0,
+        "weights point into the mapping, 64 byte aligned (no copy)");
+  vector<float> x(64, 0.5f);
+  check(model.tensor<float>("layer1.weights", TreeNodes) == nullptr && model.tensor<float>("missing", Float32) == nullptr,
+        "wrong type and missing names give nullptr");
+  float expected = 0;
+  {
+    vector<float> v = x;
+    for(size_t l = 0; l < network->weights.size(); l++){
+      vector<float> next(network->sizes[l + 1], 0.0f);
+      for(int i = 0; i < network->sizes[l]; i++){
+        for(int j = 0; j < network->sizes[l + 1]; j++){
+          next[j] = next[j] + v[i] * network->weights[l][(size_t)i * network->sizes[l + 1] + j];
+        }
+      }
+      v = next;
+    }
+    expected = v[0];
+  }
+  check(predictNetwork(model, x) == expected, "network inference from the mapping matches the trained weights");
+
+  MappedModel treeModel;
+  const TreeNodeRecord* nodes = treeModel.open(directory + "/DecisionTreeModel.model")
+                                ? treeModel.tensor<TreeNodeRecord>("tree.nodes", TreeNodes, &count) : nullptr;
+  float features[4] = {1, -1, 1, -1};
+  check(nodes && count == tree->nodes.size() && predictTree(nodes, features) == predictTree(tree->nodes.data(), features),
+        "tree inference from the mapping matches the trained tree");
+
+  //Damaged files must be refused, not crash the reader
+  string damaged = directory + "/damaged.model";
+  filesystem::copy_file(directory + "/NeuralNetworkModel.model", damaged, filesystem::copy_options::overwrite_existing);
+  filesystem::resize_file(damaged, filesystem::file_size(damaged) - 100);
+  check(!MappedModel().open(damaged), "truncated file is refused");
+  filesystem::copy_file(directory + "/NeuralNetworkModel.model", damaged, filesystem::copy_options::overwrite_existing);
+  {
+    fstream f(damaged, ios::in | ios::out | ios::binary);
+    uint32_t version = modelFormatVersion + 1;
+    f.seekp(offsetof(ModelHeader, formatVersion));
+    f.write((const char*)&version, sizeof(version));
+  }
+  check(!MappedModel().open(damaged), "other format version is refused");
+  filesystem::copy_file(directory + "/NeuralNetworkModel.model", damaged, filesystem::copy_options::overwrite_existing);
+  {
+    fstream f(damaged, ios::in | ios::out | ios::binary);
+    uint64_t offset = 1ULL << 40;
+    f.seekp(sizeof(ModelHeader) + offsetof(TensorEntry, offset));
+    f.write((const char*)&offset, sizeof(offset));
+  }
+  check(!MappedModel().open(damaged), "tensor pointing past the end is refused");
+  filesystem::copy_file(directory + "/NeuralNetworkModel.model", damaged, filesystem::copy_options::overwrite_existing);
+  {
+    //2^32 x 2^32 floats: the element count wraps to 0, and so would the byte length
+    fstream f(damaged, ios::in | ios::out | ios::binary);
+    uint64_t dims[2] = {1ULL << 32, 1ULL << 32}, bytes = 0;
+    f.seekp(sizeof(ModelHeader) + offsetof(TensorEntry, dims));
+    f.write((const char*)dims, sizeof(dims));
+    f.seekp(sizeof(ModelHeader) + offsetof(TensorEntry, bytes));
+    f.write((const char*)&bytes, sizeof(bytes));
+  }
+  check(!MappedModel().open(damaged), "dims whose product overflows are refused");
+  for(int32_t child: {1 << 20, -5, 0}){
+    filesystem::copy_file(directory + "/DecisionTreeModel.model", damaged, filesystem::copy_options::overwrite_existing);
+    fstream f(damaged, ios::in | ios::out | ios::binary);
+    TensorEntry e;
+    f.seekg(sizeof(ModelHeader));
+    f.read((char*)&e, sizeof(e));
+    f.seekp(e.offset + 3 * sizeof(TreeNodeRecord) + offsetof(TreeNodeRecord, right));
+    f.write((const char*)&child, sizeof(child));
+    f.close();
+    check(!MappedModel().open(damaged), "tree child index " + to_string(child) + " is refused");
+  }
+  filesystem::remove(damaged);
+
+  //Benchmark: cold load (page cache dropped) of 1 MB ... maxMB, e.g. ./model-format 10240 for up to 10 GB
+  uint64_t maxMB = argc > 1 ? atoll(argv[1]) : 1024;
+  cout << "===Cold load time (ms)===" << endl;
+  cout << "size MB | mmap open | mmap open + read all | stream read" << endl;
+  vector<uint64_t> sizesMB;
+  for(uint64_t mb = 1; mb < maxMB; mb = mb * 10){
+    sizesMB.push_back(mb);
+  }
+  sizesMB.push_back(maxMB);
+  for(uint64_t mb: sizesMB){
+    //Tensors of at most 64 MB, like the layers of a big network
+    vector<vector<float>> tensors;
+    uint64_t left = mb << 20;
+    while(left > 0){
+      uint64_t bytes = min<uint64_t>(left, 64 << 20);
+      tensors.emplace_back(bytes / sizeof(float), 1.0f);
+      left = left - bytes;
+    }
+    ModelWriter writer("benchmark");
+    vector<pair<string, const vector<float>*>> streamTensors;
+    for(size_t t = 0; t < tensors.size(); t++){
+      string name = "tensor" + to_string(t);
+      writer.add(name, Float32, {tensors[t].size()}, tensors[t].data());
+      streamTensors.push_back({name, &tensors[t]});
+    }
+    string mappedPath = directory + "/benchmark.model", streamPath = directory + "/benchmark.stream";
+    writer.write(mappedPath);
+    streamFormat::write(streamPath, streamTensors);
+    uint64_t tensorCount = tensors.size();
+    tensors.clear();
+    tensors.shrink_to_fit();
+
+    dropFromPageCache(mappedPath);
+    auto start = chrono::steady_clock::now();
+    MappedModel mapped;
+    mapped.open(mappedPath);
+    double openMs = millisecondsSince(start);
+    //Reading every weight once is what the first inference would do
+    float sum = 0;
+    for(uint64_t t = 0; t < tensorCount; t++){
+      uint64_t n = 0;
+      const float* values = mapped.tensor<float>("tensor" + to_string(t), Float32, &n);
+      for(uint64_t i = 0; i < n; i = i + 1024){
+        sum = sum + values[i];
+      }
+    }
+    double touchMs = millisecondsSince(start);
+
+    dropFromPageCache(streamPath);
+    start = chrono::steady_clock::now();
+    vector<streamFormat::Tensor> loaded;
+    streamFormat::read(streamPath, loaded);
+    double streamMs = millisecondsSince(start);
+    cout << mb << " | " << openMs << " | " << touchMs << " | " << streamMs << (sum > 0 ? "" : " ?") << endl;
+
+    filesystem::remove(mappedPath);
+    filesystem::remove(streamPath);
+  }
+  delete nTrainer;
+  delete dTrainer;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,569 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+//NeuralNetworkModel::trainModel() in Template-Pattern.cpp is only a print statement.
+//Here it trains a real multilayer perceptron (ReLU hidden layers, softmax output) with mini-batch SGD.
+//Almost all of the work of forward and backward passes is matrix multiplication, so everything is
+//written on top of one GEMM function:
+//  forward:   Z = A_prev * W
+//  backward:  dW = A_prev^T * delta,  dA_prev = delta * W^T
+
+//C[M x N] = A[M x K] * B[K x N], row major with leading dimensions
+typedef void (*Gemm)(int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc);
+
+//The textbook triple loop, used as the baseline and as the reference in the checks.
+//Walking B down a column touches a new cache line for every k
+void gemmNaive(int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc){
+  for(int i = 0; i < M; i++){
+    for(int j = 0; j < N; j++){
+      float sum = 0;
+      for(int k = 0; k < K; k++){
+        sum = sum + A[i * lda + k] * B[k * ldb + j];
+      }
+      C[i * ldc + j] = sum;
+    }
+  }
+}
+
+//Blocking: K is cut into blocks of 256, so a 256 x 16 strip of B (16 KB) stays in L1 while it is used by
+//every row of A. Inside, a micro kernel keeps a MR x 16 tile of C in registers for the whole K block.
+static const int blockK = 256;
+
+namespace scalar {
+  //Without SIMD the same loop order still helps: the inner j loop runs over contiguous B and C
+  void gemm(int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc){
+    for(int i = 0; i < M; i++){
+      memset(C + i * ldc, 0, N * sizeof(float));
+    }
+    for(int kk = 0; kk < K; kk = kk + blockK){
+      int kEnd = min(K, kk + blockK);
+      for(int i = 0; i < M; i++){
+        float* c = C + i * ldc;
+        for(int k = kk; k < kEnd; k++){
+          float a = A[i * lda + k];
+          const float* b = B + k * ldb;
+          for(int j = 0; j < N; j++){
+            c[j] = c[j] + a * b[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+#if defined(__x86_64__)
+namespace avx2 {
+  //MR rows x 16 columns of C in 2 * MR ymm registers
+  template <int MR>
+  __attribute__((target("avx2,fma")))
+  inline void kernel16(int k0, int k1, const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool first){
+    __m256 acc[MR][2];
+    for(int r = 0; r < MR; r++){
+      acc[r][0] = first ? _mm256_setzero_ps() : _mm256_loadu_ps(C + r * ldc);
+      acc[r][1] = first ? _mm256_setzero_ps() : _mm256_loadu_ps(C + r * ldc + 8);
+    }
+    for(int k = k0; k < k1; k++){
+      __m256 b0 = _mm256_loadu_ps(B + k * ldb);
+      __m256 b1 = _mm256_loadu_ps(B + k * ldb + 8);
+      for(int r = 0; r < MR; r++){
+        __m256 a = _mm256_broadcast_ss(A + r * lda + k);
+        acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+        acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+      }
+    }
+    for(int r = 0; r < MR; r++){
+      _mm256_storeu_ps(C + r * ldc, acc[r][0]);
+      _mm256_storeu_ps(C + r * ldc + 8, acc[r][1]);
+    }
+  }
+
+  //Columns left over after the 16 wide strips, one at a time
+  __attribute__((target("avx2,fma")))
+  inline void kernel1(int rows, int k0, int k1, const float* A, int lda, const float* B, int ldb, float* C, int ldc, bool first){
+    for(int r = 0; r < rows; r++){
+      float sum = first ? 0 : C[r * ldc];
+      for(int k = k0; k < k1; k++){
+        sum = sum + A[r * lda + k] * B[k * ldb];
+      }
+      C[r * ldc] = sum;
+    }
+  }
+
+  __attribute__((target("avx2,fma")))
+  void gemm(int M, int N, int K, const float* A, int lda, const float* B, int ldb, float* C, int ldc){
+    if(K == 0){
+      for(int i = 0; i < M; i++){
+        memset(C + i * ldc, 0, N * sizeof(float));
+      }
+      return;
+    }
+    for(int kk = 0; kk < K; kk = kk + blockK){
+      int kEnd = min(K, kk + blockK);
+      bool first = kk == 0;
+      int j = 0;
+      for(; j + 16 <= N; j = j + 16){
+        int i = 0;
+        for(; i + 4 <= M; i = i + 4){
+          kernel16<4>(kk, kEnd, A + i * lda, lda, B + j, ldb, C + i * ldc + j, ldc, first);
+        }
+        for(; i < M; i++){
+          kernel16<1>(kk, kEnd, A + i * lda, lda, B + j, ldb, C + i * ldc + j, ldc, first);
+        }
+      }
+      for(; j < N; j++){
+        kernel1(M, kk, kEnd, A, lda, B + j, ldb, C + j, ldc, first);
+      }
+    }
+  }
+}
+#endif
+
+//Best GEMM this CPU can run, picked once
+Gemm bestGemm(){
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    return avx2::gemm;
+  }
+#endif
+  return scalar::gemm;
+}
+
+//All parameters, gradients and activations of a network live in one 64 byte aligned block, cut up once when
+//the network is built. A training step then never allocates.
+//An Arena without memory only counts, which is how the network finds out how big the real one must be.
+class Arena {
+  float* base = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  public:
+    Arena() {}
+    Arena(size_t floats){
+      capacity = floats;
+      base = (float*)aligned_alloc(64, max<size_t>(64, capacity * sizeof(float)));
+      if(base == nullptr){
+        throw bad_alloc();
+      }
+      memset(base, 0, capacity * sizeof(float));
+    }
+    ~Arena(){
+      free(base);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    float* allocate(size_t floats){
+      //Every tensor starts on a cache line
+      floats = (floats + 15) / 16 * 16;
+      float* p = base ? base + used : nullptr;
+      if(base && used + floats > capacity){
+        throw bad_alloc();
+      }
+      used = used + floats;
+      return p;
+    }
+    size_t size(){
+      return used;
+    }
+};
+
+class Mlp {
+  struct Layer {
+    int in;
+    int out;
+    float* weights;     //in x out
+    float* bias;        //out
+    float* dWeights;
+    float* dBias;
+    float* z;           //batch x out, before the activation
+    float* a;           //batch x out, after it (softmax for the last layer)
+    float* delta;       //batch x out, dLoss/dz
+  };
+  vector<int> sizes;
+  int batch;
+  vector<Layer> layers;
+  float* input;          //batch x sizes[0]
+  float* transposed;     //scratch for A_prev^T and W^T
+  Arena* arena = nullptr;
+  Gemm gemm;
+
+  //Hands out every tensor; called once with a counting Arena and once with the real one
+  void plan(Arena& a){
+    input = a.allocate((size_t)batch * sizes[0]);
+    size_t scratch = 0;
+    layers.clear();
+    for(size_t l = 0; l + 1 < sizes.size(); l++){
+      Layer layer;
+      layer.in = sizes[l];
+      layer.out = sizes[l + 1];
+      layer.weights = a.allocate((size_t)layer.in * layer.out);
+      layer.bias = a.allocate(layer.out);
+      layer.dWeights = a.allocate((size_t)layer.in * layer.out);
+      layer.dBias = a.allocate(layer.out);
+      layer.z = a.allocate((size_t)batch * layer.out);
+      layer.a = a.allocate((size_t)batch * layer.out);
+      layer.delta = a.allocate((size_t)batch * layer.out);
+      layers.push_back(layer);
+      scratch = max(scratch, (size_t)layer.in * max(batch, layer.out));
+    }
+    transposed = a.allocate(scratch);
+  }
+
+  static void transpose(const float* from, int rows, int cols, float* to){
+    for(int r = 0; r < rows; r++){
+      for(int c = 0; c < cols; c++){
+        to[c * rows + r] = from[r * cols + c];
+      }
+    }
+  }
+
+  public:
+    Mlp(const vector<int>& layerSizes, int batchSize, Gemm g, uint64_t seed){
+      sizes = layerSizes;
+      batch = batchSize;
+      gemm = g;
+      Arena counter;
+      plan(counter);
+      arena = new Arena(counter.size());
+      plan(*arena);
+      //He initialization for ReLU layers
+      mt19937_64 random(seed);
+      for(auto& layer: layers){
+        normal_distribution<float> normal(0, sqrt(2.0f / layer.in));
+        for(int i = 0; i < layer.in * layer.out; i++){
+          layer.weights[i] = normal(random);
+        }
+      }
+    }
+    ~Mlp(){
+      delete arena;
+    }
+    Mlp(const Mlp&) = delete;
+    Mlp& operator=(const Mlp&) = delete;
+
+    int batchSize(){
+      return batch;
+    }
+    size_t arenaBytes(){
+      return arena->size() * sizeof(float);
+    }
+    float* parameter(int layer, bool bias){
+      return bias ? layers[layer].bias : layers[layer].weights;
+    }
+    float* gradient(int layer, bool bias){
+      return bias ? layers[layer].dBias : layers[layer].dWeights;
+    }
+
+    //rows = batch rows of features (sizes[0] each), fewer than batch is fine for the last one
+    void forward(const float* rows, int count){
+      memcpy(input, rows, (size_t)count * sizes[0] * sizeof(float));
+      const float* previous = input;
+      for(size_t l = 0; l < layers.size(); l++){
+        Layer& layer = layers[l];
+        gemm(count, layer.out, layer.in, previous, layer.in, layer.weights, layer.out, layer.z, layer.out);
+        bool last = l + 1 == layers.size();
+        for(int r = 0; r < count; r++){
+          float* z = layer.z + r * layer.out;
+          float* a = layer.a + r * layer.out;
+          for(int c = 0; c < layer.out; c++){
+            z[c] = z[c] + layer.bias[c];
+            a[c] = last ? z[c] : max(0.0f, z[c]);
+          }
+          if(last){
+            float top = *max_element(a, a + layer.out);
+            float sum = 0;
+            for(int c = 0; c < layer.out; c++){
+              a[c] = exp(a[c] - top);
+              sum = sum + a[c];
+            }
+            for(int c = 0; c < layer.out; c++){
+              a[c] = a[c] / sum;
+            }
+          }
+        }
+        previous = layer.a;
+      }
+    }
+
+    //Mean cross entropy of the last forward()
+    double loss(const int* labels, int count){
+      const Layer& last = layers.back();
+      double total = 0;
+      for(int r = 0; r < count; r++){
+        total = total - log(max(1e-30f, last.a[r * last.out + labels[r]]));
+      }
+      return total / count;
+    }
+
+    //Gradients of the mean cross entropy of the last forward(), into dWeights and dBias
+    void backward(const int* labels, int count){
+      Layer& last = layers.back();
+      for(int r = 0; r < count; r++){
+        for(int c = 0; c < last.out; c++){
+          last.delta[r * last.out + c] = (last.a[r * last.out + c] - (c == labels[r] ? 1.0f : 0.0f)) / count;
+        }
+      }
+      for(int l = (int)layers.size() - 1; l >= 0; l--){
+        Layer& layer = layers[l];
+        const float* previous = l == 0 ? input : layers[l - 1].a;
+        //dW = A_prev^T * delta
+        transpose(previous, count, layer.in, transposed);
+        gemm(layer.in, layer.out, count, transposed, count, layer.delta, layer.out, layer.dWeights, layer.out);
+        for(int c = 0; c < layer.out; c++){
+          float sum = 0;
+          for(int r = 0; r < count; r++){
+            sum = sum + layer.delta[r * layer.out + c];
+          }
+          layer.dBias[c] = sum;
+        }
+        if(l == 0){
+          break;
+        }
+        //delta_prev = (delta * W^T) where the previous ReLU was active
+        Layer& before = layers[l - 1];
+        transpose(layer.weights, layer.in, layer.out, transposed);
+        gemm(count, layer.in, layer.out, layer.delta, layer.out, transposed, layer.in, before.delta, before.out);
+        for(int i = 0; i < count * before.out; i++){
+          before.delta[i] = before.z[i] > 0 ? before.delta[i] : 0;
+        }
+      }
+    }
+
+    void step(float learningRate){
+      for(auto& layer: layers){
+        for(int i = 0; i < layer.in * layer.out; i++){
+          layer.weights[i] = layer.weights[i] - learningRate * layer.dWeights[i];
+        }
+        for(int c = 0; c < layer.out; c++){
+          layer.bias[c] = layer.bias[c] - learningRate * layer.dBias[c];
+        }
+      }
+    }
+
+    //Class with the highest probability for row r of the last forward()
+    int predicted(int r){
+      const Layer& last = layers.back();
+      const float* p = last.a + r * last.out;
+      return (int)(max_element(p, p + last.out) - p);
+    }
+};
+
+//Gaussian blobs, one per class, in `features` dimensions
+struct Samples {
+  int features;
+  vector<float> x;    //row major
+  vector<int> y;
+  int rows(){
+    return (int)y.size();
+  }
+};
+
+Samples makeSamples(int rows, int features, int classes, uint64_t seed){
+  Samples s;
+  s.features = features;
+  mt19937_64 centers(7);
+  normal_distribution<float> normal(0, 1);
+  vector<float> center((size_t)classes * features);
+  for(auto& c: center){
+    c = normal(centers);
+  }
+  mt19937_64 random(seed);
+  s.x.resize((size_t)rows * features);
+  s.y.resize(rows);
+  for(int r = 0; r < rows; r++){
+    s.y[r] = (int)(random() % classes);
+    for(int f = 0; f < features; f++){
+      s.x[(size_t)r * features + f] = center[(size_t)s.y[r] * features + f] + 0.7f * normal(random);
+    }
+  }
+  return s;
+}
+
+//One pass of mini-batch SGD over the samples, returns the mean loss
+double trainEpoch(Mlp& net, Samples& data, float learningRate){
+  double total = 0;
+  int batches = 0;
+  for(int start = 0; start < data.rows(); start = start + net.batchSize()){
+    int count = min(net.batchSize(), data.rows() - start);
+    net.forward(&data.x[(size_t)start * data.features], count);
+    total = total + net.loss(&data.y[start], count);
+    net.backward(&data.y[start], count);
+    net.step(learningRate);
+    batches++;
+  }
+  return total / batches;
+}
+
+class ModelTrainer {
+  public:
+    void trainPipeline(const string& path){
+      loadData(path);
+      preprocessData();
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+    virtual ~ModelTrainer() {}
+  protected:
+    Samples train;
+    Samples test;
+
+    void loadData(const string& path){
+      cout << "[Common] Loading data from " << path << " (synthetic 20k rows)" << endl;
+      train = makeSamples(20000, 32, 10, 1);
+      test = makeSamples(2000, 32, 10, 2);
+    }
+    void preprocessData(){
+      cout << "[Common] Preprocessing data" << endl;
+    }
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+    virtual void saveModel(){
+      cout << "[Common] Saving model" << endl;
+    }
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  Mlp net{{32, 128, 128, 10}, 128, bestGemm(), 42};
+  protected:
+    void trainModel() override {
+      for(int epoch = 1; epoch <= 5; epoch++){
+        cout << "[NeuralNetworkModel] Epoch " << epoch << " loss " << trainEpoch(net, train, 0.05f) << endl;
+      }
+    }
+    void evaluateModel() override {
+      int correct = 0;
+      for(int start = 0; start < test.rows(); start = start + net.batchSize()){
+        int count = min(net.batchSize(), test.rows() - start);
+        net.forward(&test.x[(size_t)start * test.features], count);
+        for(int r = 0; r < count; r++){
+          correct = correct + (net.predicted(r) == test.y[start + r]);
+        }
+      }
+      cout << "[NeuralNetworkModel] Test accuracy " << 100.0 * correct / test.rows() << "%" << endl;
+    }
+    void saveModel() override {
+      cout << "[NeuralNetworkModel] Saving neural network model" << endl;
+    }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what){
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if(!ok){
+    failures++;
+  }
+}
+
+//Compares a GEMM with the naive one on sizes which are not multiples of the blocks
+bool gemmMatches(Gemm g, int M, int N, int K){
+  mt19937_64 random(M * 1000 + N * 10 + K);
+  uniform_real_distribution<float> uniform(-1, 1);
+  vector<float> A((size_t)M * K), B((size_t)K * N), expected((size_t)M * N), actual((size_t)M * N, 123.0f);
+  for(auto& v: A) v = uniform(random);
+  for(auto& v: B) v = uniform(random);
+  gemmNaive(M, N, K, A.data(), K, B.data(), N, expected.data(), N);
+  g(M, N, K, A.data(), K, B.data(), N, actual.data(), N);
+  for(size_t i = 0; i < expected.size(); i++){
+    if(fabs(expected[i] - actual[i]) > 1e-4f * (1 + K)){
+      return false;
+    }
+  }
+  return true;
+}
+
+//Backward pass against central differences of the loss, for every parameter of a tiny network
+double gradientCheck(Gemm g){
+  Samples data = makeSamples(6, 5, 4, 3);
+  Mlp net({5, 7, 6, 4}, 6, g, 9);
+  int rows = data.rows();
+  net.forward(data.x.data(), rows);
+  net.backward(data.y.data(), rows);
+  double worst = 0;
+  int layerSizes[3][2] = {{5, 7}, {7, 6}, {6, 4}};
+  for(int l = 0; l < 3; l++){
+    for(int bias = 0; bias <= 1; bias++){
+      int count = bias ? layerSizes[l][1] : layerSizes[l][0] * layerSizes[l][1];
+      for(int i = 0; i < count; i++){
+        float* p = net.parameter(l, bias) + i;
+        float analytic = net.gradient(l, bias)[i];
+        float saved = *p;
+        float eps = 1e-3f;
+        *p = saved + eps;
+        net.forward(data.x.data(), rows);
+        double plus = net.loss(data.y.data(), rows);
+        *p = saved - eps;
+        net.forward(data.x.data(), rows);
+        double minus = net.loss(data.y.data(), rows);
+        *p = saved;
+        double numeric = (plus - minus) / (2 * eps);
+        worst = max(worst, fabs(numeric - analytic) / max(1e-2, fabs(numeric) + fabs(analytic)));
+      }
+    }
+  }
+  return worst;
+}
+
+int main(int argc, char** argv){
+  ModelTrainer* nTrainer = new NeuralNetworkModel();
+  nTrainer->trainPipeline("neural_network_data.csv");
+  delete nTrainer;
+
+  cout << "===Checks===" << endl;
+  Gemm gemms[] = {scalar::gemm, bestGemm()};
+  const char* gemmNames[] = {"scalar", bestGemm() == scalar::gemm ? "scalar" : "avx2"};
+  for(int g = 0; g < 2; g++){
+    string name = gemmNames[g];
+    check(gemmMatches(gemms[g], 1, 1, 1) && gemmMatches(gemms[g], 37, 53, 29) && gemmMatches(gemms[g], 64, 48, 300)
+          && gemmMatches(gemms[g], 5, 17, 0), name + " GEMM matches the naive loop on odd sizes");
+    double worst = gradientCheck(gemms[g]);
+    check(worst < 2e-2, name + " backward pass matches numeric gradients (worst relative error " + to_string(worst) + ")");
+  }
+
+  //Benchmarks: GEMM GFLOP/s at a square size, then samples/s of whole training steps
+  int size = argc > 1 ? atoi(argv[1]) : 512;
+  cout << "===GEMM " << size << " x " << size << " x " << size << "===" << endl;
+  vector<float> A((size_t)size * size, 0.5f), B((size_t)size * size, 0.25f), C((size_t)size * size);
+  Gemm benchGemms[] = {gemmNaive, scalar::gemm, bestGemm()};
+  const char* benchNames[] = {"naive", "blocked scalar", gemmNames[1]};
+  for(int g = 0; g < 3; g++){
+    if(g == 2 && benchGemms[2] == scalar::gemm){
+      break;
+    }
+    auto start = chrono::steady_clock::now();
+    int runs = 0;
+    do{
+      benchGemms[g](size, size, size, A.data(), size, B.data(), size, C.data(), size);
+      runs++;
+    }while(chrono::steady_clock::now() - start < chrono::milliseconds(500));
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << benchNames[g] << ": " << 2.0 * size * size * size * runs / seconds / 1e9 << " GFLOP/s" << endl;
+  }
+
+  cout << "===Training 256-512-512-10, batch 256===" << endl;
+  Samples data = makeSamples(8192, 256, 10, 5);
+  for(int g = 0; g < 3; g++){
+    if(g == 2 && benchGemms[2] == scalar::gemm){
+      break;
+    }
+    Mlp net({256, 512, 512, 10}, 256, benchGemms[g], 1);
+    auto start = chrono::steady_clock::now();
+    trainEpoch(net, data, 0.01f);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << benchNames[g] << ": " << data.rows() / seconds << " samples/s (arena " << net.arenaBytes() / 1024 << " KB)" << endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+using namespace std;
+
+//Template-Pattern.cpp runs load -> preprocess -> train -> evaluate -> save strictly one after another for one path.
+//With hundreds of dataset files the disk waits while we train, and the CPU waits while we load.
+//Here the same template method also accepts a list of paths and overlaps the stages:
+//while dataset i is being trained, dataset i+1 is already being loaded and preprocessed.
+
+//Fixed size queue between two stages: push waits while it is full, pop waits while it is empty.
+//The size limit is what stops a fast loader from reading every dataset into memory ahead of a slow trainer.
+//cancel() is for when a stage fails: it drops what is queued and wakes both sides, so no stage waits forever.
+template <typename T>
+class BoundedQueue {
+  deque<T> items;
+  size_t capacity;
+  bool closed = false;
+  bool cancelled = false;
+  mutex m;
+  condition_variable notFull;
+  condition_variable notEmpty;
+  public:
+    BoundedQueue(size_t c){
+      capacity = c;
+    }
+    //Returns false (and drops the item) once the queue is cancelled
+    bool push(T item){
+      unique_lock<mutex> lock(m);
+      notFull.wait(lock, [this]{ return items.size() < capacity || cancelled; });
+      if(cancelled){
+        return false;
+      }
+      items.push_back(move(item));
+      notEmpty.notify_one();
+      return true;
+    }
+    //Returns false once the queue is closed and nothing is left in it
+    bool pop(T& item){
+      unique_lock<mutex> lock(m);
+      notEmpty.wait(lock, [this]{ return !items.empty() || closed; });
+      if(items.empty()){
+        return false;
+      }
+      item = move(items.front());
+      items.pop_front();
+      notFull.notify_one();
+      return true;
+    }
+    //The producer calls this when it has nothing more to send
+    void close(){
+      lock_guard<mutex> lock(m);
+      closed = true;
+      notEmpty.notify_all();
+    }
+    void cancel(){
+      lock_guard<mutex> lock(m);
+      closed = true;
+      cancelled = true;
+      items.clear();
+      notEmpty.notify_all();
+      notFull.notify_all();
+    }
+};
+
+//Stands in for a real expensive step: sleeping is like waiting on the disk, spinning is like using the CPU
+void simulateIo(chrono::microseconds duration){
+  this_thread::sleep_for(duration);
+}
+void simulateCpu(chrono::microseconds duration){
+  auto end = chrono::steady_clock::now() + duration;
+  volatile long work = 0;
+  while(chrono::steady_clock::now() < end){
+    work = work + 1;
+  }
+}
+
+//What the common steps hand over to the model specific steps
+struct Dataset {
+  string path;
+  vector<double> rows;
+};
+
+class ModelTrainer {
+  public:
+  //The original template method for a single path
+    void trainPipeline(const string& path){
+      Dataset data = loadData(path);
+      preprocessData(data);
+      runModelSteps(data);
+    }
+
+  //The same steps in the same order for every path, but run as three stages connected by bounded queues:
+  //  [load thread] -> queue -> [preprocess thread] -> queue -> [train, evaluate, save on this thread]
+  //The model specific steps still run one dataset at a time on one thread, so subclasses need no locking.
+  //If any step throws, every stage stops, all threads are joined, and the first exception is rethrown here.
+    void trainPipeline(const vector<string>& paths, size_t queueSize = 2){
+      BoundedQueue<Dataset> loaded(queueSize);
+      BoundedQueue<Dataset> preprocessed(queueSize);
+      exception_ptr failure;
+      mutex failureMutex;
+      //Called from a catch block of any stage
+      auto fail = [&]{
+        {
+          lock_guard<mutex> lock(failureMutex);
+          if(!failure){
+            failure = current_exception();
+          }
+        }
+        loaded.cancel();
+        preprocessed.cancel();
+      };
+
+      thread loader([&]{
+        try{
+          for(auto& path: paths){
+            if(!loaded.push(loadData(path))){
+              break;
+            }
+          }
+        }catch(...){
+          fail();
+        }
+        loaded.close();
+      });
+      thread preprocessor([&]{
+        try{
+          Dataset data;
+          while(loaded.pop(data)){
+            preprocessData(data);
+            if(!preprocessed.push(move(data))){
+              break;
+            }
+          }
+        }catch(...){
+          fail();
+        }
+        preprocessed.close();
+      });
+
+      try{
+        Dataset data;
+        while(preprocessed.pop(data)){
+          runModelSteps(data);
+        }
+      }catch(...){
+        current = nullptr;
+        fail();
+      }
+      loader.join();
+      preprocessor.join();
+      if(failure){
+        rethrow_exception(failure);
+      }
+    }
+
+    void setVerbose(bool v){
+      verbose = v;
+    }
+    //Simulated cost of the common steps, so the effect of overlapping can be measured
+    void setCommonCosts(chrono::microseconds load, chrono::microseconds preprocess){
+      loadCost = load;
+      preprocessCost = preprocess;
+    }
+    virtual ~ModelTrainer() {}
+
+  protected:
+  //The dataset the model specific steps are working on right now
+    const Dataset* current = nullptr;
+
+    void log(const string& message){
+      if(verbose){
+        //Stages print from different threads, so a whole line is written under the lock
+        lock_guard<mutex> lock(printMutex);
+        cout << message << "\n";
+      }
+    }
+
+  //The common steps now return / take the dataset instead of keeping it in the trainer,
+  //that way dataset i+1 can be loaded while the trainer still holds dataset i
+    Dataset loadData(const string& path){
+      if(path.empty()){
+        throw invalid_argument("dataset path is empty");
+      }
+      log("[Common] Loading data from " + path);
+      simulateIo(loadCost);
+      Dataset data;
+      data.path = path;
+      data.rows.assign(1000, 1.0);
+      return data;
+    }
+
+    void preprocessData(Dataset& data){
+      log("[Common] Preprocessing data of " + data.path);
+      simulateCpu(preprocessCost);
+    }
+
+  //Same hook contract as before
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+
+    virtual void saveModel(){
+      log("[Common] Saving model");
+    }
+
+  private:
+    bool verbose = true;
+    mutex printMutex;
+    chrono::microseconds loadCost{0};
+    chrono::microseconds preprocessCost{0};
+
+    void runModelSteps(const Dataset& data){
+      current = &data;
+      trainModel();
+      evaluateModel();
+      saveModel();
+      current = nullptr;
+    }
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  protected:
+    void trainModel() override {
+      log("[NeuralNetworkModel] Training neural network model on " + current->path);
+    }
+    void evaluateModel() override {
+      log("[NeuralNetworkModel] Evaluating neural network model");
+    }
+    void saveModel() override {
+      log("[NeuralNetworkModel] Saving neural network model");
+    }
+};
+
+class DecisionTreeModel : public ModelTrainer {
+  protected:
+    void trainModel() override {
+      log("[DecisionTreeModel] Training decision tree model on " + current->path);
+    }
+    void evaluateModel() override {
+      log("[DecisionTreeModel] Evaluating decision tree model");
+    }
+   //Uses default save method
+};
+
+//Model used only by the benchmark, its training cost can be chosen
+class SimulatedModel : public ModelTrainer {
+  chrono::microseconds trainCost;
+  public:
+    SimulatedModel(chrono::microseconds t){
+      trainCost = t;
+      setVerbose(false);
+    }
+  protected:
+    void trainModel() override {
+      simulateCpu(trainCost);
+    }
+    void evaluateModel() override {}
+    void saveModel() override {}
+};
+
+//Model whose training fails on one chosen dataset
+class FailingModel : public ModelTrainer {
+  string failOn;
+  public:
+    FailingModel(const string& path){
+      failOn = path;
+      setVerbose(false);
+    }
+    int trained = 0;
+  protected:
+    void trainModel() override {
+      if(current->path == failOn){
+        throw runtime_error("training diverged on " + failOn);
+      }
+      trained++;
+    }
+    void evaluateModel() override {}
+    void saveModel() override {}
+};
+
+static int failures = 0;
+void check(bool ok, const string& what){
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if(!ok){
+    failures++;
+  }
+}
+
+double runSeconds(ModelTrainer& trainer, const vector<string>& paths, bool pipelined){
+  auto start = chrono::steady_clock::now();
+  if(pipelined){
+    trainer.trainPipeline(paths);
+  }else{
+    for(auto& path: paths){
+      trainer.trainPipeline(path);
+    }
+  }
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main (int argc, char** argv) {
+  cout << "===Training Neural Network on three datasets===" << endl;
+  ModelTrainer *nTrainer = new NeuralNetworkModel();
+  nTrainer->trainPipeline(vector<string>{"part1.csv", "part2.csv", "part3.csv"});
+
+  cout << "===Training Decision Tree===" << endl;
+  ModelTrainer *dTrainer = new DecisionTreeModel();
+  dTrainer->trainPipeline("decision_tree_data.csv");
+  delete nTrainer;
+  delete dTrainer;
+
+  cout << "===Checks===" << endl;
+  {
+    //The loader thread fails on the second path: the caller gets its exception, nothing hangs or terminates
+    FailingModel model("");
+    string message;
+    try{
+      model.trainPipeline(vector<string>{"a.csv", "", "c.csv", "d.csv"});
+    }catch(const invalid_argument& e){
+      message = e.what();
+    }
+    check(message == "dataset path is empty", "an exception on the loader thread reaches the caller");
+  }
+  {
+    //Training fails early while the loader is still blocked on a full queue with many paths to go
+    vector<string> many;
+    for(int i = 0; i < 100; i++){
+      many.push_back("d" + to_string(i) + ".csv");
+    }
+    FailingModel model("d3.csv");
+    bool threw = false;
+    try{
+      model.trainPipeline(many, 1);
+    }catch(const runtime_error&){
+      threw = true;
+    }
+    check(threw && model.trained == 3, "an exception in a model step stops the other stages");
+  }
+
+  //Benchmark: sequential vs pipelined over many datasets, e.g. ./pipelined 500
+  int datasetCount = argc > 1 ? atoi(argv[1]) : 50;
+  vector<string> paths;
+  for(int i = 0; i < datasetCount; i++){
+    paths.push_back("dataset_" + to_string(i) + ".csv");
+  }
+  struct Mix {
+    const char* name;
+    int load, preprocess, train;
+  };
+  //Costs in microseconds for load (I/O), preprocess (CPU) and train (CPU)
+  Mix mixes[] = {
+    {"I/O heavy", 2000, 200, 500},
+    {"CPU heavy", 200, 1000, 2000},
+    {"balanced", 1000, 500, 1000},
+  };
+  cout << "===Pipelining benchmark over " << datasetCount << " datasets===" << endl;
+  for(auto& mix: mixes){
+    SimulatedModel model{chrono::microseconds(mix.train)};
+    model.setCommonCosts(chrono::microseconds(mix.load), chrono::microseconds(mix.preprocess));
+    double sequential = runSeconds(model, paths, false);
+    double pipelined = runSeconds(model, paths, true);
+    cout << mix.name << ": sequential " << sequential << " s, pipelined " << pipelined
+         << " s, speedup " << sequential / pipelined << "x" << endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,473 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+//preprocessData() is the shared, non virtual step of the template, so every model gets what we put in it.
+//This file gives it real column transforms: z-score standardization, min-max scaling, missing value (NaN)
+//imputation and one-hot encoding. Each one is a small kernel written three times (scalar, AVX2, AVX-512);
+//the best one the CPU supports is picked once at runtime, and a column is split into chunks across threads.
+
+struct ColumnStats {
+  double sum = 0;
+  double min = numeric_limits<double>::infinity();
+  double max = -numeric_limits<double>::infinity();
+  size_t count = 0;
+
+  void mergeWith(const ColumnStats& other){
+    sum = sum + other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count = count + other.count;
+  }
+};
+
+//One set of kernels per instruction set. Every kernel skips NaN (missing) values
+struct Kernels {
+  const char* name;
+  //Sum, min, max and number of present values
+  void (*stats)(const double* x, size_t n, ColumnStats& out);
+  //Sum of (x - mean)^2, the second pass of a numerically stable variance
+  double (*squaredDeviation)(const double* x, size_t n, double mean);
+  //x = ((isnan(x) ? fill : x) - shift) * scale, in place: imputation and scaling in one pass
+  void (*imputeAffine)(double* x, size_t n, double fill, double shift, double scale);
+  //out = (x == category) ? 1 : 0
+  void (*oneHot)(const double* x, size_t n, double category, double* out);
+};
+
+namespace scalar {
+  void stats(const double* x, size_t n, ColumnStats& out){
+    for(size_t i = 0; i < n; i++){
+      if(!isnan(x[i])){
+        out.sum = out.sum + x[i];
+        out.min = min(out.min, x[i]);
+        out.max = max(out.max, x[i]);
+        out.count++;
+      }
+    }
+  }
+  double squaredDeviation(const double* x, size_t n, double mean){
+    double total = 0;
+    for(size_t i = 0; i < n; i++){
+      if(!isnan(x[i])){
+        total = total + (x[i] - mean) * (x[i] - mean);
+      }
+    }
+    return total;
+  }
+  void imputeAffine(double* x, size_t n, double fill, double shift, double scale){
+    for(size_t i = 0; i < n; i++){
+      x[i] = ((isnan(x[i]) ? fill : x[i]) - shift) * scale;
+    }
+  }
+  void oneHot(const double* x, size_t n, double category, double* out){
+    for(size_t i = 0; i < n; i++){
+      out[i] = x[i] == category ? 1.0 : 0.0;
+    }
+  }
+  const Kernels kernels = {"scalar", stats, squaredDeviation, imputeAffine, oneHot};
+}
+
+#if defined(__x86_64__)
+//The vector loops handle 4 (AVX2) or 8 (AVX-512) doubles at a time, the scalar kernels finish the tail
+namespace avx2 {
+  __attribute__((target("avx2"))) void stats(const double* x, size_t n, ColumnStats& out){
+    __m256d sum = _mm256_setzero_pd();
+    __m256d lo = _mm256_set1_pd(numeric_limits<double>::infinity());
+    __m256d hi = _mm256_set1_pd(-numeric_limits<double>::infinity());
+    size_t count = 0, i = 0;
+    for(; i + 4 <= n; i = i + 4){
+      __m256d v = _mm256_loadu_pd(x + i);
+      __m256d present = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+      sum = _mm256_add_pd(sum, _mm256_and_pd(v, present));
+      lo = _mm256_blendv_pd(lo, _mm256_min_pd(lo, v), present);
+      hi = _mm256_blendv_pd(hi, _mm256_max_pd(hi, v), present);
+      count = count + __builtin_popcount(_mm256_movemask_pd(present));
+    }
+    double s[4], l[4], h[4];
+    _mm256_storeu_pd(s, sum);
+    _mm256_storeu_pd(l, lo);
+    _mm256_storeu_pd(h, hi);
+    ColumnStats part;
+    part.sum = (s[0] + s[1]) + (s[2] + s[3]);
+    part.min = min(min(l[0], l[1]), min(l[2], l[3]));
+    part.max = max(max(h[0], h[1]), max(h[2], h[3]));
+    part.count = count;
+    scalar::stats(x + i, n - i, part);
+    out.mergeWith(part);
+  }
+  __attribute__((target("avx2"))) double squaredDeviation(const double* x, size_t n, double mean){
+    __m256d total = _mm256_setzero_pd();
+    __m256d m = _mm256_set1_pd(mean);
+    size_t i = 0;
+    for(; i + 4 <= n; i = i + 4){
+      __m256d v = _mm256_loadu_pd(x + i);
+      __m256d d = _mm256_and_pd(_mm256_sub_pd(v, m), _mm256_cmp_pd(v, v, _CMP_ORD_Q));
+      total = _mm256_add_pd(total, _mm256_mul_pd(d, d));
+    }
+    double t[4];
+    _mm256_storeu_pd(t, total);
+    return (t[0] + t[1]) + (t[2] + t[3]) + scalar::squaredDeviation(x + i, n - i, mean);
+  }
+  __attribute__((target("avx2"))) void imputeAffine(double* x, size_t n, double fill, double shift, double scale){
+    __m256d f = _mm256_set1_pd(fill), s = _mm256_set1_pd(shift), k = _mm256_set1_pd(scale);
+    size_t i = 0;
+    for(; i + 4 <= n; i = i + 4){
+      __m256d v = _mm256_loadu_pd(x + i);
+      v = _mm256_blendv_pd(f, v, _mm256_cmp_pd(v, v, _CMP_ORD_Q));
+      _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_sub_pd(v, s), k));
+    }
+    scalar::imputeAffine(x + i, n - i, fill, shift, scale);
+  }
+  __attribute__((target("avx2"))) void oneHot(const double* x, size_t n, double category, double* out){
+    __m256d c = _mm256_set1_pd(category), one = _mm256_set1_pd(1.0);
+    size_t i = 0;
+    for(; i + 4 <= n; i = i + 4){
+      __m256d hit = _mm256_cmp_pd(_mm256_loadu_pd(x + i), c, _CMP_EQ_OQ);
+      _mm256_storeu_pd(out + i, _mm256_and_pd(hit, one));
+    }
+    scalar::oneHot(x + i, n - i, category, out + i);
+  }
+  const Kernels kernels = {"avx2", stats, squaredDeviation, imputeAffine, oneHot};
+}
+
+namespace avx512 {
+  //Horizontal reductions through memory; the _mm512_reduce_* helpers trip -Wuninitialized in GCC 12's own headers
+  __attribute__((target("avx512f"))) double sumOf(__m512d v){
+    double t[8];
+    _mm512_storeu_pd(t, v);
+    return ((t[0] + t[1]) + (t[2] + t[3])) + ((t[4] + t[5]) + (t[6] + t[7]));
+  }
+  __attribute__((target("avx512f"))) double minOf(__m512d v){
+    double t[8];
+    _mm512_storeu_pd(t, v);
+    return *min_element(t, t + 8);
+  }
+  __attribute__((target("avx512f"))) double maxOf(__m512d v){
+    double t[8];
+    _mm512_storeu_pd(t, v);
+    return *max_element(t, t + 8);
+  }
+  __attribute__((target("avx512f"))) void stats(const double* x, size_t n, ColumnStats& out){
+    __m512d sum = _mm512_setzero_pd();
+    __m512d lo = _mm512_set1_pd(numeric_limits<double>::infinity());
+    __m512d hi = _mm512_set1_pd(-numeric_limits<double>::infinity());
+    size_t count = 0, i = 0;
+    for(; i + 8 <= n; i = i + 8){
+      __m512d v = _mm512_loadu_pd(x + i);
+      __mmask8 present = _mm512_cmp_pd_mask(v, v, _CMP_ORD_Q);
+      sum = _mm512_mask_add_pd(sum, present, sum, v);
+      lo = _mm512_mask_min_pd(lo, present, lo, v);
+      hi = _mm512_mask_max_pd(hi, present, hi, v);
+      count = count + __builtin_popcount(present);
+    }
+    ColumnStats part;
+    part.sum = sumOf(sum);
+    part.min = minOf(lo);
+    part.max = maxOf(hi);
+    part.count = count;
+    scalar::stats(x + i, n - i, part);
+    out.mergeWith(part);
+  }
+  __attribute__((target("avx512f"))) double squaredDeviation(const double* x, size_t n, double mean){
+    __m512d total = _mm512_setzero_pd();
+    __m512d m = _mm512_set1_pd(mean);
+    size_t i = 0;
+    for(; i + 8 <= n; i = i + 8){
+      __m512d v = _mm512_loadu_pd(x + i);
+      __m512d d = _mm512_sub_pd(v, m);
+      total = _mm512_mask3_fmadd_pd(d, d, total, _mm512_cmp_pd_mask(v, v, _CMP_ORD_Q));
+    }
+    return sumOf(total) + scalar::squaredDeviation(x + i, n - i, mean);
+  }
+  __attribute__((target("avx512f"))) void imputeAffine(double* x, size_t n, double fill, double shift, double scale){
+    __m512d f = _mm512_set1_pd(fill), s = _mm512_set1_pd(shift), k = _mm512_set1_pd(scale);
+    size_t i = 0;
+    for(; i + 8 <= n; i = i + 8){
+      __m512d v = _mm512_loadu_pd(x + i);
+      v = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, v, _CMP_ORD_Q), f, v);
+      _mm512_storeu_pd(x + i, _mm512_mul_pd(_mm512_sub_pd(v, s), k));
+    }
+    scalar::imputeAffine(x + i, n - i, fill, shift, scale);
+  }
+  __attribute__((target("avx512f"))) void oneHot(const double* x, size_t n, double category, double* out){
+    __m512d c = _mm512_set1_pd(category), one = _mm512_set1_pd(1.0);
+    size_t i = 0;
+    for(; i + 8 <= n; i = i + 8){
+      __mmask8 hit = _mm512_cmp_pd_mask(_mm512_loadu_pd(x + i), c, _CMP_EQ_OQ);
+      _mm512_storeu_pd(out + i, _mm512_maskz_mov_pd(hit, one));
+    }
+    scalar::oneHot(x + i, n - i, category, out + i);
+  }
+  const Kernels kernels = {"avx512", stats, squaredDeviation, imputeAffine, oneHot};
+}
+#endif
+
+//Every kernel set this CPU can run, best one last
+vector<const Kernels*> supportedKernels(){
+  vector<const Kernels*> all = {&scalar::kernels};
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    all.push_back(&avx2::kernels);
+  }
+  if(__builtin_cpu_supports("avx512f")){
+    all.push_back(&avx512::kernels);
+  }
+#endif
+  return all;
+}
+
+//Runs the kernels over whole columns, one chunk per thread
+class Preprocessor {
+  const Kernels* kernels;
+  int threads;
+
+  //Splits [0, n) into `threads` chunks and calls work(chunkIndex, begin, end) for each, in parallel
+  template <typename F>
+  void forChunks(size_t n, F work){
+    int count = (int)min<size_t>(threads, max<size_t>(1, n / 65536));
+    if(count <= 1){
+      work(0, 0, n);
+      return;
+    }
+    vector<thread> workers;
+    for(int c = 0; c < count; c++){
+      workers.emplace_back(work, c, n * c / count, n * (c + 1) / count);
+    }
+    for(auto& t: workers){
+      t.join();
+    }
+  }
+
+  public:
+    Preprocessor(const Kernels* k = nullptr, int t = 0){
+      kernels = k != nullptr ? k : supportedKernels().back();
+      threads = t > 0 ? t : max(1u, thread::hardware_concurrency());
+    }
+    const char* kernelName(){
+      return kernels->name;
+    }
+
+    ColumnStats stats(const vector<double>& x){
+      vector<ColumnStats> parts(threads);
+      forChunks(x.size(), [&](int c, size_t b, size_t e){ kernels->stats(x.data() + b, e - b, parts[c]); });
+      ColumnStats total;
+      for(auto& part: parts){
+        total.mergeWith(part);
+      }
+      return total;
+    }
+
+    //Mean and standard deviation of the present values, with the stable two pass formula
+    void meanAndDeviation(const vector<double>& x, double& mean, double& deviation){
+      ColumnStats s = stats(x);
+      mean = s.count ? s.sum / s.count : 0;
+      vector<double> parts(threads, 0.0);
+      forChunks(x.size(), [&](int c, size_t b, size_t e){ parts[c] = kernels->squaredDeviation(x.data() + b, e - b, mean); });
+      double total = 0;
+      for(double part: parts){
+        total = total + part;
+      }
+      deviation = s.count ? sqrt(total / s.count) : 0;
+    }
+
+    //Missing values become the mean, then (x - mean) / deviation
+    void standardize(vector<double>& x){
+      double mean, deviation;
+      meanAndDeviation(x, mean, deviation);
+      double scale = deviation > 0 ? 1.0 / deviation : 0.0;
+      forChunks(x.size(), [&](int, size_t b, size_t e){ kernels->imputeAffine(x.data() + b, e - b, mean, mean, scale); });
+    }
+
+    //Missing values become the mean, then (x - min) / (max - min), so everything ends in [0, 1]
+    void minMaxScale(vector<double>& x){
+      ColumnStats s = stats(x);
+      double mean = s.count ? s.sum / s.count : 0;
+      double range = s.max - s.min;
+      double scale = s.count && range > 0 ? 1.0 / range : 0.0;
+      double shift = s.count ? s.min : 0;
+      forChunks(x.size(), [&](int, size_t b, size_t e){ kernels->imputeAffine(x.data() + b, e - b, mean, shift, scale); });
+    }
+
+    //Only fills the missing values, with the mean of the present ones
+    void imputeMean(vector<double>& x){
+      ColumnStats s = stats(x);
+      double mean = s.count ? s.sum / s.count : 0;
+      forChunks(x.size(), [&](int, size_t b, size_t e){ kernels->imputeAffine(x.data() + b, e - b, mean, 0.0, 1.0); });
+    }
+
+    //A column holding category codes 0..categories-1 becomes one 0/1 column per category (NaN -> all zero)
+    vector<vector<double>> oneHot(const vector<double>& x, int categories){
+      vector<vector<double>> out(categories, vector<double>(x.size()));
+      for(int k = 0; k < categories; k++){
+        forChunks(x.size(), [&](int, size_t b, size_t e){ kernels->oneHot(x.data() + b, e - b, k, out[k].data() + b); });
+      }
+      return out;
+    }
+};
+
+class ModelTrainer {
+  public:
+    void trainPipeline(const string& path){
+      loadData(path);
+      preprocessData();
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+    virtual ~ModelTrainer() {}
+  protected:
+  //Numeric feature columns plus one categorical column, as codes
+    vector<vector<double>> features;
+    vector<double> category;
+    vector<vector<double>> encoded;
+
+    void loadData(const string& path){
+      cout << "[Common] Loading data from " << path << endl;
+      features = {{1, 2, NAN, 4, 5}, {10, 20, 30, NAN, 50}};
+      category = {0, 2, 1, 2, NAN};
+    }
+
+  //Shared by every model: impute + standardize every feature, one-hot the category
+    void preprocessData(){
+      Preprocessor preprocessor;
+      cout << "[Common] Preprocessing data with " << preprocessor.kernelName() << " kernels" << endl;
+      for(auto& column: features){
+        preprocessor.standardize(column);
+      }
+      encoded = preprocessor.oneHot(category, 3);
+    }
+
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+
+    virtual void saveModel(){
+      cout << "[Common] Saving model" << endl;
+    }
+};
+
+class DecisionTreeModel : public ModelTrainer {
+  protected:
+    void trainModel() override {
+      cout << "[DecisionTreeModel] Training on standardized feature 0:";
+      for(double v: features[0]){
+        cout << " " << v;
+      }
+      cout << endl << "[DecisionTreeModel] One-hot of category 2:";
+      for(double v: encoded[2]){
+        cout << " " << v;
+      }
+      cout << endl;
+    }
+    void evaluateModel() override {
+      cout << "[DecisionTreeModel] Evaluating decision tree model" << endl;
+    }
+};
+
+//Accuracy checks: every kernel set against a plain long double reference
+static int failures = 0;
+static void check(bool condition, const string& what){
+  cout << (condition ? "  ok   " : "  FAIL ") << what << endl;
+  failures = failures + !condition;
+}
+static bool close(const vector<double>& a, const vector<double>& b, double tolerance){
+  for(size_t i = 0; i < a.size(); i++){
+    if(fabs(a[i] - b[i]) > tolerance * max(1.0, fabs(b[i]))){
+      return false;
+    }
+  }
+  return a.size() == b.size();
+}
+
+static void runChecks(){
+  cout << "===Kernel checks===" << endl;
+  mt19937_64 random(42);
+  normal_distribution<double> values(100, 15);
+  //Odd length so every vector loop also has a scalar tail
+  vector<double> input(1000003);
+  for(size_t i = 0; i < input.size(); i++){
+    input[i] = i % 97 == 0 ? NAN : values(random);
+  }
+  long double sum = 0, squares = 0;
+  double lo = INFINITY, hi = -INFINITY;
+  size_t count = 0;
+  for(double v: input){
+    if(!isnan(v)){
+      sum = sum + v;
+      lo = min(lo, v);
+      hi = max(hi, v);
+      count++;
+    }
+  }
+  double mean = (double)(sum / count);
+  for(double v: input){
+    if(!isnan(v)){
+      squares = squares + ((long double)v - mean) * ((long double)v - mean);
+    }
+  }
+  double deviation = (double)sqrtl(squares / count);
+  vector<double> zscore(input.size()), minmax(input.size());
+  for(size_t i = 0; i < input.size(); i++){
+    double v = isnan(input[i]) ? mean : input[i];
+    zscore[i] = (v - mean) / deviation;
+    minmax[i] = (v - lo) / (hi - lo);
+  }
+
+  for(auto kernels: supportedKernels()){
+    Preprocessor p(kernels, 4);
+    string name = kernels->name;
+    vector<double> x = input;
+    p.standardize(x);
+    check(close(x, zscore, 1e-9), name + " z-score");
+    x = input;
+    p.minMaxScale(x);
+    check(close(x, minmax, 1e-12), name + " min-max");
+    x = input;
+    p.imputeMean(x);
+    check(isnan(input[0]) && fabs(x[0] - mean) < 1e-9 && x[1] == input[1], name + " mean imputation");
+    vector<double> codes = {0, 1, 2, 1, NAN, 0, 2, 2, 1};
+    auto hot = p.oneHot(codes, 3);
+    check(hot[1] == vector<double>{0, 1, 0, 1, 0, 0, 0, 0, 1} && hot[0][4] == 0 && hot[2][4] == 0, name + " one-hot");
+  }
+}
+
+int main(int argc, char** argv){
+  runChecks();
+
+  ModelTrainer* trainer = new DecisionTreeModel();
+  trainer->trainPipeline("decision_tree_data.csv");
+  delete trainer;
+
+  //Benchmark: rows per second of standardize, e.g. ./kernels 100000000 for 100M rows
+  size_t rows = argc > 1 ? atol(argv[1]) : 10000000;
+  vector<double> column(rows);
+  for(size_t i = 0; i < rows; i++){
+    column[i] = i % 101 == 0 ? NAN : (double)(i % 1000);
+  }
+  cout << "===Standardizing " << rows << " rows===" << endl;
+  vector<int> threadCounts = {1};
+  if(thread::hardware_concurrency() > 1){
+    threadCounts.push_back(thread::hardware_concurrency());
+  }
+  for(auto kernels: supportedKernels()){
+    for(int threads: threadCounts){
+      vector<double> x = column;
+      Preprocessor p(kernels, threads);
+      auto start = chrono::steady_clock::now();
+      p.standardize(x);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      cout << kernels->name << ", " << threads << " thread(s): " << rows / seconds / 1e6 << " M rows/s" << endl;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,439 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+//Every trainPipeline(path) call runs loadData and preprocessData again, even when the file did not change.
+//Here their output is cached on disk. The cache key is a hash of the file *contents* plus a version tag of the
+//preprocessing code, so a changed file or changed preprocessing can never give an old result.
+//The cached columns are stored aligned in a file which is mmaped on a hit, so a hit reads no numbers at all.
+
+//Read only memory mapping of a whole file, shared by the hashing, the loader and the cache
+class MappedFile {
+  void* base = MAP_FAILED;
+  size_t length = 0;
+  public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool open(const string& path){
+      close();
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if(fd < 0){
+        return false;
+      }
+      struct stat st;
+      if(fstat(fd, &st) != 0){
+        ::close(fd);
+        return false;
+      }
+      length = st.st_size;
+      if(length > 0){
+        base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      ::close(fd);
+      return length == 0 || base != MAP_FAILED;
+    }
+    void close(){
+      if(base != MAP_FAILED){
+        munmap(base, length);
+      }
+      base = MAP_FAILED;
+      length = 0;
+    }
+    ~MappedFile(){
+      close();
+    }
+    const char* data(){
+      return base == MAP_FAILED ? "" : (const char*)base;
+    }
+    size_t size(){
+      return length;
+    }
+};
+
+//XXH64, a fast non cryptographic hash (several GB/s), so hashing the input costs far less than parsing it
+class ContentHash {
+  static const uint64_t p1 = 11400714785074694791ULL;
+  static const uint64_t p2 = 14029467366897019727ULL;
+  static const uint64_t p3 = 1609587929392839161ULL;
+  static const uint64_t p4 = 9650029242287828579ULL;
+  static const uint64_t p5 = 2870177450012600261ULL;
+
+  static uint64_t rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+  }
+  static uint64_t read64(const char* p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+  }
+  static uint32_t read32(const char* p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+  static uint64_t round(uint64_t acc, uint64_t input){
+    acc = acc + input * p2;
+    return rotl(acc, 31) * p1;
+  }
+  static uint64_t merge(uint64_t acc, uint64_t value){
+    acc = acc ^ round(0, value);
+    return acc * p1 + p4;
+  }
+  public:
+    static uint64_t of(const char* p, size_t length, uint64_t seed = 0){
+      const char* end = p + length;
+      uint64_t h;
+      if(length >= 32){
+        uint64_t v1 = seed + p1 + p2, v2 = seed + p2, v3 = seed, v4 = seed - p1;
+        while(end - p >= 32){
+          v1 = round(v1, read64(p));
+          v2 = round(v2, read64(p + 8));
+          v3 = round(v3, read64(p + 16));
+          v4 = round(v4, read64(p + 24));
+          p = p + 32;
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+      }else{
+        h = seed + p5;
+      }
+      h = h + length;
+      while(end - p >= 8){
+        h = rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+        p = p + 8;
+      }
+      if(end - p >= 4){
+        h = rotl(h ^ (read32(p) * p1), 23) * p2 + p3;
+        p = p + 4;
+      }
+      while(p < end){
+        h = rotl(h ^ ((unsigned char)*p * p5), 11) * p1;
+        p++;
+      }
+      h = (h ^ (h >> 33)) * p2;
+      h = (h ^ (h >> 29)) * p3;
+      return h ^ (h >> 32);
+    }
+};
+
+//Columns as the model steps see them: one contiguous array per column.
+//They point either into vectors owned by the trainer (cache miss) or straight into the mmaped cache file (cache hit).
+struct ColumnView {
+  vector<string> names;
+  vector<const double*> columns;
+  size_t rows = 0;
+};
+
+//Cache file layout, every offset from the start of the file:
+//  CacheHeader
+//  names: every column name followed by '\0'
+//  columns: rows doubles per column, each column starting on a 64 byte boundary
+struct CacheHeader {
+  char magic[8];
+  uint32_t formatVersion;
+  uint32_t preprocessVersion;
+  uint64_t contentHash;
+  uint64_t rows;
+  uint64_t columnCount;
+  uint64_t namesOffset;
+  uint64_t dataOffset;
+  uint64_t fileSize;
+};
+
+static const char cacheMagic[8] = {'L', 'L', 'D', 'C', 'O', 'L', 'S', '1'};
+static const uint32_t cacheFormatVersion = 1;
+
+class StageCache {
+  string directory;
+
+  static uint64_t alignUp(uint64_t value){
+    return (value + 63) & ~(uint64_t)63;
+  }
+  static uint64_t columnStride(uint64_t rows){
+    return alignUp(rows * sizeof(double));
+  }
+
+  public:
+    StageCache(const string& dir){
+      directory = dir;
+      filesystem::create_directories(directory);
+    }
+
+    //Cache file name for a content hash and a preprocessing version
+    string pathFor(uint64_t contentHash, uint32_t preprocessVersion){
+      char name[64];
+      snprintf(name, sizeof(name), "%016llx-v%u.cols", (unsigned long long)contentHash, preprocessVersion);
+      return directory + "/" + name;
+    }
+
+    //Maps a cached result into `file` and points `view` at it. False when there is no valid entry.
+    bool open(uint64_t contentHash, uint32_t preprocessVersion, MappedFile& file, ColumnView& view){
+      if(!file.open(pathFor(contentHash, preprocessVersion)) || file.size() < sizeof(CacheHeader)){
+        return false;
+      }
+      const CacheHeader* h = (const CacheHeader*)file.data();
+      //Everything is checked, a truncated or foreign file is treated like a miss
+      if(memcmp(h->magic, cacheMagic, sizeof(cacheMagic)) != 0 || h->formatVersion != cacheFormatVersion
+         || h->preprocessVersion != preprocessVersion || h->contentHash != contentHash || h->fileSize != file.size()
+         || h->dataOffset + h->columnCount * columnStride(h->rows) > file.size()){
+        file.close();
+        return false;
+      }
+      view = ColumnView();
+      view.rows = h->rows;
+      const char* name = file.data() + h->namesOffset;
+      const char* namesEnd = file.data() + h->dataOffset;
+      for(uint64_t c = 0; c < h->columnCount; c++){
+        size_t length = name < namesEnd ? strnlen(name, namesEnd - name) : 0;
+        view.names.emplace_back(name, length);
+        name = name + length + 1;
+        view.columns.push_back((const double*)(file.data() + h->dataOffset + c * columnStride(h->rows)));
+      }
+      return true;
+    }
+
+    //Writes to a temporary file and renames it, so a crash never leaves a half written entry under the real name
+    bool store(uint64_t contentHash, uint32_t preprocessVersion, const ColumnView& view){
+      string names;
+      for(auto& n: view.names){
+        names += n;
+        names += '\0';
+      }
+      CacheHeader h = {};
+      memcpy(h.magic, cacheMagic, sizeof(cacheMagic));
+      h.formatVersion = cacheFormatVersion;
+      h.preprocessVersion = preprocessVersion;
+      h.contentHash = contentHash;
+      h.rows = view.rows;
+      h.columnCount = view.columns.size();
+      h.namesOffset = sizeof(CacheHeader);
+      h.dataOffset = alignUp(h.namesOffset + names.size());
+      h.fileSize = h.dataOffset + h.columnCount * columnStride(h.rows);
+
+      string finalPath = pathFor(contentHash, preprocessVersion);
+      string tempPath = finalPath + ".tmp" + to_string(getpid());
+      ofstream out(tempPath, ios::binary | ios::trunc);
+      out.write((const char*)&h, sizeof(h));
+      out.write(names.data(), names.size());
+      static const char zeros[64] = {};
+      out.write(zeros, h.dataOffset - h.namesOffset - names.size());
+      for(auto column: view.columns){
+        out.write((const char*)column, view.rows * sizeof(double));
+        out.write(zeros, columnStride(view.rows) - view.rows * sizeof(double));
+      }
+      out.close();
+      if(!out){
+        remove(tempPath.c_str());
+        return false;
+      }
+      return rename(tempPath.c_str(), finalPath.c_str()) == 0;
+    }
+};
+
+class ModelTrainer {
+  public:
+    ModelTrainer(StageCache* c = nullptr){
+      cache = c;
+    }
+    virtual ~ModelTrainer() {}
+
+    void trainPipeline(const string& path){
+      MappedFile input;
+      if(!input.open(path)){
+        cout << "[Common] Cannot open " << path << endl;
+        return;
+      }
+      uint64_t hash = ContentHash::of(input.data(), input.size());
+      //Cache hit: load and preprocess are skipped and the columns come straight from the mapping
+      if(cache != nullptr && cache->open(hash, preprocessVersion, cached, data)){
+        lastRunWasHit = true;
+        cout << "[Cache] Hit for " << path << ", skipping load and preprocess" << endl;
+      }else{
+        lastRunWasHit = false;
+        loadData(input);
+        preprocessData();
+        if(cache != nullptr){
+          cache->store(hash, preprocessVersion, data);
+        }
+      }
+      trainModel();
+      evaluateModel();
+      saveModel();
+    }
+
+    bool wasCacheHit(){
+      return lastRunWasHit;
+    }
+
+  protected:
+  //Bump this whenever preprocessData changes what it produces, old cache entries then stop matching
+    static const uint32_t preprocessVersion = 1;
+
+    ColumnView data;
+
+  //Simple version of the loader from CSV-Loader.cpp: header row with names, then plain numbers, no quoting
+    void loadData(MappedFile& input){
+      cout << "[Common] Loading data (" << input.size() << " bytes)" << endl;
+      owned.clear();
+      data = ColumnView();
+      const char* p = input.data();
+      const char* end = p + input.size();
+      const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+      lineEnd = lineEnd ? lineEnd : end;
+      for(const char* field = p; field <= lineEnd;){
+        const char* comma = (const char*)memchr(field, ',', lineEnd - field);
+        comma = comma ? comma : lineEnd;
+        const char* nameEnd = comma > field && comma[-1] == '\r' ? comma - 1 : comma;
+        data.names.emplace_back(field, nameEnd);
+        field = comma + 1;
+      }
+      owned.resize(data.names.size());
+      for(p = lineEnd < end ? lineEnd + 1 : end; p < end;){
+        lineEnd = (const char*)memchr(p, '\n', end - p);
+        lineEnd = lineEnd ? lineEnd : end;
+        const char* field = p;
+        for(size_t c = 0; c < owned.size(); c++){
+          const char* comma = (const char*)memchr(field, ',', lineEnd - field);
+          comma = comma ? comma : lineEnd;
+          double value = NAN;
+          from_chars(field, comma, value);
+          owned[c].push_back(value);
+          field = min(comma + 1, lineEnd);
+        }
+        p = lineEnd + 1;
+      }
+      for(auto& column: owned){
+        data.columns.push_back(column.data());
+      }
+      data.rows = owned.empty() ? 0 : owned[0].size();
+    }
+
+  //Z-score standardization of every column (this is what preprocessVersion 1 means)
+    void preprocessData(){
+      cout << "[Common] Preprocessing data" << endl;
+      for(auto& column: owned){
+        double sum = 0, squares = 0;
+        for(double v: column){
+          sum = sum + v;
+          squares = squares + v * v;
+        }
+        double mean = column.empty() ? 0 : sum / column.size();
+        double spread = column.empty() ? 0 : sqrt(max(0.0, squares / column.size() - mean * mean));
+        for(double& v: column){
+          v = spread > 0 ? (v - mean) / spread : 0;
+        }
+      }
+    }
+
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+
+    virtual void saveModel(){
+      cout << "[Common] Saving model" << endl;
+    }
+
+  private:
+    StageCache* cache;
+    MappedFile cached;
+    vector<vector<double>> owned;
+    bool lastRunWasHit = false;
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  public:
+    NeuralNetworkModel(StageCache* c) : ModelTrainer(c) {}
+    double checksum = 0;
+  protected:
+    void trainModel() override {
+      checksum = 0;
+      for(size_t c = 0; c < data.columns.size(); c++){
+        for(size_t r = 0; r < data.rows; r++){
+          checksum = checksum + data.columns[c][r] * (c + 1);
+        }
+      }
+      cout << "[NeuralNetworkModel] Training on " << data.rows << " rows" << endl;
+    }
+    void evaluateModel() override {
+      cout << "[NeuralNetworkModel] Evaluating neural network model" << endl;
+    }
+};
+
+static int failures = 0;
+static void check(bool condition, const string& what){
+  cout << (condition ? "  ok   " : "  FAIL ") << what << endl;
+  failures = failures + !condition;
+}
+
+static void writeFile(const string& path, const string& text){
+  ofstream(path, ios::binary | ios::trunc) << text;
+}
+
+int main(int argc, char** argv){
+  string dir = "/tmp/stage-cache-demo";
+  filesystem::remove_all(dir);
+  StageCache cache(dir + "/cache");
+  NeuralNetworkModel model(&cache);
+
+  cout << "===Cache checks===" << endl;
+  check(ContentHash::of("", 0) == 0xEF46DB3751D8E999ULL, "XXH64 of empty input");
+  string path = dir + "/small.csv";
+  string original = "a,b\n1,2\n3,4\n5,9\n";
+  writeFile(path, original);
+  model.trainPipeline(path);
+  double first = model.checksum;
+  check(!model.wasCacheHit(), "first run is a miss");
+  model.trainPipeline(path);
+  check(model.wasCacheHit() && model.checksum == first, "same content is a hit with the same columns");
+  writeFile(path, "a,b\n1,2\n3,4\n5,7\n");
+  model.trainPipeline(path);
+  check(!model.wasCacheHit() && model.checksum != first, "changed content is a miss");
+  writeFile(path, original);
+  model.trainPipeline(path);
+  check(model.wasCacheHit() && model.checksum == first, "content changed back hits the old entry again");
+  //A broken entry must be ignored, not trusted
+  string entry = cache.pathFor(ContentHash::of(original.data(), original.size()), 1);
+  filesystem::resize_file(entry, filesystem::file_size(entry) - 8);
+  model.trainPipeline(path);
+  check(!model.wasCacheHit() && model.checksum == first, "truncated entry is a miss");
+
+  //Benchmark: cold vs warm pipeline, e.g. ./stage-cache 2048 for a 2 GB input
+  size_t megabytes = argc > 1 ? atol(argv[1]) : 128;
+  string big = dir + "/neural_network_data.csv";
+  {
+    FILE* out = fopen(big.c_str(), "w");
+    fputs("feature1,feature2,feature3,label\n", out);
+    size_t written = 0;
+    char line[128];
+    for(long i = 0; written < megabytes << 20; i++){
+      int n = snprintf(line, sizeof(line), "%ld.%03ld,%ld,-%ld.25,%ld\n", i % 1000, i % 997, i % 50, i % 31, i % 2);
+      fwrite(line, 1, n, out);
+      written = written + n;
+    }
+    fclose(out);
+  }
+  auto start = chrono::steady_clock::now();
+  model.trainPipeline(big);
+  double cold = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  start = chrono::steady_clock::now();
+  model.trainPipeline(big);
+  double warm = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "===" << megabytes << " MB input: cold " << cold << " s, warm " << warm << " s ("
+       << cold / warm << "x)===" << endl;
+
+  filesystem::remove_all(dir);
+  return failures == 0 ? 0 : 1;
+}
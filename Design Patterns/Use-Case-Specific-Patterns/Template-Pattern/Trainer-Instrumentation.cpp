@@ -0,0 +1,318 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+#include <new>
+#include <typeinfo>
+#include <cxxabi.h>
+using namespace std;
+
+//Measures every step the template method calls: how long it took (ns) and how many heap allocations it made.
+//The results go into one latency histogram per model and step, and can be exported as a Chrome trace
+//(open chrome://tracing or https://ui.perfetto.dev and load the json file).
+//
+//Profiling is a compile time switch. Build with -DSTAGE_PROFILING=0 and every measurement is compiled out,
+//trainPipeline then calls the steps exactly like Template-Pattern.cpp does.
+#ifndef STAGE_PROFILING
+#define STAGE_PROFILING 1
+#endif
+
+#if STAGE_PROFILING
+//Counts heap allocations of the current thread, read before and after a step
+thread_local uint64_t allocationCount = 0;
+
+void* operator new(size_t size){
+  allocationCount++;
+  if(void* p = malloc(size ? size : 1)){
+    return p;
+  }
+  throw bad_alloc();
+}
+void operator delete(void* p) noexcept {
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+#endif
+
+// HDR style histogram of latencies, in the unit the caller records: values are grouped by their highest bit, and each
+// power of two is split into 16 linear sub buckets (values below 32 get a bucket each). A percentile is reported as the
+// upper edge of its bucket, so it is at most 1/16 (6.25%) above the real value. The table is 60 x 32 x 8 B, about 15 KB.
+// Every example is a standalone program, so Kitchen-Simulator.cpp, Trainer-Instrumentation.cpp and Replay-Harness.cpp
+// each carry this class; the three copies are identical on purpose, change them together.
+class LatencyHistogram {
+    static const int subBits = 5;
+    static const int subCount = 1 << subBits;
+    uint64_t buckets[64 - subBits + 1][subCount] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static void locate(uint64_t value, int& range, int& sub) {
+        int highest = value == 0 ? 0 : 63 - __builtin_clzll(value);
+        range = highest < subBits ? 0 : highest - subBits + 1;
+        sub = (int)((value >> range) & (subCount - 1));
+    }
+public:
+    void record(uint64_t value) {
+        int range, sub;
+        locate(value, range, sub);
+        buckets[range][sub]++;
+        total++;
+        maxValue = max(maxValue, value);
+    }
+    void add(const LatencyHistogram& other) {
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                buckets[range][sub] += other.buckets[range][sub];
+            }
+        }
+        total += other.total;
+        maxValue = max(maxValue, other.maxValue);
+    }
+    uint64_t count() const {
+        return total;
+    }
+    uint64_t maximum() const {
+        return maxValue;
+    }
+    // Smallest value v such that at least `percent` of the recorded values are <= v (upper edge of the bucket)
+    uint64_t percentile(double percent) const {
+        uint64_t wanted = max<uint64_t>(1, (uint64_t)(total * percent / 100.0 + 0.5));
+        uint64_t seen = 0;
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                seen += buckets[range][sub];
+                if (seen >= wanted) {
+                    return min(((((uint64_t)sub + 1) << range) - 1), maxValue);
+                }
+            }
+        }
+        return maxValue;
+    }
+};
+
+//The steps trainPipeline calls, in order
+enum PipelineStep { LoadData, PreprocessData, TrainModel, EvaluateModel, SaveModel, StepCount };
+static const char* stepNames[StepCount] = {"loadData", "preprocessData", "trainModel", "evaluateModel", "saveModel"};
+
+//Everything measured for one model (subclass)
+struct ModelProfile {
+  string model;
+  LatencyHistogram latency[StepCount];  //in nanoseconds
+  uint64_t allocations[StepCount] = {};
+};
+
+//Collects the measurements of every trainer. It is a Singleton, like in Singleton-Pattern.md,
+//because all trainers of the process should end up in the same report and the same trace file.
+class StageProfiler {
+  struct TraceEvent {
+    const ModelProfile* profile;
+    PipelineStep step;
+    uint64_t startNs;
+    uint64_t durationNs;
+    uint64_t allocations;
+    size_t threadId;
+  };
+  mutex m;
+  //Looked up by name once per trainer, after that the trainer keeps the pointer (map nodes never move)
+  map<string, ModelProfile> profiles;
+  vector<TraceEvent> events;
+  //Trace events are capped so a long run cannot use up all the memory, histograms keep counting
+  size_t maxEvents = 1000000;
+  chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+  StageProfiler() {}
+  public:
+    static StageProfiler& instance(){
+      static StageProfiler profiler;
+      return profiler;
+    }
+
+    uint64_t nowNs(){
+      return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count();
+    }
+
+    ModelProfile* profileFor(const string& model){
+      lock_guard<mutex> lock(m);
+      ModelProfile& profile = profiles[model];
+      profile.model = model;
+      return &profile;
+    }
+
+    void record(ModelProfile* profile, PipelineStep step, uint64_t startNs, uint64_t durationNs, uint64_t allocations){
+      lock_guard<mutex> lock(m);
+      profile->latency[step].record(durationNs);
+      profile->allocations[step] = profile->allocations[step] + allocations;
+      if(events.size() < maxEvents){
+        events.push_back({profile, step, startNs, durationNs, allocations, hash<thread::id>()(this_thread::get_id())});
+      }
+    }
+
+    void printReport(){
+      lock_guard<mutex> lock(m);
+      for(auto& entry: profiles){
+        ModelProfile& profile = entry.second;
+        cout << profile.model << endl;
+        for(int s = 0; s < StepCount; s++){
+          LatencyHistogram& h = profile.latency[s];
+          if(h.count() == 0){
+            continue;
+          }
+          cout << "  " << stepNames[s] << ": calls " << h.count() << ", p50 " << h.percentile(50) << " ns, p99 "
+               << h.percentile(99) << " ns, max " << h.maximum() << " ns, allocs/call "
+               << (double)profile.allocations[s] / h.count() << endl;
+        }
+      }
+    }
+
+    //Chrome trace event format: one complete ("X") event per step, timestamps in microseconds
+    bool exportChromeTrace(const string& path){
+      lock_guard<mutex> lock(m);
+      ofstream out(path);
+      out << "{\"traceEvents\":[\n";
+      for(size_t i = 0; i < events.size(); i++){
+        TraceEvent& e = events[i];
+        out << "{\"name\":\"" << stepNames[e.step] << "\",\"cat\":\"" << e.profile->model << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << e.threadId % 100000 << ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durationNs / 1000.0
+            << ",\"args\":{\"allocations\":" << e.allocations << "}}" << (i + 1 < events.size() ? ",\n" : "\n");
+      }
+      out << "]}\n";
+      return out.good();
+    }
+};
+
+class ModelTrainer {
+  public:
+    void trainPipeline(const string& path){
+      step(LoadData, [&]{ loadData(path); });
+      step(PreprocessData, [&]{ preprocessData(); });
+      step(TrainModel, [&]{ trainModel(); });
+      step(EvaluateModel, [&]{ evaluateModel(); });
+      step(SaveModel, [&]{ saveModel(); });
+    }
+    virtual ~ModelTrainer() {}
+
+  protected:
+    vector<double> rows;
+
+    void loadData(const string& path){
+      rows.assign(path.size() * 4, 1.0);
+    }
+
+    void preprocessData(){
+      for(auto& v: rows){
+        v = v * 0.5;
+      }
+    }
+
+    virtual void trainModel() = 0;
+    virtual void evaluateModel() = 0;
+
+    virtual void saveModel(){
+      string summary = "rows=" + to_string(rows.size());
+    }
+
+  private:
+  //Runs one step, and when profiling is compiled in, measures it.
+  //With profiling off this is just f(), which the compiler inlines away
+    template <typename F>
+    void step(PipelineStep which, F f){
+#if STAGE_PROFILING
+      StageProfiler& profiler = StageProfiler::instance();
+      if(profile == nullptr){
+        profile = profiler.profileFor(modelName());
+      }
+      uint64_t allocationsBefore = allocationCount;
+      uint64_t start = profiler.nowNs();
+      f();
+      uint64_t end = profiler.nowNs();
+      profiler.record(profile, which, start, end - start, allocationCount - allocationsBefore);
+#else
+      (void)which;
+      f();
+#endif
+    }
+
+  //Name of the concrete subclass, e.g. "NeuralNetworkModel", so every subclass gets its own histograms.
+  //It can not be read in the constructor because the subclass part is not built yet there
+    string modelName(){
+      int status = 0;
+      char* demangled = abi::__cxa_demangle(typeid(*this).name(), nullptr, nullptr, &status);
+      string name = status == 0 ? demangled : typeid(*this).name();
+      free(demangled);
+      return name;
+    }
+    ModelProfile* profile = nullptr;
+};
+
+class NeuralNetworkModel : public ModelTrainer {
+  vector<double> weights;
+  protected:
+    void trainModel() override {
+      weights.assign(64, 0.0);
+      for(double v: rows){
+        weights[(size_t)v % 64] += v;
+      }
+    }
+    void evaluateModel() override {
+      double loss = 0;
+      for(double w: weights){
+        loss = loss + w * w;
+      }
+      weights.push_back(loss);
+    }
+    void saveModel() override {
+      vector<double> copy = weights;
+    }
+};
+
+class DecisionTreeModel : public ModelTrainer {
+  vector<int> splits;
+  protected:
+    void trainModel() override {
+      splits.clear();
+      for(size_t i = 0; i < rows.size(); i = i + 50){
+        splits.push_back((int)i);
+      }
+    }
+    void evaluateModel() override {
+      volatile size_t depth = splits.size();
+      (void)depth;
+    }
+   //Uses default save method
+};
+
+int main(int argc, char** argv){
+  int runs = argc > 1 ? atoi(argv[1]) : 100000;
+  ModelTrainer* nTrainer = new NeuralNetworkModel();
+  ModelTrainer* dTrainer = new DecisionTreeModel();
+
+  //Overhead benchmark: the same loop built with and without -DSTAGE_PROFILING=0
+  auto start = chrono::steady_clock::now();
+  for(int i = 0; i < runs; i++){
+    nTrainer->trainPipeline("neural_network_data.csv");
+    dTrainer->trainPipeline("decision_tree_data.csv");
+  }
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (2.0 * runs);
+  cout << "Profiling " << (STAGE_PROFILING ? "on" : "off (compiled out)") << ": " << ns << " ns per trainPipeline" << endl;
+
+#if STAGE_PROFILING
+  StageProfiler::instance().printReport();
+  string tracePath = "/tmp/trainer_trace.json";
+  if(StageProfiler::instance().exportChromeTrace(tracePath)){
+    cout << "Chrome trace written to " << tracePath << endl;
+  }
+#endif
+  delete nTrainer;
+  delete dTrainer;
+  return 0;
+}
@@ -0,0 +1,560 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+//UserService reads users back now (findUser), and every lookup is a round trip to the database.
+//CachedDatabase is a Database in front of the real one, so UserService does not change:
+//  - reads are served from memory when the user is cached (a hit), and fill the cache on a miss
+//  - writes go to the database first and then to the cache (write-through), so the cache is never newer than the database
+//  - the cache has a memory budget; when it is full, CLOCK picks what to evict
+//  - it is split into shards, each with its own lock, so threads looking up different users rarely wait for each other
+//
+//CLOCK instead of LRU: an LRU list must be reordered on every hit, which needs the exclusive lock.
+//CLOCK only sets a "referenced" bit, so hits take the shard lock in shared mode and many readers run side by side.
+
+// Abstraction (Interface)
+class Database {
+public:
+    virtual void save(string_view data) = 0; // Pure virtual function
+    //Many rows in one call. The default is one save per row; real backends override it with one round trip
+    virtual void saveBatch(const vector<string_view>& rows) {
+        for (string_view row : rows) {
+            save(row);
+        }
+    }
+    //Reads a row back by user ID; false if there is none
+    virtual bool get(string_view id, string& row) = 0;
+    virtual ~Database() {}
+};
+
+//Rows are "id,name,...": the user ID is the key
+string_view userKey(string_view row) {
+    return row.substr(0, row.find(','));
+}
+
+//Local stand-in for MySQL: rows in memory, and every call costs one network round trip
+class MySQLDatabase : public Database {
+public:
+    //SELECT * FROM users WHERE id = ...;
+    bool get(string_view id, string& row) override {
+        roundTrip();
+        lock_guard<mutex> lock(m);
+        calls++;
+        auto it = rows.find(string(id));
+        if (it == rows.end()) {
+            return false;
+        }
+        row = it->second;
+        return true;
+    }
+
+    //INSERT INTO users VALUES(...) ON DUPLICATE KEY UPDATE ...;
+    void save(string_view data) override {
+        roundTrip();
+        lock_guard<mutex> lock(m);
+        calls++;
+        rows[string(userKey(data))] = string(data);
+    }
+
+    void saveBatch(const vector<string_view>& batch) override {
+        roundTrip();
+        lock_guard<mutex> lock(m);
+        calls++;
+        for (string_view data : batch) {
+            rows[string(userKey(data))] = string(data);
+        }
+    }
+
+    chrono::microseconds latency = chrono::microseconds(0);
+    size_t calls = 0;
+
+private:
+    void roundTrip() {
+        if (latency.count() > 0) {
+            this_thread::sleep_for(latency);
+        }
+    }
+
+    mutex m;
+    unordered_map<string, string> rows;
+};
+
+class CachedDatabase : public Database {
+public:
+    struct Options {
+        size_t memoryBudget = 64 << 20;  //bytes of keys, rows and bookkeeping, split evenly over the shards
+        unsigned shards = 256;           //rounded up to a power of two
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t entries;
+        size_t bytes;
+    };
+
+    CachedDatabase(Database* backend) : CachedDatabase(backend, Options()) {}
+
+    CachedDatabase(Database* backend, const Options& options) {
+        this->backend = backend;
+        shardBits = 0;
+        while ((1u << shardBits) < max(1u, options.shards)) {
+            shardBits++;
+        }
+        shards.reset(new Shard[1u << shardBits]);
+        for (unsigned i = 0; i < (1u << shardBits); i++) {
+            shards[i].budget = options.memoryBudget >> shardBits;
+        }
+    }
+
+    bool get(string_view id, string& row) override {
+        Shard& shard = shardOf(id);
+        uint64_t& version = versionOf(shard, id);
+        uint64_t seen;
+        {
+            shared_lock<shared_mutex> read(shard.lock);
+            auto it = shard.index.find(id);
+            if (it != shard.index.end()) {
+                Entry& entry = shard.slots[it->second];
+                row.assign(entry.value);
+                //Only write the bit when it changes, so a hot entry's cache line is not written on every hit
+                if (!entry.referenced.load(memory_order_relaxed)) {
+                    entry.referenced.store(true, memory_order_relaxed);
+                }
+                shard.hits.fetch_add(1, memory_order_relaxed);
+                return true;
+            }
+            seen = version;
+        }
+        shard.misses.fetch_add(1, memory_order_relaxed);
+        if (!backend->get(id, row)) {
+            return false;  //"no such user" is not cached
+        }
+        //If a write to this key finished while we were reading, our row may be older than the cache: do not fill
+        unique_lock<shared_mutex> write(shard.lock);
+        if (version == seen) {
+            insertLocked(shard, id, row);
+        }
+        return true;
+    }
+
+    //Write-through: the database first, then the cache
+    void save(string_view data) override {
+        string_view id = userKey(data);
+        Shard& shard = shardOf(id);
+        lock_guard<mutex> ordered(shard.writeLock);
+        backend->save(data);
+        unique_lock<shared_mutex> write(shard.lock);
+        versionOf(shard, id)++;
+        insertLocked(shard, id, data);
+    }
+
+    //One backend call for the batch; the write locks of all its shards are taken in shard order (no deadlock)
+    void saveBatch(const vector<string_view>& rows) override {
+        vector<unsigned> touched;
+        for (string_view row : rows) {
+            touched.push_back(shardIndex(userKey(row)));
+        }
+        sort(touched.begin(), touched.end());
+        touched.erase(unique(touched.begin(), touched.end()), touched.end());
+        vector<unique_lock<mutex>> ordered;
+        for (unsigned i : touched) {
+            ordered.emplace_back(shards[i].writeLock);
+        }
+        backend->saveBatch(rows);
+        for (string_view row : rows) {
+            Shard& shard = shardOf(userKey(row));
+            unique_lock<shared_mutex> write(shard.lock);
+            versionOf(shard, userKey(row))++;
+            insertLocked(shard, userKey(row), row);
+        }
+    }
+
+    Stats stats() {
+        Stats s = {0, 0, 0, 0, 0};
+        for (unsigned i = 0; i < (1u << shardBits); i++) {
+            Shard& shard = shards[i];
+            shared_lock<shared_mutex> read(shard.lock);
+            s.hits += shard.hits.load(memory_order_relaxed);
+            s.misses += shard.misses.load(memory_order_relaxed);
+            s.evictions += shard.evictions;
+            s.entries += shard.index.size();
+            s.bytes += shard.bytes;
+        }
+        return s;
+    }
+
+private:
+    struct Entry {
+        string key;
+        string value;
+        atomic<bool> referenced{false};  //set by hits (under the shared lock), cleared by the clock hand
+        bool used = false;
+    };
+
+    //Writes are counted per key, hashed into this many counters per shard. Counting per shard would make every write
+    //cancel the fills of all the shard's keys, which with few shards and many threads loses a good share of them.
+    static const unsigned versionSlots = 64;
+
+    //What an entry costs besides its key and row: the Entry, and roughly an index node and bucket
+    static const size_t entryOverhead = sizeof(Entry) + 48;
+
+    //Aligned so two shards' locks and counters never share a cache line
+    struct alignas(64) Shard {
+        shared_mutex lock;  //guards everything below; shared for hits
+        mutex writeLock;    //write-throughs of this shard's keys reach the database and the cache in the same order
+        unordered_map<string_view, uint32_t> index;  //key (owned by its Entry) -> slot
+        deque<Entry> slots;                          //a deque, so entries never move
+        vector<uint32_t> freeSlots;
+        size_t hand = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+        uint64_t versions[versionSlots] = {};  //bumped by every write of a key hashing there
+        uint64_t evictions = 0;
+        atomic<uint64_t> hits{0};
+        atomic<uint64_t> misses{0};
+    };
+
+    unsigned shardIndex(string_view id) {
+        //The top bits of a multiplicative hash, so the shard does not follow the index's bucket
+        return (hash<string_view>()(id) * 0x9E3779B97F4A7C15ull) >> (63 - shardBits) >> 1;
+    }
+
+    Shard& shardOf(string_view id) {
+        return shards[shardIndex(id)];
+    }
+
+    //The low bits of the hash: the shard took the top ones
+    uint64_t& versionOf(Shard& shard, string_view id) {
+        return shard.versions[hash<string_view>()(id) % versionSlots];
+    }
+
+    //Called with the shard's exclusive lock held
+    void insertLocked(Shard& shard, string_view id, string_view row) {
+        auto it = shard.index.find(id);
+        if (it != shard.index.end()) {
+            Entry& entry = shard.slots[it->second];
+            shard.bytes += row.size();
+            shard.bytes -= entry.value.size();
+            entry.value.assign(row);
+            entry.referenced.store(true, memory_order_relaxed);
+            makeRoom(shard, 0);
+            return;
+        }
+        size_t cost = entryOverhead + id.size() + row.size();
+        if (cost > shard.budget) {
+            return;
+        }
+        makeRoom(shard, cost);
+        uint32_t slot;
+        if (shard.freeSlots.empty()) {
+            slot = shard.slots.size();
+            shard.slots.emplace_back();
+        } else {
+            slot = shard.freeSlots.back();
+            shard.freeSlots.pop_back();
+        }
+        Entry& entry = shard.slots[slot];
+        entry.key.assign(id);
+        entry.value.assign(row);
+        entry.referenced.store(false, memory_order_relaxed);  //new entries go first, unless they are read again
+        entry.used = true;
+        shard.index.emplace(string_view(entry.key), slot);
+        shard.bytes += cost;
+    }
+
+    //CLOCK: the hand sweeps the slots; a referenced entry gets a second chance (its bit is cleared), the first
+    //unreferenced one is evicted. Two sweeps at most, because the first clears every bit.
+    void makeRoom(Shard& shard, size_t cost) {
+        while (shard.bytes + cost > shard.budget && !shard.index.empty()) {
+            if (shard.hand >= shard.slots.size()) {
+                shard.hand = 0;
+            }
+            uint32_t slot = shard.hand++;
+            Entry& entry = shard.slots[slot];
+            if (!entry.used) {
+                continue;
+            }
+            if (entry.referenced.load(memory_order_relaxed)) {
+                entry.referenced.store(false, memory_order_relaxed);
+                continue;
+            }
+            shard.index.erase(string_view(entry.key));
+            shard.bytes -= entryOverhead + entry.key.size() + entry.value.size();
+            entry.used = false;
+            string().swap(entry.value);
+            shard.freeSlots.push_back(slot);
+            shard.evictions++;
+        }
+    }
+
+    Database* backend;
+    unsigned shardBits;
+    unique_ptr<Shard[]> shards;
+};
+
+// High-level module (Now loosely coupled)
+class UserService {
+private:
+    Database* db;  // Dependency Injection
+
+public:
+    UserService(Database* database) {
+        db = database;
+    }
+
+    void storeUser(string_view user) {
+        db->save(user);
+    }
+
+    bool findUser(string_view id, string& user) {
+        return db->get(id, user);
+    }
+};
+
+//Zipfian ranks in [0, items): rank 0 is the most popular, as in YCSB (Gray et al., "Quickly generating
+//billion-record synthetic databases"). theta 0.99 is YCSB's default skew.
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t items, double theta = 0.99) {
+        this->items = items;
+        this->theta = theta;
+        zetaN = zeta(items, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta(2, theta) / zetaN);
+    }
+
+    uint64_t next(mt19937_64& random) {
+        double u = uniform_real_distribution<double>(0, 1)(random);
+        double uz = u * zetaN;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + pow(0.5, theta)) {
+            return 1;
+        }
+        return min(items - 1, (uint64_t)(items * pow(eta * u - eta + 1, alpha)));
+    }
+
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1 / pow((double)i, theta);
+        }
+        return sum;
+    }
+
+    uint64_t items;
+    double theta;
+    double zetaN;
+    double alpha;
+    double eta;
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+string userRow(uint64_t id, uint64_t version = 0) {
+    string row = to_string(id) + ",user" + to_string(id) + ",v" + to_string(version) + ",";
+    row.resize(100, '.');
+    return row;
+}
+
+// `percent` percentile of sorted latencies in us, or n/a when there are none (e.g. a run with few operations)
+string percentile(const vector<float>& sorted, size_t percent) {
+    if (sorted.empty()) {
+        return "n/a";
+    }
+    ostringstream out;
+    out << sorted[sorted.size() * percent / 100] << " us";
+    return out.str();
+}
+
+int main(int argc, char** argv) {
+    MySQLDatabase mysql;
+    {
+        CachedDatabase cache(&mysql);
+        UserService service(&cache);
+        service.storeUser("42,Aditya");
+        string user;
+        service.findUser("42", user);
+        cout << "Found " << user << " (" << mysql.calls << " database call for the save, " << cache.stats().hits << " cache hit)" << endl;
+    }
+
+    cout << "===Checks===" << endl;
+    {
+        MySQLDatabase db;
+        CachedDatabase cache(&db);
+        cache.save("1,Rohit");
+        string row;
+        bool backendHasIt = db.get("1", row) && row == "1,Rohit";
+        size_t calls = db.calls;
+        bool hit = cache.get("1", row) && row == "1,Rohit" && db.calls == calls;
+        check(backendHasIt && hit && cache.stats().hits == 1, "save writes through to the database and the cache");
+
+        db.save("2,Priya");  //behind the cache's back
+        bool filled = cache.get("2", row) && cache.get("2", row) && row == "2,Priya";
+        CachedDatabase::Stats s = cache.stats();
+        check(filled && s.misses == 1 && s.hits == 2 && !cache.get("3", row), "a miss fills the cache, the next read hits");
+
+        cache.saveBatch({"1,Rohit Sharma", "4,Karan"});
+        check(cache.get("1", row) && row == "1,Rohit Sharma" && db.get("4", row), "saveBatch updates database and cache");
+    }
+    {
+        MySQLDatabase db;
+        CachedDatabase::Options small;
+        small.memoryBudget = 64 << 10;
+        small.shards = 4;
+        CachedDatabase cache(&db, small);
+        string row;
+        bool hotStayed = true;
+        for (int i = 0; i < 5000; i++) {
+            cache.save(userRow(1000 + i));
+            hotStayed = (cache.get("1000", row) || i == 0) && hotStayed;
+        }
+        CachedDatabase::Stats s = cache.stats();
+        check(s.bytes <= small.memoryBudget && s.evictions > 0, "the memory budget holds (" + to_string(s.entries) + " entries, " +
+                                                                  to_string(s.bytes) + " bytes, " + to_string(s.evictions) + " evictions)");
+        check(hotStayed && s.misses == 0, "CLOCK keeps a user that is read all the time, while cold users stream through");
+    }
+    {
+        //Readers missing and filling while writers update the same users: the cache must end up equal to the database
+        MySQLDatabase db;
+        db.latency = chrono::microseconds(20);
+        CachedDatabase::Options few;
+        few.shards = 2;
+        CachedDatabase cache(&db, few);
+        vector<thread> threads;
+        for (int t = 0; t < 8; t++) {
+            threads.emplace_back([&, t] {
+                string row;
+                for (int i = 0; i < 300; i++) {
+                    uint64_t id = i % 10;
+                    if (t < 2) {
+                        cache.save(userRow(id, t * 1000 + i));
+                    } else {
+                        cache.get(to_string(id), row);
+                    }
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        bool same = true;
+        db.latency = chrono::microseconds(0);
+        for (uint64_t id = 0; id < 10; id++) {
+            string cached, stored;
+            cache.get(to_string(id), cached);
+            db.get(to_string(id), stored);
+            same = same && cached == stored;
+        }
+        check(same, "concurrent misses never leave an older row in the cache than the database has");
+    }
+
+    //Benchmarks
+    uint64_t users = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t operations = argc > 2 ? atol(argv[2]) : 2000000;
+    MySQLDatabase db;
+    {
+        vector<string> rows;
+        vector<string_view> batch;
+        for (uint64_t id = 0; id < users; id++) {
+            rows.push_back(userRow(id));
+        }
+        for (auto& row : rows) {
+            batch.push_back(row);
+        }
+        db.saveBatch(batch);
+    }
+
+    cout << "===Hit path, 1 thread, ns per get===" << endl;
+    for (unsigned shardCount : {1, 256}) {
+        CachedDatabase::Options options;
+        options.shards = shardCount;
+        CachedDatabase cache(&db, options);
+        vector<string> ids;
+        string row;
+        for (uint64_t id = 0; id < 10000; id++) {
+            ids.push_back(to_string(id));
+            cache.get(ids.back(), row);
+        }
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < operations; i++) {
+            cache.get(ids[i % ids.size()], row);
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / operations;
+        cout << shardCount << (shardCount == 1 ? " shard:    " : " shards:  ") << ns << " ns" << endl;
+    }
+
+    //YCSB B style: 95% reads, 5% writes, Zipfian over all users, the cache holds about 10% of them,
+    //and the database costs 50 us per call
+    ZipfianGenerator zipf(users);
+    db.latency = chrono::microseconds(50);
+    cout << "===Zipfian, " << users << " users, 95% reads, cache for 10%, 50 us database===" << endl;
+    for (unsigned shardCount : {1, 256}) {
+        for (int threads : {1, 4, 16, 32, 64}) {
+            CachedDatabase::Options options;
+            options.shards = shardCount;
+            options.memoryBudget = users / 10 * (100 + 8 + 120);
+            CachedDatabase cache(&db, options);
+            size_t perThread = operations / threads / 20;
+            vector<vector<float>> readLatency(threads);
+            auto start = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    mt19937_64 random(t + 1);
+                    string row;
+                    readLatency[t].reserve(perThread);
+                    for (size_t i = 0; i < perThread; i++) {
+                        uint64_t id = zipf.next(random);
+                        if (random() % 100 < 5) {
+                            cache.save(userRow(id, i));
+                        } else {
+                            auto before = chrono::steady_clock::now();
+                            cache.get(to_string(id), row);
+                            readLatency[t].push_back(chrono::duration<float, micro>(chrono::steady_clock::now() - before).count());
+                        }
+                    }
+                });
+            }
+            for (auto& w : workers) {
+                w.join();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            vector<float> all;
+            for (auto& l : readLatency) {
+                all.insert(all.end(), l.begin(), l.end());
+            }
+            sort(all.begin(), all.end());
+            CachedDatabase::Stats s = cache.stats();
+            cout << shardCount << (shardCount == 1 ? " shard,  " : " shards, ") << threads << " threads: " << perThread * threads / seconds / 1e3
+                 << " K ops/s, hit ratio " << 100.0 * s.hits / max<uint64_t>(1, s.hits + s.misses) << "%, get p50 " << percentile(all, 50)
+                 << ", p99 " << percentile(all, 99) << endl;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,455 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+using namespace std;
+
+//In DIP_applied.cpp every storeUser() is one Database::save() call, so every user is one round trip to the database,
+//and the string is copied on the way because it is passed by value.
+//GroupCommitDatabase sits between UserService and the real database, and it is a Database itself, so UserService
+//does not change (that is the point of depending on the abstraction):
+//  - saves from all threads are collected into a batch
+//  - a batch is flushed as ONE backend call when it is full (maxBatch) or when its oldest write waited maxDelay
+//  - every caller gets a future which is ready when its batch is committed
+
+// Abstraction (Interface)
+class Database {
+public:
+    virtual void save(string_view data) = 0; // Pure virtual function
+    //Many rows in one call. The default is one save per row; real backends override it with one round trip
+    virtual void saveBatch(const vector<string_view>& rows) {
+        for (string_view row : rows) {
+            save(row);
+        }
+    }
+    virtual ~Database() {}
+};
+
+//Local stand-ins for the real databases: every call costs one network round trip, and there is one connection,
+//so calls wait for each other. Nothing is printed, the rows are only counted.
+class SimulatedConnection {
+public:
+    SimulatedConnection(chrono::microseconds roundTrip) : roundTrip(roundTrip) {}
+
+    void call(size_t rows, size_t bytes) {
+        lock_guard<mutex> lock(m);
+        this_thread::sleep_for(roundTrip);
+        rowCount += rows;
+        byteCount += bytes;
+        calls++;
+    }
+
+    size_t rowCount = 0;
+    size_t byteCount = 0;
+    size_t calls = 0;
+
+private:
+    mutex m;
+    chrono::microseconds roundTrip;
+};
+
+// MySQL implementation (Low-level module)
+class MySQLDatabase : public Database {
+public:
+    MySQLDatabase(chrono::microseconds roundTrip = chrono::microseconds(200)) : connection(roundTrip) {}
+
+    //INSERT INTO users VALUES('data');
+    void save(string_view data) override {
+        connection.call(1, data.size());
+    }
+
+    //INSERT INTO users VALUES('a'), ('b'), ...;  one statement for the whole batch
+    void saveBatch(const vector<string_view>& rows) override {
+        size_t bytes = 0;
+        for (string_view row : rows) {
+            bytes += row.size();
+        }
+        connection.call(rows.size(), bytes);
+    }
+
+    SimulatedConnection connection;
+};
+
+// MongoDB implementation (Low-level module)
+class MongoDBDatabase : public Database {
+public:
+    MongoDBDatabase(chrono::microseconds roundTrip = chrono::microseconds(300)) : connection(roundTrip) {}
+
+    //db.users.insert({name: 'data'})
+    void save(string_view data) override {
+        connection.call(1, data.size());
+    }
+
+    //db.users.insertMany([{name: 'a'}, {name: 'b'}, ...])
+    void saveBatch(const vector<string_view>& rows) override {
+        size_t bytes = 0;
+        for (string_view row : rows) {
+            bytes += row.size();
+        }
+        connection.call(rows.size(), bytes);
+    }
+
+    SimulatedConnection connection;
+};
+
+class GroupCommitDatabase : public Database {
+public:
+    GroupCommitDatabase(Database* backend, size_t maxBatch = 128, chrono::microseconds maxDelay = chrono::microseconds(500)) {
+        this->backend = backend;
+        this->maxBatch = max<size_t>(1, maxBatch);
+        this->maxDelay = maxDelay;
+        //Writers wait when this many rows are pending, so a slow backend can not make memory grow without limit
+        maxPending = this->maxBatch * 16;
+        flusher = thread(&GroupCommitDatabase::flushLoop, this);
+    }
+
+    //Flushes everything still pending before it returns
+    ~GroupCommitDatabase() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        flusher.join();
+    }
+
+    //Queues the row (copied once, into the batch buffer) and returns at once.
+    //The future is ready when the batch holding the row was saved, or holds the backend's exception.
+    shared_future<void> submit(string_view data) {
+        unique_lock<mutex> lock(m);
+        roomLeft.wait(lock, [&] { return pendingRows < maxPending || stopping; });
+        if (stopping) {
+            throw runtime_error("GroupCommitDatabase is shutting down");
+        }
+        if (open.offsets.empty()) {
+            open.oldest = chrono::steady_clock::now();
+        }
+        open.offsets.push_back(open.bytes.size());
+        open.bytes.append(data);
+        pendingRows++;
+        shared_future<void> done = open.done;
+        if (open.offsets.size() == maxBatch) {
+            //Full: close it here, so a batch never grows past maxBatch while the flusher is busy
+            full.push_back(move(open));
+            open = Batch();
+            flushNow = false;  //a flush() request was for the batch just closed, not for the next one
+            wake.notify_one();
+        } else if (open.offsets.size() == 1) {
+            wake.notify_one();
+        }
+        return done;
+    }
+
+    //The Database interface: waits for the commit, so storeUser() keeps its meaning ("saved when it returns")
+    void save(string_view data) override {
+        submit(data).get();
+    }
+
+    //Waits until everything submitted so far is saved
+    void flush() {
+        shared_future<void> last;
+        {
+            lock_guard<mutex> lock(m);
+            if (!open.offsets.empty()) {
+                last = open.done;
+                flushNow = true;
+            } else if (!full.empty()) {
+                last = full.back().done;
+            } else {
+                last = lastFlushed;
+            }
+        }
+        wake.notify_one();
+        if (last.valid()) {
+            last.wait();
+        }
+    }
+
+    size_t batchesFlushed() {
+        lock_guard<mutex> lock(m);
+        return flushedBatches;
+    }
+
+private:
+    //Rows of one batch: all bytes in one string, `offsets` says where each row starts
+    struct Batch {
+        string bytes;
+        vector<size_t> offsets;
+        chrono::steady_clock::time_point oldest;
+        promise<void> committed;
+        shared_future<void> done = committed.get_future().share();
+    };
+
+    void flushLoop() {
+        unique_lock<mutex> lock(m);
+        while (true) {
+            //Sleep until a batch is full, the open batch's oldest row is due, or someone asks for a flush
+            if (full.empty() && open.offsets.empty()) {
+                if (stopping) {
+                    return;
+                }
+                wake.wait(lock, [&] { return stopping || !full.empty() || !open.offsets.empty(); });
+                continue;
+            }
+            if (full.empty() && !stopping && !flushNow) {
+                wake.wait_until(lock, open.oldest + maxDelay, [&] { return stopping || flushNow || !full.empty(); });
+            }
+            //Take the batch out, so writers can fill the next one while this one is being saved
+            Batch batch;
+            if (!full.empty()) {
+                batch = move(full.front());
+                full.pop_front();
+            } else {
+                batch = move(open);
+                open = Batch();
+                flushNow = false;
+            }
+            if (batch.offsets.empty()) {
+                continue;
+            }
+            lastFlushed = batch.done;
+            pendingRows -= batch.offsets.size();
+            roomLeft.notify_all();
+            lock.unlock();
+
+            vector<string_view> rows;
+            rows.reserve(batch.offsets.size());
+            for (size_t i = 0; i < batch.offsets.size(); i++) {
+                size_t end = i + 1 < batch.offsets.size() ? batch.offsets[i + 1] : batch.bytes.size();
+                rows.push_back(string_view(batch.bytes).substr(batch.offsets[i], end - batch.offsets[i]));
+            }
+            try {
+                backend->saveBatch(rows);
+                batch.committed.set_value();
+            } catch (...) {
+                batch.committed.set_exception(current_exception());
+            }
+
+            lock.lock();
+            flushedBatches++;
+        }
+    }
+
+    Database* backend;
+    size_t maxBatch;
+    size_t maxPending;
+    chrono::microseconds maxDelay;
+    mutex m;
+    condition_variable wake;
+    condition_variable roomLeft;
+    Batch open;          //the batch writers are adding to
+    deque<Batch> full;   //closed batches, oldest first
+    size_t pendingRows = 0;
+    shared_future<void> lastFlushed;
+    size_t flushedBatches = 0;
+    bool flushNow = false;
+    bool stopping = false;
+    thread flusher;
+};
+
+// High-level module (Now loosely coupled)
+class UserService {
+private:
+    Database* db;  // Dependency Injection
+
+public:
+    UserService(Database* database) {
+        db = database;
+    }
+
+    void storeUser(string_view user) {
+        db->save(user);
+    }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+//A backend that records every batch, for the checks
+class RecordingDatabase : public Database {
+public:
+    void save(string_view data) override {
+        saveBatch({data});
+    }
+    void saveBatch(const vector<string_view>& rows) override {
+        if (gate.valid()) {
+            gate.wait();
+        }
+        lock_guard<mutex> lock(m);
+        if (failNext) {
+            failNext = false;
+            throw runtime_error("connection lost");
+        }
+        batches.push_back(vector<string>(rows.begin(), rows.end()));
+    }
+    mutex m;
+    vector<vector<string>> batches;
+    bool failNext = false;
+    shared_future<void> gate;  //when set, every batch waits for it
+};
+
+struct Result {
+    double writesPerSecond;
+    double p50us;
+    double p99us;
+};
+
+//`threads` users call storeUser() `writes` times each; latency is the time one storeUser() call takes
+Result runBenchmark(Database* db, int threads, int writes) {
+    vector<vector<double>> latencies(threads);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            UserService service(db);
+            string user = "user-" + to_string(t) + "-";
+            size_t prefix = user.size();
+            latencies[t].reserve(writes);
+            for (int i = 0; i < writes; i++) {
+                user.resize(prefix);
+                user += to_string(i);
+                auto before = chrono::steady_clock::now();
+                service.storeUser(user);
+                latencies[t].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - before).count());
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    vector<double> all;
+    for (auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    sort(all.begin(), all.end());
+    return {all.size() / seconds, all[all.size() / 2], all[min(all.size() - 1, all.size() * 99 / 100)]};
+}
+
+int main(int argc, char** argv) {
+    MySQLDatabase mysql;
+    MongoDBDatabase mongodb;
+
+    {
+        GroupCommitDatabase batched(&mysql);
+        UserService service1(&batched);
+        service1.storeUser("Aditya");
+
+        //Without waiting: many users in flight, one round trip for all of them
+        vector<shared_future<void>> saved;
+        for (string user : {"Rohit", "Priya", "Karan"}) {
+            saved.push_back(batched.submit(user));
+        }
+        for (auto& s : saved) {
+            s.get();
+        }
+        cout << "Saved " << mysql.connection.rowCount << " users in " << mysql.connection.calls << " round trips" << endl;
+    }
+
+    cout << "===Checks===" << endl;
+    {
+        RecordingDatabase recorder;
+        {
+            GroupCommitDatabase batched(&recorder, 4, chrono::seconds(10));
+            vector<shared_future<void>> saved;
+            for (int i = 0; i < 10; i++) {
+                saved.push_back(batched.submit("row" + to_string(i)));
+            }
+            batched.flush();
+            check(saved.back().wait_for(chrono::seconds(0)) == future_status::ready, "flush() waits for every submitted row");
+        }
+        size_t rows = 0;
+        bool inOrder = true;
+        for (auto& b : recorder.batches) {
+            for (auto& row : b) {
+                inOrder = inOrder && row == "row" + to_string(rows);
+                rows++;
+            }
+        }
+        check(rows == 10 && inOrder && recorder.batches[0].size() == 4, "rows are saved once, in order, in batches of at most maxBatch");
+    }
+    {
+        RecordingDatabase recorder;
+        GroupCommitDatabase batched(&recorder, 1000, chrono::milliseconds(2));
+        auto start = chrono::steady_clock::now();
+        batched.save("lonely row");
+        double waited = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        check(waited >= 1.5 && waited < 100, "a lone row is flushed after maxDelay, not held until the batch is full");
+    }
+    {
+        //flush() asks for the open batch, then a writer fills and closes it: the next lone row must still wait maxDelay
+        RecordingDatabase recorder;
+        promise<void> release;
+        recorder.gate = release.get_future().share();
+        GroupCommitDatabase batched(&recorder, 2, chrono::milliseconds(200));
+        batched.submit("a");
+        batched.submit("b");  //full, the flusher takes it and waits at the gate
+        batched.submit("c");
+        thread flusher([&] { batched.flush(); });
+        this_thread::sleep_for(chrono::milliseconds(20));
+        batched.submit("d");  //closes the batch flush() asked for
+        release.set_value();
+        flusher.join();
+        auto start = chrono::steady_clock::now();
+        batched.save("e");
+        double waited = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        check(waited >= 150, "a flush() request ends with the batch it was for");
+    }
+    {
+        RecordingDatabase recorder;
+        recorder.failNext = true;
+        GroupCommitDatabase batched(&recorder, 1, chrono::microseconds(100));
+        bool threw = false;
+        try {
+            batched.save("lost");
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        batched.save("kept");
+        check(threw && recorder.batches.size() == 1 && recorder.batches[0][0] == "kept",
+              "a backend error reaches the callers of that batch only");
+    }
+    {
+        RecordingDatabase recorder;
+        GroupCommitDatabase* batched = new GroupCommitDatabase(&recorder, 64, chrono::seconds(10));
+        string owned = "gone soon";
+        shared_future<void> saved = batched->submit(owned);
+        owned.assign(owned.size(), 'x');  //the caller's buffer may change right after submit()
+        delete batched;  //destructor flushes
+        check(saved.valid() && recorder.batches.size() == 1 && recorder.batches[0][0] == "gone soon",
+              "rows are copied on submit and flushed by the destructor");
+    }
+
+    //Benchmark: writes/s and storeUser() latency by batch size, for both stand-ins
+    int threads = argc > 1 ? atoi(argv[1]) : 64;
+    int writes = argc > 2 ? atoi(argv[2]) : 200;
+    cout << "===" << threads << " threads x " << writes << " storeUser() calls===" << endl;
+    Database* backends[] = {&mysql, &mongodb};
+    const char* names[] = {"MySQL (200us round trip)", "MongoDB (300us round trip)"};
+    for (int b = 0; b < 2; b++) {
+        cout << names[b] << endl;
+        Result direct = runBenchmark(backends[b], threads, max(1, writes / 20));
+        cout << "  direct:        " << direct.writesPerSecond << " writes/s, p50 " << direct.p50us << " us, p99 " << direct.p99us << " us" << endl;
+        for (size_t maxBatch : {1, 8, 64, 256}) {
+            GroupCommitDatabase batched(backends[b], maxBatch, chrono::microseconds(500));
+            Result r = runBenchmark(&batched, threads, writes);
+            cout << "  batch " << maxBatch << (maxBatch < 10 ? ":       " : maxBatch < 100 ? ":      " : ":     ") << r.writesPerSecond
+                 << " writes/s, p50 " << r.p50us << " us, p99 " << r.p99us << " us" << endl;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1101 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+using namespace std;
+namespace fs = std::filesystem;
+
+//Build with -std=c++20 (the index is looked up by string_view without building a string).
+//
+//The databases in DIP_applied.cpp only print queries. LogStructuredDatabase is a real, embedded one (Bitcask style),
+//and UserService does not know the difference, because it only depends on Database:
+//  - the data is a directory of segment files; every write is APPENDED to the active segment, nothing is updated in place
+//  - an in-memory hash index maps each key to the file and offset of its newest record, so a read is one pread()
+//  - when the active segment is full it is sealed and a new one is started
+//  - a background thread compacts the sealed segments: live records are copied to new segments, the old ones are deleted
+//  - on open, the segments are scanned to rebuild the index; a torn record at the end (crash mid-write) is cut off
+//
+//Records carry a checksum (CRC-32C) and a sequence number. When the same key is found twice (recovery after an
+//interrupted compaction) the higher sequence number wins.
+
+// Abstraction (Interface)
+class Database {
+public:
+    virtual void save(string_view data) = 0; // Pure virtual function
+    //Many rows in one call. The default is one save per row; real backends override it with one round trip
+    virtual void saveBatch(const vector<string_view>& rows) {
+        for (string_view row : rows) {
+            save(row);
+        }
+    }
+    virtual ~Database() {}
+};
+
+//Rows are "id,name,...": the user ID is the key
+string_view userKey(string_view row) {
+    return row.substr(0, row.find(','));
+}
+
+//CRC-32C (Castagnoli), with the SSE4.2 instruction where the CPU has it
+struct CrcTable {
+    uint32_t entries[256];
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) {
+                c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32cPortable(const char* data, size_t size) {
+    static const CrcTable table;
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.entries[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const char* data, size_t size) {
+    uint64_t crc = ~0u;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        crc = __builtin_ia32_crc32di(crc, word);
+    }
+    uint32_t c = (uint32_t)crc;
+    for (; i < size; i++) {
+        c = __builtin_ia32_crc32qi(c, (uint8_t)data[i]);
+    }
+    return ~c;
+}
+#endif
+
+uint32_t crc32c(const char* data, size_t size) {
+#if defined(__x86_64__)
+    static const bool hardware = __builtin_cpu_supports("sse4.2");
+    if (hardware) {
+        return crc32cHardware(data, size);
+    }
+#endif
+    return crc32cPortable(data, size);
+}
+
+//On disk a record is this header, then the key bytes, then the value bytes. `crc` covers everything after itself.
+struct RecordHeader {
+    uint32_t crc;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t kind;
+    uint64_t sequence;
+};
+static_assert(sizeof(RecordHeader) == 24, "RecordHeader is written to disk as is");
+
+enum RecordKind : uint32_t { Put = 0, Delete = 1 };
+
+const uint32_t maxKeySize = 1 << 16;
+const uint32_t maxValueSize = 1 << 28;
+
+uint64_t recordSize(size_t keySize, size_t valueSize) {
+    return sizeof(RecordHeader) + keySize + valueSize;
+}
+
+void encodeRecord(string& out, RecordKind kind, uint64_t sequence, string_view key, string_view value) {
+    RecordHeader header = {0, (uint32_t)key.size(), (uint32_t)value.size(), kind, sequence};
+    size_t at = out.size();
+    out.append((const char*)&header, sizeof header);
+    out.append(key);
+    out.append(value);
+    uint32_t crc = crc32c(out.data() + at + 4, out.size() - at - 4);
+    memcpy(&out[at], &crc, 4);
+}
+
+//Returns the full size of the record at `data`, or 0 if it is torn or corrupt
+size_t checkRecord(const char* data, size_t available, RecordHeader& header) {
+    if (available < sizeof header) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof header);
+    if (header.kind > Delete || header.keySize > maxKeySize || header.valueSize > maxValueSize) {
+        return 0;
+    }
+    size_t size = recordSize(header.keySize, header.valueSize);
+    if (size > available || crc32c(data + 4, size - 4) != header.crc) {
+        return 0;
+    }
+    return size;
+}
+
+[[noreturn]] void fail(const string& what) {
+    throw runtime_error(what + ": " + strerror(errno));
+}
+
+void writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("write");
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+//Reads up to `size` bytes at `offset`; fewer only at the end of the file
+size_t readAt(int fd, char* data, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pread(fd, data + done, size - done, offset + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("pread");
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+//Makes creates, renames and deletes in the directory durable
+void syncDirectory(const string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fail("open " + directory);
+    }
+    ::fsync(fd);
+    ::close(fd);
+}
+
+//Looks up string keys with a string_view, without building a string
+struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(string_view key) const {
+        return hash<string_view>()(key);
+    }
+};
+
+class LogStructuredDatabase : public Database {
+public:
+    struct Options {
+        uint64_t maxSegmentBytes = 64 << 20;  //the active segment is sealed when it reaches this size
+        bool syncWrites = false;              //fdatasync before a write returns: survives power loss, not only a crash
+        double compactWhenDead = 0.5;         //compact when this share of the sealed bytes is overwritten or deleted (> 1: never)
+        chrono::milliseconds compactionCheck = chrono::milliseconds(100);
+    };
+
+    struct Stats {
+        size_t keys;
+        size_t segments;
+        uint64_t diskBytes;
+        uint64_t liveBytes;
+        size_t recoveredRecords;
+        uint64_t truncatedBytes;  //torn or corrupt bytes cut off by recovery
+        size_t compactions;
+    };
+
+    LogStructuredDatabase(const string& directory) : LogStructuredDatabase(directory, Options()) {}
+
+    LogStructuredDatabase(const string& directory, const Options& options) {
+        this->directory = directory;
+        this->options = options;
+        fs::create_directories(directory);
+        recover();
+        active = createSegment(nextSegment++);
+        segments[active->id] = active;
+        if (options.syncWrites) {
+            syncDirectory(directory);
+        }
+        compactor = thread(&LogStructuredDatabase::compactorLoop, this);
+    }
+
+    ~LogStructuredDatabase() {
+        {
+            lock_guard<mutex> lock(compactorMutex);
+            stopping = true;
+        }
+        compactorWake.notify_all();
+        compactor.join();
+    }
+
+    void put(string_view key, string_view value) {
+        Mutation mutation = {key, value, Put};
+        lock_guard<mutex> lock(writeLock);
+        appendLocked(&mutation, 1);
+    }
+
+    //Returns false if the key does not exist
+    bool get(string_view key, string& value) {
+        Location at;
+        shared_ptr<Segment> segment;
+        {
+            shared_lock<shared_mutex> read(indexLock);
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return false;
+            }
+            at = it->second;
+            segment = segments.at(at.segment);
+        }
+        //The segment may be compacted away now; the shared_ptr keeps its file open until this read is done
+        thread_local string record;
+        size_t size = recordSize(key.size(), at.valueSize);
+        record.resize(size);
+        RecordHeader header;
+        if (readAt(segment->fd, record.data(), size, at.offset) != size || checkRecord(record.data(), size, header) != size
+            || string_view(record).substr(sizeof header, key.size()) != key) {
+            throw runtime_error("corrupt record for key " + string(key) + " in segment " + to_string(at.segment));
+        }
+        value.assign(record, sizeof header + key.size(), at.valueSize);
+        return true;
+    }
+
+    //Returns false if the key did not exist
+    bool remove(string_view key) {
+        lock_guard<mutex> lock(writeLock);
+        {
+            shared_lock<shared_mutex> read(indexLock);
+            if (index.find(key) == index.end()) {
+                return false;
+            }
+        }
+        Mutation mutation = {key, string_view(), Delete};
+        appendLocked(&mutation, 1);
+        return true;
+    }
+
+    void save(string_view data) override {
+        put(userKey(data), data);
+    }
+
+    //The whole batch is one write() (and one fdatasync with syncWrites)
+    void saveBatch(const vector<string_view>& rows) override {
+        thread_local vector<Mutation> mutations;
+        mutations.clear();
+        for (string_view row : rows) {
+            mutations.push_back({userKey(row), row, Put});
+        }
+        lock_guard<mutex> lock(writeLock);
+        appendLocked(mutations.data(), mutations.size());
+    }
+
+    //Makes every write so far survive power loss (crash safety needs no sync: the data is in the OS already)
+    void sync() {
+        lock_guard<mutex> lock(writeLock);
+        if (::fdatasync(active->fd) != 0) {
+            fail("fdatasync");
+        }
+    }
+
+    //Rewrites the live records of all sealed segments into new segments and deletes the old ones
+    void compact() {
+        lock_guard<mutex> oneAtATime(compactionLock);
+        vector<shared_ptr<Segment>> sealed;
+        {
+            shared_lock<shared_mutex> read(indexLock);
+            for (auto& entry : segments) {
+                if (entry.second != active) {
+                    sealed.push_back(entry.second);
+                }
+            }
+        }
+        if (sealed.empty()) {
+            return;
+        }
+
+        //A record is copied when the index still points at it. Deleted keys and tombstones are dropped.
+        struct Move {
+            string key;
+            uint32_t from;
+            uint64_t fromOffset;
+            uint32_t to;
+            uint64_t toOffset;
+            uint32_t valueSize;
+        };
+        vector<Move> moves;
+        vector<shared_ptr<Segment>> outputs;
+        string out;
+        uint32_t outId = 0;
+        auto finishOutput = [&] {
+            if (out.empty()) {
+                return;
+            }
+            string path = segmentPath(outId);
+            int fd = ::open((path + ".tmp").c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                fail("open " + path + ".tmp");
+            }
+            shared_ptr<Segment> output(new Segment(outId, fd));
+            writeAll(fd, out.data(), out.size());
+            if (::fdatasync(fd) != 0 || ::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+                fail("finish " + path);
+            }
+            output->size = out.size();
+            outputs.push_back(output);
+            out.clear();
+        };
+        //The outputs get their final names before the old segments are listed as obsolete, so a crash never loses
+        //data. They are not in `segments` yet, so if a step fails they are removed again: otherwise a restart would
+        //load them and bring back keys deleted after the copy, once their tombstones are compacted away.
+        try {
+            for (auto& segment : sealed) {
+                string bytes(segment->size, '\0');
+                bytes.resize(readAt(segment->fd, bytes.data(), bytes.size(), 0));
+                for (size_t at = 0; at < bytes.size();) {
+                    RecordHeader header;
+                    size_t size = checkRecord(bytes.data() + at, bytes.size() - at, header);
+                    if (size == 0) {
+                        //Recovery already cut torn tails, so this is damage on disk: keep everything and give up
+                        throw runtime_error("corrupt record in segment " + to_string(segment->id) + " at " + to_string(at));
+                    }
+                    string_view key(bytes.data() + at + sizeof header, header.keySize);
+                    bool live = false;
+                    if (header.kind == Put) {
+                        shared_lock<shared_mutex> read(indexLock);
+                        auto it = index.find(key);
+                        live = it != index.end() && it->second.segment == segment->id && it->second.offset == at;
+                    }
+                    if (live) {
+                        if (!out.empty() && out.size() + size > options.maxSegmentBytes) {
+                            finishOutput();
+                        }
+                        if (out.empty()) {
+                            outId = nextSegment++;
+                        }
+                        moves.push_back({string(key), segment->id, at, outId, out.size(), header.valueSize});
+                        out.append(bytes.data() + at, size);  //as is: same sequence number, same checksum
+                    }
+                    at += size;
+                }
+            }
+            finishOutput();
+            syncDirectory(directory);
+
+            //Until every old segment is deleted, a crash could bring back keys whose tombstone is already gone,
+            //so the list of old segments is made durable first, and recovery finishes the job if we do not
+            string list;
+            for (auto& segment : sealed) {
+                list += to_string(segment->id) + "\n";
+            }
+            int fd = ::open((obsoletePath() + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                fail("open " + obsoletePath() + ".tmp");
+            }
+            try {
+                writeAll(fd, list.data(), list.size());
+            } catch (...) {
+                ::close(fd);
+                throw;
+            }
+            if (::fdatasync(fd) != 0 || ::close(fd) != 0 || ::rename((obsoletePath() + ".tmp").c_str(), obsoletePath().c_str()) != 0) {
+                fail("write " + obsoletePath());
+            }
+            syncDirectory(directory);
+        } catch (...) {
+            //The list first: with the copies gone, recovery must not delete the old segments either
+            ::unlink(obsoletePath().c_str());
+            ::unlink((obsoletePath() + ".tmp").c_str());
+            try {
+                syncDirectory(directory);
+            } catch (...) {
+            }
+            for (auto& output : outputs) {
+                ::unlink(segmentPath(output->id).c_str());
+            }
+            if (!out.empty()) {
+                ::unlink((segmentPath(outId) + ".tmp").c_str());
+            }
+            throw;
+        }
+
+        {
+            unique_lock<shared_mutex> write(indexLock);
+            for (auto& output : outputs) {
+                segments[output->id] = output;
+            }
+            for (Move& move : moves) {
+                auto it = index.find(move.key);
+                //Skip keys written or deleted while we were copying: their newest record is elsewhere now
+                if (it != index.end() && it->second.segment == move.from && it->second.offset == move.fromOffset) {
+                    it->second.segment = move.to;
+                    it->second.offset = move.toOffset;
+                    segments[move.to]->liveBytes += recordSize(move.key.size(), move.valueSize);
+                }
+            }
+            for (auto& segment : sealed) {
+                segments.erase(segment->id);
+            }
+        }
+        removeObsoleteSegments();
+        compactions++;
+    }
+
+    Stats stats() {
+        shared_lock<shared_mutex> read(indexLock);
+        Stats s = {index.size(), segments.size(), 0, 0, recoveredRecords, truncatedBytes, compactions.load()};
+        for (auto& entry : segments) {
+            s.diskBytes += entry.second->size;
+            s.liveBytes += entry.second->liveBytes;
+        }
+        return s;
+    }
+
+private:
+    struct Segment {
+        Segment(uint32_t id, int fd) : id(id), fd(fd) {}
+        ~Segment() {
+            ::close(fd);
+        }
+        uint32_t id;
+        int fd;
+        uint64_t size = 0;       //bytes written
+        uint64_t liveBytes = 0;  //bytes of records the index points at
+    };
+
+    //Where the newest record of a key is
+    struct Location {
+        uint32_t segment;
+        uint32_t valueSize;  //deleted during recovery: a tombstone is newest
+        uint64_t offset;
+        uint64_t sequence;
+    };
+    static const uint32_t deleted = UINT32_MAX;
+
+    struct Mutation {
+        string_view key;
+        string_view value;
+        RecordKind kind;
+    };
+
+    string segmentPath(uint32_t id) {
+        char name[16];
+        snprintf(name, sizeof name, "%08u.log", id);
+        return directory + "/" + name;
+    }
+
+    string obsoletePath() {
+        return directory + "/obsolete";
+    }
+
+    shared_ptr<Segment> createSegment(uint32_t id) {
+        int fd = ::open(segmentPath(id).c_str(), O_RDWR | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fail("create " + segmentPath(id));
+        }
+        return shared_ptr<Segment>(new Segment(id, fd));
+    }
+
+    //Deletes the segments listed by an earlier compaction, then the list
+    void removeObsoleteSegments() {
+        ifstream list(obsoletePath());
+        uint32_t id;
+        while (list >> id) {
+            ::unlink(segmentPath(id).c_str());
+        }
+        ::unlink(obsoletePath().c_str());
+    }
+
+    //The index entry of a key is replaced: its old record is no longer live
+    void forget(const Location& old, size_t keySize) {
+        if (old.valueSize != deleted) {
+            segments[old.segment]->liveBytes -= recordSize(keySize, old.valueSize);
+        }
+    }
+
+    void recover() {
+        removeObsoleteSegments();
+        vector<uint32_t> ids;
+        for (auto& entry : fs::directory_iterator(directory)) {
+            string name = entry.path().filename().string();
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+                fs::remove(entry.path());  //unfinished compaction output
+            } else if (name.size() == 12 && name.compare(8, 4, ".log") == 0) {
+                ids.push_back(stoul(name.substr(0, 8)));
+            }
+        }
+        sort(ids.begin(), ids.end());
+        for (uint32_t id : ids) {
+            int fd = ::open(segmentPath(id).c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+            if (fd < 0) {
+                fail("open " + segmentPath(id));
+            }
+            shared_ptr<Segment> segment(new Segment(id, fd));
+            segments[id] = segment;
+            nextSegment = id + 1;
+            string bytes(::lseek(fd, 0, SEEK_END), '\0');
+            bytes.resize(readAt(fd, bytes.data(), bytes.size(), 0));
+            size_t at = 0;
+            while (at < bytes.size()) {
+                RecordHeader header;
+                size_t size = checkRecord(bytes.data() + at, bytes.size() - at, header);
+                if (size == 0) {
+                    break;
+                }
+                auto inserted = index.try_emplace(string(bytes.data() + at + sizeof header, header.keySize));
+                Location& location = inserted.first->second;
+                if (inserted.second || header.sequence > location.sequence) {
+                    if (!inserted.second) {
+                        forget(location, header.keySize);
+                    }
+                    location = {id, header.kind == Delete ? deleted : header.valueSize, at, header.sequence};
+                    if (header.kind == Put) {
+                        segment->liveBytes += size;
+                    }
+                }
+                nextSequence = max(nextSequence, header.sequence + 1);
+                recoveredRecords++;
+                at += size;
+            }
+            if (at < bytes.size()) {
+                //Torn by a crash mid-write: cut it off, so new records are not appended after garbage
+                truncatedBytes += bytes.size() - at;
+                if (::ftruncate(fd, at) != 0) {
+                    fail("ftruncate " + segmentPath(id));
+                }
+            }
+            segment->size = at;
+            if (at == 0) {
+                segments.erase(id);
+                ::unlink(segmentPath(id).c_str());
+            }
+        }
+        for (auto it = index.begin(); it != index.end();) {
+            it = it->second.valueSize == deleted ? index.erase(it) : next(it);
+        }
+    }
+
+    //Called with writeLock held, so records are appended (and the index updated) in sequence order
+    void appendLocked(const Mutation* mutations, size_t count) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (mutations[i].key.size() > maxKeySize || mutations[i].value.size() > maxValueSize) {
+                throw invalid_argument("key or value too large");
+            }
+            total += recordSize(mutations[i].key.size(), mutations[i].value.size());
+        }
+        if (active->size > 0 && active->size + total > options.maxSegmentBytes) {
+            rollActive();
+        }
+        thread_local string buffer;
+        thread_local vector<uint64_t> offsets;
+        buffer.clear();
+        offsets.clear();
+        for (size_t i = 0; i < count; i++) {
+            offsets.push_back(active->size + buffer.size());
+            encodeRecord(buffer, mutations[i].kind, nextSequence++, mutations[i].key, mutations[i].value);
+        }
+        try {
+            writeAll(active->fd, buffer.data(), buffer.size());
+            if (options.syncWrites && ::fdatasync(active->fd) != 0) {
+                fail("fdatasync");
+            }
+        } catch (...) {
+            //Do not leave half a record for the next append to follow (disk full, ...)
+            if (::ftruncate(active->fd, active->size) != 0) {
+                cerr << "could not undo a failed write: " << strerror(errno) << endl;
+            }
+            throw;
+        }
+
+        unique_lock<shared_mutex> write(indexLock);
+        active->size += buffer.size();
+        for (size_t i = 0; i < count; i++) {
+            const Mutation& m = mutations[i];
+            if (m.kind == Put) {
+                auto it = index.find(m.key);
+                if (it == index.end()) {
+                    it = index.emplace(string(m.key), Location()).first;
+                } else {
+                    forget(it->second, m.key.size());
+                }
+                it->second = {active->id, (uint32_t)m.value.size(), offsets[i], 0};
+                active->liveBytes += recordSize(m.key.size(), m.value.size());
+            } else {
+                auto it = index.find(m.key);
+                if (it != index.end()) {
+                    forget(it->second, m.key.size());
+                    index.erase(it);
+                }
+            }
+        }
+    }
+
+    //Called with writeLock held
+    void rollActive() {
+        if (options.syncWrites && ::fdatasync(active->fd) != 0) {
+            fail("fdatasync");
+        }
+        shared_ptr<Segment> next = createSegment(nextSegment++);
+        if (options.syncWrites) {
+            syncDirectory(directory);
+        }
+        {
+            unique_lock<shared_mutex> write(indexLock);
+            segments[next->id] = next;
+            active = next;
+        }
+        compactorWake.notify_one();
+    }
+
+    bool worthCompacting() {
+        shared_lock<shared_mutex> read(indexLock);
+        uint64_t total = 0;
+        uint64_t live = 0;
+        for (auto& entry : segments) {
+            if (entry.second != active) {
+                total += entry.second->size;
+                live += entry.second->liveBytes;
+            }
+        }
+        return total > 0 && total - live >= options.compactWhenDead * total;
+    }
+
+    void compactorLoop() {
+        unique_lock<mutex> lock(compactorMutex);
+        while (!stopping) {
+            compactorWake.wait_for(lock, options.compactionCheck);
+            if (stopping) {
+                break;
+            }
+            lock.unlock();
+            if (worthCompacting()) {
+                try {
+                    compact();
+                } catch (const exception& e) {
+                    cerr << "compaction failed: " << e.what() << endl;
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    string directory;
+    Options options;
+    mutex writeLock;         //one appender at a time; guards nextSequence and the active segment's file
+    shared_mutex indexLock;  //guards index, segments, active and liveBytes
+    unordered_map<string, Location, KeyHash, equal_to<>> index;
+    map<uint32_t, shared_ptr<Segment>> segments;
+    shared_ptr<Segment> active;
+    uint64_t nextSequence = 1;
+    atomic<uint32_t> nextSegment{1};
+    size_t recoveredRecords = 0;
+    uint64_t truncatedBytes = 0;
+    atomic<size_t> compactions{0};
+    mutex compactionLock;
+    mutex compactorMutex;
+    condition_variable compactorWake;
+    bool stopping = false;
+    thread compactor;
+};
+
+// High-level module (Now loosely coupled)
+class UserService {
+private:
+    Database* db;  // Dependency Injection
+
+public:
+    UserService(Database* database) {
+        db = database;
+    }
+
+    void storeUser(string_view user) {
+        db->save(user);
+    }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+string makeTempDirectory(const string& base) {
+    string pattern = base + "/lsdb-XXXXXX";
+    if (!mkdtemp(pattern.data())) {
+        fail("mkdtemp " + pattern);
+    }
+    return pattern;
+}
+
+//Write i of the crash test goes to key i % crashKeys, and its value says which write it was
+const uint64_t crashKeys = 5000;
+
+string crashValue(uint64_t i) {
+    return "v" + to_string(i) + string(80, '.');
+}
+
+//A child process writes until it is killed with SIGKILL at a random moment (maybe mid-write, maybe mid-compaction).
+//Every write it acknowledged must then be readable, and nothing newer than the one in flight may appear.
+bool crashRound(const string& directory, atomic<uint64_t>* acknowledged, mt19937& random) {
+    uint64_t start = acknowledged->load();
+    LogStructuredDatabase::Options small;
+    small.maxSegmentBytes = 64 << 10;
+    small.compactWhenDead = 0.3;
+    small.compactionCheck = chrono::milliseconds(1);
+    pid_t child = fork();
+    if (child < 0) {
+        fail("fork");
+    }
+    if (child == 0) {
+        try {
+            LogStructuredDatabase db(directory, small);
+            for (uint64_t i = start;; i++) {
+                db.put("user" + to_string(i % crashKeys), crashValue(i));
+                acknowledged->store(i + 1);
+            }
+        } catch (const exception& e) {
+            cerr << "crash test writer: " << e.what() << endl;
+        }
+        _exit(1);
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+    while (acknowledged->load() < start + 2000 && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::microseconds(100));
+    }
+    this_thread::sleep_for(chrono::microseconds(random() % 20000));
+    ::kill(child, SIGKILL);
+    int status;
+    ::waitpid(child, &status, 0);
+    if (!WIFSIGNALED(status)) {
+        return false;
+    }
+
+    uint64_t acked = acknowledged->load();
+    LogStructuredDatabase db(directory, small);
+    string value;
+    for (uint64_t key = 0; key < crashKeys; key++) {
+        //The newest acknowledged write of this key, if any
+        bool written = acked > key;
+        uint64_t newest = written ? key + (acked - 1 - key) / crashKeys * crashKeys : 0;
+        if (!db.get("user" + to_string(key), value)) {
+            if (written) {
+                return false;
+            }
+            continue;
+        }
+        uint64_t i = stoull(value.substr(1));
+        //The write in flight (number `acked`) may or may not have made it
+        if (i % crashKeys != key || (written && i < newest) || i > acked || value != crashValue(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    string base = argc > 2 ? argv[2] : fs::temp_directory_path().string();
+    string directory = makeTempDirectory(base);
+
+    //The crash test forks, so it runs first, while this process has no other threads
+    cout << "===Checks===" << endl;
+    {
+        atomic<uint64_t>* acknowledged = (atomic<uint64_t>*)mmap(nullptr, sizeof(atomic<uint64_t>), PROT_READ | PROT_WRITE,
+                                                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        new (acknowledged) atomic<uint64_t>(0);
+        mt19937 random(42);
+        bool consistent = true;
+        for (int round = 0; round < 8 && consistent; round++) {
+            consistent = crashRound(directory + "/crash", acknowledged, random);
+        }
+        check(consistent, "after SIGKILL mid-write, every acknowledged write is there (8 rounds, " +
+                          to_string(acknowledged->load()) + " writes)");
+        munmap(acknowledged, sizeof(atomic<uint64_t>));
+    }
+
+    check(crc32c("123456789", 9) == 0xE3069283 && crc32cPortable("123456789", 9) == 0xE3069283, "CRC-32C check value");
+
+    {
+        string path = directory + "/basic";
+        {
+            LogStructuredDatabase db(path);
+            UserService service(&db);
+            service.storeUser("42,Aditya");
+            db.saveBatch({"7,Rohit", "8,Priya", "7,Rohit Sharma"});
+            db.put("gone", "soon");
+            db.remove("gone");
+        }
+        LogStructuredDatabase db(path);
+        string value;
+        bool found = db.get("42", value) && value == "42,Aditya";
+        found = found && db.get("7", value) && value == "7,Rohit Sharma";
+        check(found && !db.get("gone", value) && !db.remove("gone") && db.stats().keys == 3,
+              "storeUser, saveBatch, overwrite and remove survive a reopen");
+    }
+
+    {
+        string path = directory + "/torn";
+        {
+            LogStructuredDatabase db(path);
+            for (int i = 0; i < 1000; i++) {
+                db.put("user" + to_string(i), crashValue(i));
+            }
+        }
+        //Half a record at the end, as a crash (or power loss) in the middle of write() leaves it
+        string record;
+        encodeRecord(record, Put, 1u << 30, "torn", crashValue(1000));
+        string last;
+        for (auto& entry : fs::directory_iterator(path)) {
+            last = max(last, entry.path().string());
+        }
+        {
+            ofstream out(last, ios::binary | ios::app);
+            out.write(record.data(), record.size() / 2);
+        }
+        string value;
+        bool intact = true;
+        {
+            LogStructuredDatabase db(path);
+            for (int i = 0; i < 1000; i++) {
+                intact = intact && db.get("user" + to_string(i), value) && value == crashValue(i);
+            }
+            intact = intact && !db.get("torn", value) && db.stats().truncatedBytes == record.size() / 2;
+            db.put("after", "recovery");
+        }
+        LogStructuredDatabase db(path);
+        check(intact && db.get("after", value) && value == "recovery" && db.stats().truncatedBytes == 0,
+              "a torn record at the end is cut off, the records before it are kept");
+    }
+
+    {
+        string path = directory + "/compact";
+        LogStructuredDatabase::Options small;
+        small.maxSegmentBytes = 16 << 10;
+        small.compactWhenDead = 2;  //never in the background: compact() by hand
+        uint64_t before;
+        {
+            LogStructuredDatabase db(path, small);
+            for (int round = 0; round < 5; round++) {
+                for (int i = 0; i < 1000; i++) {
+                    db.put("user" + to_string(i), crashValue(round * 1000 + i));
+                }
+            }
+            for (int i = 0; i < 1000; i += 2) {
+                db.remove("user" + to_string(i));
+            }
+            db.put("last", "write");  //rolls the segment holding the tombstones
+            before = db.stats().diskBytes;
+            db.compact();
+            db.compact();
+        }
+        LogStructuredDatabase db(path, small);
+        string value;
+        bool correct = true;
+        for (int i = 0; i < 1000; i++) {
+            bool found = db.get("user" + to_string(i), value);
+            correct = correct && (i % 2 == 0 ? !found : found && value == crashValue(4000 + i));
+        }
+        LogStructuredDatabase::Stats s = db.stats();
+        check(correct && s.keys == 501 && s.diskBytes < before / 3,
+              "compaction keeps the newest values, drops deleted keys and frees the space (" + to_string(before >> 10) + " KB -> " +
+              to_string(s.diskBytes >> 10) + " KB)");
+    }
+
+    {
+        //A compaction that fails half way (here: a damaged record in the last old segment) must not leave copies behind
+        string path = directory + "/failed-compaction";
+        LogStructuredDatabase::Options small;
+        small.maxSegmentBytes = 16 << 10;
+        small.compactWhenDead = 2;
+        LogStructuredDatabase db(path, small);
+        for (int i = 0; i < 1000; i++) {
+            db.put("user" + to_string(i), crashValue(i));
+        }
+        vector<string> logs;
+        for (auto& entry : fs::directory_iterator(path)) {
+            logs.push_back(entry.path().string());
+        }
+        sort(logs.begin(), logs.end());
+        {
+            fstream damage(logs[logs.size() - 2], ios::in | ios::out | ios::binary);
+            damage.seekp(fs::file_size(logs[logs.size() - 2]) / 2);
+            damage.put('#');
+        }
+        bool threw = false;
+        try {
+            db.compact();
+        } catch (const runtime_error&) {
+            threw = true;
+        }
+        size_t files = distance(fs::directory_iterator(path), fs::directory_iterator());
+        check(threw && logs.size() > 3 && files == logs.size() && db.stats().segments == logs.size(),
+              "a failed compaction removes the segments it already wrote");
+    }
+
+    {
+        //Writers, readers and the background compactor at the same time
+        string path = directory + "/concurrent";
+        LogStructuredDatabase::Options small;
+        small.maxSegmentBytes = 32 << 10;
+        small.compactionCheck = chrono::milliseconds(1);
+        bool correct = true;
+        {
+            LogStructuredDatabase db(path, small);
+            atomic<bool> readersOk{true};
+            vector<thread> threads;
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&, t] {
+                    string value;
+                    for (int i = 0; i < 3000; i++) {
+                        string key = "user" + to_string(t) + "-" + to_string(i % 300);
+                        if (t % 2 == 0) {
+                            db.put(key, crashValue(i));
+                        } else if (db.get("user" + to_string(t - 1) + "-" + to_string(i % 300), value) && value[0] != 'v') {
+                            readersOk = false;
+                        }
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            correct = readersOk;
+        }
+        LogStructuredDatabase db(path, small);
+        string value;
+        for (int t = 0; t < 4; t += 2) {
+            for (int k = 0; k < 300; k++) {
+                correct = correct && db.get("user" + to_string(t) + "-" + to_string(k), value) && value == crashValue(2700 + k);
+            }
+        }
+        check(correct, "concurrent writers, readers and compaction");
+    }
+
+    //Benchmarks
+    size_t n = argc > 1 ? atol(argv[1]) : 200000;
+    const size_t valueSize = 100;
+    vector<string> rows(n);
+    for (size_t i = 0; i < n; i++) {
+        rows[i] = to_string(i) + "," + string(valueSize - to_string(i).size() - 1, 'x');
+    }
+    auto seconds = [](chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    auto report = [&](const string& what, size_t ops, double s) {
+        cout << what << ops / s / 1e3 << " K ops/s, " << ops * (valueSize + 24 + 6) / s / 1e6 << " MB/s" << endl;
+    };
+    cout << "===" << n << " users, " << valueSize << " byte rows===" << endl;
+    string path = directory + "/bench";
+    LogStructuredDatabase::Options bench;
+    bench.maxSegmentBytes = 4 << 20;
+    bench.compactWhenDead = 2;  //compact() by hand, to time it
+    {
+        LogStructuredDatabase db(path, bench);
+        auto start = chrono::steady_clock::now();
+        for (auto& row : rows) {
+            db.save(row);
+        }
+        report("save:                   ", n, seconds(start));
+
+        start = chrono::steady_clock::now();
+        vector<string_view> batch;
+        for (size_t i = 0; i < n; i++) {
+            batch.push_back(rows[i]);
+            if (batch.size() == 64 || i + 1 == n) {
+                db.saveBatch(batch);
+                batch.clear();
+            }
+        }
+        report("saveBatch of 64:        ", n, seconds(start));
+
+        mt19937 random(7);
+        vector<string> keys(n);
+        for (auto& key : keys) {
+            key = to_string(random() % n);
+        }
+        string value;
+        start = chrono::steady_clock::now();
+        size_t hits = 0;
+        for (auto& key : keys) {
+            hits += db.get(key, value);
+        }
+        report("get (random key):       ", n, seconds(start));
+        int threads = max(2u, thread::hardware_concurrency());
+        start = chrono::steady_clock::now();
+        vector<thread> readers;
+        for (int t = 0; t < threads; t++) {
+            readers.emplace_back([&, t] {
+                string v;
+                for (size_t i = t; i < n; i += threads) {
+                    db.get(keys[i], v);
+                }
+            });
+        }
+        for (auto& r : readers) {
+            r.join();
+        }
+        report("get, " + to_string(threads) + " threads:         ", n, seconds(start));
+
+        uint64_t before = db.stats().diskBytes;
+        start = chrono::steady_clock::now();
+        db.compact();
+        cout << "compact:                " << seconds(start) * 1e3 << " ms, " << (before >> 20) << " MB -> " << (db.stats().diskBytes >> 20)
+             << " MB" << (hits == n ? "" : " (missing keys!)") << endl;
+    }
+    {
+        auto start = chrono::steady_clock::now();
+        LogStructuredDatabase db(path, bench);
+        double s = seconds(start);
+        cout << "recovery:               " << s * 1e3 << " ms for " << db.stats().recoveredRecords << " records, "
+             << db.stats().recoveredRecords / s / 1e6 << " M records/s" << endl;
+    }
+    {
+        //Durable writes: one fdatasync per call, so batching is what makes them fast (see Group-Commit.cpp)
+        LogStructuredDatabase::Options durable;
+        durable.syncWrites = true;
+        LogStructuredDatabase db(directory + "/durable", durable);
+        size_t synced = min<size_t>(n, 2000);
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < synced; i++) {
+            db.save(rows[i]);
+        }
+        report("save + fdatasync:       ", synced, seconds(start));
+        start = chrono::steady_clock::now();
+        vector<string_view> batch;
+        for (size_t i = 0; i < synced * 16 && i < n; i++) {
+            batch.push_back(rows[i]);
+            if (batch.size() == 64) {
+                db.saveBatch(batch);
+                batch.clear();
+            }
+        }
+        report("saveBatch 64 + fdatasync: ", min(synced * 16, n) / 64 * 64, seconds(start));
+    }
+    fs::remove_all(directory);
+    return failures == 0 ? 0 : 1;
+}
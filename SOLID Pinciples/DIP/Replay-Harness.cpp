@@ -0,0 +1,640 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+using namespace std;
+
+//UserService depends only on Database, so any backend can be put behind it, but nothing told us which one is faster.
+//This harness replays a trace of storeUser() calls against a Database and reports, as JSON:
+//  - throughput, and latency percentiles (p50 ... max)
+//  - CPU time per call (user + system, all threads of the process, so background threads of the backend count too)
+//  - heap allocations and bytes per call (operator new is counted below)
+//
+//A trace is a list of (time, row). It is generated (Poisson arrivals), loaded from a file, or recorded from a real
+//program by putting RecordingDatabase in front of its database.
+//Replay is open loop: every call has a scheduled time, and its latency is measured FROM THAT TIME, so a backend that
+//falls behind is charged for the wait too (a closed loop would quietly send fewer calls and hide it).
+//With rate 0 every call is due at once: the backend runs at its maximum speed.
+//
+//The JSON goes to stdout (or --json FILE), the self-checks to stderr, so the output can be piped into other tools.
+
+//Counting allocations: one counter per thread slot (own cache line), so counting does not make threads contend
+struct alignas(64) AllocationCounter {
+    atomic<uint64_t> count{0};
+    atomic<uint64_t> bytes{0};
+};
+static AllocationCounter allocationCounters[64];
+static atomic<unsigned> nextAllocationCounter{0};
+
+static void countAllocation(size_t size) {
+    thread_local unsigned slot = nextAllocationCounter.fetch_add(1, memory_order_relaxed) % 64;
+    allocationCounters[slot].count.fetch_add(1, memory_order_relaxed);
+    allocationCounters[slot].bytes.fetch_add(size, memory_order_relaxed);
+}
+
+struct AllocationTotals {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+
+AllocationTotals allocationTotals() {
+    AllocationTotals totals;
+    for (auto& counter : allocationCounters) {
+        totals.count += counter.count.load(memory_order_relaxed);
+        totals.bytes += counter.bytes.load(memory_order_relaxed);
+    }
+    return totals;
+}
+
+//noinline: when GCC sees malloc and free through the replaced operators it warns about a new/free mismatch
+__attribute__((noinline)) void* operator new(size_t size) {
+    countAllocation(size);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+//The nothrow forms (used by stable_sort for its buffer) are replaced too, so they are counted and pair with delete above
+__attribute__((noinline)) void* operator new(size_t size, const nothrow_t&) noexcept {
+    countAllocation(size);
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// Abstraction (Interface)
+class Database {
+public:
+    virtual void save(string_view data) = 0; // Pure virtual function
+    virtual ~Database() {}
+};
+
+//Backends to compare. The MySQL and MongoDB ones are local stand-ins with one connection and a simulated round trip;
+//to replay against another Database, add it to makeBackend().
+class MemoryDatabase : public Database {
+public:
+    void save(string_view data) override {
+        string_view id = data.substr(0, data.find(','));
+        lock_guard<mutex> lock(m);
+        rows[string(id)] = string(data);
+    }
+
+private:
+    mutex m;
+    unordered_map<string, string> rows;
+};
+
+class RemoteDatabase : public Database {
+public:
+    RemoteDatabase(chrono::microseconds roundTrip) : roundTrip(roundTrip) {}
+
+    void save(string_view data) override {
+        lock_guard<mutex> lock(connection);
+        this_thread::sleep_for(roundTrip);
+        bytes += data.size();
+    }
+
+private:
+    mutex connection;
+    chrono::microseconds roundTrip;
+    size_t bytes = 0;
+};
+
+// MySQL implementation (Low-level module)
+class MySQLDatabase : public RemoteDatabase {
+public:
+    MySQLDatabase() : RemoteDatabase(chrono::microseconds(200)) {}
+};
+
+// MongoDB implementation (Low-level module)
+class MongoDBDatabase : public RemoteDatabase {
+public:
+    MongoDBDatabase() : RemoteDatabase(chrono::microseconds(300)) {}
+};
+
+//Appends each row to a local file, with or without fdatasync per row
+class AppendFileDatabase : public Database {
+public:
+    AppendFileDatabase(bool syncEveryRow) {
+        this->syncEveryRow = syncEveryRow;
+        char name[] = "/tmp/replay-XXXXXX";
+        fd = mkstemp(name);
+        if (fd < 0) {
+            throw runtime_error(string("mkstemp: ") + strerror(errno));
+        }
+        ::unlink(name);
+    }
+
+    ~AppendFileDatabase() {
+        ::close(fd);
+    }
+
+    void save(string_view data) override {
+        //One write() per row, so rows from different threads never interleave
+        thread_local string line;
+        line.assign(data);
+        line += '\n';
+        if (::write(fd, line.data(), line.size()) != (ssize_t)line.size() || (syncEveryRow && ::fdatasync(fd) != 0)) {
+            throw runtime_error(string("append: ") + strerror(errno));
+        }
+    }
+
+private:
+    int fd;
+    bool syncEveryRow;
+};
+
+unique_ptr<Database> makeBackend(const string& name) {
+    if (name == "memory") {
+        return unique_ptr<Database>(new MemoryDatabase());
+    } else if (name == "mysql") {
+        return unique_ptr<Database>(new MySQLDatabase());
+    } else if (name == "mongodb") {
+        return unique_ptr<Database>(new MongoDBDatabase());
+    } else if (name == "file") {
+        return unique_ptr<Database>(new AppendFileDatabase(false));
+    } else if (name == "file-sync") {
+        return unique_ptr<Database>(new AppendFileDatabase(true));
+    }
+    return nullptr;
+}
+
+const vector<string> backendNames = {"memory", "mysql", "mongodb", "file", "file-sync"};
+
+// High-level module (Now loosely coupled)
+class UserService {
+private:
+    Database* db;  // Dependency Injection
+
+public:
+    UserService(Database* database) {
+        db = database;
+    }
+
+    void storeUser(string_view user) {
+        db->save(user);
+    }
+};
+
+//One storeUser() call of a trace: when (ns after the start) and which row
+struct Operation {
+    uint64_t atNs;
+    string user;
+};
+
+//Trace files are text, one call per line: "<ns after start> <row>"
+void saveTrace(const vector<Operation>& trace, const string& path) {
+    ofstream out(path);
+    for (const Operation& op : trace) {
+        if (op.user.find('\n') != string::npos) {
+            throw invalid_argument("a row with a line break can not be saved in a trace");
+        }
+        out << op.atNs << ' ' << op.user << '\n';
+    }
+    if (!out) {
+        throw runtime_error("could not write trace " + path);
+    }
+}
+
+vector<Operation> loadTrace(const string& path) {
+    ifstream in(path);
+    if (!in) {
+        throw runtime_error("could not read trace " + path);
+    }
+    vector<Operation> trace;
+    string line;
+    while (getline(in, line)) {
+        size_t space = line.find(' ');
+        if (space == string::npos) {
+            throw runtime_error("bad trace line " + to_string(trace.size() + 1) + " in " + path);
+        }
+        trace.push_back({stoull(line.substr(0, space)), line.substr(space + 1)});
+    }
+    return trace;
+}
+
+//Poisson arrivals at `rate` calls per second; rows "id,name" with ids from a small hot set and a long tail
+vector<Operation> generateTrace(size_t count, double rate, uint64_t seed) {
+    mt19937_64 random(seed);
+    exponential_distribution<double> gap(rate);
+    lognormal_distribution<double> nameLength(3, 0.5);
+    vector<Operation> trace(count);
+    double at = 0;
+    for (size_t i = 0; i < count; i++) {
+        at += gap(random);
+        uint64_t id = random() % 10 < 8 ? random() % 1000 : random() % 10000000;
+        size_t length = min<size_t>(200, 1 + (size_t)nameLength(random));
+        string name(length, 'a');
+        for (char& c : name) {
+            c = 'a' + random() % 26;
+        }
+        trace[i] = {(uint64_t)(at * 1e9), to_string(id) + "," + name};
+    }
+    return trace;
+}
+
+//Put it in front of a program's real database to record the trace of what the program does
+class RecordingDatabase : public Database {
+public:
+    RecordingDatabase(Database* backend) : backend(backend), start(chrono::steady_clock::now()) {}
+
+    void save(string_view data) override {
+        uint64_t at = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        {
+            lock_guard<mutex> lock(m);
+            recorded.push_back({at, string(data)});
+        }
+        backend->save(data);
+    }
+
+    vector<Operation> trace() {
+        lock_guard<mutex> lock(m);
+        vector<Operation> sorted = recorded;
+        stable_sort(sorted.begin(), sorted.end(), [](const Operation& a, const Operation& b) { return a.atNs < b.atNs; });
+        return sorted;
+    }
+
+private:
+    Database* backend;
+    chrono::steady_clock::time_point start;
+    mutex m;
+    vector<Operation> recorded;
+};
+
+// HDR style histogram of latencies, in the unit the caller records: values are grouped by their highest bit, and each
+// power of two is split into 16 linear sub buckets (values below 32 get a bucket each). A percentile is reported as the
+// upper edge of its bucket, so it is at most 1/16 (6.25%) above the real value. The table is 60 x 32 x 8 B, about 15 KB.
+// Every example is a standalone program, so Kitchen-Simulator.cpp, Trainer-Instrumentation.cpp and Replay-Harness.cpp
+// each carry this class; the three copies are identical on purpose, change them together.
+class LatencyHistogram {
+    static const int subBits = 5;
+    static const int subCount = 1 << subBits;
+    uint64_t buckets[64 - subBits + 1][subCount] = {};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static void locate(uint64_t value, int& range, int& sub) {
+        int highest = value == 0 ? 0 : 63 - __builtin_clzll(value);
+        range = highest < subBits ? 0 : highest - subBits + 1;
+        sub = (int)((value >> range) & (subCount - 1));
+    }
+public:
+    void record(uint64_t value) {
+        int range, sub;
+        locate(value, range, sub);
+        buckets[range][sub]++;
+        total++;
+        maxValue = max(maxValue, value);
+    }
+    void add(const LatencyHistogram& other) {
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                buckets[range][sub] += other.buckets[range][sub];
+            }
+        }
+        total += other.total;
+        maxValue = max(maxValue, other.maxValue);
+    }
+    uint64_t count() const {
+        return total;
+    }
+    uint64_t maximum() const {
+        return maxValue;
+    }
+    // Smallest value v such that at least `percent` of the recorded values are <= v (upper edge of the bucket)
+    uint64_t percentile(double percent) const {
+        uint64_t wanted = max<uint64_t>(1, (uint64_t)(total * percent / 100.0 + 0.5));
+        uint64_t seen = 0;
+        for (int range = 0; range <= 64 - subBits; range++) {
+            for (int sub = 0; sub < subCount; sub++) {
+                seen += buckets[range][sub];
+                if (seen >= wanted) {
+                    return min(((((uint64_t)sub + 1) << range) - 1), maxValue);
+                }
+            }
+        }
+        return maxValue;
+    }
+};
+
+struct ReplayOptions {
+    double rate = 0;         //calls per second the trace is stretched or squeezed to; 0: all due at once
+    bool traceTiming = false;  //replay at the trace's own times instead (rate is ignored)
+    int threads = 4;
+};
+
+struct Report {
+    string backend;
+    string mode;
+    double targetRate;
+    int threads;
+    size_t operations;
+    size_t errors;
+    double seconds;
+    double throughput;
+    LatencyHistogram latencyNs;
+    double cpuUsPerOperation;
+    double allocationsPerOperation;
+    double allocatedBytesPerOperation;
+};
+
+double cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+//Call i goes to thread i % threads; each thread sleeps until its next call is due, so waiting costs no CPU
+Report replay(Database& db, const string& backend, const vector<Operation>& trace, const ReplayOptions& options) {
+    double scale = 0;
+    if (options.traceTiming) {
+        scale = 1;
+    } else if (options.rate > 0 && !trace.empty() && trace.back().atNs > 0) {
+        scale = (trace.size() / options.rate * 1e9) / trace.back().atNs;
+    }
+    int threads = max(1, options.threads);
+    vector<unique_ptr<LatencyHistogram>> latencies;
+    vector<size_t> errors(threads);
+    for (int t = 0; t < threads; t++) {
+        latencies.emplace_back(new LatencyHistogram());
+    }
+    AllocationTotals allocationsBefore = allocationTotals();
+    double cpuBefore = cpuSeconds();
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            //Linux wakes sleepers up to 50 us late by default; that would show up as latency of the backend
+            prctl(PR_SET_TIMERSLACK, 1);
+            UserService service(&db);
+            LatencyHistogram& latency = *latencies[t];
+            for (size_t i = t; i < trace.size(); i += threads) {
+                auto due = start + chrono::nanoseconds((uint64_t)(trace[i].atNs * scale));
+                auto now = chrono::steady_clock::now();
+                if (now < due) {
+                    this_thread::sleep_until(due);
+                } else if (scale == 0) {
+                    due = now;  //max speed: a call is due when its thread is free
+                }
+                try {
+                    service.storeUser(trace[i].user);
+                } catch (const exception&) {
+                    errors[t]++;
+                }
+                latency.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - due).count());
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double cpu = cpuSeconds() - cpuBefore;
+    AllocationTotals allocationsAfter = allocationTotals();
+
+    Report report;
+    report.backend = backend;
+    report.mode = options.traceTiming ? "trace" : options.rate > 0 ? "rate" : "max";
+    report.targetRate = options.traceTiming ? 0 : options.rate;
+    report.threads = threads;
+    report.operations = trace.size();
+    report.errors = 0;
+    for (int t = 0; t < threads; t++) {
+        report.errors += errors[t];
+        report.latencyNs.add(*latencies[t]);
+    }
+    report.seconds = seconds;
+    report.throughput = trace.size() / seconds;
+    double ops = max<size_t>(1, trace.size());
+    report.cpuUsPerOperation = cpu * 1e6 / ops;
+    //The harness's own allocations (threads, histograms) are a few per run, not per call
+    report.allocationsPerOperation = (allocationsAfter.count - allocationsBefore.count) / ops;
+    report.allocatedBytesPerOperation = (allocationsAfter.bytes - allocationsBefore.bytes) / ops;
+    return report;
+}
+
+string jsonString(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof escaped, "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+string toJson(const Report& r) {
+    ostringstream out;
+    out.precision(6);
+    auto us = [&](double percent) { return r.latencyNs.percentile(percent) / 1e3; };
+    out << "{\"backend\": " << jsonString(r.backend) << ", \"mode\": " << jsonString(r.mode) << ", \"targetRate\": " << r.targetRate
+        << ", \"threads\": " << r.threads << ", \"operations\": " << r.operations << ", \"errors\": " << r.errors
+        << ", \"seconds\": " << r.seconds << ", \"throughput\": " << r.throughput << ", \"latencyUs\": {\"p50\": " << us(50)
+        << ", \"p90\": " << us(90) << ", \"p99\": " << us(99) << ", \"p999\": " << us(99.9) << ", \"max\": " << us(100)
+        << "}, \"cpuUsPerOperation\": " << r.cpuUsPerOperation << ", \"allocationsPerOperation\": " << r.allocationsPerOperation
+        << ", \"allocatedBytesPerOperation\": " << r.allocatedBytesPerOperation << "}";
+    return out.str();
+}
+
+//Which build produced the numbers, so runs of different builds are not compared by mistake
+string buildJson() {
+    ostringstream out;
+#if defined(__OPTIMIZE__)
+    bool optimized = true;
+#else
+    bool optimized = false;
+#endif
+    out << "{\"compiler\": " << jsonString(__VERSION__) << ", \"optimized\": " << (optimized ? "true" : "false")
+        << ", \"cpus\": " << thread::hardware_concurrency() << "}";
+    return out.str();
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+    cerr << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+void runChecks() {
+    cerr << "===Checks===" << endl;
+    {
+        LatencyHistogram h;
+        for (uint64_t v = 1; v <= 100000; v++) {
+            h.record(v);
+        }
+        uint64_t p50 = h.percentile(50);
+        uint64_t p99 = h.percentile(99);
+        check(p50 >= 50000 && p50 <= 50000 + 50000 / 16 && p99 >= 99000 && p99 <= 99000 + 99000 / 16 &&
+              h.percentile(100) == 100000,
+              "histogram percentiles are within 1/16");
+    }
+    {
+        //32768 opens the bucket [32768, 34815], so it is reported at the top edge: the worst case of 2047/32768
+        uint64_t worst = (uint64_t)1 << 15;
+        uint64_t edge = worst + (worst >> 4) - 1;
+        LatencyHistogram low, high;
+        low.record(worst);
+        low.record((uint64_t)1 << 30);
+        high.record(edge);
+        high.record((uint64_t)1 << 30);
+        check(low.percentile(50) == edge && edge - worst <= worst / 16 && edge - worst > worst / 20,
+              "a value at the bottom of a bucket is reported up to 1/16 high");
+        check(high.percentile(50) == edge, "a value at the top of a bucket is reported exactly");
+    }
+    {
+        MemoryDatabase memory;
+        RecordingDatabase recorder(&memory);
+        UserService service(&recorder);
+        service.storeUser("42,Aditya");
+        service.storeUser("7,Rohit");
+        vector<Operation> trace = recorder.trace();
+        string path = "/tmp/replay-check-" + to_string(getpid()) + ".trace";
+        saveTrace(trace, path);
+        vector<Operation> loaded = loadTrace(path);
+        ::unlink(path.c_str());
+        check(loaded.size() == 2 && loaded[0].user == "42,Aditya" && loaded[1].user == "7,Rohit" && loaded[0].atNs == trace[0].atNs,
+              "a recorded trace saves and loads unchanged");
+    }
+    {
+        //400 calls at 4000/s must take about 0.1 s, however fast the backend is
+        MemoryDatabase memory;
+        ReplayOptions options;
+        options.rate = 4000;
+        options.threads = 2;
+        Report r = replay(memory, "memory", generateTrace(400, 1000, 1), options);
+        check(r.seconds > 0.09 && r.seconds < 0.2 && r.errors == 0, "rate mode keeps the target rate (" + to_string(r.throughput) + "/s)");
+    }
+    {
+        //A backend that takes 200 us per call, asked for 10000 calls/s on one thread, falls behind:
+        //open loop charges the queueing, so p99 is far above the service time
+        MySQLDatabase slow;
+        ReplayOptions options;
+        options.rate = 10000;
+        options.threads = 1;
+        Report r = replay(slow, "mysql", generateTrace(200, 1000, 2), options);
+        check(r.latencyNs.percentile(99) > 5 * r.latencyNs.percentile(1), "open loop counts the time calls waited to be sent");
+    }
+    {
+        MemoryDatabase memory;
+        vector<Operation> trace = generateTrace(10000, 1e6, 3);
+        replay(memory, "memory", trace, ReplayOptions());  //the map grows here; the second run only overwrites
+        Report r = replay(memory, "memory", trace, ReplayOptions());
+        check(r.allocationsPerOperation >= 0.9 && r.allocationsPerOperation < 3, "allocations are counted (" +
+                                                                                  to_string(r.allocationsPerOperation) + " per save)");
+    }
+}
+
+int main(int argc, char** argv) {
+    string backend = "all";
+    string tracePath;
+    string saveTracePath;
+    string jsonPath;
+    size_t operations = 20000;
+    ReplayOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        string value = i + 1 < argc ? argv[i + 1] : "";
+        if (arg == "--backend") {
+            backend = value;
+        } else if (arg == "--ops") {
+            operations = stoul(value);
+        } else if (arg == "--rate") {
+            options.traceTiming = value == "trace";
+            options.rate = options.traceTiming ? 0 : stod(value);
+        } else if (arg == "--threads") {
+            options.threads = stoi(value);
+        } else if (arg == "--trace") {
+            tracePath = value;
+        } else if (arg == "--save-trace") {
+            saveTracePath = value;
+        } else if (arg == "--json") {
+            jsonPath = value;
+        } else {
+            cerr << "usage: " << argv[0] << " [--backend memory|mysql|mongodb|file|file-sync|all] [--ops N]\n"
+                 << "       [--rate CALLS_PER_SECOND|0|trace] [--threads N] [--trace FILE] [--save-trace FILE] [--json FILE]" << endl;
+            return 2;
+        }
+        i++;
+    }
+
+    runChecks();
+
+    vector<Operation> trace = tracePath.empty() ? generateTrace(operations, 5000, 42) : loadTrace(tracePath);
+    if (!saveTracePath.empty()) {
+        saveTrace(trace, saveTracePath);
+    }
+    vector<string> backends = backend == "all" ? backendNames : vector<string>{backend};
+    string runs;
+    for (const string& name : backends) {
+        unique_ptr<Database> db = makeBackend(name);
+        if (!db) {
+            cerr << "unknown backend " << name << endl;
+            return 2;
+        }
+        //The remote stand-ins do one call at a time: at max speed, replay a slice so the run stays short
+        vector<Operation> slice = trace;
+        if (dynamic_cast<RemoteDatabase*>(db.get()) && options.rate == 0 && !options.traceTiming) {
+            slice.resize(min<size_t>(slice.size(), 2000));
+        }
+        Report report = replay(*db, name, slice, options);
+        runs += (runs.empty() ? "\n    " : ",\n    ") + toJson(report);
+        cerr << name << ": " << report.throughput << " calls/s, p99 " << report.latencyNs.percentile(99) / 1e3 << " us" << endl;
+    }
+    string json = "{\n  \"build\": " + buildJson() + ",\n  \"runs\": [" + runs + "\n  ]\n}\n";
+    if (jsonPath.empty()) {
+        cout << json;
+    } else {
+        ofstream(jsonPath) << json;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,410 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdint>
+using namespace std;
+
+//In LSP.cpp a withdrawal from a FixedDepositAccount is not an accident, it happens on every pass, and it is reported
+//with a thrown logic_error. A throw costs microseconds: the unwinder looks up the unwind tables of every frame between
+//the throw and the catch, and runs the destructors on the way. A normal return costs nanoseconds.
+//
+//Here the accounts have two APIs side by side:
+//  - tryDeposit()/tryWithdraw() return an Expected<Cents, AccountError>: the new balance or the reason it was
+//    refused, and they never throw
+//  - deposit()/withdraw() are the throwing API of LSP.cpp, written on top of the result API, so both always agree
+//The error to exception mapping follows ExceptionRule.cpp: every error is a logic_error or a narrower subclass
+//(invalid_argument for "invalid amount", domain_error for "insufficient funds"), so the catch (const logic_error&)
+//of LSP.cpp's BankClient handles all of them.
+//
+//The benchmark measures both at several failure rates and call depths (frames between the failure and the caller
+//that handles it), and with several threads, since they all share the unwinder.
+
+typedef int64_t Cents;
+
+enum class AccountError { NotAllowed, InvalidAmount, InsufficientFunds };
+
+const char* describe(AccountError error) {
+  switch (error) {
+    case AccountError::NotAllowed: return "Withdrawal not allowed in Fixed Term Account!";
+    case AccountError::InvalidAmount: return "Amount must be positive";
+    case AccountError::InsufficientFunds: return "Insufficient funds";
+  }
+  return "Unknown error";
+}
+
+//What the throwing API throws for an error
+[[noreturn]] void throwFor(AccountError error) {
+  switch (error) {
+    case AccountError::NotAllowed: throw logic_error(describe(error));
+    case AccountError::InvalidAmount: throw invalid_argument(describe(error));
+    case AccountError::InsufficientFunds: throw domain_error(describe(error));
+  }
+  throw logic_error(describe(error));
+}
+
+//The error side of an Expected, so `return Unexpected<E>{error};` can not be mistaken for a value
+template <typename E>
+struct Unexpected {
+  E error;
+};
+
+//A value or an error, in the style of C++23 std::expected. It is a bool and a union, returned in registers for
+//small types, so only trivially copyable types are allowed (no destructors to run).
+template <typename T, typename E>
+class Expected {
+  static_assert(is_trivially_copyable<T>::value && is_trivially_copyable<E>::value, "Expected holds trivially copyable types");
+
+  public:
+    Expected(T value) : ok(true), val(value) {}
+    Expected(Unexpected<E> unexpected) : ok(false), err(unexpected.error) {}
+
+    bool has_value() const {
+      return ok;
+    }
+    explicit operator bool() const {
+      return ok;
+    }
+    //Asking for the value of an error is a bug in the caller, so it throws
+    T value() const {
+      if (!ok) {
+        throw logic_error(string("Expected has no value: ") + describe(err));
+      }
+      return val;
+    }
+    T value_or(T fallback) const {
+      return ok ? val : fallback;
+    }
+    E error() const {
+      return err;
+    }
+
+  private:
+    bool ok;
+    union {
+      T val;
+      E err;
+    };
+};
+
+typedef Expected<Cents, AccountError> BalanceResult;
+
+class Account {
+  public:
+    Account(Cents opening) : balance(opening) {}
+    virtual ~Account() {}
+
+    //Result API: the new balance, or why nothing changed
+    virtual BalanceResult tryDeposit(Cents amount) {
+      if (amount <= 0) {
+        return Unexpected<AccountError>{AccountError::InvalidAmount};
+      }
+      balance += amount;
+      return balance;
+    }
+    virtual BalanceResult tryWithdraw(Cents amount) = 0;
+
+    //Throwing API, as in LSP.cpp
+    void deposit(Cents amount) {
+      BalanceResult result = tryDeposit(amount);
+      if (!result) {
+        throwFor(result.error());
+      }
+    }
+    void withdraw(Cents amount) {
+      BalanceResult result = tryWithdraw(amount);
+      if (!result) {
+        throwFor(result.error());
+      }
+    }
+
+    Cents currentBalance() const {
+      return balance;
+    }
+
+  protected:
+    //Shared by the accounts that may withdraw: the balance may not go below -overdraftLimit
+    BalanceResult withdrawUpTo(Cents amount, Cents overdraftLimit) {
+      if (amount <= 0) {
+        return Unexpected<AccountError>{AccountError::InvalidAmount};
+      }
+      if (amount > balance + overdraftLimit) {
+        return Unexpected<AccountError>{AccountError::InsufficientFunds};
+      }
+      balance -= amount;
+      return balance;
+    }
+
+    Cents balance;
+};
+
+class SavingAccount : public Account {
+  public:
+    SavingAccount(Cents opening) : Account(opening) {}
+    BalanceResult tryWithdraw(Cents amount) {
+      return withdrawUpTo(amount, 0);
+    }
+};
+
+class CurrentAccount : public Account {
+  public:
+    CurrentAccount(Cents opening) : Account(opening) {}
+    BalanceResult tryWithdraw(Cents amount) {
+      return withdrawUpTo(amount, 50000);
+    }
+};
+
+class FixedDepositAccount : public Account {
+  public:
+    FixedDepositAccount(Cents opening) : Account(opening) {}
+    BalanceResult tryWithdraw(Cents) {
+      return Unexpected<AccountError>{AccountError::NotAllowed};
+    }
+};
+
+class BankClient {
+  private:
+    vector<Account*> accounts;
+  public:
+    BankClient(vector<Account*> accounts) {
+      this->accounts = accounts;
+    }
+    //processTransaction() of LSP.cpp without try/catch: a refused withdrawal is a result, counted and moved past.
+    //Returns how many operations were refused.
+    size_t processTransaction() {
+      size_t refused = 0;
+      for (Account* account : accounts) {
+        refused += !account->tryDeposit(100000);
+        refused += !account->tryWithdraw(50000);
+      }
+      return refused;
+    }
+};
+
+//===Benchmark===
+//Every frame of a call chain owns an object with a destructor, like real code with locks and strings on the stack,
+//so the unwinder has cleanup to run in each frame.
+struct FrameGuard {
+  size_t& counter;
+  ~FrameGuard() {
+    counter++;
+  }
+};
+
+//`depth` frames down, then one withdrawal; the failure travels back up as an exception...
+__attribute__((noinline)) Cents throwingChain(Account& account, Cents amount, int depth, size_t& frames) {
+  FrameGuard guard{frames};
+  if (depth <= 1) {
+    account.withdraw(amount);
+    return 1;
+  }
+  return throwingChain(account, amount, depth - 1, frames) + 1;
+}
+
+//...or as a result that every frame checks and passes on
+__attribute__((noinline)) BalanceResult resultChain(Account& account, Cents amount, int depth, size_t& frames) {
+  FrameGuard guard{frames};
+  if (depth <= 1) {
+    BalanceResult result = account.tryWithdraw(amount);
+    return result ? BalanceResult(1) : result;
+  }
+  BalanceResult result = resultChain(account, amount, depth - 1, frames);
+  if (!result) {
+    return result;
+  }
+  return result.value() + 1;
+}
+
+//One caller's work: ops[i] says whether withdrawal i is refused (it goes to a fixed deposit account) or not.
+//Returns how many were refused, so both versions can be compared.
+size_t runThrowing(const vector<uint8_t>& fails, int depth) {
+  SavingAccount saving((Cents)1 << 50);
+  FixedDepositAccount fixed(0);
+  size_t refused = 0, frames = 0;
+  for (uint8_t fail : fails) {
+    Account& account = fail ? (Account&)fixed : (Account&)saving;
+    try {
+      throwingChain(account, 1, depth, frames);
+    } catch (const logic_error& e) {
+      refused++;
+    }
+  }
+  return refused;
+}
+
+size_t runResult(const vector<uint8_t>& fails, int depth) {
+  SavingAccount saving((Cents)1 << 50);
+  FixedDepositAccount fixed(0);
+  size_t refused = 0, frames = 0;
+  for (uint8_t fail : fails) {
+    Account& account = fail ? (Account&)fixed : (Account&)saving;
+    refused += !resultChain(account, 1, depth, frames);
+  }
+  return refused;
+}
+
+vector<uint8_t> failurePattern(size_t n, double rate, uint64_t seed) {
+  mt19937_64 random(seed);
+  bernoulli_distribution fail(rate);
+  vector<uint8_t> fails(n);
+  for (auto& f : fails) {
+    f = fail(random);
+  }
+  return fails;
+}
+
+//Runs `run` on `threads` threads, each with its own accounts and `perThread` operations; returns ns per operation
+//(wall time divided by all operations) and adds up the refused count
+template <typename Run>
+double timed(Run run, int threads, size_t perThread, double rate, int depth, size_t& refused) {
+  vector<vector<uint8_t>> fails;
+  for (int t = 0; t < threads; t++) {
+    fails.push_back(failurePattern(perThread, rate, 11 + t));
+  }
+  vector<size_t> counts(threads);
+  auto start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() { counts[t] = run(fails[t], depth); });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  refused = 0;
+  for (size_t c : counts) {
+    refused += c;
+  }
+  return seconds * 1e9 / (perThread * threads);
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+int main(int argc, char** argv) {
+  SavingAccount saving(100000);
+  CurrentAccount current(0);
+  FixedDepositAccount fixed(500000);
+  BankClient client({&saving, &current, &fixed});
+  size_t refused = client.processTransaction();
+  cout << "Saving " << saving.currentBalance() / 100.0 << ", current " << current.currentBalance() / 100.0 << ", fixed deposit "
+       << fixed.currentBalance() / 100.0 << ", " << refused << " refused" << endl;
+
+  cout << "===Checks===" << endl;
+  {
+    BalanceResult ok = saving.tryDeposit(1), bad = fixed.tryWithdraw(1);
+    bool threw = false;
+    try {
+      bad.value();
+    } catch (const logic_error&) {
+      threw = true;
+    }
+    check(ok && ok.value() == 150001 && !bad && bad.error() == AccountError::NotAllowed && bad.value_or(-1) == -1 && threw,
+          "Expected holds a value or an error, and value() of an error throws");
+  }
+  {
+    //Both APIs on twin accounts, for a mix of amounts: same balances, and every error becomes the mapped exception
+    mt19937_64 random(3);
+    bool same = true;
+    for (int i = 0; i < 20000 && same; i++) {
+      int kind = random() % 3;
+      Cents opening = random() % 100000;
+      unique_ptr<Account> a, b;
+      if (kind == 0) {
+        a.reset(new SavingAccount(opening));
+        b.reset(new SavingAccount(opening));
+      } else if (kind == 1) {
+        a.reset(new CurrentAccount(opening));
+        b.reset(new CurrentAccount(opening));
+      } else {
+        a.reset(new FixedDepositAccount(opening));
+        b.reset(new FixedDepositAccount(opening));
+      }
+      Cents amount = (Cents)(random() % 300000) - 20000;
+      bool isDeposit = random() % 2;
+      BalanceResult result = isDeposit ? a->tryDeposit(amount) : a->tryWithdraw(amount);
+      string thrown = "none";
+      try {
+        isDeposit ? b->deposit(amount) : b->withdraw(amount);
+      } catch (const invalid_argument& e) {
+        thrown = "invalid_argument";
+      } catch (const domain_error& e) {
+        thrown = "domain_error";
+      } catch (const logic_error& e) {
+        thrown = "logic_error";
+      }
+      string expected = result ? "none"
+                        : result.error() == AccountError::InvalidAmount ? "invalid_argument"
+                        : result.error() == AccountError::NotAllowed ? "logic_error" : "domain_error";
+      same = a->currentBalance() == b->currentBalance() && thrown == expected &&
+             (!result || result.value() == a->currentBalance());
+    }
+    check(same, "the result API and the throwing API agree on balances and errors");
+  }
+  {
+    //The handler of LSP.cpp's BankClient: every refusal has to end up in it
+    auto caughtAsLogicError = [](Account& account, Cents amount) {
+      try {
+        account.withdraw(amount);
+      } catch (const logic_error& e) {
+        return true;
+      } catch (...) {
+      }
+      return false;
+    };
+    SavingAccount empty(0);
+    FixedDepositAccount fixedTerm(0);
+    check(caughtAsLogicError(empty, 1) && caughtAsLogicError(empty, -1) && caughtAsLogicError(fixedTerm, 1),
+          "insufficient funds, invalid amounts and not allowed are all caught as logic_error");
+  }
+  {
+    vector<uint8_t> fails = failurePattern(10000, 0.3, 5);
+    size_t expected = 0;
+    for (uint8_t f : fails) {
+      expected += f;
+    }
+    check(runThrowing(fails, 8) == expected && runResult(fails, 8) == expected, "both chains refuse the same operations at depth 8");
+  }
+
+  size_t ops = argc > 1 ? atol(argv[1]) : 200000;
+  int maxThreads = argc > 2 ? atoi(argv[2]) : max(4u, thread::hardware_concurrency());
+  cout << "===ns per withdrawal, 1 thread: throw/catch vs result===" << endl;
+  cout << "failure rate";
+  int depths[] = {1, 4, 16, 64};
+  for (int depth : depths) {
+    cout << "\tdepth " << depth;
+  }
+  cout << endl;
+  for (double rate : {0.0, 0.001, 0.01, 0.1, 0.5, 1.0}) {
+    cout << rate * 100 << "%";
+    for (int depth : depths) {
+      size_t refusedThrowing, refusedResult;
+      double throwing = timed(runThrowing, 1, ops, rate, depth, refusedThrowing);
+      double result = timed(runResult, 1, ops, rate, depth, refusedResult);
+      if (refusedThrowing != refusedResult) {
+        failures++;
+      }
+      cout << "\t" << (int)(throwing + 0.5) << " / " << (int)(result + 0.5);
+    }
+    cout << endl;
+  }
+  //Every thread throws at the same time: if unwinding took a shared lock, the throwing column would stop scaling
+  cout << "===M withdrawals/s, all of them refused, depth 4: throw/catch vs result===" << endl;
+  for (int threads = 1; threads <= maxThreads; threads = threads * 2) {
+    size_t refusedThrowing, refusedResult;
+    double throwing = timed(runThrowing, threads, ops / 4, 1.0, 4, refusedThrowing);
+    double result = timed(runResult, threads, ops / 4, 1.0, 4, refusedResult);
+    cout << threads << " threads\t" << 1e3 / throwing << " / " << 1e3 / result << endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
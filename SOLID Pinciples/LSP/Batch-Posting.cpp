@@ -0,0 +1,523 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <limits>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+//The nightly run posts to every account: processTransaction() in LSP.cpp deposits 1000 and withdraws 500, with two
+//virtual calls per account, and for every FixedDepositAccount it throws and catches a logic_error.
+//For millions of accounts this engine does the same run another way:
+//  - balances are stored as a structure of arrays: one contiguous array per field, no objects, no vtables
+//  - the accounts are partitioned by kind, as in LSP_applied.cpp: withdrawable ones (saving, current) and
+//    deposit-only ones (fixed deposit), so "can this account withdraw" is decided once per partition, not per account
+//  - a batch is one amount per account, and it is applied by a SIMD kernel, 4 (AVX2) or 8 (AVX-512) accounts at a time
+//  - rejected operations go to an error array, with the reason; nothing throws
+//The kernels are written three times (scalar, AVX2, AVX-512) and the best one the CPU supports is picked at runtime.
+
+typedef int64_t Cents;
+
+//Balances stay within +-2^60 cents, so no check below can overflow
+const Cents maxBalance = (Cents)1 << 60;
+
+enum Reason : uint8_t { InvalidAmount, OverdraftLimit, BalanceLimit, NotWithdrawable };
+
+enum Partition : uint8_t { Withdrawable, DepositOnly };
+
+struct Rejection {
+  Partition partition;
+  Reason reason;
+  uint32_t account;  //index in its partition
+};
+
+//A kernel posts amount[i] to account i, skips the accounts it has to reject, writes their indices to `rejected`
+//and returns how many there are. `rejected` must have room for n indices.
+struct PostingKernels {
+  const char* name;
+  //Rejects amount <= 0 and balances that would pass maxBalance
+  size_t (*deposit)(Cents* balance, const Cents* amount, size_t n, uint32_t* rejected);
+  //Rejects amount <= 0 and balances that would go below floor (minus the overdraft limit)
+  size_t (*withdraw)(Cents* balance, const Cents* floor, const Cents* amount, size_t n, uint32_t* rejected);
+};
+
+namespace scalar {
+  //Branchless: the index is always written, and the count only moves on a rejection
+  size_t deposit(Cents* balance, const Cents* amount, size_t n, uint32_t* rejected) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      bool ok = amount[i] > 0 && amount[i] <= maxBalance - balance[i];
+      balance[i] += ok ? amount[i] : 0;
+      rejected[count] = (uint32_t)i;
+      count += !ok;
+    }
+    return count;
+  }
+  size_t withdraw(Cents* balance, const Cents* floor, const Cents* amount, size_t n, uint32_t* rejected) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      bool ok = amount[i] > 0 && amount[i] <= balance[i] - floor[i];
+      balance[i] -= ok ? amount[i] : 0;
+      rejected[count] = (uint32_t)i;
+      count += !ok;
+    }
+    return count;
+  }
+  const PostingKernels kernels = {"scalar", deposit, withdraw};
+}
+
+#if defined(__x86_64__)
+//The vector loops handle 4 (AVX2) or 16 (AVX-512, two registers of 8) accounts at a time, the scalar kernels the tail
+namespace avx2 {
+  //Rejections are rare, so the lanes of a rejection mask are walked with a bit loop only when it is not zero
+  __attribute__((target("avx2"))) size_t collect(int mask, size_t base, uint32_t* rejected, size_t count) {
+    while (mask != 0) {
+      rejected[count++] = (uint32_t)(base + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+    return count;
+  }
+  __attribute__((target("avx2"))) size_t deposit(Cents* balance, const Cents* amount, size_t n, uint32_t* rejected) {
+    __m256i zero = _mm256_setzero_si256(), limit = _mm256_set1_epi64x(maxBalance);
+    size_t count = 0, i = 0;
+    for (; i + 4 <= n; i = i + 4) {
+      __m256i b = _mm256_loadu_si256((const __m256i*)(balance + i));
+      __m256i a = _mm256_loadu_si256((const __m256i*)(amount + i));
+      //reject = !(a > 0) | (a > limit - b)
+      __m256i reject = _mm256_or_si256(_mm256_cmpgt_epi64(a, _mm256_sub_epi64(limit, b)),
+                                       _mm256_xor_si256(_mm256_cmpgt_epi64(a, zero), _mm256_cmpeq_epi64(zero, zero)));
+      _mm256_storeu_si256((__m256i*)(balance + i), _mm256_add_epi64(b, _mm256_andnot_si256(reject, a)));
+      int mask = _mm256_movemask_pd(_mm256_castsi256_pd(reject));
+      if (mask != 0) {
+        count = collect(mask, i, rejected, count);
+      }
+    }
+    size_t tail = scalar::deposit(balance + i, amount + i, n - i, rejected + count);
+    for (size_t k = count; k < count + tail; k++) {
+      rejected[k] += (uint32_t)i;
+    }
+    return count + tail;
+  }
+  __attribute__((target("avx2"))) size_t withdraw(Cents* balance, const Cents* floor, const Cents* amount, size_t n, uint32_t* rejected) {
+    __m256i zero = _mm256_setzero_si256();
+    size_t count = 0, i = 0;
+    for (; i + 4 <= n; i = i + 4) {
+      __m256i b = _mm256_loadu_si256((const __m256i*)(balance + i));
+      __m256i f = _mm256_loadu_si256((const __m256i*)(floor + i));
+      __m256i a = _mm256_loadu_si256((const __m256i*)(amount + i));
+      //reject = !(a > 0) | (a > b - floor)
+      __m256i reject = _mm256_or_si256(_mm256_cmpgt_epi64(a, _mm256_sub_epi64(b, f)),
+                                       _mm256_xor_si256(_mm256_cmpgt_epi64(a, zero), _mm256_cmpeq_epi64(zero, zero)));
+      _mm256_storeu_si256((__m256i*)(balance + i), _mm256_sub_epi64(b, _mm256_andnot_si256(reject, a)));
+      int mask = _mm256_movemask_pd(_mm256_castsi256_pd(reject));
+      if (mask != 0) {
+        count = collect(mask, i, rejected, count);
+      }
+    }
+    size_t tail = scalar::withdraw(balance + i, floor + i, amount + i, n - i, rejected + count);
+    for (size_t k = count; k < count + tail; k++) {
+      rejected[k] += (uint32_t)i;
+    }
+    return count + tail;
+  }
+  const PostingKernels kernels = {"avx2", deposit, withdraw};
+}
+
+namespace avx512 {
+  //The rejected indices are written with one compress-store per 16 accounts, no bit loop
+  __attribute__((target("avx512f"))) size_t deposit(Cents* balance, const Cents* amount, size_t n, uint32_t* rejected) {
+    __m512i zero = _mm512_setzero_si512(), limit = _mm512_set1_epi64(maxBalance);
+    __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t count = 0, i = 0;
+    for (; i + 16 <= n; i = i + 16) {
+      __mmask8 ok[2];
+      for (int half = 0; half < 2; half++) {
+        __m512i b = _mm512_loadu_si512(balance + i + 8 * half);
+        __m512i a = _mm512_loadu_si512(amount + i + 8 * half);
+        ok[half] = _mm512_cmpgt_epi64_mask(a, zero) & _mm512_cmple_epi64_mask(a, _mm512_sub_epi64(limit, b));
+        _mm512_storeu_si512(balance + i + 8 * half, _mm512_mask_add_epi64(b, ok[half], b, a));
+      }
+      __mmask16 reject = (__mmask16) ~(ok[0] | (ok[1] << 8));
+      if (reject != 0) {
+        _mm512_mask_compressstoreu_epi32(rejected + count, reject, _mm512_add_epi32(index, _mm512_set1_epi32((int)i)));
+        count += __builtin_popcount(reject);
+      }
+    }
+    size_t tail = scalar::deposit(balance + i, amount + i, n - i, rejected + count);
+    for (size_t k = count; k < count + tail; k++) {
+      rejected[k] += (uint32_t)i;
+    }
+    return count + tail;
+  }
+  __attribute__((target("avx512f"))) size_t withdraw(Cents* balance, const Cents* floor, const Cents* amount, size_t n, uint32_t* rejected) {
+    __m512i zero = _mm512_setzero_si512();
+    __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t count = 0, i = 0;
+    for (; i + 16 <= n; i = i + 16) {
+      __mmask8 ok[2];
+      for (int half = 0; half < 2; half++) {
+        __m512i b = _mm512_loadu_si512(balance + i + 8 * half);
+        __m512i f = _mm512_loadu_si512(floor + i + 8 * half);
+        __m512i a = _mm512_loadu_si512(amount + i + 8 * half);
+        ok[half] = _mm512_cmpgt_epi64_mask(a, zero) & _mm512_cmple_epi64_mask(a, _mm512_sub_epi64(b, f));
+        _mm512_storeu_si512(balance + i + 8 * half, _mm512_mask_sub_epi64(b, ok[half], b, a));
+      }
+      __mmask16 reject = (__mmask16) ~(ok[0] | (ok[1] << 8));
+      if (reject != 0) {
+        _mm512_mask_compressstoreu_epi32(rejected + count, reject, _mm512_add_epi32(index, _mm512_set1_epi32((int)i)));
+        count += __builtin_popcount(reject);
+      }
+    }
+    size_t tail = scalar::withdraw(balance + i, floor + i, amount + i, n - i, rejected + count);
+    for (size_t k = count; k < count + tail; k++) {
+      rejected[k] += (uint32_t)i;
+    }
+    return count + tail;
+  }
+  const PostingKernels kernels = {"avx512", deposit, withdraw};
+}
+#endif
+
+//Every kernel set this CPU can run, best one last
+vector<const PostingKernels*> supportedKernels() {
+  vector<const PostingKernels*> all = {&scalar::kernels};
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    all.push_back(&avx2::kernels);
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    all.push_back(&avx512::kernels);
+  }
+#endif
+  return all;
+}
+
+class PostingEngine {
+  public:
+    //One array per field. floor is minus the overdraft limit: 0 for saving, -500.00 for current accounts.
+    struct WithdrawableAccounts {
+      vector<Cents> balance;
+      vector<Cents> floor;
+    };
+    struct DepositOnlyAccounts {
+      vector<Cents> balance;
+    };
+
+    PostingEngine(const PostingKernels* k = nullptr) {
+      kernels = k != nullptr ? k : supportedKernels().back();
+    }
+
+    //The open* functions return the account's index in its partition
+    uint32_t openSaving(Cents opening) {
+      return openWithdrawable(opening, 0);
+    }
+    uint32_t openCurrent(Cents opening) {
+      return openWithdrawable(opening, -50000);
+    }
+    uint32_t openFixedDeposit(Cents opening) {
+      if (opening < 0 || opening > maxBalance) {
+        throw invalid_argument("opening balance out of range");
+      }
+      depositOnly.balance.push_back(opening);
+      return (uint32_t)depositOnly.balance.size() - 1;
+    }
+
+    //amounts[i] goes to account i of the partition (0 for "nothing today" is rejected too: the batch says every
+    //account gets a posting). Rejections are appended to `rejected`.
+    void deposit(Partition partition, const vector<Cents>& amounts, vector<Rejection>& rejected) {
+      vector<Cents>& balance = partition == Withdrawable ? withdrawable.balance : depositOnly.balance;
+      checkSize(balance, amounts);
+      for (size_t at = 0; at < amounts.size(); at = at + chunk) {
+        size_t n = min(chunk, amounts.size() - at);
+        size_t count = kernels->deposit(balance.data() + at, amounts.data() + at, n, indices);
+        for (size_t k = 0; k < count; k++) {
+          Reason reason = amounts[at + indices[k]] <= 0 ? InvalidAmount : BalanceLimit;
+          rejected.push_back({partition, reason, (uint32_t)(at + indices[k])});
+        }
+      }
+    }
+
+    void withdraw(Partition partition, const vector<Cents>& amounts, vector<Rejection>& rejected) {
+      if (partition == DepositOnly) {
+        //Decided once for the whole partition: no account here can withdraw
+        checkSize(depositOnly.balance, amounts);
+        for (size_t i = 0; i < amounts.size(); i++) {
+          rejected.push_back({DepositOnly, NotWithdrawable, (uint32_t)i});
+        }
+        return;
+      }
+      checkSize(withdrawable.balance, amounts);
+      for (size_t at = 0; at < amounts.size(); at = at + chunk) {
+        size_t n = min(chunk, amounts.size() - at);
+        size_t count = kernels->withdraw(withdrawable.balance.data() + at, withdrawable.floor.data() + at, amounts.data() + at, n, indices);
+        for (size_t k = 0; k < count; k++) {
+          Reason reason = amounts[at + indices[k]] <= 0 ? InvalidAmount : OverdraftLimit;
+          rejected.push_back({Withdrawable, reason, (uint32_t)(at + indices[k])});
+        }
+      }
+    }
+
+    size_t size(Partition partition) {
+      return partition == Withdrawable ? withdrawable.balance.size() : depositOnly.balance.size();
+    }
+
+    WithdrawableAccounts withdrawable;
+    DepositOnlyAccounts depositOnly;
+    const PostingKernels* kernels;
+
+  private:
+    //Accounts per kernel call, so the index buffer is small and stays in L1
+    static constexpr size_t chunk = 4096;
+
+    uint32_t openWithdrawable(Cents opening, Cents floor) {
+      if (opening < floor || opening > maxBalance) {
+        throw invalid_argument("opening balance out of range");
+      }
+      withdrawable.balance.push_back(opening);
+      withdrawable.floor.push_back(floor);
+      return (uint32_t)withdrawable.balance.size() - 1;
+    }
+
+    static void checkSize(const vector<Cents>& balance, const vector<Cents>& amounts) {
+      if (amounts.size() != balance.size()) {
+        throw invalid_argument("a batch needs one amount per account of the partition");
+      }
+    }
+
+    uint32_t indices[chunk];
+};
+
+//The loops being replaced, with a balance instead of the cout lines, so only the posting is measured
+namespace lsp {
+  class Account {
+    public:
+      virtual void deposit(Cents amount) = 0;
+      virtual void withdraw(Cents amount) = 0;
+      virtual ~Account() {}
+      Cents balance = 0;
+  };
+
+  class SavingAccount : public Account {
+    public:
+      void deposit(Cents amount) {
+        balance += amount;
+      }
+      void withdraw(Cents amount) {
+        if (amount > balance) {
+          throw runtime_error("Insufficient funds");
+        }
+        balance -= amount;
+      }
+  };
+
+  class CurrentAccount : public Account {
+    public:
+      void deposit(Cents amount) {
+        balance += amount;
+      }
+      void withdraw(Cents amount) {
+        if (amount > balance + 50000) {
+          throw runtime_error("Overdraft limit");
+        }
+        balance -= amount;
+      }
+  };
+
+  class FixedDepositAccount : public Account {
+    public:
+      void deposit(Cents amount) {
+        balance += amount;
+      }
+      void withdraw(Cents) {
+        throw logic_error("Withdrawal not allowed in Fixed Term Account!");
+      }
+  };
+
+  //processTransaction() of LSP.cpp; returns how many withdrawals failed
+  size_t processTransaction(vector<Account*>& accounts) {
+    size_t failed = 0;
+    for (Account* account : accounts) {
+      account->deposit(100000);
+      try {
+        account->withdraw(50000);
+      } catch (const exception& e) {
+        failed++;
+      }
+    }
+    return failed;
+  }
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+int main(int argc, char** argv) {
+  PostingEngine bank;
+  bank.openSaving(100000);
+  bank.openCurrent(0);
+  bank.openFixedDeposit(500000);
+  vector<Rejection> rejected;
+  bank.deposit(Withdrawable, {100000, 100000}, rejected);
+  bank.withdraw(Withdrawable, {50000, 170000}, rejected);
+  bank.deposit(DepositOnly, {100000}, rejected);
+  bank.withdraw(DepositOnly, {50000}, rejected);
+  cout << "Saving " << bank.withdrawable.balance[0] / 100.0 << ", current " << bank.withdrawable.balance[1] / 100.0 << ", fixed deposit "
+       << bank.depositOnly.balance[0] / 100.0 << ", " << rejected.size() << " rejected (" << bank.kernels->name << " kernels)" << endl;
+
+  cout << "===Checks===" << endl;
+  vector<const PostingKernels*> kernels = supportedKernels();
+  {
+    //Every kernel set against the scalar one, on amounts full of edge cases, for many lengths (tails)
+    mt19937_64 random(1);
+    bool same = true;
+    for (size_t n : {0, 1, 3, 4, 5, 15, 16, 17, 100, 1001}) {
+      vector<Cents> balance(n), floor(n), amount(n);
+      for (size_t i = 0; i < n; i++) {
+        floor[i] = random() % 2 ? 0 : -50000;
+        balance[i] = floor[i] + (Cents)(random() % 200000);
+        switch (random() % 6) {
+          case 0: amount[i] = 0; break;
+          case 1: amount[i] = -(Cents)(random() % 1000); break;
+          case 2: amount[i] = balance[i] - floor[i]; break;  //exactly down to the limit: allowed
+          case 3: amount[i] = balance[i] - floor[i] + 1; break;
+          case 4: amount[i] = maxBalance; break;
+          default: amount[i] = random() % 100000;
+        }
+      }
+      for (int op = 0; op < 2; op++) {
+        vector<Cents> expected = balance;
+        vector<uint32_t> expectedRejected(max<size_t>(1, n));
+        size_t expectedCount = op == 0 ? scalar::deposit(expected.data(), amount.data(), n, expectedRejected.data())
+                                       : scalar::withdraw(expected.data(), floor.data(), amount.data(), n, expectedRejected.data());
+        expectedRejected.resize(expectedCount);
+        for (const PostingKernels* k : kernels) {
+          vector<Cents> got = balance;
+          vector<uint32_t> gotRejected(max<size_t>(1, n));
+          size_t count = op == 0 ? k->deposit(got.data(), amount.data(), n, gotRejected.data())
+                                 : k->withdraw(got.data(), floor.data(), amount.data(), n, gotRejected.data());
+          gotRejected.resize(count);
+          same = same && got == expected && gotRejected == expectedRejected;
+        }
+      }
+    }
+    string names;
+    for (const PostingKernels* k : kernels) {
+      names += string(names.empty() ? "" : ", ") + k->name;
+    }
+    check(same, "kernels agree on balances and rejections (" + names + ")");
+  }
+  {
+    PostingEngine engine;
+    engine.openSaving(1000);
+    engine.openCurrent(1000);
+    engine.openFixedDeposit(1000);
+    vector<Rejection> r;
+    engine.withdraw(Withdrawable, {1001, 51000}, r);
+    engine.withdraw(DepositOnly, {5}, r);
+    engine.deposit(Withdrawable, {maxBalance, -3}, r);
+    bool reasons = r.size() == 4 && r[0].reason == OverdraftLimit && r[0].account == 0 && r[1].reason == NotWithdrawable &&
+                   r[2].reason == BalanceLimit && r[2].account == 0 && r[3].reason == InvalidAmount && r[3].account == 1;
+    check(reasons && engine.withdrawable.balance[1] == -50000 && engine.depositOnly.balance[0] == 1000,
+          "rejected operations land in the error array with their reason, balances stay unchanged");
+    bool threw = false;
+    try {
+      engine.deposit(Withdrawable, {1}, r);
+    } catch (const invalid_argument&) {
+      threw = true;
+    }
+    check(threw, "a batch with the wrong number of amounts is refused as a whole");
+    size_t refused = 0;
+    for (Cents opening : {(Cents)-1, maxBalance + 1, numeric_limits<Cents>::min()}) {
+      try {
+        engine.openFixedDeposit(opening);
+      } catch (const invalid_argument&) {
+        refused++;
+      }
+    }
+    check(refused == 3 && engine.size(DepositOnly) == 1, "fixed deposits open only within 0 .. maxBalance, like the others");
+  }
+
+  //Benchmark: the nightly run (deposit 1000.00, withdraw 500.00 everywhere) over `accounts` accounts,
+  //a third of each kind, as in the LSP.cpp loop
+  size_t accounts = argc > 1 ? atol(argv[1]) : 3000000;
+  int passes = argc > 2 ? atoi(argv[2]) : 5;
+  mt19937_64 random(7);
+  vector<Cents> opening(accounts);
+  for (auto& o : opening) {
+    o = random() % 100000;
+  }
+  vector<unique_ptr<lsp::Account>> owned;
+  vector<lsp::Account*> objects;
+  for (size_t i = 0; i < accounts; i++) {
+    lsp::Account* a = i % 3 == 0 ? (lsp::Account*)new lsp::SavingAccount() : i % 3 == 1 ? (lsp::Account*)new lsp::CurrentAccount()
+                                                                                         : (lsp::Account*)new lsp::FixedDepositAccount();
+    a->balance = opening[i];
+    owned.emplace_back(a);
+    objects.push_back(a);
+  }
+  auto start = chrono::steady_clock::now();
+  size_t loopFailed = 0;
+  for (int pass = 0; pass < passes; pass++) {
+    loopFailed += lsp::processTransaction(objects);
+  }
+  double loopSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  Cents loopTotal = 0;
+  for (lsp::Account* a : objects) {
+    loopTotal += a->balance;
+  }
+  cout << "===Nightly run, " << accounts << " accounts x " << passes << " passes, M accounts/s===" << endl;
+  cout << "LSP.cpp loop (virtual calls, exceptions): " << accounts * passes / loopSeconds / 1e6 << endl;
+
+  for (const PostingKernels* k : kernels) {
+    PostingEngine engine(k);
+    for (size_t i = 0; i < accounts; i++) {
+      if (i % 3 == 0) {
+        engine.openSaving(opening[i]);
+      } else if (i % 3 == 1) {
+        engine.openCurrent(opening[i]);
+      } else {
+        engine.openFixedDeposit(opening[i]);
+      }
+    }
+    vector<Cents> depositW(engine.size(Withdrawable), 100000), withdrawW(engine.size(Withdrawable), 50000);
+    vector<Cents> depositD(engine.size(DepositOnly), 100000);
+    vector<Rejection> errors;
+    errors.reserve(accounts);
+    size_t failed = 0;
+    start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+      errors.clear();
+      engine.deposit(Withdrawable, depositW, errors);
+      engine.withdraw(Withdrawable, withdrawW, errors);
+      engine.deposit(DepositOnly, depositD, errors);
+      failed += errors.size() + engine.size(DepositOnly);  //the loop also "tries" a withdrawal on every fixed deposit
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    Cents total = 0;
+    for (Cents b : engine.withdrawable.balance) {
+      total += b;
+    }
+    for (Cents b : engine.depositOnly.balance) {
+      total += b;
+    }
+    cout << "PostingEngine, " << k->name << ": " << accounts * passes / seconds / 1e6
+         << (total == loopTotal && failed == loopFailed ? "" : " (results differ from the loop!)") << endl;
+    if (total != loopTotal || failed != loopFailed) {
+      failures++;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,478 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+using namespace std;
+
+//The accounts of LSP_applied.cpp, with real balances that many threads can use at the same time.
+//
+//Money is counted in cents (int64_t): doubles can not hold 0.10 exactly, and sums of many of them drift.
+//
+//deposit() and withdraw() are LOCK-FREE: the balance is one atomic, and both are compare-and-swap loops that check
+//the rules on the value they are about to replace (the overdraft limit, and that the sum fits in 64 bits). A rule
+//can never be broken, because the swap fails (and is retried with the new balance) if another thread changed the
+//balance in between.
+//
+//transfer(from, to, amount) is atomic across both accounts: it locks the two accounts, the one with the lower id
+//first, and debits and credits while holding both. Ledger::balances(a, b) and Ledger::total() take the same locks
+//in the same order, so they never see the debit without the credit. Because every thread locks in id order, two
+//transfers in opposite directions can not deadlock. Transfers that share no account run in parallel.
+//Single-account deposits and withdrawals take no lock at all, and currentBalance() is one atomic read.
+
+typedef int64_t Cents;
+
+class DepositableAccount {
+  public:
+    DepositableAccount(uint32_t id, Cents opening) : id(id), balance(opening) {}
+    virtual ~DepositableAccount() {}
+
+    //False for amounts that are not positive, or that would take the balance past the largest Cents
+    bool deposit(Cents amount) {
+      if (amount <= 0) {
+        return false;
+      }
+      Cents current = balance.load();
+      Cents next;
+      do {
+        if (__builtin_add_overflow(current, amount, &next)) {
+          return false;
+        }
+      } while (!balance.compare_exchange_weak(current, next));
+      return true;
+    }
+
+    Cents currentBalance() const {
+      return balance.load();
+    }
+
+    const uint32_t id;
+
+  protected:
+    friend class Ledger;
+    atomic<Cents> balance;
+    //Held by transfers and by the Ledger's readers, never by deposit() and withdraw()
+    mutex transferLock;
+};
+
+//The overdraft rule is a number, not a virtual function, so it is checked inside the compare-and-swap loop.
+class WithdrawableAccount : public DepositableAccount {
+  public:
+    WithdrawableAccount(uint32_t id, Cents opening, Cents overdraftLimit) : DepositableAccount(id, opening), overdraftLimit(overdraftLimit) {}
+
+    //False (and nothing changes) if the balance would go below -overdraftLimit, or below the smallest Cents
+    bool withdraw(Cents amount) {
+      if (amount <= 0) {
+        return false;
+      }
+      Cents current = balance.load();
+      Cents next;
+      do {
+        if (__builtin_sub_overflow(current, amount, &next) || next < -overdraftLimit) {
+          return false;
+        }
+      } while (!balance.compare_exchange_weak(current, next));
+      return true;
+    }
+
+    const Cents overdraftLimit;
+};
+
+//SavingAccount supports both deposit and withdrawl, and never goes below zero.
+class SavingAccount : public WithdrawableAccount {
+  public:
+    SavingAccount(uint32_t id, Cents opening) : WithdrawableAccount(id, opening, 0) {}
+};
+
+//CurrentAccount supports both deposit and withdrawl, with an overdraft of up to 500.00.
+class CurrentAccount : public WithdrawableAccount {
+  public:
+    CurrentAccount(uint32_t id, Cents opening) : WithdrawableAccount(id, opening, 50000) {}
+};
+
+//FixedDepositAccount only supports deposit, so it can only be the receiving side of a transfer.
+class FixedDepositAccount : public DepositableAccount {
+  public:
+    FixedDepositAccount(uint32_t id, Cents opening) : DepositableAccount(id, opening) {}
+};
+
+class Ledger {
+  public:
+    //Accounts are never moved or closed, so references to them stay valid
+    template <typename T>
+    T& open(Cents opening) {
+      lock_guard<mutex> lock(accountsLock);
+      T* account = new T((uint32_t)accounts.size(), opening);
+      accounts.emplace_back(account);
+      return *account;
+    }
+
+    //Moves the amount, or nothing: false if it is not positive, from and to are the same account, from's
+    //overdraft rule would be broken, or to's balance would overflow. The source must be a WithdrawableAccount, so
+    //the compiler rejects a transfer out of a FixedDepositAccount. Holds both accounts' locks (lower id first), so
+    //balances() and total() see the debit and the credit together.
+    bool transfer(WithdrawableAccount& from, DepositableAccount& to, Cents amount) {
+      if (amount <= 0 || from.id == to.id) {
+        return false;
+      }
+      unique_lock<mutex> first, second;
+      lockInOrder(from, to, first, second);
+      if (!from.withdraw(amount)) {
+        return false;
+      }
+      if (!to.deposit(amount)) {
+        from.balance.fetch_add(amount);  //gives back what was just taken
+        return false;
+      }
+      return true;
+    }
+
+    //Both balances at one moment: never in the middle of a transfer between them
+    pair<Cents, Cents> balances(DepositableAccount& a, DepositableAccount& b) {
+      unique_lock<mutex> first, second;
+      lockInOrder(a, b, first, second);
+      return {a.currentBalance(), b.currentBalance()};
+    }
+
+    //The sum of all balances, with no transfer half done. Takes every account's lock, in id order.
+    Cents total() {
+      lock_guard<mutex> lock(accountsLock);
+      vector<unique_lock<mutex>> locks;
+      locks.reserve(accounts.size());
+      for (auto& account : accounts) {
+        locks.emplace_back(account->transferLock);
+      }
+      Cents sum = 0;
+      for (auto& account : accounts) {
+        sum += account->currentBalance();
+      }
+      return sum;
+    }
+
+    size_t size() {
+      lock_guard<mutex> lock(accountsLock);
+      return accounts.size();
+    }
+
+  private:
+    //The fixed order every thread locks in, so no two threads can wait for each other in a circle
+    static void lockInOrder(DepositableAccount& a, DepositableAccount& b, unique_lock<mutex>& first, unique_lock<mutex>& second) {
+      DepositableAccount& lower = a.id < b.id ? a : b;
+      DepositableAccount& higher = a.id < b.id ? b : a;
+      first = unique_lock<mutex>(lower.transferLock);
+      if (&higher != &lower) {
+        second = unique_lock<mutex>(higher.transferLock);
+      }
+    }
+
+    mutex accountsLock;
+    deque<unique_ptr<DepositableAccount>> accounts;  //in id order
+};
+
+class BankClient {
+  private:
+  //A bank client can have a vector of both the type account
+    vector<WithdrawableAccount*> withdrawableAccounts;
+    vector<DepositableAccount*> depositableAccounts;
+  public:
+    BankClient(vector<WithdrawableAccount*> withdrawableAccounts, vector<DepositableAccount*> depositableAccounts) {
+      this->withdrawableAccounts = withdrawableAccounts;
+      this->depositableAccounts = depositableAccounts;
+    }
+
+    //Every thread takes its own slice of the accounts, so no two threads touch the same account.
+    //Returns how many withdrawals the overdraft rule rejected.
+    size_t processTransaction(unsigned threads = thread::hardware_concurrency()) {
+      size_t total = withdrawableAccounts.size() + depositableAccounts.size();
+      //Below this, starting threads costs more than the work
+      threads = (unsigned)min<size_t>(max(1u, threads), total / 4096 + 1);
+      vector<size_t> rejected(threads);
+      auto work = [&](unsigned t) {
+        size_t begin = total * t / threads;
+        size_t end = total * (t + 1) / threads;
+        for (size_t i = begin; i < end; i++) {
+          if (i < withdrawableAccounts.size()) {
+            withdrawableAccounts[i]->deposit(100000);
+            rejected[t] += !withdrawableAccounts[i]->withdraw(50000);
+          } else {
+            depositableAccounts[i - withdrawableAccounts.size()]->deposit(100000);
+          }
+        }
+      };
+      vector<thread> workers;
+      for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(work, t);
+      }
+      work(0);
+      for (auto& w : workers) {
+        w.join();
+      }
+      size_t sum = 0;
+      for (size_t r : rejected) {
+        sum += r;
+      }
+      return sum;
+    }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+//Opens `count` accounts, a third of each kind, 1000.00 each
+void openAccounts(Ledger& ledger, size_t count, vector<WithdrawableAccount*>& withdrawable, vector<DepositableAccount*>& all) {
+  for (size_t i = 0; i < count; i++) {
+    DepositableAccount* account;
+    if (i % 3 == 0) {
+      account = &ledger.open<SavingAccount>(100000);
+      withdrawable.push_back((WithdrawableAccount*)account);
+    } else if (i % 3 == 1) {
+      account = &ledger.open<CurrentAccount>(100000);
+      withdrawable.push_back((WithdrawableAccount*)account);
+    } else {
+      account = &ledger.open<FixedDepositAccount>(100000);
+    }
+    all.push_back(account);
+  }
+}
+
+int main(int argc, char** argv) {
+  Ledger ledger;
+  SavingAccount& saving = ledger.open<SavingAccount>(100000);
+  CurrentAccount& current = ledger.open<CurrentAccount>(0);
+  FixedDepositAccount& fixed = ledger.open<FixedDepositAccount>(500000);
+  BankClient client({&saving, &current}, {&fixed});
+  client.processTransaction();
+  ledger.transfer(current, fixed, 20000);
+  cout << "Saving " << saving.currentBalance() / 100.0 << ", current " << current.currentBalance() / 100.0 << ", fixed deposit "
+       << fixed.currentBalance() / 100.0 << endl;
+
+  cout << "===Checks===" << endl;
+  {
+    Ledger l;
+    SavingAccount& s = l.open<SavingAccount>(1000);
+    CurrentAccount& c = l.open<CurrentAccount>(1000);
+    bool savingRule = !s.withdraw(1001) && s.withdraw(1000) && s.currentBalance() == 0 && !s.withdraw(1);
+    bool currentRule = c.withdraw(51000) && c.currentBalance() == -50000 && !c.withdraw(1);
+    bool amounts = !s.deposit(0) && !s.deposit(-5) && !c.withdraw(-5) && !l.transfer(c, s, 0) && !l.transfer(s, s, 10);
+    check(savingRule && currentRule && amounts, "overdraft rules and invalid amounts");
+    //-500.00 minus the largest amount does not fit in 64 bits and must not wrap around to a big positive balance
+    Cents most = numeric_limits<Cents>::max();
+    bool noWrap = !c.withdraw(most) && !l.transfer(c, s, most) && c.currentBalance() == -50000;
+    bool noOverflow = s.deposit(1) && !s.deposit(most) && s.deposit(most - 1) && s.currentBalance() == most;
+    //The credit can not fit, so the debit is given back
+    bool undone = c.deposit(50001) && !l.transfer(c, s, 1) && c.currentBalance() == 1 && s.currentBalance() == most;
+    check(noWrap && noOverflow && undone, "amounts that would overflow a balance are refused");
+  }
+  {
+    //One thread moves money back and forth between two accounts; every read of both together sees the same sum
+    Ledger l;
+    CurrentAccount& a = l.open<CurrentAccount>(100000);
+    SavingAccount& b = l.open<SavingAccount>(100000);
+    atomic<bool> running{true};
+    thread mover([&] {
+      for (int i = 0; i < 200000; i++) {
+        l.transfer(a, b, 70000);
+        l.transfer(b, a, 70000);
+      }
+      running = false;
+    });
+    bool together = true;
+    long reads = 0;
+    while (running || reads == 0) {
+      pair<Cents, Cents> both = l.balances(b, a);
+      together = together && both.first + both.second == 200000;
+      reads++;
+    }
+    mover.join();
+    check(together, "a transfer changes both balances together for readers that lock both");
+  }
+  {
+    //Many threads withdraw from one account at once: exactly as many succeed as the balance allows
+    Ledger l;
+    SavingAccount& s = l.open<SavingAccount>(30000);
+    atomic<int> succeeded{0};
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++) {
+      threads.emplace_back([&] {
+        for (int i = 0; i < 1000; i++) {
+          succeeded += s.withdraw(7);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    check(succeeded == 30000 / 7 && s.currentBalance() == 30000 % 7, "concurrent withdrawals never overdraw a saving account");
+  }
+  {
+    //Transfers only: total() must be exactly the same every time, even while transfers run,
+    //and opposite transfers between a few hot accounts must not deadlock
+    Ledger l;
+    vector<WithdrawableAccount*> withdrawable;
+    vector<DepositableAccount*> all;
+    openAccounts(l, 300, withdrawable, all);
+    Cents expected = l.total();
+    atomic<bool> running{true};
+    atomic<bool> conserved{true};
+    thread auditor([&] {
+      while (running) {
+        conserved = conserved && l.total() == expected;
+      }
+    });
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++) {
+      threads.emplace_back([&, t] {
+        mt19937 random(t);
+        for (int i = 0; i < 20000; i++) {
+          //half of the transfers go between the first four accounts, in both directions
+          bool hot = i % 2 == 0;
+          WithdrawableAccount& from = *withdrawable[random() % (hot ? 4 : withdrawable.size())];
+          DepositableAccount& to = hot ? *(DepositableAccount*)withdrawable[random() % 4] : *all[random() % all.size()];
+          l.transfer(from, to, 1 + random() % 50000);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    running = false;
+    auditor.join();
+    bool rules = true;
+    for (WithdrawableAccount* a : withdrawable) {
+      rules = rules && a->currentBalance() >= -a->overdraftLimit;
+    }
+    check(conserved && l.total() == expected && rules, "160000 concurrent transfers conserve money and keep every overdraft rule");
+  }
+  {
+    //Everything at once: the total moves exactly by what was deposited and withdrawn from outside
+    Ledger l;
+    vector<WithdrawableAccount*> withdrawable;
+    vector<DepositableAccount*> all;
+    openAccounts(l, 90, withdrawable, all);
+    Cents opening = l.total();
+    vector<Cents> external(8);
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++) {
+      threads.emplace_back([&, t] {
+        mt19937 random(100 + t);
+        for (int i = 0; i < 20000; i++) {
+          Cents amount = 1 + random() % 30000;
+          switch (random() % 3) {
+            case 0:
+              if (all[random() % all.size()]->deposit(amount)) {
+                external[t] += amount;
+              }
+              break;
+            case 1:
+              if (withdrawable[random() % withdrawable.size()]->withdraw(amount)) {
+                external[t] -= amount;
+              }
+              break;
+            default:
+              l.transfer(*withdrawable[random() % withdrawable.size()], *all[random() % all.size()], amount);
+          }
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    Cents net = 0;
+    for (Cents e : external) {
+      net += e;
+    }
+    check(l.total() == opening + net, "deposits, withdrawals and transfers together: money in = money out");
+  }
+  {
+    Ledger l;
+    vector<WithdrawableAccount*> withdrawable;
+    vector<DepositableAccount*> all;
+    openAccounts(l, 30000, withdrawable, all);
+    vector<DepositableAccount*> depositOnly;
+    for (DepositableAccount* a : all) {
+      if (dynamic_cast<WithdrawableAccount*>(a) == nullptr) {
+        depositOnly.push_back(a);
+      }
+    }
+    BankClient bank(withdrawable, depositOnly);
+    Cents before = l.total();
+    size_t rejected = bank.processTransaction(4);
+    check(rejected == 0 && l.total() == before + (Cents)30000 * 100000 - (Cents)withdrawable.size() * 50000,
+          "parallel processTransaction posts every account once");
+  }
+
+  //Benchmarks
+  size_t accounts = argc > 1 ? atol(argv[1]) : 100000;
+  size_t operations = argc > 2 ? atol(argv[2]) : 2000000;
+  unsigned maxThreads = max(4u, thread::hardware_concurrency());
+  Ledger l;
+  vector<WithdrawableAccount*> withdrawable;
+  vector<DepositableAccount*> all;
+  openAccounts(l, accounts, withdrawable, all);
+  auto run = [&](unsigned threads, auto operation) {
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        mt19937 random(t + 1);
+        for (size_t i = 0; i < operations / threads; i++) {
+          operation(random);
+        }
+      });
+    }
+    for (auto& w : workers) {
+      w.join();
+    }
+    return operations / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e6;
+  };
+  cout << "===" << accounts << " accounts, M operations per second===" << endl;
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+    double spread = run(threads, [&](mt19937& random) {
+      WithdrawableAccount* a = withdrawable[random() % withdrawable.size()];
+      a->deposit(100);
+      a->withdraw(100);
+    });
+    double hot = run(threads, [&](mt19937&) {
+      withdrawable[0]->deposit(100);
+      withdrawable[0]->withdraw(100);
+    });
+    double transfers = run(threads, [&](mt19937& random) {
+      l.transfer(*withdrawable[random() % withdrawable.size()], *all[random() % all.size()], 100);
+    });
+    double hotTransfers = run(threads, [&](mt19937& random) {
+      l.transfer(*withdrawable[random() % 4], *withdrawable[random() % 4], 100);
+    });
+    cout << threads << " threads: deposit+withdraw " << spread << " (one hot account " << hot << "), transfer " << transfers
+         << " (between 4 hot accounts " << hotTransfers << ")" << endl;
+  }
+  vector<DepositableAccount*> depositOnly;
+  for (DepositableAccount* a : all) {
+    if (dynamic_cast<WithdrawableAccount*>(a) == nullptr) {
+      depositOnly.push_back(a);
+    }
+  }
+  BankClient bank(withdrawable, depositOnly);
+  for (unsigned threads : {1u, maxThreads}) {
+    auto start = chrono::steady_clock::now();
+    for (int pass = 0; pass < 10; pass++) {
+      bank.processTransaction(threads);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "processTransaction, " << threads << " threads: " << accounts * 10 / seconds / 1e6 << " M accounts/s" << endl;
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,912 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+using namespace std;
+namespace fs = std::filesystem;
+
+//For auditing, the ledger does not store balances, it stores what happened: every account opening, deposit and
+//withdrawal is an immutable EVENT appended to a log, and the balances are what you get by replaying the log.
+//
+//A command is first DECIDED against the current balances (the overdraft rules of LSP_applied.cpp: a saving account
+//may not go below 0, a current account below -500.00, and a fixed deposit account can not withdraw at all). A refused
+//command records nothing. An accepted one becomes an event, which is appended to the log and then APPLIED to the
+//balances. Replaying applies events without deciding again: they are facts.
+//
+//Replaying years of events at startup is too slow, so every `snapshotEvery` events the ledger writes a SNAPSHOT: all
+//balances as of one event number. Recovery loads the newest good snapshot and replays only the events after it.
+//  - events.log is fixed size records, so event n is at offset (n - 1) * 24 and the tail is found without a scan
+//  - every event has a CRC-32C that also covers its number, so a torn or misplaced record is detected; the log is cut
+//    at the first bad event
+//  - a snapshot is written by a background thread to a .tmp file, fsynced and renamed, and only after the log is
+//    durable up to its event number, so a snapshot is never ahead of the log. If the log later loses its tail anyway,
+//    recovery deletes the snapshots past it
+//  - the newest `keepSnapshots` are kept, so a damaged snapshot falls back to the one before it
+//One ledger has one writer; spread accounts over several ledgers for more.
+
+typedef int64_t Cents;
+
+const Cents maxBalance = (Cents)1 << 60;
+
+//CRC-32C (Castagnoli), with the SSE4.2 instruction where the CPU has it
+struct CrcTable {
+  uint32_t entries[256];
+  CrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int bit = 0; bit < 8; bit++) {
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+      }
+      entries[i] = c;
+    }
+  }
+};
+
+uint32_t crc32cPortable(const char* data, size_t size) {
+  static const CrcTable table;
+  uint32_t crc = ~0u;
+  for (size_t i = 0; i < size; i++) {
+    crc = table.entries[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cHardware(const char* data, size_t size) {
+  uint64_t crc = ~0u;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    crc = __builtin_ia32_crc32di(crc, word);
+  }
+  uint32_t c = (uint32_t)crc;
+  for (; i < size; i++) {
+    c = __builtin_ia32_crc32qi(c, (uint8_t)data[i]);
+  }
+  return ~c;
+}
+#endif
+
+uint32_t crc32c(const char* data, size_t size) {
+#if defined(__x86_64__)
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  if (hardware) {
+    return crc32cHardware(data, size);
+  }
+#endif
+  return crc32cPortable(data, size);
+}
+
+enum AccountKind : uint8_t { Saving, Current, FixedDeposit };
+
+enum EventKind : uint8_t { OpenSaving, OpenCurrent, OpenFixedDeposit, Deposited, Withdrawn };
+
+//Written to disk as is. `account` of an Open event is the id the new account gets.
+struct Event {
+  Cents amount;
+  uint32_t account;
+  uint32_t crc;
+  uint8_t kind;
+  uint8_t reserved[7];
+};
+static_assert(sizeof(Event) == 24, "Event is written to disk as is");
+
+//Covers the event's number too, so an event read back at the wrong position does not pass
+uint32_t eventCrc(const Event& event, uint64_t sequence) {
+  char bytes[8 + sizeof(Event)];
+  memcpy(bytes, &sequence, 8);
+  memcpy(bytes + 8, &event, sizeof event);
+  memset(bytes + 8 + offsetof(Event, crc), 0, 4);
+  return crc32c(bytes, sizeof bytes);
+}
+
+Event makeEvent(EventKind kind, uint32_t account, Cents amount) {
+  Event event;
+  memset(&event, 0, sizeof event);
+  event.kind = kind;
+  event.account = account;
+  event.amount = amount;
+  return event;
+}
+
+//The balances, and the two halves of event sourcing: deciding whether a proposed event may happen, and applying one
+//that did
+class Accounts {
+  public:
+    //The rules. Only events that pass are recorded.
+    bool allows(const Event& event) const {
+      if (event.kind <= OpenFixedDeposit) {
+        Cents floor = event.kind == OpenCurrent ? -50000 : 0;
+        return event.account == balance.size() && event.amount >= floor && event.amount <= maxBalance;
+      }
+      if (event.account >= balance.size() || event.amount <= 0) {
+        return false;
+      }
+      Cents current = balance[event.account];
+      if (event.kind == Deposited) {
+        return event.amount <= maxBalance - current;
+      }
+      if (event.kind == Withdrawn && kind[event.account] != FixedDeposit) {
+        Cents floor = kind[event.account] == Current ? -50000 : 0;
+        return event.amount <= current - floor;
+      }
+      return false;
+    }
+
+    //Events are facts, so this never refuses one; false only for an event that can not belong to this ledger
+    bool apply(const Event& event) {
+      switch (event.kind) {
+        case OpenSaving:
+        case OpenCurrent:
+        case OpenFixedDeposit:
+          if (event.account != balance.size()) {
+            return false;
+          }
+          balance.push_back(event.amount);
+          kind.push_back(event.kind == OpenSaving ? Saving : event.kind == OpenCurrent ? Current : FixedDeposit);
+          return true;
+        case Deposited:
+        case Withdrawn:
+          if (event.account >= balance.size()) {
+            return false;
+          }
+          balance[event.account] += event.kind == Deposited ? event.amount : -event.amount;
+          return true;
+      }
+      return false;
+    }
+
+    vector<Cents> balance;
+    vector<uint8_t> kind;
+};
+
+[[noreturn]] void fail(const string& what) {
+  throw runtime_error(what + ": " + strerror(errno));
+}
+
+void writeAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("write");
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+//Reads up to `size` bytes at `offset`; fewer only at the end of the file
+size_t readAt(int fd, char* data, size_t size, uint64_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = ::pread(fd, data + done, size - done, offset + done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("pread");
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+//Makes creates, renames and deletes in the directory durable
+void syncDirectory(const string& directory) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    fail("open " + directory);
+  }
+  ::fsync(fd);
+  ::close(fd);
+}
+
+//Snapshot file: this header, then `accounts` balances, then `accounts` kinds. `crc` covers everything after itself.
+struct SnapshotHeader {
+  uint32_t crc;
+  uint32_t magic;
+  uint64_t sequence;
+  uint64_t accounts;
+};
+static_assert(sizeof(SnapshotHeader) == 24, "SnapshotHeader is written to disk as is");
+
+const uint32_t snapshotMagic = 0x534E4150;
+
+class EventSourcedLedger {
+  public:
+    struct Options {
+      uint64_t snapshotEvery = 1 << 24;  //events; 0 for no automatic snapshots
+      int keepSnapshots = 2;
+      bool useSnapshots = true;          //false: recover by replaying the whole log
+      size_t bufferBytes = 1 << 20;      //events are written to the file when this much is buffered, or on commit()
+    };
+
+    //What the last recovery did
+    struct Recovery {
+      uint64_t snapshotSequence = 0;  //0 if no snapshot was used
+      uint64_t replayed = 0;
+      uint64_t truncatedBytes = 0;
+      double seconds = 0;
+    };
+
+    EventSourcedLedger(const string& directory) : EventSourcedLedger(directory, Options()) {}
+
+    EventSourcedLedger(const string& directory, const Options& options) : directory(directory), options(options) {
+      fs::create_directories(directory);
+      for (auto& entry : fs::directory_iterator(directory)) {
+        if (entry.path().extension() == ".tmp") {
+          fs::remove(entry.path());
+        }
+      }
+      fd = ::open(logPath().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (fd < 0) {
+        fail("open " + logPath());
+      }
+      recover();
+      buffer.reserve(options.bufferBytes);
+    }
+
+    ~EventSourcedLedger() {
+      try {
+        commit();
+      } catch (const exception& e) {
+        cerr << "EventSourcedLedger: " << e.what() << endl;
+      }
+      if (snapshotWriter.joinable()) {
+        snapshotWriter.join();
+      }
+      ::close(fd);
+    }
+
+    //The commands. Each returns false (and records nothing) if the rules refuse it.
+    //An accepted event is durable once commit() returns.
+    bool openSaving(Cents opening) {
+      return record(makeEvent(OpenSaving, (uint32_t)accounts.balance.size(), opening));
+    }
+    bool openCurrent(Cents opening) {
+      return record(makeEvent(OpenCurrent, (uint32_t)accounts.balance.size(), opening));
+    }
+    bool openFixedDeposit(Cents opening) {
+      return record(makeEvent(OpenFixedDeposit, (uint32_t)accounts.balance.size(), opening));
+    }
+    bool deposit(uint32_t account, Cents amount) {
+      return record(makeEvent(Deposited, account, amount));
+    }
+    bool withdraw(uint32_t account, Cents amount) {
+      return record(makeEvent(Withdrawn, account, amount));
+    }
+
+    bool record(Event event) {
+      if (!accounts.allows(event)) {
+        return false;
+      }
+      //Everything that can fail on disk (the snapshot's commit, the flush) comes before the event gets its number, and
+      //it is applied last: if anything throws, nothing about the event has changed, neither in the log nor in memory
+      if (options.snapshotEvery != 0 && sequence - lastSnapshot >= options.snapshotEvery) {
+        snapshot();
+      }
+      if (buffer.size() + sizeof event > options.bufferBytes) {
+        flushBuffer();
+      }
+      event.crc = eventCrc(event, sequence + 1);
+      buffer.append((const char*)&event, sizeof event);
+      sequence++;
+      try {
+        accounts.apply(event);
+      } catch (...) {
+        //Opening an account can run out of memory
+        buffer.resize(buffer.size() - sizeof event);
+        sequence--;
+        throw;
+      }
+      return true;
+    }
+
+    //Makes every recorded event durable
+    void commit() {
+      flushBuffer();
+      if (durable < sequence) {
+        if (::fdatasync(fd) != 0) {
+          fail("fdatasync " + logPath());
+        }
+        durable = sequence;
+      }
+    }
+
+    //Starts writing a snapshot of the balances as of now. The copy is taken here, the file is written in the background.
+    void snapshot() {
+      commit();
+      if (snapshotWriter.joinable()) {
+        snapshotWriter.join();
+      }
+      snapshotWriter = thread(&EventSourcedLedger::writeSnapshot, this, sequence, accounts.balance, accounts.kind);
+      lastSnapshot = sequence;
+    }
+
+    //Waits for the snapshot being written, if any
+    void waitForSnapshot() {
+      if (snapshotWriter.joinable()) {
+        snapshotWriter.join();
+      }
+    }
+
+    Cents balance(uint32_t account) const {
+      return accounts.balance.at(account);
+    }
+    const vector<Cents>& balances() const {
+      return accounts.balance;
+    }
+    uint64_t events() const {
+      return sequence;
+    }
+    const Recovery& lastRecovery() const {
+      return recovery;
+    }
+
+    //Writes the buffered events to the log. If that fails part way, the log is cut back to where they start and they
+    //stay buffered, so the file never holds half an event or one twice, and a later flush can try again.
+    void flushBuffer() {
+      if (buffer.empty()) {
+        return;
+      }
+      try {
+        writeAll(fd, buffer.data(), buffer.size());
+      } catch (...) {
+        off_t start = (off_t)((sequence - buffer.size() / sizeof(Event)) * sizeof(Event));
+        if (::ftruncate(fd, start) == 0) {
+          ::lseek(fd, start, SEEK_SET);
+        }
+        throw;
+      }
+      buffer.clear();
+    }
+
+    string logPath() const {
+      return directory + "/events.log";
+    }
+    string snapshotPath(uint64_t at) const {
+      char name[40];
+      snprintf(name, sizeof name, "/snapshot-%020llu.snap", (unsigned long long)at);
+      return directory + name;
+    }
+
+  private:
+    void writeSnapshot(uint64_t at, vector<Cents> balance, vector<uint8_t> kind) {
+      try {
+        string bytes(sizeof(SnapshotHeader) + balance.size() * sizeof(Cents) + kind.size(), '\0');
+        SnapshotHeader header = {0, snapshotMagic, at, balance.size()};
+        memcpy(&bytes[0], &header, sizeof header);
+        memcpy(&bytes[sizeof header], balance.data(), balance.size() * sizeof(Cents));
+        memcpy(&bytes[sizeof header + balance.size() * sizeof(Cents)], kind.data(), kind.size());
+        header.crc = crc32c(bytes.data() + 4, bytes.size() - 4);
+        memcpy(&bytes[0], &header.crc, 4);
+
+        string path = snapshotPath(at);
+        int out = ::open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+          fail("open " + path + ".tmp");
+        }
+        writeAll(out, bytes.data(), bytes.size());
+        if (::fdatasync(out) != 0 || ::close(out) != 0 || ::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+          fail("finish " + path);
+        }
+        syncDirectory(directory);
+        vector<uint64_t> all = snapshotSequences();
+        for (size_t i = options.keepSnapshots; i < all.size(); i++) {
+          fs::remove(snapshotPath(all[i]));
+        }
+      } catch (const exception& e) {
+        //A missing snapshot only makes the next recovery slower
+        cerr << "EventSourcedLedger snapshot: " << e.what() << endl;
+      }
+    }
+
+    //Newest first
+    vector<uint64_t> snapshotSequences() const {
+      vector<uint64_t> all;
+      for (auto& entry : fs::directory_iterator(directory)) {
+        string name = entry.path().filename().string();
+        if (name.size() == 34 && name.compare(0, 9, "snapshot-") == 0 && name.compare(29, 5, ".snap") == 0) {
+          all.push_back(stoull(name.substr(9, 20)));
+        }
+      }
+      sort(all.rbegin(), all.rend());
+      return all;
+    }
+
+    //False if the snapshot is missing, damaged, or ahead of the log
+    bool loadSnapshot(uint64_t at, uint64_t eventsInLog) {
+      if (at > eventsInLog) {
+        return false;
+      }
+      string path = snapshotPath(at);
+      int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (in < 0) {
+        return false;
+      }
+      struct stat info;
+      string bytes;
+      if (::fstat(in, &info) == 0 && (size_t)info.st_size >= sizeof(SnapshotHeader)) {
+        bytes.resize(info.st_size);
+        bytes.resize(readAt(in, &bytes[0], bytes.size(), 0));
+      }
+      ::close(in);
+      SnapshotHeader header;
+      if (bytes.size() < sizeof header) {
+        return false;
+      }
+      memcpy(&header, bytes.data(), sizeof header);
+      if (header.magic != snapshotMagic || header.sequence != at || bytes.size() != sizeof header + header.accounts * (sizeof(Cents) + 1) ||
+          crc32c(bytes.data() + 4, bytes.size() - 4) != header.crc) {
+        return false;
+      }
+      accounts.balance.resize(header.accounts);
+      accounts.kind.resize(header.accounts);
+      memcpy(accounts.balance.data(), bytes.data() + sizeof header, header.accounts * sizeof(Cents));
+      memcpy(accounts.kind.data(), bytes.data() + sizeof header + header.accounts * sizeof(Cents), header.accounts);
+      return true;
+    }
+
+    void recover() {
+      auto start = chrono::steady_clock::now();
+      struct stat info;
+      if (::fstat(fd, &info) != 0) {
+        fail("stat " + logPath());
+      }
+      uint64_t eventsInLog = info.st_size / sizeof(Event);
+      if (options.useSnapshots) {
+        for (uint64_t at : snapshotSequences()) {
+          if (loadSnapshot(at, eventsInLog)) {
+            sequence = at;
+            recovery.snapshotSequence = at;
+            break;
+          }
+        }
+      }
+
+      //Replays the tail, 4 MB at a time, up to the first event that is torn, damaged or impossible
+      vector<Event> chunk(1 << 17);
+      uint64_t at = sequence;
+      bool good = true;
+      while (good && at < eventsInLog) {
+        size_t bytes = readAt(fd, (char*)chunk.data(), chunk.size() * sizeof(Event), at * sizeof(Event));
+        size_t count = bytes / sizeof(Event);
+        for (size_t i = 0; i < count; i++) {
+          if (chunk[i].crc != eventCrc(chunk[i], at + 1) || !accounts.apply(chunk[i])) {
+            good = false;
+            break;
+          }
+          at++;
+        }
+        if (count == 0) {
+          break;
+        }
+      }
+      recovery.replayed = at - sequence;
+      sequence = durable = lastSnapshot = at;
+      //A snapshot past the recovered log (the log lost its tail) describes events that will now be recorded
+      //differently; once the log grows past it, it would be loaded, so it goes now
+      bool removed = false;
+      for (uint64_t stale : snapshotSequences()) {
+        if (stale > at) {
+          fs::remove(snapshotPath(stale));
+          removed = true;
+        }
+      }
+      if (removed) {
+        syncDirectory(directory);
+      }
+      if ((uint64_t)info.st_size != at * sizeof(Event)) {
+        recovery.truncatedBytes = info.st_size - at * sizeof(Event);
+        if (::ftruncate(fd, at * sizeof(Event)) != 0 || ::fdatasync(fd) != 0) {
+          fail("truncate " + logPath());
+        }
+      }
+      if (::lseek(fd, at * sizeof(Event), SEEK_SET) < 0) {
+        fail("seek " + logPath());
+      }
+      recovery.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    string directory;
+    Options options;
+    int fd;
+    Accounts accounts;
+    string buffer;
+    uint64_t sequence = 0;
+    uint64_t durable = 0;
+    uint64_t lastSnapshot = 0;
+    Recovery recovery;
+    thread snapshotWriter;
+};
+
+//A random stream of proposed events: mostly deposits and withdrawals on a fixed set of accounts, some refused by
+//the rules. The same seed gives the same stream, so a second Accounts can follow along as a reference.
+struct Workload {
+  mt19937_64 random;
+  uint32_t accountCount;
+
+  Workload(uint64_t seed, uint32_t accountCount) : random(seed), accountCount(accountCount) {}
+
+  Event next(const Accounts& accounts) {
+    if (accounts.balance.size() < accountCount) {
+      EventKind open = (EventKind)(accounts.balance.size() % 3);
+      return makeEvent(open, (uint32_t)accounts.balance.size(), (Cents)(random() % 100000));
+    }
+    uint64_t r = random();
+    return makeEvent(r & 1 ? Deposited : Withdrawn, (uint32_t)((r >> 1) % accountCount), (Cents)((r >> 33) % 60000));
+  }
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+string makeTempDirectory(const string& base) {
+  string pattern = base + "/ledger-XXXXXX";
+  if (!mkdtemp(pattern.data())) {
+    fail("mkdtemp " + pattern);
+  }
+  return pattern;
+}
+
+//The reference: the same workload applied to plain Accounts, `events` accepted events long
+Accounts reference(uint64_t seed, uint32_t accountCount, uint64_t events) {
+  Accounts accounts;
+  Workload workload(seed, accountCount);
+  uint64_t accepted = 0;
+  while (accepted < events) {
+    Event event = workload.next(accounts);
+    if (accounts.allows(event)) {
+      accounts.apply(event);
+      accepted++;
+    }
+  }
+  return accounts;
+}
+
+//A child process records events (committing every 100) until it is killed with SIGKILL at a random moment, maybe in
+//the middle of a write or a snapshot. Recovery must then give exactly the balances after some number of events that
+//is at least the number committed.
+bool crashRound(const string& directory, atomic<uint64_t>* committed, uint64_t seed, mt19937& random) {
+  EventSourcedLedger::Options options;
+  options.snapshotEvery = 5000;
+  options.bufferBytes = 4096;
+  committed->store(0);
+  pid_t child = fork();
+  if (child < 0) {
+    fail("fork");
+  }
+  if (child == 0) {
+    try {
+      fs::remove_all(directory);
+      EventSourcedLedger ledger(directory, options);
+      Accounts mirror;
+      Workload workload(seed, 300);
+      for (;;) {
+        Event event = workload.next(mirror);
+        if (mirror.allows(event)) {
+          mirror.apply(event);
+          ledger.record(event);
+          if (ledger.events() % 100 == 0) {
+            ledger.commit();
+            committed->store(ledger.events());
+          }
+        }
+      }
+    } catch (const exception& e) {
+      cerr << "crash test writer: " << e.what() << endl;
+    }
+    _exit(1);
+  }
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+  while (committed->load() < 20000 && chrono::steady_clock::now() < deadline) {
+    this_thread::sleep_for(chrono::microseconds(100));
+  }
+  this_thread::sleep_for(chrono::microseconds(random() % 20000));
+  ::kill(child, SIGKILL);
+  int status;
+  ::waitpid(child, &status, 0);
+  if (!WIFSIGNALED(status)) {
+    return false;
+  }
+  EventSourcedLedger ledger(directory, options);
+  return ledger.events() >= committed->load() && ledger.balances() == reference(seed, 300, ledger.events()).balance;
+}
+
+//`./Event-Sourced-Ledger 1000000000` runs the benchmark at 1B events: a 24 GB log, about 1.5 minutes on one core with
+//an SSD. The default is 20M, so a plain run (the checks) stays quick and small.
+int main(int argc, char** argv) {
+  uint64_t events = argc > 1 ? stoull(argv[1]) : 20000000;
+  string base = argc > 2 ? argv[2] : fs::temp_directory_path().string();
+  string directory = makeTempDirectory(base);
+
+  {
+    EventSourcedLedger ledger(directory + "/example");
+    ledger.openSaving(100000);
+    ledger.openCurrent(0);
+    ledger.openFixedDeposit(500000);
+    ledger.deposit(0, 100000);
+    ledger.withdraw(1, 50000);
+    ledger.withdraw(2, 50000);  //refused: nothing is recorded
+    ledger.commit();
+  }
+  {
+    EventSourcedLedger ledger(directory + "/example");
+    cout << "After replaying " << ledger.events() << " events: saving " << ledger.balance(0) / 100.0 << ", current "
+         << ledger.balance(1) / 100.0 << ", fixed deposit " << ledger.balance(2) / 100.0 << endl;
+  }
+
+  //The crash test forks, so it runs first, while this process has no other threads
+  cout << "===Checks===" << endl;
+  {
+    atomic<uint64_t>* committed = (atomic<uint64_t>*)mmap(nullptr, sizeof(atomic<uint64_t>), PROT_READ | PROT_WRITE,
+                                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    new (committed) atomic<uint64_t>(0);
+    mt19937 random(42);
+    bool consistent = true;
+    for (int round = 0; round < 8 && consistent; round++) {
+      consistent = crashRound(directory + "/crash" + to_string(round), committed, 100 + round, random);
+    }
+    check(consistent, "after SIGKILL mid-write, recovery gives the exact balances of a prefix with every committed event (8 rounds)");
+    munmap(committed, sizeof(atomic<uint64_t>));
+  }
+
+  check(crc32c("123456789", 9) == 0xE3069283 && crc32cPortable("123456789", 9) == 0xE3069283, "CRC-32C check value");
+  {
+    string path = directory + "/rules";
+    EventSourcedLedger ledger(path);
+    bool rules = ledger.openSaving(1000) && ledger.openCurrent(0) && ledger.openFixedDeposit(0) && !ledger.withdraw(0, 1001) &&
+                 ledger.withdraw(1, 50000) && !ledger.withdraw(1, 1) && !ledger.withdraw(2, 1) && !ledger.deposit(0, 0) &&
+                 !ledger.deposit(7, 10) && !ledger.openSaving(-1);
+    check(rules && ledger.events() == 4, "refused commands record no event");
+  }
+  {
+    //The same 300000 events, recovered from snapshots and from the whole log
+    string path = directory + "/recover";
+    EventSourcedLedger::Options options;
+    options.snapshotEvery = 40000;
+    options.keepSnapshots = 3;
+    Accounts expected = reference(7, 1000, 300000);
+    {
+      EventSourcedLedger ledger(path, options);
+      Workload workload(7, 1000);
+      Accounts mirror;
+      while (ledger.events() < 300000) {
+        Event event = workload.next(mirror);
+        if (mirror.allows(event)) {
+          mirror.apply(event);
+          ledger.record(event);
+        }
+      }
+    }
+    EventSourcedLedger fromSnapshot(path, options);
+    EventSourcedLedger::Options noSnapshots = options;
+    noSnapshots.useSnapshots = false;
+    EventSourcedLedger fromLog(path, noSnapshots);
+    check(fromSnapshot.lastRecovery().snapshotSequence == 280000 && fromSnapshot.lastRecovery().replayed == 20000 &&
+          fromLog.lastRecovery().replayed == 300000 && fromSnapshot.balances() == expected.balance && fromLog.balances() == expected.balance,
+          "snapshot + tail replay and full replay give identical balances");
+  }
+  {
+    //Damage the newest snapshot and tear the log: the older snapshot is used, and the torn event is cut off
+    string path = directory + "/recover";
+    EventSourcedLedger::Options options;
+    options.snapshotEvery = 0;
+    {
+      int fd = ::open((path + "/snapshot-00000000000000280000.snap").c_str(), O_WRONLY);
+      ::pwrite(fd, "\x55", 1, 100);
+      ::close(fd);
+      fd = ::open((path + "/events.log").c_str(), O_WRONLY | O_APPEND);
+      writeAll(fd, "torn event", 10);
+      ::close(fd);
+    }
+    EventSourcedLedger ledger(path, options);
+    check(ledger.lastRecovery().snapshotSequence == 240000 && ledger.lastRecovery().truncatedBytes == 10 &&
+          ledger.balances() == reference(7, 1000, 300000).balance, "a damaged snapshot falls back to the previous one, a torn tail is cut off");
+  }
+  {
+    //A write that fails part way (here: the file size limit): the refused event is not counted, and once writes work
+    //again the log holds every recorded event exactly once
+    string path = directory + "/full-disk";
+    EventSourcedLedger::Options options;
+    options.snapshotEvery = 0;
+    options.bufferBytes = 4096;
+    ::signal(SIGXFSZ, SIG_IGN);
+    rlimit unlimited;
+    ::getrlimit(RLIMIT_FSIZE, &unlimited);
+    bool threw = false;
+    uint64_t eventsWhenThrown = 0;
+    {
+      EventSourcedLedger ledger(path, options);
+      Workload workload(11, 100);
+      Accounts mirror;
+      while (ledger.events() < 20000) {
+        if (ledger.events() == 10000 && !threw) {
+          rlimit small = unlimited;
+          small.rlim_cur = fs::file_size(path + "/events.log") + 1000;  //not a whole number of events
+          ::setrlimit(RLIMIT_FSIZE, &small);
+        }
+        Event event = workload.next(mirror);
+        if (!mirror.allows(event)) {
+          continue;
+        }
+        uint64_t before = ledger.events();
+        try {
+          ledger.record(event);
+        } catch (const runtime_error&) {
+          threw = true;
+          eventsWhenThrown = ledger.events() - before;
+          ::setrlimit(RLIMIT_FSIZE, &unlimited);
+          ledger.record(event);  //the same event again
+        }
+        mirror.apply(event);
+      }
+      ledger.commit();
+    }
+    ::setrlimit(RLIMIT_FSIZE, &unlimited);
+    ::signal(SIGXFSZ, SIG_DFL);
+    EventSourcedLedger ledger(path, options);
+    check(threw && eventsWhenThrown == 0 && ledger.events() == 20000 && ledger.lastRecovery().truncatedBytes == 0 &&
+          ledger.balances() == reference(11, 100, 20000).balance,
+          "a failed write leaves the event unnumbered and the log without partial or repeated events");
+  }
+
+  {
+    //The snapshot's commit fails: record() throws, and the event is neither in the log nor in the balances
+    string path = directory + "/snapshot-fails";
+    EventSourcedLedger::Options options;
+    options.snapshotEvery = 1000;
+    ::signal(SIGXFSZ, SIG_IGN);
+    rlimit unlimited;
+    ::getrlimit(RLIMIT_FSIZE, &unlimited);
+    bool threw = false;
+    bool unchanged = false;
+    {
+      EventSourcedLedger ledger(path, options);
+      Workload workload(13, 100);
+      Accounts mirror;
+      while (ledger.events() < 3000) {
+        if (ledger.events() == 1000 && !threw) {
+          rlimit small = unlimited;
+          small.rlim_cur = 1000;  //the 24000 buffered bytes do not fit
+          ::setrlimit(RLIMIT_FSIZE, &small);
+        }
+        Event event = workload.next(mirror);
+        if (!mirror.allows(event)) {
+          continue;
+        }
+        try {
+          ledger.record(event);
+        } catch (const runtime_error&) {
+          threw = true;
+          unchanged = ledger.events() == 1000 && ledger.balances() == mirror.balance;
+          ::setrlimit(RLIMIT_FSIZE, &unlimited);
+          ledger.record(event);
+        }
+        mirror.apply(event);
+      }
+      ledger.commit();
+    }
+    ::setrlimit(RLIMIT_FSIZE, &unlimited);
+    ::signal(SIGXFSZ, SIG_DFL);
+    EventSourcedLedger ledger(path, options);
+    check(threw && unchanged && ledger.events() == 3000 && ledger.balances() == reference(13, 100, 3000).balance,
+          "a snapshot that can not commit leaves the event unapplied");
+  }
+  {
+    //The log loses its tail (say, restored from an older copy): the snapshots past it are deleted, so they are not
+    //loaded once new events take their numbers
+    string path = directory + "/stale";
+    EventSourcedLedger::Options options;
+    options.snapshotEvery = 1000;
+    Workload workload(17, 100);
+    Accounts mirror;
+    {
+      EventSourcedLedger ledger(path, options);
+      while (ledger.events() < 5000) {
+        Event event = workload.next(mirror);
+        if (mirror.allows(event)) {
+          mirror.apply(event);
+          ledger.record(event);
+        }
+      }
+    }
+    fs::resize_file(path + "/events.log", 3500 * sizeof(Event));
+    bool staleGone = false;
+    {
+      EventSourcedLedger ledger(path, options);
+      staleGone = ledger.lastRecovery().snapshotSequence == 3000 && !fs::exists(ledger.snapshotPath(4000));
+      for (uint32_t i = 0; ledger.events() < 4500; i++) {
+        ledger.deposit(i % 100, 1);
+      }
+    }
+    EventSourcedLedger fromSnapshot(path, options);
+    EventSourcedLedger::Options noSnapshots = options;
+    noSnapshots.useSnapshots = false;
+    EventSourcedLedger fromLog(path, noSnapshots);
+    check(staleGone && fromSnapshot.lastRecovery().snapshotSequence <= 3500 && fromSnapshot.balances() == fromLog.balances(),
+          "recovery deletes snapshots ahead of the log");
+  }
+
+  //Benchmark: `events` events over 1M accounts, with a snapshot every 5/64 of them, so the last one is some way
+  //before the end and recovery has a tail to replay
+  cout << "===" << events << " events, 1M accounts===" << endl;
+  string path = directory + "/bench";
+  EventSourcedLedger::Options options;
+  options.snapshotEvery = max<uint64_t>(1, events / 64 * 5);
+  {
+    EventSourcedLedger ledger(path, options);
+    Workload workload(9, 1000000);
+    Accounts mirror;
+    vector<Event> proposed;
+    //The events are generated before the clock starts, so only recording is measured
+    for (uint64_t made = 0; made < min<uint64_t>(events, 1 << 22);) {
+      Event event = workload.next(mirror);
+      if (mirror.allows(event)) {
+        mirror.apply(event);
+        proposed.push_back(event);
+        made++;
+      }
+    }
+    auto start = chrono::steady_clock::now();
+    for (const Event& event : proposed) {
+      ledger.record(event);
+    }
+    //Past the pregenerated ones, deposits to every account in turn (always allowed)
+    for (uint64_t i = proposed.size(); i < events; i++) {
+      ledger.record(makeEvent(Deposited, (uint32_t)(i % 1000000), 1 + i % 1000));
+      if (i % 65536 == 0) {
+        ledger.commit();
+      }
+    }
+    ledger.commit();
+    ledger.waitForSnapshot();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "record (commit every 64K events): " << events / seconds / 1e6 << " M events/s, " << events * sizeof(Event) / seconds / 1e6
+         << " MB/s" << endl;
+  }
+  for (bool useSnapshots : {true, false}) {
+    //Evict the log from the page cache, so recovery reads it from disk
+    int fd = ::open((path + "/events.log").c_str(), O_RDONLY);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+    options.useSnapshots = useSnapshots;
+    options.snapshotEvery = 0;
+    EventSourcedLedger ledger(path, options);
+    const EventSourcedLedger::Recovery& r = ledger.lastRecovery();
+    cout << (useSnapshots ? "recover from snapshot + tail: " : "recover by full replay:      ") << r.seconds << " s (" << r.replayed
+         << " events replayed)" << endl;
+  }
+  fs::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
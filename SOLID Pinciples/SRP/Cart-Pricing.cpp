@@ -0,0 +1,499 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+//Do not build with -ffast-math: it lets the compiler "simplify" the error terms of the compensated sums to zero.
+//
+//The ShoppingCart of SRP_applied.cpp walks a vector<Product*> and adds up every price again on each
+//calculateTotalPrice(), one pointer (and one cache miss) per product. Our carts are priced on every page view, so
+//this cart does the work when the cart changes instead:
+//  - the prices are kept next to each other in a vector<double>, in the same order as the products
+//  - a running total is updated by addProduct() and removeProduct(), so calculateTotalPrice() is O(1)
+//  - the running total is COMPENSATED: each add or subtract also keeps the rounding error it made (TwoSum), so
+//    thousands of adds and removes do not drift away from the real sum
+//  - recalculateTotalPrice() adds up all the prices again with a SIMD compensated sum (4 or 8 lanes, each with its
+//    own error term), for when prices change in bulk; refreshPrices() first copies the current product prices
+
+class Product {
+  public:
+    string name;
+    double price;
+
+    Product(string name, double price){
+      this->name = name;
+      this->price = price;
+    }
+};
+
+//a + b = sum + error exactly, with sum the rounded double result (Knuth's TwoSum, no branches)
+inline double twoSum(double a, double b, double& error) {
+  double sum = a + b;
+  double bb = sum - a;
+  error = (a - (sum - bb)) + (b - bb);
+  return sum;
+}
+
+//One compensated sum over a whole array
+struct SumKernels {
+  const char* name;
+  double (*sum)(const double* values, size_t n);
+};
+
+namespace scalar {
+  double sum(const double* values, size_t n) {
+    double total = 0, compensation = 0, error;
+    for (size_t i = 0; i < n; i++) {
+      total = twoSum(total, values[i], error);
+      compensation += error;
+    }
+    return total + compensation;
+  }
+  const SumKernels kernels = {"scalar", sum};
+}
+
+#if defined(__x86_64__)
+//Two vectors of lanes, each lane a running sum with its own error term. At the end the two vectors are added with
+//TwoSum, then the lanes, then the tail. Carts shorter than two vectors go to the narrower kernel.
+namespace avx2 {
+  __attribute__((target("avx2"))) inline __m256d twoSum(__m256d a, __m256d b, __m256d& error) {
+    __m256d sum = _mm256_add_pd(a, b);
+    __m256d bb = _mm256_sub_pd(sum, a);
+    error = _mm256_add_pd(_mm256_sub_pd(a, _mm256_sub_pd(sum, bb)), _mm256_sub_pd(b, bb));
+    return sum;
+  }
+  __attribute__((target("avx2"))) double sum(const double* values, size_t n) {
+    if (n < 8) {
+      return scalar::sum(values, n);
+    }
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), c0 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd(), e;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      s0 = twoSum(s0, _mm256_loadu_pd(values + i), e);
+      c0 = _mm256_add_pd(c0, e);
+      s1 = twoSum(s1, _mm256_loadu_pd(values + i + 4), e);
+      c1 = _mm256_add_pd(c1, e);
+    }
+    s0 = twoSum(s0, s1, e);
+    c0 = _mm256_add_pd(_mm256_add_pd(c0, c1), e);
+    if (i + 4 <= n) {
+      s0 = twoSum(s0, _mm256_loadu_pd(values + i), e);
+      c0 = _mm256_add_pd(c0, e);
+      i += 4;
+    }
+    double lanes[4], errors[4];
+    _mm256_storeu_pd(lanes, s0);
+    _mm256_storeu_pd(errors, c0);
+    double total = 0, compensation = errors[0] + errors[1] + errors[2] + errors[3], error;
+    for (int lane = 0; lane < 4; lane++) {
+      total = ::twoSum(total, lanes[lane], error);
+      compensation += error;
+    }
+    for (; i < n; i++) {
+      total = ::twoSum(total, values[i], error);
+      compensation += error;
+    }
+    return total + compensation;
+  }
+  const SumKernels kernels = {"avx2", sum};
+}
+
+namespace avx512 {
+  __attribute__((target("avx512f"))) inline __m512d twoSum(__m512d a, __m512d b, __m512d& error) {
+    __m512d sum = _mm512_add_pd(a, b);
+    __m512d bb = _mm512_sub_pd(sum, a);
+    error = _mm512_add_pd(_mm512_sub_pd(a, _mm512_sub_pd(sum, bb)), _mm512_sub_pd(b, bb));
+    return sum;
+  }
+  __attribute__((target("avx512f"))) double sum(const double* values, size_t n) {
+    if (n < 16) {
+      return avx2::sum(values, n);
+    }
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd(), c0 = _mm512_setzero_pd(), c1 = _mm512_setzero_pd(), e;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      s0 = twoSum(s0, _mm512_loadu_pd(values + i), e);
+      c0 = _mm512_add_pd(c0, e);
+      s1 = twoSum(s1, _mm512_loadu_pd(values + i + 8), e);
+      c1 = _mm512_add_pd(c1, e);
+    }
+    s0 = twoSum(s0, s1, e);
+    c0 = _mm512_add_pd(_mm512_add_pd(c0, c1), e);
+    if (i + 8 <= n) {
+      s0 = twoSum(s0, _mm512_loadu_pd(values + i), e);
+      c0 = _mm512_add_pd(c0, e);
+      i += 8;
+    }
+    double lanes[8], errors[8];
+    _mm512_storeu_pd(lanes, s0);
+    _mm512_storeu_pd(errors, c0);
+    double total = 0, compensation = 0, error;
+    for (int lane = 0; lane < 8; lane++) {
+      total = ::twoSum(total, lanes[lane], error);
+      compensation += error + errors[lane];
+    }
+    for (; i < n; i++) {
+      total = ::twoSum(total, values[i], error);
+      compensation += error;
+    }
+    return total + compensation;
+  }
+  const SumKernels kernels = {"avx512", sum};
+}
+#endif
+
+//Every kernel set this CPU can run, best one last
+vector<const SumKernels*> supportedKernels() {
+  vector<const SumKernels*> all = {&scalar::kernels};
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    all.push_back(&avx2::kernels);
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    all.push_back(&avx512::kernels);
+  }
+#endif
+  return all;
+}
+
+const SumKernels* bestKernels() {
+  static const SumKernels* best = supportedKernels().back();
+  return best;
+}
+
+class ShoppingCart {
+  private:
+    //products[i] costs prices[i]
+    vector<Product*> products;
+    vector<double> prices;
+    //The total is runningTotal + compensation, compensation being the rounding errors the running total made
+    double runningTotal = 0;
+    double compensation = 0;
+
+    void addToTotal(double amount) {
+      double error;
+      runningTotal = twoSum(runningTotal, amount, error);
+      compensation += error;
+    }
+
+  public:
+    void addProduct(Product* product) {
+      products.push_back(product);
+      prices.push_back(product->price);
+      addToTotal(product->price);
+    }
+
+    //Removes the product at `index`; the last product takes its place, so it is O(1)
+    void removeProduct(size_t index) {
+      addToTotal(-prices[index]);
+      products[index] = products.back();
+      prices[index] = prices.back();
+      products.pop_back();
+      prices.pop_back();
+    }
+
+    //Removes one copy of the product; false if it is not in the cart
+    bool removeProduct(Product* product) {
+      auto found = find(products.begin(), products.end(), product);
+      if (found == products.end()) {
+        return false;
+      }
+      removeProduct(found - products.begin());
+      return true;
+    }
+
+    void getAllProducts() {
+      for (size_t i = 0; i < products.size(); i++) {
+        cout << products[i]->name << " " << prices[i] << endl;
+      }
+    }
+
+    //O(1): the running total
+    double calculateTotalPrice() const {
+      return runningTotal + compensation;
+    }
+
+    //Adds up all the prices again (SIMD, compensated) and restarts the running total from the result
+    double recalculateTotalPrice(const SumKernels* kernels = bestKernels()) {
+      runningTotal = kernels->sum(prices.data(), prices.size());
+      compensation = 0;
+      return runningTotal;
+    }
+
+    //recalculateTotalPrice() for many carts. Each cart's prices are a separate allocation, so one at a time the
+    //time goes to cache misses, not to adding; this asks for the prices of the carts a few places ahead first.
+    static double recalculateAll(ShoppingCart* carts, size_t n, const SumKernels* kernels = bestKernels()) {
+      const size_t ahead = 8;
+      double sum = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (i + ahead < n) {
+          const vector<double>& next = carts[i + ahead].prices;
+          for (size_t at = 0; at < next.size(); at += 8) {
+            __builtin_prefetch(next.data() + at);
+          }
+        }
+        if (i + 2 * ahead < n) {
+          __builtin_prefetch(&carts[i + 2 * ahead]);
+        }
+        sum += carts[i].recalculateTotalPrice(kernels);
+      }
+      return sum;
+    }
+
+    //For when product prices have changed: copies them into the cart, then recalculates
+    double refreshPrices() {
+      for (size_t i = 0; i < products.size(); i++) {
+        prices[i] = products[i]->price;
+      }
+      return recalculateTotalPrice();
+    }
+
+    size_t size() const {
+      return products.size();
+    }
+    const vector<double>& allPrices() const {
+      return prices;
+    }
+};
+
+//The cart of SRP_applied.cpp (returning the double), to compare with
+namespace applied {
+  class ShoppingCart {
+    private:
+      vector<Product*> products;
+    public:
+      void addProduct(Product* product) {
+        products.push_back(product);
+      }
+
+      double calculateTotalPrice(){
+        double totalPrice = 0;
+        for(auto product: products) {
+          totalPrice = totalPrice + product->price;
+        }
+        return totalPrice;
+      }
+  };
+}
+
+//The exact sum, correctly rounded: Shewchuk's algorithm, which keeps the sum as a list of non-overlapping doubles
+//(what Python's math.fsum does). Slow; only for the checks.
+double exactSum(const vector<double>& values) {
+  vector<double> partials;
+  for (double x : values) {
+    size_t kept = 0;
+    for (double p : partials) {
+      double error;
+      double sum = twoSum(x, p, error);
+      if (error != 0) {
+        partials[kept++] = error;
+      }
+      x = sum;
+    }
+    partials.resize(kept);
+    partials.push_back(x);
+  }
+  double total = 0;
+  while (!partials.empty()) {
+    double x = partials.back(), error;
+    partials.pop_back();
+    total = twoSum(total, x, error);
+    if (error != 0) {
+      partials.push_back(error);
+      //Exact from here unless the remaining partials change the rounding, which their sign decides
+      double rest = 0;
+      for (double p : partials) {
+        rest += p;
+      }
+      return total + rest;
+    }
+  }
+  return total;
+}
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+bool withinOneUlp(double got, double exact) {
+  return fabs(got - exact) <= nextafter(fabs(exact), INFINITY) - fabs(exact);
+}
+
+int main(int argc, char** argv) {
+  Product apple("Apple", 0.1), banana("Banana", 0.2), cherry("Cherry", 99.99);
+  ShoppingCart cart;
+  cart.addProduct(&apple);
+  cart.addProduct(&banana);
+  cart.addProduct(&cherry);
+  cart.getAllProducts();
+  cout << "Total Price: " << cart.calculateTotalPrice() << endl;
+
+  cout << "===Checks===" << endl;
+  vector<const SumKernels*> kernels = supportedKernels();
+  {
+    //Each kernel against the exact sum, on random prices and lengths that are not a multiple of the lanes
+    mt19937_64 random(1);
+    uniform_real_distribution<double> price(0.01, 500);
+    bool close = true;
+    for (size_t n : {0, 1, 7, 8, 15, 16, 17, 31, 100, 1001, 100000}) {
+      vector<double> prices(n);
+      for (auto& p : prices) {
+        p = price(random);
+      }
+      double exact = exactSum(prices);
+      for (const SumKernels* k : kernels) {
+        close = close && withinOneUlp(k->sum(prices.data(), n), exact);
+      }
+    }
+    check(close, "every kernel is within one ulp of the exact sum");
+  }
+  {
+    //Many small prices after one huge one: the plain loop loses all of them, the compensated sums none
+    vector<double> prices = {1e16};
+    for (int i = 0; i < 1000; i++) {
+      prices.push_back(1.0);
+    }
+    applied::ShoppingCart plain;
+    vector<unique_ptr<Product>> owned;
+    for (double p : prices) {
+      owned.emplace_back(new Product("p", p));
+      plain.addProduct(owned.back().get());
+    }
+    bool exact = true;
+    for (const SumKernels* k : kernels) {
+      exact = exact && k->sum(prices.data(), prices.size()) == 1e16 + 1000;
+    }
+    check(exact && plain.calculateTotalPrice() == 1e16, "compensation keeps what the plain sum rounds away");
+  }
+  {
+    //Decimal prices such as 0.10 and 19.99, which no double holds exactly, against the same cart counted in integer
+    //cents. A plain running total drifts about 1e-4 cents away over this sequence; the compensated one must stay
+    //within rounding of the total itself, and always round to the right cent.
+    mt19937_64 random(2);
+    vector<unique_ptr<Product>> owned;
+    vector<int64_t> priceCents;
+    for (int i = 0; i < 1000; i++) {
+      priceCents.push_back(i % 4 == 0 ? 10 : i % 4 == 1 ? 1999 : (int64_t)(random() % 100000));
+      owned.emplace_back(new Product("p" + to_string(i), priceCents.back() / 100.0));
+    }
+    ShoppingCart c;
+    vector<int64_t> inCart;  //cents of c's products, in the same order
+    int64_t cents = 0;
+    bool rounded = true;
+    double worst = 0;
+    auto compare = [&](double total) {
+      rounded = rounded && llround(total * 100) == cents;
+      worst = max(worst, fabs(total * 100 - cents));
+    };
+    for (int step = 0; step < 200000; step++) {
+      if (c.size() > 0 && random() % 3 == 0) {
+        size_t index = random() % c.size();
+        cents -= inCart[index];
+        inCart[index] = inCart.back();  //removeProduct() moves the last product into the gap too
+        inCart.pop_back();
+        c.removeProduct(index);
+      } else {
+        size_t product = random() % owned.size();
+        cents += priceCents[product];
+        inCart.push_back(priceCents[product]);
+        c.addProduct(owned[product].get());
+      }
+      compare(c.calculateTotalPrice());
+    }
+    compare(c.recalculateTotalPrice());
+    check(rounded && worst < 1e-5, "decimal prices stay on the integer-cent total after 200000 adds and removes");
+  }
+  {
+    //Fractional prices: the running total stays within one ulp of the exact sum of what is in the cart
+    mt19937_64 random(3);
+    uniform_real_distribution<double> price(0.01, 500);
+    vector<unique_ptr<Product>> owned;
+    for (int i = 0; i < 1000; i++) {
+      owned.emplace_back(new Product("p" + to_string(i), price(random)));
+    }
+    ShoppingCart c;
+    bool close = true;
+    for (int step = 0; step < 20000; step++) {
+      if (c.size() > 0 && random() % 3 == 0) {
+        c.removeProduct(random() % c.size());
+      } else {
+        c.addProduct(owned[random() % owned.size()].get());
+      }
+      if (step % 97 == 0) {
+        close = close && withinOneUlp(c.calculateTotalPrice(), exactSum(c.allPrices()));
+      }
+    }
+    check(close, "the running total does not drift after 20000 adds and removes");
+    owned[0]->price = 0;
+    c.refreshPrices();
+    check(withinOneUlp(c.calculateTotalPrice(), exactSum(c.allPrices())), "refreshPrices() picks up changed product prices");
+    Product missing("Missing", 1);
+    size_t before = c.size();
+    check(!c.removeProduct(&missing) && c.size() == before, "removing a product that is not in the cart changes nothing");
+  }
+
+  //Benchmark: 100k carts of 1 to 40 products each, priced again and again
+  size_t cartCount = argc > 1 ? atol(argv[1]) : 100000;
+  int passes = argc > 2 ? atoi(argv[2]) : 20;
+  mt19937_64 random(4);
+  uniform_real_distribution<double> price(0.01, 500);
+  vector<unique_ptr<Product>> catalog;
+  for (int i = 0; i < 100000; i++) {
+    catalog.emplace_back(new Product("product" + to_string(i), price(random)));
+  }
+  vector<applied::ShoppingCart> oldCarts(cartCount);
+  vector<ShoppingCart> carts(cartCount);
+  size_t products = 0;
+  for (size_t i = 0; i < cartCount; i++) {
+    size_t n = 1 + random() % 40;
+    for (size_t j = 0; j < n; j++) {
+      Product* p = catalog[random() % catalog.size()].get();
+      oldCarts[i].addProduct(p);
+      carts[i].addProduct(p);
+    }
+    products += n;
+  }
+  cout << "===Pricing " << cartCount << " carts (" << products << " products), M carts/s===" << endl;
+  auto measure = [&](const string& label, auto price) {
+    double sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+      for (size_t i = 0; i < cartCount; i++) {
+        sum += price(i);
+      }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << label << cartCount * passes / seconds / 1e6 << "  (sum " << (int64_t)(sum / passes) << ")" << endl;
+  };
+  measure("SRP_applied.cpp loop over Product*:  ", [&](size_t i) { return oldCarts[i].calculateTotalPrice(); });
+  measure("running total (page view):           ", [&](size_t i) { return carts[i].calculateTotalPrice(); });
+  for (const SumKernels* k : kernels) {
+    measure("recalculate, " + string(k->name) + string(24 - string(k->name).size(), ' '), [&](size_t i) { return carts[i].recalculateTotalPrice(k); });
+  }
+  for (const SumKernels* k : kernels) {
+    double sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+      sum += ShoppingCart::recalculateAll(carts.data(), cartCount, k);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "recalculateAll, " << k->name << string(21 - string(k->name).size(), ' ') << cartCount * passes / seconds / 1e6
+         << "  (sum " << (int64_t)(sum / passes) << ")" << endl;
+  }
+  measure("refreshPrices (copy + recalculate):  ", [&](size_t i) { return carts[i].refreshPrices(); });
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,473 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <charconv>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+//InvoiceGenerator::genrateIvoice() in SRP_applied.cpp prints every line with cout and endl (a flush per line), and
+//walks the cart twice: once in getAllProducts() and once more in calculateTotalPrice(). At month end we render
+//millions of invoices, so:
+//  - InvoiceRenderer formats an invoice in ONE pass over the cart, adding up the total as it goes, and appends it to a
+//    buffer the caller reuses; prices are formatted from whole cents (no locale, no stream state, no allocation)
+//  - BatchInvoiceWriter splits the carts into batches of a few thousand, renders the batches on a thread pool, and
+//    writes each batch's buffer to the file with one large write(), in cart order
+//Batches finish out of order, so a finished batch waits in a map until the ones before it are written. Whichever
+//thread finishes the batch that is next in line writes it (and any that were waiting behind it); no thread is only
+//a writer. A batch is not started more than 2 x threads batches ahead of the file, which bounds the memory.
+
+class Product {
+  public:
+    string name;
+    double price;
+
+    Product(string name, double price){
+      this->name = name;
+      this->price = price;
+    }
+};
+
+class ShoppingCart {
+  private:
+    vector<Product*> products;
+  public:
+    void addProduct(Product* product) {
+      products.push_back(product);
+    }
+
+    const vector<Product*>& allProducts() const {
+      return products;
+    }
+
+    double calculateTotalPrice() const {
+      double totalPrice = 0;
+      for (auto product: products) {
+        totalPrice = totalPrice + product->price;
+      }
+      return totalPrice;
+    }
+};
+
+//The InvoiceGenerator of SRP_applied.cpp, to compare with
+class InvoiceGenerator {
+  private:
+    const ShoppingCart* shoppingCart;
+  public:
+    InvoiceGenerator(const ShoppingCart* shoppingCart) {
+      this->shoppingCart = shoppingCart;
+    }
+
+    void genrateIvoice() {
+      cout << "Invoice for the shopping cart:" << endl;
+      for (auto product: shoppingCart->allProducts()) {
+        cout << product->name << " " << product->price << endl;
+      }
+      cout << "Total Price: " << shoppingCart->calculateTotalPrice() << endl;
+    }
+};
+
+class InvoiceRenderer {
+  public:
+    //Appends the invoice to `out`:
+    //  Invoice 42 for the shopping cart:
+    //  Apple 100.00
+    //  Total Price: 100.00
+    //with an empty line after it. The total is added up in the same order as calculateTotalPrice(), so it is the
+    //same double.
+    void render(const ShoppingCart& cart, uint64_t number, string& out) const {
+      out.append("Invoice ");
+      appendNumber(out, number);
+      out.append(" for the shopping cart:\n");
+      double total = 0;
+      for (const Product* product : cart.allProducts()) {
+        total = total + product->price;
+        out.append(product->name);
+        out.push_back(' ');
+        appendPrice(out, product->price);
+        out.push_back('\n');
+      }
+      out.append("Total Price: ");
+      appendPrice(out, total);
+      out.append("\n\n");
+    }
+
+  private:
+    static void appendNumber(string& out, uint64_t value) {
+      char digits[24];
+      char* end = to_chars(digits, digits + sizeof digits, value).ptr;
+      out.append(digits, end);
+    }
+
+    //Two decimals, rounded the way printf("%.2f") rounds: to the nearest cent of the exact value of the double,
+    //ties to even. For 1/8 <= |value| < 2^40, value * 100 - cents is computed exactly with one fma, so the cents
+    //are found with integer work only; anything else goes to to_chars.
+    static void appendPrice(string& out, double value) {
+      double magnitude = fabs(value);
+      if (!(magnitude >= 0.125 && magnitude < 0x1p40)) {
+        char digits[400];
+        char* end = to_chars(digits, digits + sizeof digits, value, chars_format::fixed, 2).ptr;
+        out.append(digits, end);
+        return;
+      }
+      double cents = nearbyint(magnitude * 100);
+      double rest = fma(magnitude, 100, -cents);
+      if (rest > 0.5 || (rest == 0.5 && fmod(cents, 2) != 0)) {
+        cents += 1;
+      } else if (rest < -0.5 || (rest == -0.5 && fmod(cents, 2) != 0)) {
+        cents -= 1;
+      }
+      int64_t whole = (int64_t)cents / 100, fraction = (int64_t)cents % 100;
+      char digits[24];
+      char* at = digits;
+      if (value < 0) {
+        *at++ = '-';
+      }
+      at = to_chars(at, digits + sizeof digits, whole).ptr;
+      *at++ = '.';
+      *at++ = (char)('0' + fraction / 10);
+      *at++ = (char)('0' + fraction % 10);
+      out.append(digits, at);
+    }
+};
+
+[[noreturn]] void fail(const string& what) {
+  throw runtime_error(what + ": " + strerror(errno));
+}
+
+void writeAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fail("write");
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+//Runs parallelFor() tasks on a fixed set of threads; the calling thread works too
+class ThreadPool {
+  struct Batch {
+    const function<void(int)>* task;
+    int count;
+    atomic<int> next{0};
+    atomic<int> remaining;
+  };
+  vector<thread> workers;
+  mutex m;
+  condition_variable wake;
+  condition_variable finished;
+  shared_ptr<Batch> current;
+  uint64_t generation = 0;
+  bool stopping = false;
+
+  void run(Batch& batch) {
+    while (true) {
+      int i = batch.next.fetch_add(1);
+      if (i >= batch.count) {
+        return;
+      }
+      (*batch.task)(i);
+      if (batch.remaining.fetch_sub(1) == 1) {
+        lock_guard<mutex> lock(m);
+        finished.notify_all();
+      }
+    }
+  }
+
+  void workerLoop() {
+    uint64_t seen = 0;
+    while (true) {
+      shared_ptr<Batch> batch;
+      {
+        unique_lock<mutex> lock(m);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+        batch = current;
+      }
+      run(*batch);
+    }
+  }
+
+  public:
+    ThreadPool(int threads) {
+      for (int i = 1; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+      }
+    }
+    ~ThreadPool() {
+      {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (auto& t : workers) {
+        t.join();
+      }
+    }
+    int size() {
+      return (int)workers.size() + 1;
+    }
+    //Calls task(0) ... task(count - 1) across the pool, claimed in increasing order, and returns when all are done
+    void parallelFor(int count, const function<void(int)>& task) {
+      if (workers.empty() || count <= 1) {
+        for (int i = 0; i < count; i++) {
+          task(i);
+        }
+        return;
+      }
+      auto batch = make_shared<Batch>();
+      batch->task = &task;
+      batch->count = count;
+      batch->remaining = count;
+      {
+        lock_guard<mutex> lock(m);
+        current = batch;
+        generation++;
+      }
+      wake.notify_all();
+      run(*batch);
+      unique_lock<mutex> lock(m);
+      finished.wait(lock, [&] { return batch->remaining == 0; });
+    }
+};
+
+class BatchInvoiceWriter {
+  public:
+    BatchInvoiceWriter(ThreadPool& pool, size_t cartsPerBatch = 4096) : pool(pool), cartsPerBatch(cartsPerBatch) {}
+
+    //Writes the invoices of all carts to `path` (numbered from `firstNumber`, in cart order) and makes the file
+    //durable; returns the number of bytes written
+    uint64_t write(const vector<ShoppingCart>& carts, const string& path, uint64_t firstNumber = 1) {
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd < 0) {
+        fail("open " + path);
+      }
+      int batches = (int)((carts.size() + cartsPerBatch - 1) / cartsPerBatch);
+      size_t maxAhead = 2 * pool.size();
+      mutex m;
+      condition_variable written;
+      size_t next = 0;        //the batch the file is waiting for
+      bool writing = false;   //a thread is writing batches right now
+      map<size_t, string> ready;
+      vector<string> spare;   //buffers of written batches, to reuse
+      uint64_t bytes = 0;
+      exception_ptr error;
+
+      pool.parallelFor(batches, [&](int index) {
+        size_t batch = index;
+        string buffer;
+        {
+          unique_lock<mutex> lock(m);
+          written.wait(lock, [&] { return batch < next + maxAhead; });
+          if (!spare.empty()) {
+            buffer = move(spare.back());
+            spare.pop_back();
+          }
+        }
+        buffer.clear();
+        size_t begin = batch * cartsPerBatch, end = min(carts.size(), begin + cartsPerBatch);
+        for (size_t i = begin; i < end; i++) {
+          renderer.render(carts[i], firstNumber + i, buffer);
+        }
+
+        unique_lock<mutex> lock(m);
+        ready.emplace(batch, move(buffer));
+        if (writing) {
+          return;
+        }
+        writing = true;
+        for (auto found = ready.find(next); found != ready.end(); found = ready.find(next)) {
+          string out = move(found->second);
+          ready.erase(found);
+          lock.unlock();
+          try {
+            if (!error) {
+              writeAll(fd, out.data(), out.size());
+            }
+          } catch (...) {
+            error = current_exception();
+          }
+          lock.lock();
+          bytes += out.size();
+          next++;
+          spare.push_back(move(out));
+          written.notify_all();
+        }
+        writing = false;
+      });
+
+      if (!error && ::fdatasync(fd) != 0) {
+        error = make_exception_ptr(runtime_error("fdatasync " + path + ": " + strerror(errno)));
+      }
+      ::close(fd);
+      if (error) {
+        rethrow_exception(error);
+      }
+      return bytes;
+    }
+
+  private:
+    ThreadPool& pool;
+    size_t cartsPerBatch;
+    InvoiceRenderer renderer;
+};
+
+static int failures = 0;
+void check(bool ok, const string& what) {
+  cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+string readFile(const string& path) {
+  ifstream in(path, ios::binary);
+  return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+//The invoice as printf would write it, to check the renderer against
+string referenceInvoice(const ShoppingCart& cart, uint64_t number) {
+  char line[512];
+  string out = "Invoice " + to_string(number) + " for the shopping cart:\n";
+  for (const Product* product : cart.allProducts()) {
+    snprintf(line, sizeof line, "%s %.2f\n", product->name.c_str(), product->price);
+    out += line;
+  }
+  snprintf(line, sizeof line, "Total Price: %.2f\n\n", cart.calculateTotalPrice());
+  return out + line;
+}
+
+int main(int argc, char** argv) {
+  Product apple("Apple", 100), banana("Banana", 200.5);
+  ShoppingCart cart;
+  cart.addProduct(&apple);
+  cart.addProduct(&banana);
+  string invoice;
+  InvoiceRenderer().render(cart, 1, invoice);
+  cout << invoice;
+
+  string directory = argc > 3 ? argv[3] : "/tmp";
+  cout << "===Checks===" << endl;
+  mt19937_64 random(1);
+  vector<unique_ptr<Product>> catalog;
+  double special[] = {0, 0.005, 0.015, 1.005, 2.675, 0.1 + 0.2, 99.995, 1e15 + 0.25, 123456789.125, -0.001, -5.5};
+  for (double price : special) {
+    catalog.emplace_back(new Product("special" + to_string(catalog.size()), price));
+  }
+  uniform_real_distribution<double> price(0.01, 1000);
+  for (int i = 0; i < 100000; i++) {
+    catalog.emplace_back(new Product("product" + to_string(i), price(random)));
+  }
+  auto makeCarts = [&](size_t count) {
+    vector<ShoppingCart> carts(count);
+    for (auto& c : carts) {
+      size_t n = 1 + random() % 40;
+      for (size_t j = 0; j < n; j++) {
+        c.addProduct(catalog[random() % 5 == 0 ? random() % size(special) : random() % catalog.size()].get());
+      }
+    }
+    return carts;
+  };
+  {
+    vector<ShoppingCart> carts = makeCarts(20000);
+    InvoiceRenderer renderer;
+    bool same = true;
+    string out;
+    for (size_t i = 0; i < carts.size() && same; i++) {
+      out.clear();
+      renderer.render(carts[i], i + 1, out);
+      same = out == referenceInvoice(carts[i], i + 1);
+    }
+    check(same, "the one-pass renderer writes the same text as printf(\"%.2f\"), including the total");
+
+    //Prices of every size, and exact ties (k/8 and k/200 are halfway between two cents when k is odd)
+    bool prices = true;
+    for (int i = 0; i < 2000000 && prices; i++) {
+      double value;
+      switch (i % 4) {
+        case 0: value = ldexp((double)(random() >> 11), (int)(random() % 100) - 90); break;
+        case 1: value = (double)(int64_t)(random() % 2000001 - 1000000) / 8; break;
+        case 2: value = (double)(int64_t)(random() % 2000001 - 1000000) / 200; break;
+        default: value = (random() % 2 ? -1 : 1) * price(random);
+      }
+      ShoppingCart one;
+      Product p("p", value);
+      one.addProduct(&p);
+      out.clear();
+      renderer.render(one, 1, out);
+      prices = out == referenceInvoice(one, 1);
+    }
+    check(prices, "2000000 prices of every size and exact ties round like printf");
+
+    //Small batches, so they finish out of order and have to wait for each other
+    string expected;
+    for (size_t i = 0; i < carts.size(); i++) {
+      expected += referenceInvoice(carts[i], i + 1);
+    }
+    bool identical = true;
+    for (int threads : {1, 3, 8}) {
+      ThreadPool pool(threads);
+      BatchInvoiceWriter writer(pool, 7);
+      string path = directory + "/invoices-check.txt";
+      uint64_t bytes = writer.write(carts, path);
+      identical = identical && bytes == expected.size() && readFile(path) == expected;
+      ::unlink(path.c_str());
+    }
+    check(identical, "the file is the invoices in cart order with 1, 3 and 8 threads");
+  }
+
+  //Benchmark: `count` carts of 1 to 40 products
+  size_t count = argc > 1 ? atol(argv[1]) : 1000000;
+  int maxThreads = argc > 2 ? atoi(argv[2]) : 32;
+  vector<ShoppingCart> carts = makeCarts(count);
+  string path = directory + "/invoices-bench.txt";
+  cout << "===" << count << " invoices, written to " << path << "===" << endl;
+  {
+    //The old way, with cout pointed at the file, on the first 1/10 of the carts
+    size_t some = max<size_t>(1, count / 10);
+    ofstream file(path);
+    streambuf* saved = cout.rdbuf(file.rdbuf());
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < some; i++) {
+      InvoiceGenerator(&carts[i]).genrateIvoice();
+    }
+    file.flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout.rdbuf(saved);
+    cout << "genrateIvoice() with cout and endl: " << some / seconds / 1e6 << " M invoices/s, " << file.tellp() / seconds / 1e6
+         << " MB/s" << endl;
+  }
+  for (int threads = 1; threads <= maxThreads; threads = threads * 2) {
+    ThreadPool pool(threads);
+    BatchInvoiceWriter writer(pool);
+    auto start = chrono::steady_clock::now();
+    uint64_t bytes = writer.write(carts, path);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << threads << " threads: " << count / seconds / 1e6 << " M invoices/s, " << bytes / seconds / 1e6 << " MB/s" << endl;
+  }
+  ::unlink(path.c_str());
+  return failures == 0 ? 0 : 1;
+}
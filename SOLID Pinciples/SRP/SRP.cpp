@@ -31,7 +31,7 @@ class ShoppingCart {
       }
     }
     //Can be present in the class single job to calvulate the total price
-    int calculateTotalPrice(){
+    double calculateTotalPrice(){
       double totalPrice = 0;
       for(auto product: products) {
         totalPrice = totalPrice + product->price;
@@ -30,7 +30,7 @@ class ShoppingCart {
       }
     }
 
-    int calculateTotalPrice(){
+    double calculateTotalPrice(){
       double totalPrice = 0;
       for(auto product: products) {
         totalPrice = totalPrice + product->price;